@@ -0,0 +1,267 @@
+/* Copyright (c) 2018. TIG developer. */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#include "connlog.h"
+#include "connlog_query.h"
+
+#define NS_PER_S UINT64_C(1000000000)
+
+/* An address of the filter, 0 matches any. */
+struct connlog_addr {
+    int family;
+    uint32_t ip;
+    uint8_t ip6[16];
+    uint16_t port;
+};
+
+struct connlog_filter {
+    struct connlog_addr cip, vip, lip, rip;
+    uint8_t proto;
+    uint8_t event;
+    uint64_t since_ns, until_ns;
+};
+
+static const char *
+connlog_proto_name(uint8_t proto) {
+    switch (proto) {
+    case IPPROTO_TCP:
+        return "tcp";
+    case IPPROTO_UDP:
+        return "udp";
+    default:
+        return "unknown";
+    }
+}
+
+/* IP[:PORT], IPV6 or [IPV6][:PORT]. */
+static int
+connlog_addr_parse(const char *s, struct connlog_addr *a) {
+    char buf[64], *ip = buf, *p;
+    unsigned long port = 0;
+
+    snprintf(buf, sizeof(buf), "%s", s);
+    if (buf[0] == '[') {
+        ip = buf + 1;
+        p = strchr(ip, ']');
+        if (p == NULL)
+            return -1;
+        *p++ = '\0';
+        if (*p != '\0' && *p != ':')
+            return -1;
+    } else {
+        p = strchr(buf, ':');
+        /* More than one colon, an IPv6 address alone. */
+        if (p != NULL && strchr(p + 1, ':') != NULL)
+            p = NULL;
+    }
+    if (p != NULL && *p == ':') {
+        *p++ = '\0';
+        port = strtoul(p, &p, 10);
+        if (*p != '\0' || port == 0 || port > 65535)
+            return -1;
+    }
+    if (inet_pton(AF_INET, ip, &a->ip) == 1)
+        a->family = AF_INET;
+    else if (inet_pton(AF_INET6, ip, a->ip6) == 1)
+        a->family = AF_INET6;
+    else
+        return -1;
+    a->port = htons(port);
+    return 0;
+}
+
+static int
+connlog_addr_match(const struct connlog_addr *a, uint32_t ip, uint16_t port) {
+    if (a->family == AF_INET6)
+        return 0;
+    return (a->ip == 0 || a->ip == ip) && (a->port == 0 || a->port == port);
+}
+
+/* For the client side, IPv6 in the NAT64 records. */
+static int
+connlog_addr_match6(const struct connlog_addr *a,
+                    const struct connlog_record *r, uint32_t ip,
+                    const uint8_t *ip6, uint16_t port) {
+    if (!(r->flags & CONNLOG_F_IPV6))
+        return connlog_addr_match(a, ip, port);
+    if (a->family == AF_INET)
+        return 0;
+    return (a->family == 0 || memcmp(a->ip6, ip6, sizeof(a->ip6)) == 0) &&
+           (a->port == 0 || a->port == port);
+}
+
+static int
+connlog_filter_parse(int argc, char **argv, struct connlog_filter *f) {
+    char *end;
+    int i, rc;
+
+    memset(f, 0, sizeof(*f));
+    for (i = 0; i < argc; i += 2) {
+        if (i + 1 >= argc) {
+            fprintf(stderr, "Missing value of %s.\n", argv[i]);
+            return -1;
+        }
+        rc = 0;
+        if (strcmp(argv[i], "cip") == 0) {
+            rc = connlog_addr_parse(argv[i + 1], &f->cip);
+        } else if (strcmp(argv[i], "vip") == 0) {
+            rc = connlog_addr_parse(argv[i + 1], &f->vip);
+        } else if (strcmp(argv[i], "lip") == 0) {
+            rc = connlog_addr_parse(argv[i + 1], &f->lip);
+        } else if (strcmp(argv[i], "rip") == 0) {
+            rc = connlog_addr_parse(argv[i + 1], &f->rip);
+        } else if (strcmp(argv[i], "proto") == 0) {
+            if (strcasecmp(argv[i + 1], "tcp") == 0)
+                f->proto = IPPROTO_TCP;
+            else if (strcasecmp(argv[i + 1], "udp") == 0)
+                f->proto = IPPROTO_UDP;
+            else
+                rc = -1;
+        } else if (strcmp(argv[i], "event") == 0) {
+            if (strcmp(argv[i + 1], "new") == 0)
+                f->event = CONNLOG_EV_NEW;
+            else if (strcmp(argv[i + 1], "end") == 0)
+                f->event = CONNLOG_EV_END;
+            else
+                rc = -1;
+        } else if (strcmp(argv[i], "since") == 0) {
+            f->since_ns = strtoull(argv[i + 1], &end, 10) * NS_PER_S;
+            rc = *end == '\0' ? 0 : -1;
+        } else if (strcmp(argv[i], "until") == 0) {
+            f->until_ns = strtoull(argv[i + 1], &end, 10) * NS_PER_S;
+            rc = *end == '\0' ? 0 : -1;
+        } else {
+            fprintf(stderr, "Unknown filter %s.\n", argv[i]);
+            return -1;
+        }
+        if (rc < 0) {
+            fprintf(stderr, "Invalid %s: %s.\n", argv[i], argv[i + 1]);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int
+connlog_match(const struct connlog_filter *f, const struct connlog_record *r) {
+    if (f->since_ns != 0 && r->ts_ns < f->since_ns)
+        return 0;
+    if (f->until_ns != 0 && r->ts_ns >= f->until_ns)
+        return 0;
+    if (f->proto != 0 && r->proto != f->proto)
+        return 0;
+    if (f->event != 0 && r->event != f->event)
+        return 0;
+    return connlog_addr_match6(&f->cip, r, r->cip, r->cip6, r->cport) &&
+           connlog_addr_match6(&f->vip, r, r->vip, r->vip6, r->vport) &&
+           connlog_addr_match(&f->lip, r->lip, r->lport) &&
+           connlog_addr_match(&f->rip, r->rip, r->rport);
+}
+
+/* IP:PORT, or [IPV6]:PORT. */
+static void
+connlog_addr_format(char *buf, size_t size, int family, const void *ip,
+                    uint16_t port) {
+    char s[INET6_ADDRSTRLEN];
+
+    inet_ntop(family, ip, s, sizeof(s));
+    snprintf(buf, size, family == AF_INET6 ? "[%s]:%u" : "%s:%u", s,
+             ntohs(port));
+}
+
+static void
+connlog_print(const struct connlog_record *r) {
+    char cip[INET6_ADDRSTRLEN + 8], vip[INET6_ADDRSTRLEN + 8];
+    char lip[INET6_ADDRSTRLEN + 8], rip[INET6_ADDRSTRLEN + 8];
+    char date[32];
+    struct tm tm;
+    time_t sec = r->ts_ns / NS_PER_S;
+
+    localtime_r(&sec, &tm);
+    strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", &tm);
+    if (r->flags & CONNLOG_F_IPV6) {
+        connlog_addr_format(cip, sizeof(cip), AF_INET6, r->cip6, r->cport);
+        connlog_addr_format(vip, sizeof(vip), AF_INET6, r->vip6, r->vport);
+    } else {
+        connlog_addr_format(cip, sizeof(cip), AF_INET, &r->cip, r->cport);
+        connlog_addr_format(vip, sizeof(vip), AF_INET, &r->vip, r->vport);
+    }
+    connlog_addr_format(lip, sizeof(lip), AF_INET, &r->lip, r->lport);
+    connlog_addr_format(rip, sizeof(rip), AF_INET, &r->rip, r->rport);
+    printf("%s.%06u %-3s %s %s %s %s %s lcore%u", date,
+           (uint32_t)(r->ts_ns % NS_PER_S / 1000),
+           r->event == CONNLOG_EV_NEW ? "new" : "end",
+           connlog_proto_name(r->proto), cip, vip, lip, rip, r->lcore_id);
+    if (r->event == CONNLOG_EV_END)
+        printf(" %ums", r->duration_ms);
+    printf("\n");
+}
+
+static int
+connlog_file_cmp(const void *a, const void *b) {
+    const struct connlog_header *ha = ((const struct connlog_file *)a)->base;
+    const struct connlog_header *hb = ((const struct connlog_file *)b)->base;
+
+    return ha->seq < hb->seq ? -1 : ha->seq > hb->seq;
+}
+
+/*
+ * Print the records of the files PATH.0 onwards matching the filter,
+ * the oldest file first.
+ */
+int
+connlog_query(const char *path, int argc, char **argv) {
+    struct connlog_file *files;
+    struct connlog_filter filter;
+    struct connlog_record r;
+    char name[4096];
+    uint64_t nb, j;
+    uint32_t i, nb_files = 0;
+
+    if (connlog_filter_parse(argc, argv, &filter) < 0) {
+        fprintf(stderr, "Filters: [cip|vip|lip|rip IP[:PORT]] "
+                        "[cip|vip [IPV6][:PORT]] [proto tcp|udp] "
+                        "[event new|end] [since SEC] [until SEC]\n");
+        return -1;
+    }
+
+    files = calloc(CONNLOG_MAX_FILES, sizeof(*files));
+    if (files == NULL)
+        return -1;
+    for (i = 0; i < CONNLOG_MAX_FILES; i++) {
+        snprintf(name, sizeof(name), "%s.%u", path, i);
+        if (connlog_open(&files[nb_files], name) < 0) {
+            if (errno == ENOENT)
+                break;
+            fprintf(stderr, "Cannot read %s, %s.\n", name, strerror(errno));
+            continue;
+        }
+        nb_files++;
+    }
+    if (nb_files == 0) {
+        fprintf(stderr, "No connection log at %s.0.\n", path);
+        free(files);
+        return -1;
+    }
+
+    qsort(files, nb_files, sizeof(*files), connlog_file_cmp);
+    for (i = 0; i < nb_files; i++) {
+        nb = connlog_count(&files[i]);
+        for (j = 0; j < nb; j++) {
+            connlog_record_get(&files[i], j, &r);
+            if (connlog_match(&filter, &r))
+                connlog_print(&r);
+        }
+        connlog_close(&files[i]);
+    }
+    free(files);
+    return 0;
+}
@@ -0,0 +1,8 @@
+/* Copyright (c) 2018. TIG developer. */
+
+#ifndef __CONNLOG_QUERY_H__
+#define __CONNLOG_QUERY_H__
+
+int connlog_query(const char *path, int argc, char **argv);
+
+#endif
@@ -3,6 +3,10 @@
 #include <stdio.h>
 #include <string.h>
 
+#include "connlog.h"
+#include "connlog_query.h"
+#include "metrics.h"
+#include "metrics_shm.h"
 #include "unixctl_command.h"
 
 static const char *default_unix_sock_path = "/var/run/jupiter.sock";
@@ -11,6 +15,9 @@ static void
 usage(const char *progname) {
     printf("Usage: %s COMMAND [ARG...] [--unixsock=%s]\n", progname,
            default_unix_sock_path);
+    printf("       %s --metrics[=%s]\n", progname, METRICS_SHM_DEFAULT_PATH);
+    printf("       %s --connlog[=%s] [FILTER...]\n", progname,
+           CONNLOG_DEFAULT_PATH);
 }
 
 static const char *
@@ -29,6 +36,20 @@ main(int argc, char **argv) {
     int i;
 
     for (i = 1; i < argc; i++) {
+        if (strcmp("--metrics", argv[i]) == 0)
+            return metrics_show(METRICS_SHM_DEFAULT_PATH) < 0 ? -1 : 0;
+        if (strncmp("--metrics=", argv[i], strlen("--metrics=")) == 0)
+            return metrics_show(argv[i] + strlen("--metrics=")) < 0 ? -1 : 0;
+        if (strcmp("--connlog", argv[i]) == 0)
+            return connlog_query(CONNLOG_DEFAULT_PATH, argc - i - 1,
+                                 argv + i + 1) < 0
+                       ? -1
+                       : 0;
+        if (strncmp("--connlog=", argv[i], strlen("--connlog=")) == 0)
+            return connlog_query(argv[i] + strlen("--connlog="),
+                                 argc - i - 1, argv + i + 1) < 0
+                       ? -1
+                       : 0;
         if (strncmp("--unixsock=", argv[i], strlen("--unixsock=")) == 0) {
             unix_sock_path = strdup(argv[i] + strlen("--unixsock="));
         } else {
@@ -0,0 +1,140 @@
+/* Copyright (c) 2018. TIG developer. */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "metrics.h"
+#include "metrics_shm.h"
+
+static const char *
+metrics_proto_name(uint8_t proto) {
+    switch (proto) {
+    case IPPROTO_TCP:
+        return "tcp";
+    case IPPROTO_UDP:
+        return "udp";
+    default:
+        return "unknown";
+    }
+}
+
+static void
+metrics_show_lcores(struct metrics_shm_header *h) {
+    struct metrics_shm_lcore *l;
+    uint64_t total;
+    uint32_t i;
+
+    printf("%-6s %-6s %-6s %-7s %-12s %-21s %-21s %s\n", "lcore", "socket",
+           "worker", "busy(%)", "drops", "tcp_conns", "udp_conns", "stalled");
+    for (i = 0; i < h->nb_lcores; i++) {
+        l = METRICS_SHM_ENTRY(h, lcore, i);
+        total = l->busy_cycles + l->idle_cycles;
+        printf("%-6u %-6u %-6s %-7" PRIu64 " %-12" PRIu64 " %10u/%-10u "
+               "%10u/%-10u %s\n",
+               l->lcore_id, l->socket_id, l->worker ? "yes" : "no",
+               total != 0 ? l->busy_cycles * 100 / total : 0, l->drops,
+               l->tcp_conns, l->tcp_conns_max, l->udp_conns,
+               l->udp_conns_max, l->stalled ? "yes" : "no");
+    }
+}
+
+static void
+metrics_show_ports(struct metrics_shm_header *h) {
+    struct metrics_shm_port *p;
+    uint32_t i;
+
+    for (i = 0; i < h->nb_ports; i++) {
+        p = METRICS_SHM_ENTRY(h, port, i);
+        printf("dev %s port%u\n", p->name, p->port_id);
+        printf("  RX-packets: %" PRIu64 "  RX-bytes: %" PRIu64
+               "  RX-misses: %" PRIu64 "  RX-errors: %" PRIu64
+               "  RX-nombuf: %" PRIu64 "  RX-dropped: %" PRIu64 "\n",
+               p->ipackets, p->ibytes, p->imissed, p->ierrors, p->rx_nombuf,
+               p->rx_dropped);
+        printf("  TX-packets: %" PRIu64 "  TX-bytes: %" PRIu64
+               "  TX-errors: %" PRIu64 "  TX-dropped: %" PRIu64 "\n",
+               p->opackets, p->obytes, p->oerrors, p->tx_dropped);
+        printf("  pktmbuf-in-use: %u  pktmbuf-avail: %u\n", p->mbuf_in_use,
+               p->mbuf_avail);
+    }
+}
+
+static void
+metrics_show_services(struct metrics_shm_header *h) {
+    struct metrics_shm_vs *vs;
+    struct metrics_shm_rs *rs;
+    char ip[INET_ADDRSTRLEN];
+    uint32_t i, j;
+
+    for (i = 0; i < h->nb_vs; i++) {
+        vs = METRICS_SHM_ENTRY(h, vs, i);
+        inet_ntop(AF_INET, &vs->vip, ip, sizeof(ip));
+        printf("vs %s:%u %s\n", ip, ntohs(vs->vport),
+               metrics_proto_name(vs->proto));
+        printf("  active-conns: %d  history-conns: %" PRIu64 "\n",
+               vs->active_conns, vs->conns);
+        printf("  [c2v]packets: %" PRIu64 "  [c2v]bytes: %" PRIu64
+               "  [c2v]drops: %" PRIu64 "\n",
+               vs->packets[0], vs->bytes[0], vs->drops[0]);
+        printf("  [r2v]packets: %" PRIu64 "  [r2v]bytes: %" PRIu64
+               "  [r2v]drops: %" PRIu64 "\n",
+               vs->packets[1], vs->bytes[1], vs->drops[1]);
+        for (j = 0; j < vs->nb_rs; j++) {
+            rs = METRICS_SHM_ENTRY(h, rs, vs->rs_first + j);
+            inet_ntop(AF_INET, &rs->rip, ip, sizeof(ip));
+            printf("  rs %s:%u weight %d active-conns: %d "
+                   "history-conns: %" PRIu64 "\n",
+                   ip, ntohs(rs->rport), rs->weight, rs->active_conns,
+                   rs->conns);
+            printf("    [v2r]packets: %" PRIu64 "  [v2r]bytes: %" PRIu64
+                   "  [r2v]packets: %" PRIu64 "  [r2v]bytes: %" PRIu64 "\n",
+                   rs->packets[0], rs->bytes[0], rs->packets[1],
+                   rs->bytes[1]);
+        }
+    }
+    if (h->vs_truncated != 0 || h->rs_truncated != 0)
+        printf("not in the region: %u vs, %u rs\n", h->vs_truncated,
+               h->rs_truncated);
+}
+
+/* Print a snapshot of the metrics region, without the control socket. */
+int
+metrics_show(const char *path) {
+    struct metrics_shm m;
+    struct metrics_shm_header *h;
+    struct timespec ts;
+    uint64_t now_ns;
+    void *buf;
+
+    if (metrics_shm_open(&m, path) < 0) {
+        fprintf(stderr, "Cannot open metrics region %s: %s.\n", path,
+                strerror(errno));
+        return -1;
+    }
+    buf = malloc(m.size);
+    if (buf == NULL || metrics_shm_snapshot(&m, buf, m.size) < 0) {
+        fprintf(stderr, "Cannot read metrics region %s: %s.\n", path,
+                strerror(errno));
+        free(buf);
+        metrics_shm_close(&m);
+        return -1;
+    }
+    metrics_shm_close(&m);
+
+    h = buf;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    now_ns = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    printf("pid: %u  interval_ms: %u  age_ms: %" PRIu64 "\n", h->pid,
+           h->interval_ms,
+           now_ns > h->update_ns ? (now_ns - h->update_ns) / 1000000 : 0);
+    metrics_show_lcores(h);
+    metrics_show_ports(h);
+    metrics_show_services(h);
+    free(buf);
+    return 0;
+}
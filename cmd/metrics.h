@@ -0,0 +1,8 @@
+/* Copyright (c) 2018. TIG developer. */
+
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+int metrics_show(const char *path);
+
+#endif
@@ -65,10 +65,11 @@ arp_expire(struct rte_timer *t, void *arg) {
     curr_time = LB_CLOCK();
     use_time = rte_atomic32_read(&entry->use_time);
     if (curr_time - use_time >= entry->timeout) {
+        /* Stopped before a kni lcore reuses the entry. */
         ARP_TABLE_RWLOCK_WLOCK(tbl);
         rte_hash_del_key(tbl->hash, &entry->ip);
-        ARP_TABLE_RWLOCK_WUNLOCK(tbl);
         rc = rte_timer_stop(t);
+        ARP_TABLE_RWLOCK_WUNLOCK(tbl);
         if (rc < 0) {
             RTE_LOG(WARNING, USER1,
                     "%s(): Stop arp timer failed, ip(0x%08x).\n", __func__,
@@ -90,10 +91,23 @@ lb_arp_input(struct rte_mbuf *pkt, struct lb_device *dev) {
     arph = rte_pktmbuf_mtod_offset(pkt, struct arp_hdr *, ETHER_HDR_LEN);
     sip = arph->arp_data.arp_sip;
     sha = &arph->arp_data.arp_sha;
+
+    /*
+     * The kni lcores get ARP replies while the master expires the
+     * entries, the table is only read under the lock.
+     */
+    ARP_TABLE_RWLOCK_RLOCK(tbl);
+    i = rte_hash_lookup(tbl->hash, &sip);
+    if (i >= 0 && ether_addr_cmp(sha, &tbl->entries[i].ha)) {
+        ARP_TABLE_RWLOCK_RUNLOCK(tbl);
+        return;
+    }
+    ARP_TABLE_RWLOCK_RUNLOCK(tbl);
+
+    ARP_TABLE_RWLOCK_WLOCK(tbl);
     i = rte_hash_lookup(tbl->hash, &sip);
     if (i < 0) {
         /* add */
-        ARP_TABLE_RWLOCK_WLOCK(tbl);
         i = rte_hash_add_key(tbl->hash, &sip);
         if (i < 0) {
             ARP_TABLE_RWLOCK_WUNLOCK(tbl);
@@ -113,17 +127,13 @@ lb_arp_input(struct rte_mbuf *pkt, struct lb_device *dev) {
         rte_timer_init(&entry->timer);
         rte_timer_reset(&entry->timer, SEC_TO_CYCLES(5), PERIODICAL,
                         rte_get_master_lcore(), arp_expire, entry);
-        ARP_TABLE_RWLOCK_WUNLOCK(tbl);
     } else {
         /* update */
         entry = &tbl->entries[i];
-        if (!ether_addr_cmp(sha, &entry->ha)) {
-            ARP_TABLE_RWLOCK_WLOCK(tbl);
-            ether_addr_copy(sha, &entry->ha);
-            rte_atomic32_set(&entry->use_time, LB_CLOCK());
-            ARP_TABLE_RWLOCK_WUNLOCK(tbl);
-        }
+        ether_addr_copy(sha, &entry->ha);
+        rte_atomic32_set(&entry->use_time, LB_CLOCK());
     }
+    ARP_TABLE_RWLOCK_WUNLOCK(tbl);
 }
 
 static int
@@ -0,0 +1,577 @@
+/* Copyright (c) 2018. TIG developer. */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <rte_cycles.h>
+#include <rte_errno.h>
+#include <rte_ether.h>
+#include <rte_ip.h>
+#include <rte_lcore.h>
+#include <rte_log.h>
+#include <rte_mbuf.h>
+#include <rte_memcpy.h>
+#include <rte_mempool.h>
+#include <rte_ring.h>
+
+#include <unixctl_command.h>
+
+#include "lb_capture.h"
+#include "lb_config.h"
+#include "lb_format.h"
+#include "lb_parser.h"
+
+/*
+ * A matching packet is copied, truncated to the snap length, into a
+ * record queued on a ring of its lcore; the packet itself goes on
+ * unchanged. A writer thread drains the rings into pcap files, rotated
+ * by size. Nothing runs and nothing is allocated before the first
+ * capture, the points test a single word until then.
+ */
+#define CAPTURE_MAX_SNAPLEN 2048
+#define CAPTURE_POOL_SIZE 4095
+#define CAPTURE_POOL_CACHE 64
+#define CAPTURE_RING_SIZE 1024
+#define CAPTURE_BURST 32
+#define CAPTURE_WRITER_SLEEP_US 1000
+#define CAPTURE_DEFAULT_PATH "/tmp/jupiter.pcap"
+#define CAPTURE_DEFAULT_FILES 8
+
+#define PCAP_MAGIC_NSEC 0xa1b23c4d
+#define PCAP_LINKTYPE_ETHERNET 1
+
+struct pcap_file_hdr {
+    uint32_t magic;
+    uint16_t version_major;
+    uint16_t version_minor;
+    int32_t thiszone;
+    uint32_t sigfigs;
+    uint32_t snaplen;
+    uint32_t linktype;
+};
+
+struct pcap_rec_hdr {
+    uint32_t ts_sec;
+    uint32_t ts_nsec;
+    uint32_t caplen;
+    uint32_t len;
+};
+
+struct capture_rec {
+    uint64_t tsc;
+    uint32_t len;
+    uint32_t caplen;
+    uint8_t data[CAPTURE_MAX_SNAPLEN];
+};
+
+/* Addresses and ports in network order, 0 matches any. */
+struct capture_filter {
+    uint8_t proto;
+    uint32_t src_ip, dst_ip, host_ip;
+    uint16_t src_port, dst_port, host_port;
+};
+
+struct capture_lcore {
+    struct rte_ring *ring;
+    uint64_t pkts[LB_CAPTURE_P_MAX];
+    uint64_t nomem;
+    uint64_t ring_full;
+} __rte_cache_aligned;
+
+volatile uint32_t lb_capture_points;
+
+static struct capture_filter capture_filter;
+static uint32_t capture_snaplen;
+static struct rte_mempool *capture_mp;
+static struct capture_lcore capture_lcores[RTE_MAX_LCORE];
+
+/* Writer state, only touched by the writer thread while it runs. */
+static pthread_t capture_writer_tid;
+static volatile int capture_running;
+static char capture_path[LB_MAX_PATH_LEN];
+static FILE *capture_fp;
+static uint64_t capture_count;
+static uint64_t capture_file_size;
+static uint32_t capture_nb_files;
+static uint32_t capture_file_idx;
+static uint64_t capture_file_bytes;
+static uint64_t capture_written;
+static uint64_t capture_bytes;
+static uint64_t capture_write_errors;
+static uint64_t capture_base_tsc;
+static struct timespec capture_base_ts;
+
+static const char *capture_point_names[] = {
+    [LB_CAPTURE_P_RX] = "rx",
+    [LB_CAPTURE_P_TX] = "tx",
+    [LB_CAPTURE_P_DROP] = "drop",
+};
+
+static int
+capture_match(const struct capture_filter *f, struct rte_mbuf *m) {
+    struct ether_hdr *eth;
+    struct ipv4_hdr *iph;
+    uint16_t *ports;
+    uint16_t sport = 0, dport = 0;
+
+    if (f->proto == 0 && f->src_ip == 0 && f->dst_ip == 0 && f->host_ip == 0 &&
+        f->src_port == 0 && f->dst_port == 0 && f->host_port == 0)
+        return 1;
+
+    eth = rte_pktmbuf_mtod(m, struct ether_hdr *);
+    if (eth->ether_type != rte_cpu_to_be_16(ETHER_TYPE_IPv4) ||
+        rte_pktmbuf_data_len(m) < ETHER_HDR_LEN + sizeof(struct ipv4_hdr))
+        return 0;
+    iph = (struct ipv4_hdr *)(eth + 1);
+
+    if (f->proto != 0 && iph->next_proto_id != f->proto)
+        return 0;
+    if (f->src_ip != 0 && iph->src_addr != f->src_ip)
+        return 0;
+    if (f->dst_ip != 0 && iph->dst_addr != f->dst_ip)
+        return 0;
+    if (f->host_ip != 0 && iph->src_addr != f->host_ip &&
+        iph->dst_addr != f->host_ip)
+        return 0;
+    if (f->src_port == 0 && f->dst_port == 0 && f->host_port == 0)
+        return 1;
+
+    /* Only the first fragment has the ports. */
+    if ((iph->next_proto_id != IPPROTO_TCP &&
+         iph->next_proto_id != IPPROTO_UDP) ||
+        (iph->fragment_offset & rte_cpu_to_be_16(IPV4_HDR_OFFSET_MASK)) ||
+        rte_pktmbuf_data_len(m) <
+            ETHER_HDR_LEN + (iph->version_ihl & IPV4_HDR_IHL_MASK) * 4 + 4)
+        return 0;
+    ports = (uint16_t *)((char *)iph +
+                         (iph->version_ihl & IPV4_HDR_IHL_MASK) * 4);
+    sport = ports[0];
+    dport = ports[1];
+    if (f->src_port != 0 && sport != f->src_port)
+        return 0;
+    if (f->dst_port != 0 && dport != f->dst_port)
+        return 0;
+    if (f->host_port != 0 && sport != f->host_port && dport != f->host_port)
+        return 0;
+    return 1;
+}
+
+void
+lb_capture_packet(struct rte_mbuf *m, uint32_t point) {
+    struct capture_lcore *cl = &capture_lcores[rte_lcore_id()];
+    struct capture_rec *rec;
+    const void *p;
+
+    if (!capture_match(&capture_filter, m))
+        return;
+    if (rte_mempool_get(capture_mp, (void **)&rec) < 0) {
+        cl->nomem++;
+        return;
+    }
+    rec->tsc = rte_rdtsc();
+    rec->len = rte_pktmbuf_pkt_len(m);
+    rec->caplen = RTE_MIN(rec->len, capture_snaplen);
+    p = rte_pktmbuf_read(m, 0, rec->caplen, rec->data);
+    if (p != rec->data)
+        rte_memcpy(rec->data, p, rec->caplen);
+    if (rte_ring_sp_enqueue(cl->ring, rec) < 0) {
+        rte_mempool_put(capture_mp, rec);
+        cl->ring_full++;
+        return;
+    }
+    cl->pkts[point]++;
+}
+
+static int
+capture_file_open(void) {
+    struct pcap_file_hdr hdr;
+    char path[LB_MAX_PATH_LEN + 16];
+
+    if (capture_fp != NULL)
+        fclose(capture_fp);
+    if (capture_file_size != 0) {
+        snprintf(path, sizeof(path), "%s.%u", capture_path,
+                 capture_file_idx);
+        capture_file_idx = (capture_file_idx + 1) % capture_nb_files;
+    } else {
+        snprintf(path, sizeof(path), "%s", capture_path);
+    }
+    capture_fp = fopen(path, "w");
+    if (capture_fp == NULL)
+        return -1;
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = PCAP_MAGIC_NSEC;
+    hdr.version_major = 2;
+    hdr.version_minor = 4;
+    hdr.snaplen = capture_snaplen;
+    hdr.linktype = PCAP_LINKTYPE_ETHERNET;
+    if (fwrite(&hdr, sizeof(hdr), 1, capture_fp) != 1)
+        return -1;
+    capture_file_bytes = sizeof(hdr);
+    return 0;
+}
+
+static void
+capture_write(const struct capture_rec *rec) {
+    struct pcap_rec_hdr hdr;
+    uint64_t hz = rte_get_tsc_hz();
+    uint64_t delta, nsec;
+
+    if (capture_count != 0 && capture_written >= capture_count) {
+        lb_capture_points = 0;
+        return;
+    }
+    if (capture_file_size != 0 &&
+        capture_file_bytes + sizeof(hdr) + rec->caplen > capture_file_size &&
+        capture_file_open() < 0) {
+        capture_write_errors++;
+        return;
+    }
+    if (capture_fp == NULL) {
+        capture_write_errors++;
+        return;
+    }
+
+    delta = rec->tsc - capture_base_tsc;
+    nsec = capture_base_ts.tv_nsec + delta % hz * NS_PER_S / hz;
+    hdr.ts_sec = capture_base_ts.tv_sec + delta / hz + nsec / NS_PER_S;
+    hdr.ts_nsec = nsec % NS_PER_S;
+    hdr.caplen = rec->caplen;
+    hdr.len = rec->len;
+    if (fwrite(&hdr, sizeof(hdr), 1, capture_fp) != 1 ||
+        fwrite(rec->data, rec->caplen, 1, capture_fp) != 1) {
+        capture_write_errors++;
+        return;
+    }
+    capture_file_bytes += sizeof(hdr) + rec->caplen;
+    capture_bytes += sizeof(hdr) + rec->caplen;
+    capture_written++;
+}
+
+/* Records of the rings are written in lcore order, not in time order. */
+static uint32_t
+capture_drain(int discard) {
+    struct capture_rec *recs[CAPTURE_BURST];
+    struct rte_ring *r;
+    uint32_t lcore_id, n, i, total = 0;
+
+    RTE_LCORE_FOREACH(lcore_id) {
+        r = capture_lcores[lcore_id].ring;
+        if (r == NULL)
+            continue;
+        while ((n = rte_ring_sc_dequeue_burst(r, (void **)recs, CAPTURE_BURST,
+                                              NULL)) != 0) {
+            for (i = 0; i < n; i++) {
+                if (!discard)
+                    capture_write(recs[i]);
+            }
+            rte_mempool_put_bulk(capture_mp, (void **)recs, n);
+            total += n;
+        }
+    }
+    return total;
+}
+
+static void *
+capture_writer(__attribute__((unused)) void *arg) {
+    while (capture_running) {
+        if (capture_drain(0) == 0) {
+            if (capture_fp != NULL)
+                fflush(capture_fp);
+            usleep(CAPTURE_WRITER_SLEEP_US);
+        }
+    }
+    capture_drain(0);
+    return NULL;
+}
+
+static int
+capture_alloc(void) {
+    char name[RTE_RING_NAMESIZE];
+    uint32_t lcore_id;
+
+    if (capture_mp == NULL) {
+        capture_mp = rte_mempool_create(
+            "capture_mp", CAPTURE_POOL_SIZE, sizeof(struct capture_rec),
+            CAPTURE_POOL_CACHE, 0, NULL, NULL, NULL, NULL, SOCKET_ID_ANY, 0);
+        if (capture_mp == NULL) {
+            RTE_LOG(ERR, USER1, "%s(): Create mempool failed, %s.\n",
+                    __func__, rte_strerror(rte_errno));
+            return -1;
+        }
+    }
+    RTE_LCORE_FOREACH(lcore_id) {
+        if (capture_lcores[lcore_id].ring != NULL)
+            continue;
+        snprintf(name, sizeof(name), "capture_ring%u", lcore_id);
+        capture_lcores[lcore_id].ring =
+            rte_ring_create(name, CAPTURE_RING_SIZE,
+                            rte_lcore_to_socket_id(lcore_id),
+                            RING_F_SP_ENQ | RING_F_SC_DEQ);
+        if (capture_lcores[lcore_id].ring == NULL) {
+            RTE_LOG(ERR, USER1, "%s(): Create ring %s failed, %s.\n",
+                    __func__, name, rte_strerror(rte_errno));
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int
+capture_ip_port_parse(const char *token, uint32_t *ip, uint16_t *port) {
+    if (strchr(token, ':') != NULL)
+        return parse_ipv4_port(token, ip, port);
+    *port = 0;
+    return parse_ipv4_addr(token, (struct in_addr *)ip);
+}
+
+static int
+capture_start_arg_parse(char *argv[], int argc, uint32_t *points,
+                        struct capture_filter *f, uint32_t *snaplen,
+                        uint64_t *count, char *path, uint64_t *file_size,
+                        uint32_t *nb_files) {
+    uint32_t p, size_mb;
+    int i = 0;
+    int rc;
+
+    while (i < argc) {
+        for (p = 0; p < LB_CAPTURE_P_MAX; p++) {
+            if (strcmp(argv[i], capture_point_names[p]) == 0)
+                break;
+        }
+        if (p < LB_CAPTURE_P_MAX) {
+            *points |= 1u << p;
+            i++;
+            continue;
+        }
+        if (i + 1 >= argc)
+            return i;
+
+        if (strcmp(argv[i], "proto") == 0) {
+            if (strcasecmp(argv[i + 1], "icmp") == 0) {
+                f->proto = IPPROTO_ICMP;
+                rc = 0;
+            } else {
+                rc = parse_l4_proto(argv[i + 1], &f->proto);
+            }
+        } else if (strcmp(argv[i], "src") == 0) {
+            rc = capture_ip_port_parse(argv[i + 1], &f->src_ip, &f->src_port);
+        } else if (strcmp(argv[i], "dst") == 0) {
+            rc = capture_ip_port_parse(argv[i + 1], &f->dst_ip, &f->dst_port);
+        } else if (strcmp(argv[i], "host") == 0) {
+            rc = capture_ip_port_parse(argv[i + 1], &f->host_ip,
+                                       &f->host_port);
+        } else if (strcmp(argv[i], "snaplen") == 0) {
+            rc = parser_read_uint32(snaplen, argv[i + 1]);
+            if (rc == 0 && *snaplen > CAPTURE_MAX_SNAPLEN)
+                rc = -1;
+        } else if (strcmp(argv[i], "count") == 0) {
+            rc = parser_read_uint64(count, argv[i + 1]);
+        } else if (strcmp(argv[i], "file") == 0) {
+            rc = strlen(argv[i + 1]) < LB_MAX_PATH_LEN ? 0 : -1;
+            if (rc == 0)
+                strcpy(path, argv[i + 1]);
+        } else if (strcmp(argv[i], "size") == 0) {
+            rc = parser_read_uint32(&size_mb, argv[i + 1]);
+            *file_size = (uint64_t)size_mb << 20;
+        } else if (strcmp(argv[i], "files") == 0) {
+            rc = parser_read_uint32(nb_files, argv[i + 1]);
+            if (rc == 0 && *nb_files == 0)
+                rc = -1;
+        } else {
+            return i;
+        }
+        if (rc < 0)
+            return i + 1;
+        i += 2;
+    }
+    return i;
+}
+
+static void
+capture_start_cmd_cb(int fd, char *argv[], int argc) {
+    struct capture_filter filter;
+    uint32_t points = 0, snaplen = 0, nb_files = CAPTURE_DEFAULT_FILES;
+    uint64_t count = 0, file_size = 0;
+    char path[LB_MAX_PATH_LEN] = CAPTURE_DEFAULT_PATH;
+    int rc;
+
+    if (capture_running) {
+        unixctl_command_reply_error(fd, "Capture is running, stop it first.\n");
+        return;
+    }
+
+    memset(&filter, 0, sizeof(filter));
+    rc = capture_start_arg_parse(argv, argc, &points, &filter, &snaplen,
+                                 &count, path, &file_size, &nb_files);
+    if (rc != argc) {
+        unixctl_command_reply_error(fd, "Invalid parameter: %s.\n", argv[rc]);
+        return;
+    }
+    if (points == 0)
+        points = 1u << LB_CAPTURE_P_RX;
+
+    if (capture_alloc() < 0) {
+        unixctl_command_reply_error(fd, "Not enough memory.\n");
+        return;
+    }
+    /* Records left by the workers after the last stop. */
+    capture_drain(1);
+
+    capture_filter = filter;
+    capture_snaplen = snaplen != 0 ? snaplen : CAPTURE_MAX_SNAPLEN;
+    snprintf(capture_path, sizeof(capture_path), "%s", path);
+    capture_count = count;
+    capture_file_size = file_size;
+    capture_nb_files = nb_files;
+    capture_file_idx = 0;
+    capture_written = 0;
+    capture_bytes = 0;
+    capture_write_errors = 0;
+    capture_base_tsc = rte_rdtsc();
+    clock_gettime(CLOCK_REALTIME, &capture_base_ts);
+    if (capture_file_open() < 0) {
+        unixctl_command_reply_error(fd, "Cannot write %s, %s.\n", path,
+                                    strerror(errno));
+        if (capture_fp != NULL) {
+            fclose(capture_fp);
+            capture_fp = NULL;
+        }
+        return;
+    }
+
+    capture_running = 1;
+    rc = pthread_create(&capture_writer_tid, NULL, capture_writer, NULL);
+    if (rc != 0) {
+        capture_running = 0;
+        fclose(capture_fp);
+        capture_fp = NULL;
+        unixctl_command_reply_error(fd, "Cannot start the writer, %s.\n",
+                                    strerror(rc));
+        return;
+    }
+    rte_wmb();
+    lb_capture_points = points;
+}
+
+UNIXCTL_CMD_REGISTER("capture/start",
+                     "[rx] [tx] [drop] [proto tcp|udp|icmp] [src IP[:PORT]] "
+                     "[dst IP[:PORT]] [host IP[:PORT]] [snaplen LEN] "
+                     "[count NUM] [file PATH] [size MB] [files NUM].",
+                     "Capture the matching packets into pcap files.", 0, 21,
+                     capture_start_cmd_cb);
+
+static void
+capture_stop_cmd_cb(int fd, __attribute__((unused)) char *argv[],
+                    __attribute__((unused)) int argc) {
+    if (!capture_running) {
+        unixctl_command_reply_error(fd, "No capture is running.\n");
+        return;
+    }
+    lb_capture_points = 0;
+    rte_wmb();
+    capture_running = 0;
+    pthread_join(capture_writer_tid, NULL);
+    if (capture_fp != NULL) {
+        fclose(capture_fp);
+        capture_fp = NULL;
+    }
+    unixctl_command_reply(fd, "%" PRIu64 " packets written.\n",
+                          capture_written);
+}
+
+UNIXCTL_CMD_REGISTER("capture/stop", "", "Stop the capture.", 0, 0,
+                     capture_stop_cmd_cb);
+
+static void
+capture_stats_cmd_cb(int fd, char *argv[], int argc) {
+    struct capture_lcore *cl;
+    uint32_t lcore_id, p;
+    int json_fmt = 0, json_first_obj = 1;
+    char points[32] = "";
+
+    if (argc > 0) {
+        if (strcmp(argv[0], "--json") != 0) {
+            unixctl_command_reply_error(fd, "Invalid parameter: %s.\n",
+                                        argv[0]);
+            return;
+        }
+        json_fmt = 1;
+    }
+
+    for (p = 0; p < LB_CAPTURE_P_MAX; p++) {
+        if (!(lb_capture_points & (1u << p)))
+            continue;
+        if (points[0] != '\0')
+            strcat(points, ",");
+        strcat(points, capture_point_names[p]);
+    }
+
+    if (json_fmt) {
+        unixctl_command_reply(fd, "{");
+        unixctl_command_reply(fd, JSON_KV_32_FMT("running", ","),
+                              capture_running);
+        unixctl_command_reply(fd, JSON_KV_S_FMT("points", ","), points);
+        unixctl_command_reply(fd, JSON_KV_S_FMT("file", ","), capture_path);
+        unixctl_command_reply(fd, JSON_KV_64_FMT("written", ","),
+                              capture_written);
+        unixctl_command_reply(fd, JSON_KV_64_FMT("bytes", ","), capture_bytes);
+        unixctl_command_reply(fd, JSON_KV_64_FMT("write_errors", ","),
+                              capture_write_errors);
+        unixctl_command_reply(fd, "\"lcores\":[");
+    } else {
+        unixctl_command_reply(fd, NORM_KV_S_FMT("running", "\n"),
+                              capture_running ? "yes" : "no");
+        unixctl_command_reply(fd, NORM_KV_S_FMT("points", "\n"), points);
+        unixctl_command_reply(fd, NORM_KV_S_FMT("file", "\n"), capture_path);
+        unixctl_command_reply(fd, NORM_KV_64_FMT("written", "\n"),
+                              capture_written);
+        unixctl_command_reply(fd, NORM_KV_64_FMT("bytes", "\n"),
+                              capture_bytes);
+        unixctl_command_reply(fd, NORM_KV_64_FMT("write_errors", "\n"),
+                              capture_write_errors);
+    }
+    RTE_LCORE_FOREACH(lcore_id) {
+        cl = &capture_lcores[lcore_id];
+        if (cl->ring == NULL)
+            continue;
+        if (json_fmt) {
+            unixctl_command_reply(fd, json_first_obj ? "{" : ",{");
+            json_first_obj = 0;
+            unixctl_command_reply(fd, JSON_KV_32_FMT("lcore", ","), lcore_id);
+            for (p = 0; p < LB_CAPTURE_P_MAX; p++) {
+                unixctl_command_reply(fd, "\"%s_pkts\":%" PRIu64 ",",
+                                      capture_point_names[p], cl->pkts[p]);
+            }
+            unixctl_command_reply(fd, JSON_KV_64_FMT("nomem", ","),
+                                  cl->nomem);
+            unixctl_command_reply(fd, JSON_KV_64_FMT("ring_full", "}"),
+                                  cl->ring_full);
+        } else {
+            unixctl_command_reply(fd, "lcore%u\n", lcore_id);
+            for (p = 0; p < LB_CAPTURE_P_MAX; p++) {
+                unixctl_command_reply(fd, "  %s_pkts: %" PRIu64 "\n",
+                                      capture_point_names[p], cl->pkts[p]);
+            }
+            unixctl_command_reply(fd, NORM_KV_64_FMT("  nomem", "\n"),
+                                  cl->nomem);
+            unixctl_command_reply(fd, NORM_KV_64_FMT("  ring_full", "\n"),
+                                  cl->ring_full);
+        }
+    }
+    if (json_fmt)
+        unixctl_command_reply(fd, "]}\n");
+}
+
+UNIXCTL_CMD_REGISTER("capture/stats", "[--json].",
+                     "Show the state of the capture and the packets queued, "
+                     "or missed, by each lcore.",
+                     0, 1, capture_stats_cmd_cb);
@@ -0,0 +1,29 @@
+/* Copyright (c) 2018. TIG developer. */
+
+#ifndef __LB_CAPTURE_H__
+#define __LB_CAPTURE_H__
+
+#include <rte_branch_prediction.h>
+#include <rte_mbuf.h>
+
+/* Where the packets are captured, selected by capture/start. */
+enum {
+    LB_CAPTURE_P_RX,   /* Received, before translation. */
+    LB_CAPTURE_P_TX,   /* Sent, after translation. */
+    LB_CAPTURE_P_DROP, /* Dropped, see lb_drop(). */
+    LB_CAPTURE_P_MAX,
+};
+
+/* Bit mask of the capture points, 0 while no capture runs. */
+extern volatile uint32_t lb_capture_points;
+
+void lb_capture_packet(struct rte_mbuf *m, uint32_t point);
+
+static inline void
+lb_capture(struct rte_mbuf *m, uint32_t point) {
+    if (likely(!(lb_capture_points & (1u << point))))
+        return;
+    lb_capture_packet(m, point);
+}
+
+#endif
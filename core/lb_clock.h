@@ -19,6 +19,8 @@ extern rte_atomic32_t lb_clock;
 
 #define SEC_TO_CYCLES(a) (rte_get_timer_hz() * (a))
 
+#define US_TO_CYCLES(a) ((rte_get_timer_hz() + US_PER_S - 1) / US_PER_S * (a))
+
 #define SEC_TO_LB_CLOCK(a) (LB_CLOCK_PER_S * (a))
 
 #define LB_CLOCK_TO_SEC(a) (((a) + LB_CLOCK_PER_S - 1) / LB_CLOCK_PER_S)
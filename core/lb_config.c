@@ -2,10 +2,14 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <rte_cfgfile.h>
 #include <rte_eth_bond.h>
 #include <rte_ip.h>
+#include <rte_log.h>
+
+#include <connlog.h>
 
 #include "lb_config.h"
 #include "lb_parser.h"
@@ -161,6 +165,21 @@ device_entry_parse_mtu(const char *token, void *_conf) {
     return 0;
 }
 
+static int
+device_entry_parse_mbufsize(const char *token, void *_conf) {
+    struct lb_device_conf *conf = _conf;
+    uint16_t size;
+
+    /* The data room, the mbuf pool adds the headroom. */
+    if (parser_read_uint16(&size, token) < 0 ||
+        size < RTE_MBUF_DEFAULT_DATAROOM ||
+        size > UINT16_MAX - RTE_PKTMBUF_HEADROOM)
+        return -1;
+
+    conf->mbufsize = size;
+    return 0;
+}
+
 static int
 device_entry_parse_rxoffload(const char *token, void *_conf) {
     struct lb_device_conf *conf = _conf;
@@ -185,6 +204,112 @@ device_entry_parse_txoffload(const char *token, void *_conf) {
     return 0;
 }
 
+static int
+device_entry_parse_gue_port(const char *token, void *_conf) {
+    struct lb_device_conf *conf = _conf;
+    uint16_t port;
+
+    if (parser_read_uint16(&port, token) < 0 || port == 0)
+        return -1;
+
+    conf->gue_port = port;
+    return 0;
+}
+
+static int
+device_entry_parse_lport_partition(const char *token, void *_conf) {
+    struct lb_device_conf *conf = _conf;
+    uint8_t on;
+
+    if (parser_read_uint8(&on, token) < 0 || on > 1)
+        return -1;
+
+    conf->lport_partition = on;
+    return 0;
+}
+
+/* A list of lcores and lcore ranges, such as "1-4,9". */
+static int
+lcore_list_parse(const char *token, uint8_t *lcores, uint16_t *nb_lcores) {
+    char *str, *p, *dash;
+    uint16_t first, last, id;
+    int rc = 0;
+
+    str = strdup(token);
+    if (str == NULL)
+        return -1;
+    p = strtok(str, " ,");
+    while (p != NULL) {
+        dash = strchr(p, '-');
+        if (dash != NULL)
+            *dash = '\0';
+        if (parser_read_uint16(&first, p) < 0 ||
+            (dash != NULL && parser_read_uint16(&last, dash + 1) < 0)) {
+            rc = -1;
+            break;
+        }
+        if (dash == NULL)
+            last = first;
+        if (first > last || last >= RTE_MAX_LCORE) {
+            rc = -1;
+            break;
+        }
+        for (id = first; id <= last; id++) {
+            if (!lcores[id]) {
+                lcores[id] = 1;
+                (*nb_lcores)++;
+            }
+        }
+        p = strtok(NULL, " ,");
+    }
+    free(str);
+    return rc;
+}
+
+static int
+device_entry_parse_lcores(const char *token, void *_conf) {
+    struct lb_device_conf *conf = _conf;
+
+    return lcore_list_parse(token, conf->lcores, &conf->nb_lcores);
+}
+
+static int
+device_entry_parse_rxq_per_lcore(const char *token, void *_conf) {
+    struct lb_device_conf *conf = _conf;
+    uint16_t n;
+
+    if (parser_read_uint16(&n, token) < 0 || n == 0 ||
+        n > LB_MAX_RXQ_PER_LCORE)
+        return -1;
+
+    conf->rxq_per_lcore = n;
+    return 0;
+}
+
+static int
+device_entry_parse_kni(const char *token, void *_conf) {
+    struct lb_device_conf *conf = _conf;
+
+    if (strcmp(token, "tap") == 0)
+        conf->kni_type = LB_KNI_T_TAP;
+    else if (strcmp(token, "virtio-user") == 0)
+        conf->kni_type = LB_KNI_T_VIRTIO_USER;
+    else if (strcmp(token, "kni") == 0)
+        conf->kni_type = LB_KNI_T_KNI;
+    else
+        return -1;
+    return 0;
+}
+
+static int
+device_entry_parse_kni_lcores(const char *token, void *_conf) {
+    struct lb_device_conf *conf = _conf;
+
+    if (lcore_list_parse(token, conf->kni_lcores, &conf->nb_kni_lcores) < 0)
+        return -1;
+    return conf->nb_kni_lcores <= LB_MAX_KNI_LCORES ? 0 : -1;
+}
+
 static int
 device_entry_parse_local_ipv4(const char *token, void *_conf) {
     struct lb_device_conf *conf = _conf;
@@ -293,6 +418,11 @@ static const struct conf_entry device_entries[] = {
         .required = 0,
         .parse = device_entry_parse_mtu,
     },
+    {
+        .name = "mbufsize",
+        .required = 0,
+        .parse = device_entry_parse_mbufsize,
+    },
     {
         .name = "rxoffload",
         .required = 0,
@@ -303,6 +433,36 @@ static const struct conf_entry device_entries[] = {
         .required = 0,
         .parse = device_entry_parse_txoffload,
     },
+    {
+        .name = "gue-port",
+        .required = 0,
+        .parse = device_entry_parse_gue_port,
+    },
+    {
+        .name = "lport-partition",
+        .required = 0,
+        .parse = device_entry_parse_lport_partition,
+    },
+    {
+        .name = "lcores",
+        .required = 0,
+        .parse = device_entry_parse_lcores,
+    },
+    {
+        .name = "rxq-per-lcore",
+        .required = 0,
+        .parse = device_entry_parse_rxq_per_lcore,
+    },
+    {
+        .name = "kni",
+        .required = 0,
+        .parse = device_entry_parse_kni,
+    },
+    {
+        .name = "kni-lcores",
+        .required = 0,
+        .parse = device_entry_parse_kni_lcores,
+    },
     {
         .name = "local-ipv4",
         .required = 1,
@@ -316,48 +476,420 @@ static const struct conf_entry device_entries[] = {
 };
 
 static int
-dpdk_section_parse(struct rte_cfgfile *cfgfile, const char *section,
-                   struct lb_dpdk_conf *conf) {
-    const char *val;
-    uint32_t j;
+ipfrag_entry_parse_table_size(const char *token, void *_conf) {
+    struct lb_ipfrag_conf *conf = _conf;
+    uint32_t size;
 
-    for (j = 0; j < RTE_DIM(dpdk_entries); j++) {
-        val = rte_cfgfile_get_entry(cfgfile, section, dpdk_entries[j].name);
-        if (val == NULL) {
-            if (dpdk_entries[j].required) {
-                printf("%s(): %s is required in section %s.\n", __func__,
-                       dpdk_entries[j].name, section);
-                return -1;
-            }
-        } else {
-            if (dpdk_entries[j].parse(val, conf) < 0) {
-                printf("%s(): Cannot parse %s in section %s.\n", __func__,
-                       dpdk_entries[j].name, section);
-                return -1;
-            }
-        }
-    }
+    if (parser_read_uint32(&size, token) < 0)
+        return -1;
+    if (size < 1024 || size > (1 << 20))
+        return -1;
+
+    conf->table_size = size;
+    return 0;
+}
+
+static int
+ipfrag_entry_parse_timeout(const char *token, void *_conf) {
+    struct lb_ipfrag_conf *conf = _conf;
+    uint32_t timeout;
+
+    if (parser_read_uint32(&timeout, token) < 0)
+        return -1;
+    if (timeout == 0 || timeout > 60)
+        return -1;
+
+    conf->timeout = timeout;
+    return 0;
+}
+
+static const struct conf_entry ipfrag_entries[] = {
+    {
+        .name = "table-size",
+        .required = 0,
+        .parse = ipfrag_entry_parse_table_size,
+    },
+    {
+        .name = "timeout",
+        .required = 0,
+        .parse = ipfrag_entry_parse_timeout,
+    },
+};
+
+static int
+poll_entry_parse_mode(const char *token, void *_conf) {
+    struct lb_poll_conf *conf = _conf;
+
+    if (strcmp(token, "busy") == 0)
+        conf->mode = LB_POLL_M_BUSY;
+    else if (strcmp(token, "adaptive") == 0)
+        conf->mode = LB_POLL_M_ADAPTIVE;
+    else if (strcmp(token, "interrupt") == 0)
+        conf->mode = LB_POLL_M_INTERRUPT;
+    else
+        return -1;
+    return 0;
+}
+
+static int
+poll_entry_parse_idle_polls(const char *token, void *_conf) {
+    struct lb_poll_conf *conf = _conf;
+    uint32_t n;
+
+    if (parser_read_uint32(&n, token) < 0 || n == 0)
+        return -1;
+
+    conf->idle_polls = n;
+    return 0;
+}
+
+static int
+poll_entry_parse_max_sleep_us(const char *token, void *_conf) {
+    struct lb_poll_conf *conf = _conf;
+    uint32_t us;
+
+    if (parser_read_uint32(&us, token) < 0)
+        return -1;
+    if (us == 0 || us > 10000)
+        return -1;
+
+    conf->max_sleep_us = us;
+    return 0;
+}
+
+static const struct conf_entry poll_entries[] = {
+    {
+        .name = "mode",
+        .required = 0,
+        .parse = poll_entry_parse_mode,
+    },
+    {
+        .name = "idle-polls",
+        .required = 0,
+        .parse = poll_entry_parse_idle_polls,
+    },
+    {
+        .name = "max-sleep-us",
+        .required = 0,
+        .parse = poll_entry_parse_max_sleep_us,
+    },
+};
+
+static int
+overload_entry_parse_percent(const char *token, uint32_t *val) {
+    uint32_t n;
+
+    if (parser_read_uint32(&n, token) < 0 || n > 100)
+        return -1;
+
+    *val = n;
+    return 0;
+}
+
+static int
+overload_entry_parse_rxq_high(const char *token, void *_conf) {
+    struct lb_overload_conf *conf = _conf;
+
+    return overload_entry_parse_percent(token, &conf->rxq_high);
+}
+
+static int
+overload_entry_parse_mbuf_low(const char *token, void *_conf) {
+    struct lb_overload_conf *conf = _conf;
+
+    return overload_entry_parse_percent(token, &conf->mbuf_low);
+}
+
+static int
+overload_entry_parse_round_max_us(const char *token, void *_conf) {
+    struct lb_overload_conf *conf = _conf;
+    uint32_t us;
+
+    if (parser_read_uint32(&us, token) < 0 || us > 1000000)
+        return -1;
+
+    conf->round_max_us = us;
+    return 0;
+}
+
+static const struct conf_entry overload_entries[] = {
+    {
+        .name = "rxq-high",
+        .required = 0,
+        .parse = overload_entry_parse_rxq_high,
+    },
+    {
+        .name = "mbuf-low",
+        .required = 0,
+        .parse = overload_entry_parse_mbuf_low,
+    },
+    {
+        .name = "round-max-us",
+        .required = 0,
+        .parse = overload_entry_parse_round_max_us,
+    },
+};
+
+static int
+watchdog_entry_parse_stall_ms(const char *token, void *_conf) {
+    struct lb_watchdog_conf *conf = _conf;
+    uint32_t ms;
+
+    if (parser_read_uint32(&ms, token) < 0 || ms < 50 || ms > 60000)
+        return -1;
+
+    conf->stall_ms = ms;
+    return 0;
+}
+
+static int
+watchdog_entry_parse_backtrace(const char *token, void *_conf) {
+    struct lb_watchdog_conf *conf = _conf;
+    uint32_t on;
+
+    if (parser_read_uint32(&on, token) < 0 || on > 1)
+        return -1;
+
+    conf->backtrace = on;
+    return 0;
+}
+
+static const struct conf_entry watchdog_entries[] = {
+    {
+        .name = "stall-ms",
+        .required = 0,
+        .parse = watchdog_entry_parse_stall_ms,
+    },
+    {
+        .name = "backtrace",
+        .required = 0,
+        .parse = watchdog_entry_parse_backtrace,
+    },
+};
+
+static int
+metrics_entry_parse_path(const char *token, void *_conf) {
+    struct lb_metrics_conf *conf = _conf;
+
+    if (strlen(token) == 0 || strlen(token) >= sizeof(conf->path))
+        return -1;
+
+    snprintf(conf->path, sizeof(conf->path), "%s", token);
+    return 0;
+}
+
+static int
+metrics_entry_parse_interval_ms(const char *token, void *_conf) {
+    struct lb_metrics_conf *conf = _conf;
+    uint32_t ms;
+
+    if (parser_read_uint32(&ms, token) < 0 || ms < 10 || ms > 60000)
+        return -1;
+
+    conf->interval_ms = ms;
+    return 0;
+}
+
+static const struct conf_entry metrics_entries[] = {
+    {
+        .name = "path",
+        .required = 1,
+        .parse = metrics_entry_parse_path,
+    },
+    {
+        .name = "interval-ms",
+        .required = 0,
+        .parse = metrics_entry_parse_interval_ms,
+    },
+};
+
+static int
+exporter_entry_parse_listen(const char *token, void *_conf) {
+    struct lb_exporter_conf *conf = _conf;
+    uint32_t ip;
+    uint16_t port;
+
+    if (strlen(token) == 0 || strlen(token) >= sizeof(conf->listen))
+        return -1;
+    if (token[0] != '/' && parse_ipv4_port(token, &ip, &port) < 0)
+        return -1;
+
+    snprintf(conf->listen, sizeof(conf->listen), "%s", token);
+    return 0;
+}
+
+static const struct conf_entry exporter_entries[] = {
+    {
+        .name = "listen",
+        .required = 1,
+        .parse = exporter_entry_parse_listen,
+    },
+};
+
+static int
+ipfix_entry_parse_collector(const char *token, void *_conf) {
+    struct lb_ipfix_conf *conf = _conf;
+    uint32_t ip;
+    uint16_t port;
+
+    if (strlen(token) >= sizeof(conf->collector) ||
+        parse_ipv4_port(token, &ip, &port) < 0)
+        return -1;
+
+    snprintf(conf->collector, sizeof(conf->collector), "%s", token);
     return 0;
 }
 
 static int
-device_section_parse(struct rte_cfgfile *cfgfile, const char *section,
-                     struct lb_device_conf *conf) {
+ipfix_entry_parse_file(const char *token, void *_conf) {
+    struct lb_ipfix_conf *conf = _conf;
+
+    if (strlen(token) == 0 || strlen(token) >= sizeof(conf->file))
+        return -1;
+
+    snprintf(conf->file, sizeof(conf->file), "%s", token);
+    return 0;
+}
+
+static int
+ipfix_entry_parse_sample_rate(const char *token, void *_conf) {
+    struct lb_ipfix_conf *conf = _conf;
+    uint32_t rate;
+
+    if (parser_read_uint32(&rate, token) < 0 || rate == 0 || rate > 1048576)
+        return -1;
+
+    conf->sample_rate = rate;
+    return 0;
+}
+
+static int
+ipfix_entry_parse_sample_mode(const char *token, void *_conf) {
+    struct lb_ipfix_conf *conf = _conf;
+
+    if (strcmp(token, "connection") == 0)
+        conf->sample_packets = 0;
+    else if (strcmp(token, "packet") == 0)
+        conf->sample_packets = 1;
+    else
+        return -1;
+    return 0;
+}
+
+static int
+ipfix_entry_parse_active_timeout(const char *token, void *_conf) {
+    struct lb_ipfix_conf *conf = _conf;
+    uint32_t timeout;
+
+    if (parser_read_uint32(&timeout, token) < 0 || timeout == 0 ||
+        timeout > 86400)
+        return -1;
+
+    conf->active_timeout = timeout;
+    return 0;
+}
+
+static const struct conf_entry ipfix_entries[] = {
+    {
+        .name = "collector",
+        .required = 0,
+        .parse = ipfix_entry_parse_collector,
+    },
+    {
+        .name = "file",
+        .required = 0,
+        .parse = ipfix_entry_parse_file,
+    },
+    {
+        .name = "sample-rate",
+        .required = 0,
+        .parse = ipfix_entry_parse_sample_rate,
+    },
+    {
+        .name = "sample-mode",
+        .required = 0,
+        .parse = ipfix_entry_parse_sample_mode,
+    },
+    {
+        .name = "active-timeout",
+        .required = 0,
+        .parse = ipfix_entry_parse_active_timeout,
+    },
+};
+
+static int
+connlog_entry_parse_path(const char *token, void *_conf) {
+    struct lb_connlog_conf *conf = _conf;
+
+    if (strlen(token) == 0 || strlen(token) >= sizeof(conf->path))
+        return -1;
+
+    snprintf(conf->path, sizeof(conf->path), "%s", token);
+    return 0;
+}
+
+static int
+connlog_entry_parse_file_size(const char *token, void *_conf) {
+    struct lb_connlog_conf *conf = _conf;
+    uint32_t mb;
+
+    if (parser_read_uint32(&mb, token) < 0 || mb == 0 || mb > 65536)
+        return -1;
+
+    conf->file_size_mb = mb;
+    return 0;
+}
+
+static int
+connlog_entry_parse_files(const char *token, void *_conf) {
+    struct lb_connlog_conf *conf = _conf;
+    uint32_t files;
+
+    if (parser_read_uint32(&files, token) < 0 || files == 0 ||
+        files > CONNLOG_MAX_FILES)
+        return -1;
+
+    conf->files = files;
+    return 0;
+}
+
+static const struct conf_entry connlog_entries[] = {
+    {
+        .name = "path",
+        .required = 1,
+        .parse = connlog_entry_parse_path,
+    },
+    {
+        .name = "file-size",
+        .required = 0,
+        .parse = connlog_entry_parse_file_size,
+    },
+    {
+        .name = "files",
+        .required = 0,
+        .parse = connlog_entry_parse_files,
+    },
+};
+
+/* Parse the entries of a section into conf, checking the required ones. */
+static int
+conf_section_parse(struct rte_cfgfile *cfgfile, const char *section,
+                   const struct conf_entry *entries, uint32_t nb, void *conf) {
     const char *val;
     uint32_t j;
 
-    for (j = 0; j < RTE_DIM(device_entries); j++) {
-        val = rte_cfgfile_get_entry(cfgfile, section, device_entries[j].name);
+    for (j = 0; j < nb; j++) {
+        val = rte_cfgfile_get_entry(cfgfile, section, entries[j].name);
         if (val == NULL) {
-            if (device_entries[j].required) {
-                printf("%s(): %s is required in section %s.\n", __func__,
-                       device_entries[j].name, section);
+            if (entries[j].required) {
+                RTE_LOG(ERR, USER1, "%s(): %s is required in section %s.\n",
+                        __func__, entries[j].name, section);
                 return -1;
             }
         } else {
-            if (device_entries[j].parse(val, conf) < 0) {
-                printf("%s(): Cannot parse %s in section %s.\n", __func__,
-                       device_entries[j].name, section);
+            if (entries[j].parse(val, conf) < 0) {
+                RTE_LOG(ERR, USER1, "%s(): Cannot parse %s in section %s.\n",
+                        __func__, entries[j].name, section);
                 return -1;
             }
         }
@@ -365,6 +897,21 @@ device_section_parse(struct rte_cfgfile *cfgfile, const char *section,
     return 0;
 }
 
+static int
+ipfix_section_parse(struct rte_cfgfile *cfgfile, const char *section,
+                    struct lb_ipfix_conf *conf) {
+    if (conf_section_parse(cfgfile, section, ipfix_entries,
+                           RTE_DIM(ipfix_entries), conf) < 0)
+        return -1;
+    if ((conf->collector[0] == '\0') == (conf->file[0] == '\0')) {
+        RTE_LOG(ERR, USER1,
+                "%s(): One of collector and file is required in section %s.\n",
+                __func__, section);
+        return -1;
+    }
+    return 0;
+}
+
 int
 lb_config_file_load(const char *cfgfile_path) {
     struct rte_cfgfile *cfgfile;
@@ -374,32 +921,35 @@ lb_config_file_load(const char *cfgfile_path) {
 
     cfgfile = rte_cfgfile_load(cfgfile_path, 0);
     if (cfgfile == NULL) {
-        printf("%s(): Load config file %s failed.\n", __func__, cfgfile_path);
+        RTE_LOG(ERR, USER1, "%s(): Load config file %s failed.\n", __func__,
+                cfgfile_path);
         return -1;
     }
 
     num_sections = rte_cfgfile_num_sections(cfgfile, "", 0);
     if (num_sections == 0) {
-        printf("%s(): There is no sections in config file.\n", __func__);
+        RTE_LOG(ERR, USER1, "%s(): There is no sections in config file.\n",
+                __func__);
         return -1;
     }
 
     sections = malloc(num_sections * sizeof(char *));
     if (sections == NULL) {
-        printf("%s(): Alloc memory failed.\n", __func__);
+        RTE_LOG(ERR, USER1, "%s(): Alloc memory failed.\n", __func__);
         return -1;
     }
     for (i = 0; i < num_sections; i++) {
         sections[i] = malloc(CFG_NAME_LEN);
         if (sections[i] == NULL) {
-            printf("%s(): Alloc memory failed.\n", __func__);
+            RTE_LOG(ERR, USER1, "%s(): Alloc memory failed.\n", __func__);
             return -1;
         }
     }
 
     lb_cfg = malloc(sizeof(struct lb_conf));
     if (lb_cfg == NULL) {
-        printf("%s(): Alloc memory for lb_conf failed.\n", __func__);
+        RTE_LOG(ERR, USER1, "%s(): Alloc memory for lb_conf failed.\n",
+                __func__);
         return -1;
     }
     memset(lb_cfg, 0, sizeof(*lb_cfg));
@@ -409,13 +959,44 @@ lb_config_file_load(const char *cfgfile_path) {
         int rc = 0;
 
         if (strncmp(sections[i], "DEVICE", 6) == 0)
-            rc = device_section_parse(cfgfile, sections[i],
-                                      &lb_cfg->devices[lb_cfg->nb_decices++]);
+            rc = conf_section_parse(cfgfile, sections[i], device_entries,
+                                    RTE_DIM(device_entries),
+                                    &lb_cfg->devices[lb_cfg->nb_decices++]);
         else if (strcmp(sections[i], "DPDK") == 0)
-            rc = dpdk_section_parse(cfgfile, sections[i], &lb_cfg->dpdk);
+            rc = conf_section_parse(cfgfile, sections[i], dpdk_entries,
+                                    RTE_DIM(dpdk_entries), &lb_cfg->dpdk);
+        else if (strcmp(sections[i], "IPFRAG") == 0)
+            rc = conf_section_parse(cfgfile, sections[i], ipfrag_entries,
+                                    RTE_DIM(ipfrag_entries), &lb_cfg->ipfrag);
+        else if (strcmp(sections[i], "POLL") == 0)
+            rc = conf_section_parse(cfgfile, sections[i], poll_entries,
+                                    RTE_DIM(poll_entries), &lb_cfg->poll);
+        else if (strcmp(sections[i], "OVERLOAD") == 0)
+            rc = conf_section_parse(cfgfile, sections[i], overload_entries,
+                                    RTE_DIM(overload_entries),
+                                    &lb_cfg->overload);
+        else if (strcmp(sections[i], "WATCHDOG") == 0)
+            rc = conf_section_parse(cfgfile, sections[i], watchdog_entries,
+                                    RTE_DIM(watchdog_entries),
+                                    &lb_cfg->watchdog);
+        else if (strcmp(sections[i], "METRICS") == 0)
+            rc = conf_section_parse(cfgfile, sections[i], metrics_entries,
+                                    RTE_DIM(metrics_entries),
+                                    &lb_cfg->metrics);
+        else if (strcmp(sections[i], "EXPORTER") == 0)
+            rc = conf_section_parse(cfgfile, sections[i], exporter_entries,
+                                    RTE_DIM(exporter_entries),
+                                    &lb_cfg->exporter);
+        else if (strcmp(sections[i], "IPFIX") == 0)
+            rc = ipfix_section_parse(cfgfile, sections[i], &lb_cfg->ipfix);
+        else if (strcmp(sections[i], "CONNLOG") == 0)
+            rc = conf_section_parse(cfgfile, sections[i], connlog_entries,
+                                    RTE_DIM(connlog_entries),
+                                    &lb_cfg->connlog);
 
         if (rc < 0) {
-            printf("%s(): Cannot parse section %s.\n", __func__, sections[i]);
+            RTE_LOG(ERR, USER1, "%s(): Cannot parse section %s.\n", __func__,
+                    sections[i]);
             return -1;
         }
     }
@@ -4,9 +4,20 @@
 #define __LB_CONFIG_H__
 
 #include <rte_kni.h>
+#include <rte_lcore.h>
 #include <rte_pci.h>
 
 #define LB_MAX_LADDR 256
+#define LB_MAX_RXQ_PER_LCORE 8
+#define LB_MAX_KNI_LCORES 8
+#define LB_MAX_PATH_LEN 256
+
+/* Kernel interface types, KNI is the fallback of the others. */
+enum {
+    LB_KNI_T_TAP,
+    LB_KNI_T_VIRTIO_USER,
+    LB_KNI_T_KNI,
+};
 
 struct lb_device_conf {
     char name[RTE_KNI_NAMESIZE];
@@ -16,8 +27,19 @@ struct lb_device_conf {
     uint32_t gw;
     uint16_t rxqsize, txqsize;
     uint16_t mtu;
+    uint16_t mbufsize;
     uint32_t rxoffload;
     uint32_t txoffload;
+    uint16_t gue_port;
+    uint8_t lport_partition;
+    /* Worker lcores polling the device, none means those of its socket. */
+    uint16_t nb_lcores;
+    uint8_t lcores[RTE_MAX_LCORE];
+    uint16_t rxq_per_lcore;
+    uint32_t kni_type;
+    /* Lcores passing packets to the kernel, none means the master. */
+    uint16_t nb_kni_lcores;
+    uint8_t kni_lcores[RTE_MAX_LCORE];
     uint32_t nb_lips;
     uint32_t lips[LB_MAX_LADDR];
     uint16_t nb_pcis;
@@ -31,10 +53,80 @@ struct lb_dpdk_conf {
     int argc;
 };
 
+struct lb_ipfrag_conf {
+    uint32_t table_size;
+    uint32_t timeout;
+};
+
+/* Poll modes of the workers. */
+enum {
+    LB_POLL_M_BUSY,
+    LB_POLL_M_ADAPTIVE,
+    LB_POLL_M_INTERRUPT,
+};
+
+struct lb_poll_conf {
+    uint32_t mode;
+    uint32_t idle_polls;
+    uint32_t max_sleep_us;
+};
+
+/* Thresholds of the overload control, 0 turns one off. */
+struct lb_overload_conf {
+    uint32_t rxq_high;
+    uint32_t mbuf_low;
+    uint32_t round_max_us;
+};
+
+/* Worker stall detection, a stall_ms of 0 takes the default. */
+struct lb_watchdog_conf {
+    uint32_t stall_ms;
+    uint32_t backtrace;
+};
+
+/* Shared memory metrics, off without a path. */
+struct lb_metrics_conf {
+    char path[LB_MAX_PATH_LEN];
+    uint32_t interval_ms;
+};
+
+/* OpenMetrics exporter, off without a listen address. */
+struct lb_exporter_conf {
+    /* IP:PORT or the path of a unix socket. */
+    char listen[LB_MAX_PATH_LEN];
+};
+
+/* Sampled connection records, off without a collector or a file. */
+struct lb_ipfix_conf {
+    /* IP:PORT of an IPFIX collector over UDP. */
+    char collector[LB_MAX_PATH_LEN];
+    char file[LB_MAX_PATH_LEN];
+    /* One new connection, or packet, in sample_rate is recorded. */
+    uint32_t sample_rate;
+    uint8_t sample_packets;
+    /* Seconds between two records of a sampled connection. */
+    uint32_t active_timeout;
+};
+
+/* Connection event log, off without a path. */
+struct lb_connlog_conf {
+    char path[LB_MAX_PATH_LEN];
+    uint32_t file_size_mb;
+    uint32_t files;
+};
+
 struct lb_conf {
     struct lb_device_conf devices[RTE_MAX_ETHPORTS];
     uint16_t nb_decices;
     struct lb_dpdk_conf dpdk;
+    struct lb_ipfrag_conf ipfrag;
+    struct lb_poll_conf poll;
+    struct lb_overload_conf overload;
+    struct lb_watchdog_conf watchdog;
+    struct lb_metrics_conf metrics;
+    struct lb_exporter_conf exporter;
+    struct lb_ipfix_conf ipfix;
+    struct lb_connlog_conf connlog;
 };
 
 extern struct lb_conf *lb_cfg;
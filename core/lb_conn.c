@@ -16,50 +16,67 @@
 
 #include "lb_clock.h"
 #include "lb_conn.h"
+#include "lb_connlog.h"
+#include "lb_drop.h"
+#include "lb_ipfix.h"
 #include "lb_proto.h"
 #include "lb_service.h"
+#include "lb_trace.h"
 
 #define CONN_TIMER_CYCLE MS_TO_CYCLES(10)
 
-struct lb_conn *
-lb_conn_new(struct lb_conn_table *ct, uint32_t cip, uint32_t cport,
-            struct lb_real_service *rs, uint8_t is_synproxy,
-            struct lb_device *dev) {
+static struct lb_conn *
+__conn_new(struct lb_conn_table *ct, struct lb_real_service *rs,
+           uint32_t flags, struct lb_device *dev) {
     struct lb_conn *conn;
-    struct ipv4_4tuple tuple;
     int rc;
 
     rc = rte_mempool_get(ct->mp, (void **)&conn);
     if (rc < 0) {
+        lb_drop_count(LB_DROP_CONN_FULL);
         return NULL;
     }
 
-    rc = lb_laddr_get(dev, ct->type, &conn->laddr, &conn->lport);
-    if (rc < 0) {
-        rte_mempool_put(ct->mp, conn);
-        return NULL;
+    if (flags & LB_CONN_F_ONEWAY) {
+        /* The packets keep the client address, no local address is used. */
+        conn->laddr = NULL;
+        conn->lip = 0;
+        conn->lport = 0;
+    } else {
+        rc = lb_laddr_get(dev, ct->type, &conn->laddr, &conn->lport);
+        if (rc < 0) {
+            lb_drop_count(LB_DROP_NO_LPORT);
+            rte_mempool_put(ct->mp, conn);
+            return NULL;
+        }
+        conn->lip = conn->laddr->ipv4;
     }
 
     conn->ct = ct;
     conn->dev = dev;
-    conn->lip = conn->laddr->ipv4;
-    conn->cip = cip;
-    conn->cport = cport;
     conn->vip = rs->virt_service->vip;
     conn->vport = rs->virt_service->vport;
     conn->rip = rs->rip;
     conn->rport = rs->rport;
 
     conn->use_time = LB_CLOCK();
+    conn->create_time = conn->use_time;
     conn->timeout = ct->timeout;
+    conn->state = TCP_CONNTRACK_NONE;
 
     conn->real_service = rs;
-    conn->flags = 0;
-    if (rs->virt_service->flags & LB_VS_F_TOA)
+    conn->flags = flags;
+    if (!(flags & (LB_CONN_F_ONEWAY | LB_CONN_F_NAT64)) &&
+        (rs->virt_service->flags & LB_VS_F_TOA))
         conn->flags |= LB_CONN_F_TOA;
+    if (!(flags & LB_CONN_F_NAT64) && lb_ipfix_sample()) {
+        conn->flags |= LB_CONN_F_SAMPLED;
+        memset(conn->packets, 0, sizeof(conn->packets));
+        memset(conn->bytes, 0, sizeof(conn->bytes));
+        conn->export_time = conn->create_time;
+    }
 
-    if (is_synproxy) {
-        conn->flags |= LB_CONN_F_SYNPROXY;
+    if (flags & LB_CONN_F_SYNPROXY) {
         conn->proxy.syn_mbuf = NULL;
         conn->proxy.ack_mbuf = NULL;
         conn->proxy.isn = 0;
@@ -70,29 +87,115 @@ lb_conn_new(struct lb_conn_table *ct, uint32_t cip, uint32_t cport,
     conn->tseq.isn = 0;
     conn->tseq.oft = 0;
 
+    return conn;
+}
+
+static void
+__conn_free(struct lb_conn_table *ct, struct lb_conn *conn) {
+    if (conn->laddr != NULL)
+        lb_laddr_put(conn->laddr, conn->lport, ct->type);
+    rte_mempool_put(ct->mp, conn);
+}
+
+static inline void
+__conn_insert(struct lb_conn_table *ct, struct lb_conn *conn) {
+    rte_spinlock_lock(&ct->spinlock);
+    TAILQ_INSERT_TAIL(&ct->timeout_list, conn, next);
+    rte_spinlock_unlock(&ct->spinlock);
+}
+
+struct lb_conn *
+lb_conn_new(struct lb_conn_table *ct, uint32_t cip, uint32_t cport,
+            struct lb_real_service *rs, uint32_t flags, struct lb_device *dev) {
+    struct lb_conn *conn;
+    struct ipv4_4tuple tuple;
+    int rc;
+
+    conn = __conn_new(ct, rs, flags, dev);
+    if (conn == NULL)
+        return NULL;
+
+    conn->cip = cip;
+    conn->cport = cport;
+
     IPv4_4TUPLE(&tuple, conn->cip, conn->cport, conn->vip, conn->vport);
     rc = rte_hash_add_key_data(ct->hash, (const void *)&tuple, conn);
     if (rc < 0) {
-        lb_laddr_put(conn->laddr, conn->lport, ct->type);
-        rte_mempool_put(ct->mp, conn);
+        goto free_conn;
+    }
+
+    if (!(flags & LB_CONN_F_ONEWAY)) {
+        IPv4_4TUPLE(&tuple, conn->rip, conn->rport, conn->lip, conn->lport);
+        rc = rte_hash_add_key_data(ct->hash, (const void *)&tuple, conn);
+        if (rc < 0) {
+            IPv4_4TUPLE(&tuple, conn->cip, conn->cport, conn->vip,
+                        conn->vport);
+            rte_hash_del_key(ct->hash, (const void *)&tuple);
+            goto free_conn;
+        }
+    }
+
+    __conn_insert(ct, conn);
+    lb_connlog(conn, CONNLOG_EV_NEW);
+    LB_TRACE(conn_new, conn, rs->virt_service->proto, conn->cip, conn->cport,
+             conn->vip, conn->vport, conn->lip, conn->lport, conn->rip,
+             conn->rport);
+
+    return conn;
+
+free_conn:
+    lb_drop_count(LB_DROP_CONN_FULL);
+    __conn_free(ct, conn);
+    return NULL;
+}
+
+/*
+ * NAT64: the IPv6 client is keyed in hash6, the IPv4 side towards the real
+ * service is keyed in hash like any full NAT connection.
+ */
+struct lb_conn *
+lb_conn_new6(struct lb_conn_table *ct, const uint8_t *cip6, uint16_t cport,
+             const uint8_t *vip6, struct lb_real_service *rs,
+             struct lb_device *dev) {
+    struct lb_conn *conn;
+    struct ipv6_4tuple tuple6;
+    struct ipv4_4tuple tuple;
+    int rc;
+
+    conn = __conn_new(ct, rs, LB_CONN_F_NAT64, dev);
+    if (conn == NULL)
         return NULL;
+
+    conn->cip = 0;
+    conn->cport = cport;
+    rte_memcpy(conn->cip6, cip6, 16);
+    rte_memcpy(conn->vip6, vip6, 16);
+
+    IPv6_4TUPLE(&tuple6, conn->cip6, conn->cport, conn->vip6, conn->vport);
+    rc = rte_hash_add_key_data(ct->hash6, (const void *)&tuple6, conn);
+    if (rc < 0) {
+        goto free_conn;
     }
 
     IPv4_4TUPLE(&tuple, conn->rip, conn->rport, conn->lip, conn->lport);
     rc = rte_hash_add_key_data(ct->hash, (const void *)&tuple, conn);
     if (rc < 0) {
-        IPv4_4TUPLE(&tuple, conn->cip, conn->cport, conn->vip, conn->vport);
-        rte_hash_del_key(ct->hash, (const void *)&tuple);
-        lb_laddr_put(conn->laddr, conn->lport, ct->type);
-        rte_mempool_put(ct->mp, conn);
-        return NULL;
+        rte_hash_del_key(ct->hash6, (const void *)&tuple6);
+        goto free_conn;
     }
 
-    rte_spinlock_lock(&ct->spinlock);
-    TAILQ_INSERT_TAIL(&ct->timeout_list, conn, next);
-    rte_spinlock_unlock(&ct->spinlock);
+    __conn_insert(ct, conn);
+    lb_connlog(conn, CONNLOG_EV_NEW);
+    LB_TRACE(conn_new6, conn, rs->virt_service->proto, conn->cip6,
+             conn->cport, conn->vip6, conn->vport, conn->lip, conn->lport,
+             conn->rip, conn->rport);
 
     return conn;
+
+free_conn:
+    lb_drop_count(LB_DROP_CONN_FULL);
+    __conn_free(ct, conn);
+    return NULL;
 }
 
 struct lb_conn *
@@ -119,27 +222,60 @@ lb_conn_find(struct lb_conn_table *ct, uint32_t sip, uint32_t dip,
     return conn;
 }
 
+struct lb_conn *
+lb_conn_find6(struct lb_conn_table *ct, const uint8_t *sip6,
+              const uint8_t *dip6, uint16_t sport, uint16_t dport) {
+    struct lb_conn *conn;
+    struct ipv6_4tuple tuple6;
+    int rc;
+
+    IPv6_4TUPLE(&tuple6, sip6, sport, dip6, dport);
+    rc = rte_hash_lookup_data(ct->hash6, (const void *)&tuple6,
+                              (void **)&conn);
+    if (rc < 0)
+        return NULL;
+
+    conn->use_time = LB_CLOCK();
+
+    return conn;
+}
+
 static void
 __conn_expire(struct lb_conn_table *ct, struct lb_conn *conn) {
     struct ipv4_4tuple tuple;
+    struct ipv6_4tuple tuple6;
 
     if (conn->flags & LB_CONN_F_SYNPROXY) {
         rte_pktmbuf_free(conn->proxy.syn_mbuf);
         rte_pktmbuf_free(conn->proxy.ack_mbuf);
     }
 
+    lb_connlog(conn, CONNLOG_EV_END);
+    LB_TRACE(conn_expire, conn, conn->real_service->virt_service->proto,
+             conn->cip, conn->cport, conn->vip, conn->vport,
+             (conn->use_time - conn->create_time) * MS_PER_S / LB_CLOCK_HZ);
+    if (conn->flags & LB_CONN_F_SAMPLED)
+        lb_ipfix_record(conn);
+
     if (conn->flags & LB_CONN_F_ACTIVE) {
         rte_atomic32_add(&conn->real_service->active_conns, -1);
         rte_atomic32_add(&conn->real_service->virt_service->active_conns, -1);
     }
 
-    IPv4_4TUPLE(&tuple, conn->cip, conn->cport, conn->vip, conn->vport);
-    rte_hash_del_key(ct->hash, (const void *)&tuple);
-
-    IPv4_4TUPLE(&tuple, conn->rip, conn->rport, conn->lip, conn->lport);
-    rte_hash_del_key(ct->hash, (const void *)&tuple);
+    if (conn->flags & LB_CONN_F_NAT64) {
+        IPv6_4TUPLE(&tuple6, conn->cip6, conn->cport, conn->vip6,
+                    conn->vport);
+        rte_hash_del_key(ct->hash6, (const void *)&tuple6);
+    } else {
+        IPv4_4TUPLE(&tuple, conn->cip, conn->cport, conn->vip, conn->vport);
+        rte_hash_del_key(ct->hash, (const void *)&tuple);
+    }
 
-    lb_laddr_put(conn->laddr, conn->lport, ct->type);
+    if (conn->laddr != NULL) {
+        IPv4_4TUPLE(&tuple, conn->rip, conn->rport, conn->lip, conn->lport);
+        rte_hash_del_key(ct->hash, (const void *)&tuple);
+        lb_laddr_put(conn->laddr, conn->lport, ct->type);
+    }
     lb_vs_put_rs(conn->real_service);
     rte_mempool_put(ct->mp, conn);
 
@@ -173,6 +309,38 @@ conn_table_expire_cb(__attribute((unused)) struct rte_timer *timer, void *arg) {
     rte_spinlock_unlock(&ct->spinlock);
 }
 
+/*
+ * Called from the master before the first NAT64 service is added, the
+ * lcores only look up hash6 for the IPv6 packets to such a service.
+ */
+int
+lb_conn_table_ipv6_enable(struct lb_conn_table *ct) {
+    struct rte_hash_parameters param;
+    char name[RTE_HASH_NAMESIZE];
+    struct rte_hash *hash6;
+
+    if (ct->hash == NULL || ct->hash6 != NULL)
+        return 0;
+
+    memset(&param, 0, sizeof(param));
+    snprintf(name, sizeof(name), "ct_hash6%p", ct);
+    param.name = name;
+    param.entries = ct->size;
+    param.key_len = sizeof(struct ipv6_4tuple);
+    param.hash_func = rte_hash_crc;
+    param.socket_id = ct->socket_id;
+
+    hash6 = rte_hash_create(&param);
+    if (hash6 == NULL) {
+        RTE_LOG(ERR, USER1, "%s(): Create hash table %s failed, %s.\n",
+                __func__, name, rte_strerror(rte_errno));
+        return -1;
+    }
+    rte_smp_wmb();
+    ct->hash6 = hash6;
+    return 0;
+}
+
 int
 lb_conn_table_init(struct lb_conn_table *ct, enum lb_proto_type type,
                    uint32_t lcore_id, uint32_t timeout, uint32_t size,
@@ -201,6 +369,9 @@ lb_conn_table_init(struct lb_conn_table *ct, enum lb_proto_type type,
         return -1;
     }
 
+    ct->size = size;
+    ct->socket_id = socket_id;
+
     snprintf(name, sizeof(name), "ct_mp%p", ct);
     ct->mp = rte_mempool_create(name, size, sizeof(struct lb_conn), 0, 0, NULL,
                                 NULL, NULL, NULL, socket_id,
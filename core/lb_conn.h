@@ -5,7 +5,9 @@
 
 #include <sys/queue.h>
 
+#include <rte_ether.h>
 #include <rte_hash.h>
+#include <rte_memcpy.h>
 #include <rte_mempool.h>
 #include <rte_spinlock.h>
 #include <rte_timer.h>
@@ -19,6 +21,15 @@
 #define LB_CONN_F_SYNPROXY (0x01)
 #define LB_CONN_F_ACTIVE (0x02)
 #define LB_CONN_F_TOA (0x4)
+#define LB_CONN_F_DR (0x08)
+#define LB_CONN_F_IPIP (0x10)
+#define LB_CONN_F_GUE (0x20)
+#define LB_CONN_F_NAT64 (0x40)
+/* Counted and recorded periodically and at its end, see lb_ipfix.h. */
+#define LB_CONN_F_SAMPLED (0x80)
+
+/* The replies bypass us, no local address is allocated. */
+#define LB_CONN_F_ONEWAY (LB_CONN_F_DR | LB_CONN_F_IPIP | LB_CONN_F_GUE)
 
 struct ipv4_4tuple {
     uint32_t sip, dip;
@@ -33,6 +44,19 @@ struct ipv4_4tuple {
         (t)->dport = dp;                                                       \
     } while (0)
 
+struct ipv6_4tuple {
+    uint8_t sip[16], dip[16];
+    uint16_t sport, dport;
+} __attribute__((__packed__));
+
+#define IPv6_4TUPLE(t, si, sp, di, dp)                                         \
+    do {                                                                       \
+        rte_memcpy((t)->sip, si, 16);                                          \
+        (t)->sport = sp;                                                       \
+        rte_memcpy((t)->dip, di, 16);                                          \
+        (t)->dport = dp;                                                       \
+    } while (0)
+
 struct lb_conn {
     TAILQ_ENTRY(lb_conn) next;
 
@@ -51,11 +75,20 @@ struct lb_conn {
     struct lb_real_service *real_service;
     struct lb_laddr *laddr;
 
+    /* NAT64: the IPv6 client side, cip and vip are not used. */
+    uint8_t cip6[16], vip6[16];
+    struct ether_addr cha;
+
     uint32_t flags;
     uint32_t state;
 
     struct synproxy proxy;
 
+    /* Only counted for the sampled connections, since export_time. */
+    uint64_t packets[LB_DIR_MAX];
+    uint64_t bytes[LB_DIR_MAX];
+    uint32_t export_time;
+
     /* tcp seq adjust */
     struct tcp_secret_seq tseq;
 };
@@ -63,7 +96,14 @@ struct lb_conn {
 struct lb_conn_table {
     enum lb_proto_type type;
     struct rte_hash *hash;
+    /*
+     * IPv6 client side of the NAT64 connections, created with the first
+     * NAT64 service, see lb_conn_table_ipv6_enable().
+     */
+    struct rte_hash *hash6;
     struct rte_mempool *mp;
+    uint32_t size;
+    uint32_t socket_id;
     uint32_t timeout;
     rte_spinlock_t spinlock;
     TAILQ_HEAD(, lb_conn) timeout_list;
@@ -76,16 +116,37 @@ struct lb_conn_table {
     for ((var) = TAILQ_FIRST((head));                                          \
          (var) && ((tvar) = TAILQ_NEXT((var), field), 1); (var) = (tvar))
 
+static inline uint32_t
+lb_conn_fwd_flags(struct lb_virt_service *vs) {
+    switch (vs->fwd_mode) {
+    case LB_VS_FWD_DR:
+        return LB_CONN_F_DR;
+    case LB_VS_FWD_IPIP:
+        return LB_CONN_F_IPIP;
+    case LB_VS_FWD_GUE:
+        return LB_CONN_F_GUE;
+    default:
+        return 0;
+    }
+}
+
 struct lb_conn *lb_conn_new(struct lb_conn_table *ct, uint32_t cip,
                             uint32_t cport, struct lb_real_service *rs,
-                            uint8_t is_synproxy, struct lb_device *dev);
+                            uint32_t flags, struct lb_device *dev);
+struct lb_conn *lb_conn_new6(struct lb_conn_table *ct, const uint8_t *cip6,
+                             uint16_t cport, const uint8_t *vip6,
+                             struct lb_real_service *rs, struct lb_device *dev);
 void lb_conn_expire(struct lb_conn_table *ct, struct lb_conn *conn);
 struct lb_conn *lb_conn_find(struct lb_conn_table *ct, uint32_t sip,
                              uint32_t dip, uint16_t sport, uint16_t dport,
                              uint8_t *dir);
+struct lb_conn *lb_conn_find6(struct lb_conn_table *ct, const uint8_t *sip6,
+                              const uint8_t *dip6, uint16_t sport,
+                              uint16_t dport);
 int lb_conn_table_init(struct lb_conn_table *ct, enum lb_proto_type type,
                        uint32_t lcore_id, uint32_t timeout, uint32_t size,
                        void (*task_cb)(struct lb_conn *),
                        int (*expire_cb)(struct lb_conn *, uint32_t));
+int lb_conn_table_ipv6_enable(struct lb_conn_table *ct);
 
 #endif
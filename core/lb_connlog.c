@@ -0,0 +1,365 @@
+/* Copyright (c) 2018. TIG developer. */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <rte_atomic.h>
+#include <rte_cycles.h>
+#include <rte_lcore.h>
+#include <rte_log.h>
+#include <rte_malloc.h>
+
+#include <connlog.h>
+#include <unixctl_command.h>
+
+#include "lb_clock.h"
+#include "lb_config.h"
+#include "lb_conn.h"
+#include "lb_connlog.h"
+#include "lb_format.h"
+
+/*
+ * Each lcore appends fixed size records to its own ring, a single
+ * producer and single consumer array indexed by free running counters,
+ * and drops them when the writer falls behind. The writer thread copies
+ * them into the current log file, mapped in full, and moves to the next
+ * file when it is full. A restart continues after the file of the highest
+ * seq. The files are reused in place, never truncated under a reader
+ * which maps them.
+ */
+#define CONNLOG_RING_SIZE 16384
+#define CONNLOG_RING_MASK (CONNLOG_RING_SIZE - 1)
+#define CONNLOG_DEFAULT_FILE_SIZE_MB 256
+#define CONNLOG_DEFAULT_FILES 8
+#define CONNLOG_WRITER_SLEEP_US 1000
+
+struct connlog_lcore {
+    /* Written by the lcore. */
+    volatile uint32_t head;
+    uint64_t events;
+    uint64_t drops;
+    struct connlog_record *recs;
+    /* Written by the writer. */
+    volatile uint32_t tail __rte_cache_aligned;
+} __rte_cache_aligned;
+
+uint32_t lb_connlog_enabled;
+
+static struct connlog_lcore connlog_lcores[RTE_MAX_LCORE];
+static pthread_t connlog_writer_tid;
+
+/* Writer state. */
+static char connlog_path[LB_MAX_PATH_LEN];
+static uint64_t connlog_file_size;
+static uint32_t connlog_nb_files;
+static uint32_t connlog_file_idx;
+static struct connlog_header *connlog_hdr;
+static uint64_t connlog_seq;
+static uint64_t connlog_base_tsc;
+static uint64_t connlog_base_ns;
+static uint64_t connlog_written;
+static uint64_t connlog_errors;
+
+void
+lb_connlog_event(struct lb_conn *conn, uint8_t event) {
+    uint32_t lcore_id = rte_lcore_id();
+    struct connlog_lcore *cl = &connlog_lcores[lcore_id];
+    struct connlog_record *rec;
+    uint32_t head = cl->head;
+
+    if (head - cl->tail >= CONNLOG_RING_SIZE) {
+        cl->drops++;
+        return;
+    }
+    rec = &cl->recs[head & CONNLOG_RING_MASK];
+    /* Turned into the wall clock by the writer. */
+    rec->ts_ns = rte_rdtsc();
+    if (conn->flags & LB_CONN_F_NAT64) {
+        rec->flags = CONNLOG_F_IPV6;
+        rec->cip = 0;
+        rec->vip = 0;
+        memcpy(rec->cip6, conn->cip6, sizeof(rec->cip6));
+        memcpy(rec->vip6, conn->vip6, sizeof(rec->vip6));
+    } else {
+        rec->flags = 0;
+        rec->cip = conn->cip;
+        rec->vip = conn->vip;
+        memset(rec->cip6, 0, sizeof(rec->cip6));
+        memset(rec->vip6, 0, sizeof(rec->vip6));
+    }
+    rec->cport = conn->cport;
+    rec->vport = conn->vport;
+    rec->lip = conn->lip;
+    rec->lport = conn->lport;
+    rec->rip = conn->rip;
+    rec->rport = conn->rport;
+    rec->event = event;
+    rec->proto = conn->real_service->virt_service->proto;
+    rec->lcore_id = lcore_id;
+    rec->duration_ms = event == CONNLOG_EV_END
+                           ? (conn->use_time - conn->create_time) * MS_PER_S /
+                                 LB_CLOCK_HZ
+                           : 0;
+    rte_smp_wmb();
+    cl->head = head + 1;
+    cl->events++;
+}
+
+static void
+connlog_file_close(void) {
+    if (connlog_hdr == NULL)
+        return;
+    munmap(connlog_hdr, connlog_file_size);
+    connlog_hdr = NULL;
+    connlog_file_idx = (connlog_file_idx + 1) % connlog_nb_files;
+    connlog_seq++;
+}
+
+static int
+connlog_file_open(void) {
+    char path[LB_MAX_PATH_LEN + 16];
+    void *base;
+    int fd;
+
+    snprintf(path, sizeof(path), "%s.%u", connlog_path, connlog_file_idx);
+    /* Truncating would fault a reader still mapping the old records. */
+    fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+        return -1;
+    if (ftruncate(fd, connlog_file_size) < 0) {
+        close(fd);
+        return -1;
+    }
+    base = mmap(NULL, connlog_file_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+        return -1;
+
+    connlog_hdr = base;
+    /* The old records are dropped before the header changes. */
+    __atomic_store_n(&connlog_hdr->used, sizeof(*connlog_hdr),
+                     __ATOMIC_RELEASE);
+    connlog_hdr->magic = CONNLOG_MAGIC;
+    connlog_hdr->version = CONNLOG_VERSION;
+    connlog_hdr->size = connlog_file_size;
+    connlog_hdr->seq = connlog_seq;
+    connlog_hdr->first_ns = 0;
+    connlog_hdr->last_ns = 0;
+    connlog_hdr->record_size = sizeof(struct connlog_record);
+    connlog_hdr->pid = getpid();
+    return 0;
+}
+
+/* Continue the log of the previous runs after its newest file. */
+static void
+connlog_resume(void) {
+    char path[LB_MAX_PATH_LEN + 16];
+    struct connlog_header h;
+    uint32_t i;
+    int fd, found = 0;
+
+    for (i = 0; i < connlog_nb_files; i++) {
+        snprintf(path, sizeof(path), "%s.%u", connlog_path, i);
+        fd = open(path, O_RDONLY);
+        if (fd < 0)
+            continue;
+        if (read(fd, &h, sizeof(h)) == sizeof(h) && h.magic == CONNLOG_MAGIC &&
+            (!found || h.seq > connlog_seq)) {
+            connlog_seq = h.seq;
+            connlog_file_idx = i;
+            found = 1;
+        }
+        close(fd);
+    }
+    if (found) {
+        connlog_seq++;
+        connlog_file_idx = (connlog_file_idx + 1) % connlog_nb_files;
+    }
+}
+
+static uint64_t
+connlog_tsc_to_ns(uint64_t tsc) {
+    uint64_t hz = rte_get_tsc_hz();
+    uint64_t delta = tsc - connlog_base_tsc;
+
+    return connlog_base_ns + delta / hz * NS_PER_S + delta % hz * NS_PER_S / hz;
+}
+
+static void
+connlog_write(const struct connlog_record *rec) {
+    struct connlog_record *dst;
+    uint64_t used;
+
+    if (connlog_hdr != NULL &&
+        connlog_hdr->used + sizeof(*rec) > connlog_file_size)
+        connlog_file_close();
+    if (connlog_hdr == NULL && connlog_file_open() < 0) {
+        connlog_errors++;
+        return;
+    }
+
+    used = connlog_hdr->used;
+    dst = (struct connlog_record *)((char *)connlog_hdr + used);
+    *dst = *rec;
+    dst->ts_ns = connlog_tsc_to_ns(rec->ts_ns);
+    if (connlog_hdr->first_ns == 0)
+        connlog_hdr->first_ns = dst->ts_ns;
+    connlog_hdr->last_ns = dst->ts_ns;
+    __atomic_store_n(&connlog_hdr->used, used + sizeof(*rec),
+                     __ATOMIC_RELEASE);
+    connlog_written++;
+}
+
+/* The records of the lcores are interleaved batch by batch. */
+static void *
+connlog_writer(__attribute__((unused)) void *arg) {
+    struct connlog_lcore *cl;
+    uint32_t lcore_id, head, tail, total;
+
+    for (;;) {
+        total = 0;
+        RTE_LCORE_FOREACH(lcore_id) {
+            cl = &connlog_lcores[lcore_id];
+            head = cl->head;
+            rte_smp_rmb();
+            for (tail = cl->tail; tail != head; tail++)
+                connlog_write(&cl->recs[tail & CONNLOG_RING_MASK]);
+            total += head - cl->tail;
+            /* The copies are done before the slots are given back. */
+            rte_smp_mb();
+            cl->tail = head;
+        }
+        if (total == 0)
+            usleep(CONNLOG_WRITER_SLEEP_US);
+    }
+    return NULL;
+}
+
+int
+lb_connlog_init(void) {
+    struct lb_connlog_conf *conf = &lb_cfg->connlog;
+    struct timespec ts;
+    uint32_t lcore_id;
+    int rc;
+
+    if (conf->path[0] == '\0')
+        return 0;
+
+    snprintf(connlog_path, sizeof(connlog_path), "%s", conf->path);
+    connlog_file_size = (uint64_t)(conf->file_size_mb != 0
+                                       ? conf->file_size_mb
+                                       : CONNLOG_DEFAULT_FILE_SIZE_MB)
+                        << 20;
+    connlog_nb_files =
+        conf->files != 0 ? conf->files : CONNLOG_DEFAULT_FILES;
+
+    RTE_LCORE_FOREACH(lcore_id) {
+        connlog_lcores[lcore_id].recs = rte_malloc_socket(
+            "connlog", CONNLOG_RING_SIZE * sizeof(struct connlog_record),
+            RTE_CACHE_LINE_SIZE, rte_lcore_to_socket_id(lcore_id));
+        if (connlog_lcores[lcore_id].recs == NULL) {
+            RTE_LOG(ERR, USER1, "%s(): Not enough memory.\n", __func__);
+            return -1;
+        }
+    }
+
+    connlog_resume();
+    if (connlog_file_open() < 0) {
+        RTE_LOG(ERR, USER1, "%s(): Cannot write %s.%u, %s.\n", __func__,
+                connlog_path, connlog_file_idx, strerror(errno));
+        return -1;
+    }
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    connlog_base_tsc = rte_rdtsc();
+    connlog_base_ns = (uint64_t)ts.tv_sec * NS_PER_S + ts.tv_nsec;
+
+    rc = pthread_create(&connlog_writer_tid, NULL, connlog_writer, NULL);
+    if (rc != 0) {
+        RTE_LOG(ERR, USER1, "%s(): Cannot start the writer, %s.\n",
+                __func__, strerror(rc));
+        return -1;
+    }
+    lb_connlog_enabled = 1;
+    return 0;
+}
+
+static void
+connlog_stats_cmd_cb(int fd, char *argv[], int argc) {
+    struct connlog_lcore *cl;
+    uint32_t lcore_id;
+    int json_fmt = 0, json_first_obj = 1;
+
+    if (argc > 0) {
+        if (strcmp(argv[0], "--json") != 0) {
+            unixctl_command_reply_error(fd, "Invalid parameter: %s.\n",
+                                        argv[0]);
+            return;
+        }
+        json_fmt = 1;
+    }
+
+    if (json_fmt) {
+        unixctl_command_reply(fd, "{");
+        unixctl_command_reply(fd, JSON_KV_32_FMT("enabled", ","),
+                              lb_connlog_enabled);
+        unixctl_command_reply(fd, JSON_KV_32_FMT("file", ","),
+                              connlog_file_idx);
+        unixctl_command_reply(fd, JSON_KV_64_FMT("seq", ","), connlog_seq);
+        unixctl_command_reply(fd, JSON_KV_64_FMT("written", ","),
+                              connlog_written);
+        unixctl_command_reply(fd, JSON_KV_64_FMT("errors", ","),
+                              connlog_errors);
+        unixctl_command_reply(fd, "\"lcores\":[");
+    } else {
+        unixctl_command_reply(fd, NORM_KV_S_FMT("enabled", "\n"),
+                              lb_connlog_enabled ? "yes" : "no");
+        unixctl_command_reply(fd, NORM_KV_32_FMT("file", "\n"),
+                              connlog_file_idx);
+        unixctl_command_reply(fd, NORM_KV_64_FMT("seq", "\n"), connlog_seq);
+        unixctl_command_reply(fd, NORM_KV_64_FMT("written", "\n"),
+                              connlog_written);
+        unixctl_command_reply(fd, NORM_KV_64_FMT("errors", "\n"),
+                              connlog_errors);
+    }
+    if (lb_connlog_enabled) {
+        RTE_LCORE_FOREACH(lcore_id) {
+            cl = &connlog_lcores[lcore_id];
+            if (json_fmt) {
+                unixctl_command_reply(fd, json_first_obj ? "{" : ",{");
+                json_first_obj = 0;
+                unixctl_command_reply(fd, JSON_KV_32_FMT("lcore", ","),
+                                      lcore_id);
+                unixctl_command_reply(fd, JSON_KV_64_FMT("events", ","),
+                                      cl->events);
+                unixctl_command_reply(fd, JSON_KV_64_FMT("drops", ","),
+                                      cl->drops);
+                unixctl_command_reply(fd, JSON_KV_32_FMT("pending", "}"),
+                                      cl->head - cl->tail);
+            } else {
+                unixctl_command_reply(fd, "lcore%u\n", lcore_id);
+                unixctl_command_reply(fd, NORM_KV_64_FMT("  events", "\n"),
+                                      cl->events);
+                unixctl_command_reply(fd, NORM_KV_64_FMT("  drops", "\n"),
+                                      cl->drops);
+                unixctl_command_reply(fd, NORM_KV_32_FMT("  pending", "\n"),
+                                      cl->head - cl->tail);
+            }
+        }
+    }
+    if (json_fmt)
+        unixctl_command_reply(fd, "]}\n");
+}
+
+UNIXCTL_CMD_REGISTER("connlog/stats", "[--json].",
+                     "Show the connection events logged and dropped by each "
+                     "lcore, and the records written.",
+                     0, 1, connlog_stats_cmd_cb);
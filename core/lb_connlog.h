@@ -0,0 +1,27 @@
+/* Copyright (c) 2018. TIG developer. */
+
+#ifndef __LB_CONNLOG_H__
+#define __LB_CONNLOG_H__
+
+#include <rte_branch_prediction.h>
+
+#include <connlog.h>
+
+struct lb_conn;
+
+/* 0 while no CONNLOG section is configured. */
+extern uint32_t lb_connlog_enabled;
+
+void lb_connlog_event(struct lb_conn *conn, uint8_t event);
+
+/* Log a CONNLOG_EV_* event of the connection, dropped if the ring is full. */
+static inline void
+lb_connlog(struct lb_conn *conn, uint8_t event) {
+    if (likely(!lb_connlog_enabled))
+        return;
+    lb_connlog_event(conn, event);
+}
+
+int lb_connlog_init(void);
+
+#endif
@@ -4,12 +4,6 @@
 #include <stdio.h>
 #include <string.h>
 
-#include <net/if.h>
-#include <net/if_arp.h>
-#include <sys/ioctl.h>
-#include <sys/socket.h>
-#include <unistd.h>
-
 #include <rte_bus_pci.h>
 #include <rte_byteorder.h>
 #include <rte_cycles.h>
@@ -17,18 +11,25 @@
 #include <rte_eth_bond.h>
 #include <rte_eth_ctrl.h>
 #include <rte_ethdev.h>
-#include <rte_kni.h>
 #include <rte_log.h>
 #include <rte_malloc.h>
 #include <rte_pci.h>
 #include <rte_ring.h>
+#include <rte_timer.h>
 
 #include <unixctl_command.h>
 
+#include "lb_clock.h"
 #include "lb_config.h"
 #include "lb_device.h"
+#include "lb_flow.h"
 #include "lb_format.h"
+#include "lb_kni.h"
 #include "lb_parser.h"
+#include "lb_poll.h"
+#include "lb_rate.h"
+#include "lb_steer.h"
+#include "lb_tunnel.h"
 
 #define LB_PKTMBUF_POOL_DEFAULT_SIZE 4096
 
@@ -68,6 +69,18 @@ _fdir_filter_input_set(uint16_t port_id) {
     rc += __fdir_filter_input_set(port_id, RTE_ETH_FLOW_NONFRAG_IPV4_UDP,
                                   RTE_ETH_INPUT_SET_L3_DST_IP4,
                                   RTE_ETH_INPUT_SET_ADD);
+    rc += __fdir_filter_input_set(port_id, RTE_ETH_FLOW_FRAG_IPV4,
+                                  RTE_ETH_INPUT_SET_NONE,
+                                  RTE_ETH_INPUT_SET_SELECT);
+    rc += __fdir_filter_input_set(port_id, RTE_ETH_FLOW_FRAG_IPV4,
+                                  RTE_ETH_INPUT_SET_L3_DST_IP4,
+                                  RTE_ETH_INPUT_SET_ADD);
+    rc += __fdir_filter_input_set(port_id, RTE_ETH_FLOW_NONFRAG_IPV4_OTHER,
+                                  RTE_ETH_INPUT_SET_NONE,
+                                  RTE_ETH_INPUT_SET_SELECT);
+    rc += __fdir_filter_input_set(port_id, RTE_ETH_FLOW_NONFRAG_IPV4_OTHER,
+                                  RTE_ETH_INPUT_SET_L3_DST_IP4,
+                                  RTE_ETH_INPUT_SET_ADD);
     return rc;
 }
 
@@ -118,10 +131,27 @@ dpdk_dev_fdir_filter_add(uint16_t port_id, uint32_t dst_ip, uint32_t rxq_id) {
                 __func__, port_id, IPv4_BE_ARG(dst_ip), rxq_id);
         return rc;
     }
+    /* Fragments of the replies follow the local address to its lcore. */
+    rc = _fdir_filter_add(port_id, RTE_ETH_FLOW_FRAG_IPV4, dst_ip, rxq_id);
+    if (rc < 0) {
+        RTE_LOG(WARNING, USER1,
+                "%s(): Port%u add FDIR fileter failed, "
+                "type:FRAG_IPV4, dst-ip:" IPv4_BE_FMT ", rxq:%u\n",
+                __func__, port_id, IPv4_BE_ARG(dst_ip), rxq_id);
+    }
+    /* ICMP errors about our packets to the real services. */
+    rc = _fdir_filter_add(port_id, RTE_ETH_FLOW_NONFRAG_IPV4_OTHER, dst_ip,
+                          rxq_id);
+    if (rc < 0) {
+        RTE_LOG(WARNING, USER1,
+                "%s(): Port%u add FDIR fileter failed, "
+                "type:NONFRAG_IPV4_OTHER, dst-ip:" IPv4_BE_FMT ", rxq:%u\n",
+                __func__, port_id, IPv4_BE_ARG(dst_ip), rxq_id);
+    }
     RTE_LOG(INFO, USER1,
             "%s(): Port%u add FDIR filter, "
-            "type:NONFRAG_IPV4_TCP|NONFRAG_IPV4_UDP, dst-ip:" IPv4_BE_FMT
-            ", rxq:%u\n",
+            "type:NONFRAG_IPV4_TCP|NONFRAG_IPV4_UDP|FRAG_IPV4|"
+            "NONFRAG_IPV4_OTHER, dst-ip:" IPv4_BE_FMT ", rxq:%u\n",
             __func__, port_id, IPv4_BE_ARG(dst_ip), rxq_id);
     return 0;
 }
@@ -152,8 +182,19 @@ dpdk_dev_5tuple_filter_add(uint16_t port_id, uint32_t dst_ip, uint32_t rxq_id) {
     return rc;
 }
 
+/*
+ * rte_flow first, the legacy filter_ctrl API only for the PMDs which do not
+ * implement it.
+ */
 static int
 dpdk_dev_filter_add(uint16_t port_id, uint32_t dst_ip, uint32_t rxq_id) {
+    if (lb_flow_laddr_add(port_id, dst_ip, rxq_id) == 0) {
+        return 0;
+    }
+
+    RTE_LOG(INFO, USER1, "%s(): Port%u does not support rte_flow steering.\n",
+            __func__, port_id);
+
     if (rte_eth_dev_filter_supported(port_id, RTE_ETH_FILTER_NTUPLE) == 0) {
         return dpdk_dev_5tuple_filter_add(port_id, dst_ip, rxq_id);
     }
@@ -171,43 +212,13 @@ dpdk_dev_filter_add(uint16_t port_id, uint32_t dst_ip, uint32_t rxq_id) {
     return -1;
 }
 
-static int
-kni_get_mac(const char *name, struct ether_addr *ha) {
-    int fd;
-    struct ifreq req;
-
-    fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (fd < 0) {
-        RTE_LOG(ERR, USER1, "%s(): Create SOCK_STREAM socket failed, %s\n",
-                __func__, strerror(errno));
-        return -1;
-    }
-
-    /* Get KNI MAC */
-    memset(&req, 0, sizeof(struct ifreq));
-    strncpy(req.ifr_name, name, IFNAMSIZ);
-    req.ifr_addr.sa_family = AF_INET;
-
-    if (ioctl(fd, SIOCGIFHWADDR, &req) < 0) {
-        RTE_LOG(ERR, USER1, "%s(): Set MAC failed, %s\n", __func__,
-                strerror(errno));
-        close(fd);
-        return -1;
-    }
-
-    close(fd);
-    memcpy(ha->addr_bytes, req.ifr_hwaddr.sa_data, ETHER_ADDR_LEN);
-
-    return 0;
-}
-
 static void
 tx_buffer_callback(struct rte_mbuf **pkts, uint16_t unsend, void *userdata) {
     uint16_t i;
     struct lb_device *dev = userdata;
 
     for (i = 0; i < unsend; i++) {
-        rte_pktmbuf_free(pkts[i]);
+        lb_drop(pkts[i], LB_DROP_TX_FULL);
     }
     dev->lcore_stats[rte_lcore_id()].tx_dropped += unsend;
 }
@@ -218,7 +229,7 @@ l4_ports_create(const char *name, uint16_t min, uint16_t max,
     struct rte_ring *r;
     uint16_t p;
 
-    r = rte_ring_create(name, UINT16_MAX + 1, socket_id,
+    r = rte_ring_create(name, rte_align32pow2(max - min + 1), socket_id,
                         RING_F_SP_ENQ | RING_F_SC_DEQ);
     if (r == NULL) {
         RTE_LOG(ERR, USER1, "%s(): Create ports ring %s failed, %s.\n",
@@ -231,32 +242,123 @@ l4_ports_create(const char *name, uint16_t min, uint16_t max,
     return r;
 }
 
+/*
+ * Partitioned local ports always keep software steering, the port range
+ * rules only save the redirects on the NICs which take them.
+ */
+static void
+dpdk_dev_lport_filter_add(uint16_t port_id, struct lb_device *dev) {
+    struct lb_laddr_list *laddr_list;
+    struct lb_laddr *laddr;
+    uint32_t lcore_id, lid;
+    uint16_t lo, hi;
+    int rc = 0;
+
+    RTE_LCORE_FOREACH_SLAVE(lcore_id) {
+        laddr_list = &dev->laddr_list[lcore_id];
+        for (lid = 0; lid < laddr_list->nb; lid++) {
+            laddr = &laddr_list->entries[lid];
+            lb_lport_range(LB_MIN_L4_PORT, LB_MAX_L4_PORT, dev->nb_rxq,
+                           laddr->rxq_id, &lo, &hi);
+            rc = lb_flow_lport_add(port_id, laddr->ipv4, IPPROTO_TCP, lo, hi,
+                                   laddr->rxq_id);
+            if (rc < 0)
+                break;
+            lb_lport_range(LB_MIN_L4_PORT, LB_UDP_ONEPACKET_MIN_PORT,
+                           dev->nb_rxq, laddr->rxq_id, &lo, &hi);
+            rc = lb_flow_lport_add(port_id, laddr->ipv4, IPPROTO_UDP, lo, hi,
+                                   laddr->rxq_id);
+            if (rc < 0)
+                break;
+            rc = lb_flow_lport_add(port_id, laddr->ipv4, IPPROTO_UDP,
+                                   laddr->udp_onepacket_min,
+                                   laddr->udp_onepacket_min +
+                                       laddr->udp_onepacket_nb,
+                                   laddr->rxq_id);
+            if (rc < 0)
+                break;
+        }
+        if (rc < 0)
+            break;
+    }
+    if (rc < 0) {
+        RTE_LOG(INFO, USER1,
+                "%s(): Port%u cannot steer local port ranges, "
+                "steer them by software only.\n",
+                __func__, port_id);
+    }
+}
+
 static int
 dpdk_dev_config_and_set_ipfilter(uint16_t port_id, struct lb_device *dev,
                                  uint8_t ipfilter_enabled) {
     struct rte_eth_conf dev_conf;
+    struct rte_eth_dev_info info;
+    struct rte_eth_txconf txconf;
+    uint32_t frame_len;
     int rc;
     uint16_t i;
 
+    rte_eth_dev_info_get(port_id, &info);
+    frame_len = LB_MTU_TO_FRAME_LEN(dev->mtu);
+    if (frame_len > info.max_rx_pktlen) {
+        RTE_LOG(ERR, USER1, "%s(): Port%u does not support mtu %u.\n",
+                __func__, port_id, dev->mtu);
+        return -EINVAL;
+    }
+    if (dev->rx_offload & ~info.rx_offload_capa) {
+        RTE_LOG(WARNING, USER1,
+                "%s(): Port%u does not support rxoffload 0x%x, ignore it.\n",
+                __func__, port_id,
+                (uint32_t)(dev->rx_offload & ~info.rx_offload_capa));
+        dev->rx_offload &= info.rx_offload_capa;
+    }
+
+    txconf = info.default_txconf;
+    if (dev->tx_offload & ~info.tx_offload_capa) {
+        RTE_LOG(WARNING, USER1,
+                "%s(): Port%u does not support txoffload 0x%x, ignore it.\n",
+                __func__, port_id,
+                (uint32_t)(dev->tx_offload & ~info.tx_offload_capa));
+        dev->tx_offload &= info.tx_offload_capa;
+    }
+
     memset(&dev_conf, 0, sizeof(dev_conf));
     dev_conf.rxmode.mq_mode = ETH_MQ_RX_RSS;
+    dev_conf.rxmode.ignore_offload_bitfield = 1;
+    dev_conf.rxmode.offloads = dev->rx_offload;
     dev_conf.rxmode.max_rx_pkt_len = ETHER_MAX_LEN;
+    if (frame_len > ETHER_MAX_LEN) {
+        dev_conf.rxmode.offloads |= DEV_RX_OFFLOAD_JUMBO_FRAME;
+        dev_conf.rxmode.max_rx_pkt_len = frame_len;
+    }
+    /* Frames larger than one mbuf are chained, and sent back chained. */
+    if (frame_len > dev->mbuf_size) {
+        dev_conf.rxmode.offloads |= DEV_RX_OFFLOAD_SCATTER;
+        dev->tx_offload |= DEV_TX_OFFLOAD_MULTI_SEGS;
+    }
     dev_conf.rx_adv_conf.rss_conf.rss_hf = ETH_RSS_PROTO_MASK;
     dev_conf.fdir_conf.mode = RTE_FDIR_MODE_PERFECT;
     dev_conf.fdir_conf.mask.ipv4_mask.src_ip = 0xFFFFFFFF;
     dev_conf.fdir_conf.mask.ipv4_mask.dst_ip = 0xFFFFFFFF;
     dev_conf.fdir_conf.mask.src_port_mask = 0xFFFF;
     dev_conf.fdir_conf.mask.dst_port_mask = 0xFFFF;
+    /* No filter drops to it, flow/drop rules use RTE_FLOW_ACTION_TYPE_DROP. */
     dev_conf.fdir_conf.drop_queue = 127;
+    dev_conf.txmode.offloads = dev->tx_offload;
+    /* Idle workers wait for the interrupts of their queues. */
+    if (port_id == dev->port_id && dev->type == LB_DEV_T_NORM)
+        dev_conf.intr_conf.rxq = lb_poll_intr_enabled();
 
-    rc = rte_eth_dev_configure(port_id, dev->nb_rxq, dev->nb_txq, &dev_conf);
+    rc = rte_eth_dev_configure(port_id, dev->nb_rxq * dev->rxq_per_lcore,
+                               dev->nb_txq, &dev_conf);
     if (rc < 0) {
         RTE_LOG(ERR, USER1, "%s(): config port%u failed, %s.\n", __func__,
                 port_id, strerror(-rc));
         return rc;
     }
 
-    for (i = 0; i < dev->nb_rxq; i++) {
+    for (i = 0; i < dev->nb_rxq * dev->rxq_per_lcore; i++) {
         rc = rte_eth_rx_queue_setup(port_id, i, dev->rxq_size, dev->socket_id,
                                     NULL, dev->mp);
         if (rc < 0) {
@@ -266,9 +368,11 @@ dpdk_dev_config_and_set_ipfilter(uint16_t port_id, struct lb_device *dev,
         }
     }
 
+    txconf.txq_flags = ETH_TXQ_FLAGS_IGNORE;
+    txconf.offloads = dev->tx_offload;
     for (i = 0; i < dev->nb_txq; i++) {
         rc = rte_eth_tx_queue_setup(port_id, i, dev->txq_size, dev->socket_id,
-                                    NULL);
+                                    dev->tx_offload ? &txconf : NULL);
         if (rc < 0) {
             RTE_LOG(ERR, USER1, "%s(): Setup the txq%u of port%u failed, %s.\n",
                     __func__, i, port_id, strerror(-rc));
@@ -276,9 +380,17 @@ dpdk_dev_config_and_set_ipfilter(uint16_t port_id, struct lb_device *dev,
         }
     }
 
+    rc = rte_eth_dev_set_mtu(port_id, dev->mtu);
+    if (rc < 0) {
+        RTE_LOG(WARNING, USER1, "%s(): Port%u set mtu %u failed, %s.\n",
+                __func__, port_id, dev->mtu, strerror(-rc));
+    }
+
     rte_eth_promiscuous_enable(port_id);
 
-    if (ipfilter_enabled && dev->nb_rxq > 1) {
+    if (ipfilter_enabled && dev->nb_rxq > 1 && dev->lport_partition) {
+        dpdk_dev_lport_filter_add(port_id, dev);
+    } else if (ipfilter_enabled && dev->nb_rxq > 1) {
         uint32_t lcore_id;
 
         RTE_LCORE_FOREACH_SLAVE(lcore_id) {
@@ -291,9 +403,11 @@ dpdk_dev_config_and_set_ipfilter(uint16_t port_id, struct lb_device *dev,
                 laddr = &laddr_list->entries[lid];
                 rc = dpdk_dev_filter_add(port_id, laddr->ipv4, laddr->rxq_id);
                 if (rc < 0) {
-                    RTE_LOG(ERR, USER1, "%s(): dpdk_dev_filter_add failed.\n",
-                            __func__);
-                    return rc;
+                    RTE_LOG(WARNING, USER1,
+                            "%s(): Port%u cannot steer local addresses, "
+                            "fall back to software steering.\n",
+                            __func__, port_id);
+                    return lb_steer_init(dev);
                 }
             }
         }
@@ -384,7 +498,9 @@ init_mempool(struct lb_device *dev) {
     uint32_t mp_size;
     char mp_name[RTE_MEMPOOL_NAMESIZE];
 
-    mp_size = dev->nb_rxq * dev->rxq_size + dev->nb_txq * dev->txq_size;
+    mp_size = dev->nb_rxq * dev->rxq_per_lcore * dev->rxq_size +
+              dev->nb_txq * dev->txq_size;
+    mp_size += dev->nb_kni_lcores * (dev->rxq_size + dev->txq_size);
     mp_size += LB_PKTMBUF_POOL_DEFAULT_SIZE;
     snprintf(mp_name, sizeof(mp_name), "mp%p", dev);
     dev->mp =
@@ -394,7 +510,8 @@ init_mempool(struct lb_device *dev) {
                                 /* priv_size */
                                 0,
                                 /* data_room_size */
-                                RTE_MBUF_DEFAULT_BUF_SIZE, dev->socket_id);
+                                dev->mbuf_size + RTE_PKTMBUF_HEADROOM,
+                                dev->socket_id);
     if (dev->mp == NULL) {
         RTE_LOG(ERR, USER1, "%s(): Create pktmbuf mempool failed, %s.\n",
                 __func__, rte_strerror(rte_errno));
@@ -403,74 +520,19 @@ init_mempool(struct lb_device *dev) {
     return 0;
 }
 
-static int
-init_kni(struct lb_device *dev) {
-    struct rte_kni_conf kni_conf;
-    struct rte_kni_ops kni_ops;
-    struct rte_eth_dev_info info;
-
-    memset(&info, 0, sizeof(info));
-    rte_eth_dev_info_get(dev->port_id, &info);
-
-    memset(&kni_conf, 0, sizeof(kni_conf));
-    memcpy(kni_conf.name, dev->name, RTE_KNI_NAMESIZE);
-    kni_conf.core_id = rte_get_master_lcore();
-    kni_conf.force_bind = 1;
-    kni_conf.group_id = dev->port_id;
-    kni_conf.mbuf_size = RTE_MBUF_DEFAULT_DATAROOM;
-    if (info.pci_dev) {
-        kni_conf.addr = info.pci_dev->addr;
-        kni_conf.id = info.pci_dev->id;
-    }
-
-    kni_ops.port_id = dev->port_id;
-    kni_ops.change_mtu = NULL;
-    kni_ops.config_network_if = NULL;
-
-    dev->kni = rte_kni_alloc(dev->mp, &kni_conf, &kni_ops);
-    if (dev->kni == NULL) {
-        RTE_LOG(ERR, USER1, "%s(): Create kni %s failed.\n", __func__,
-                dev->name);
-        return -1;
-    }
-
-    if (kni_get_mac(dev->name, &dev->ha) < 0) {
-        RTE_LOG(ERR, USER1, "%s(): kni_set_mac failed.\n", __func__);
-        return -1;
-    }
-    return 0;
-}
-
-static int
-init_master_worker_ring(struct lb_device *dev) {
-    char rname[RTE_RING_NAMESIZE];
-    uint32_t size;
-
-    snprintf(rname, sizeof(rname), "ring%p", dev);
-    size = PKT_MAX_BURST * dev->nb_rxq;
-    dev->ring = rte_ring_create(rname, size, dev->socket_id,
-                                RING_F_SC_DEQ | RING_F_EXACT_SZ);
-    if (dev->ring == NULL) {
-        RTE_LOG(ERR, USER1, "%s(): Create master-worker ring failed.\n",
-                __func__);
-        return -1;
-    }
-    return 0;
-}
-
 static int
 init_tx_buffer(struct lb_device *dev) {
-    uint32_t lcore_id, socket_id;
+    uint32_t lcore_id;
 
-    socket_id = dev->socket_id;
     RTE_LCORE_FOREACH(lcore_id) {
         if (lcore_id != rte_get_master_lcore() &&
-            socket_id != rte_lcore_to_socket_id(lcore_id)) {
+            !dev->lcore_conf[lcore_id].rxq_enable &&
+            !dev->lcore_conf[lcore_id].kni_enable) {
             continue;
         }
         dev->tx_buffer[lcore_id] = rte_zmalloc_socket(
             "tx-buffer", RTE_ETH_TX_BUFFER_SIZE(PKT_MAX_BURST),
-            RTE_CACHE_LINE_SIZE, socket_id);
+            RTE_CACHE_LINE_SIZE, rte_lcore_to_socket_id(lcore_id));
         if (dev->tx_buffer[lcore_id] == NULL) {
             RTE_LOG(ERR, USER1, "%s(): Create tx pkt buffer failed.\n",
                     __func__);
@@ -484,6 +546,85 @@ init_tx_buffer(struct lb_device *dev) {
     return 0;
 }
 
+static void
+lcore_conf_add(struct lb_device *dev, uint32_t lcore_id) {
+    dev->lcore_conf[lcore_id].rxq_enable = 1;
+    dev->lcore_conf[lcore_id].rxq_id = dev->nb_rxq;
+    dev->lcore_conf[lcore_id].txq_id = dev->nb_rxq;
+    dev->nb_rxq++;
+}
+
+/* A kni lcore of any device cannot poll devices. */
+static int
+kni_lcore_is_configured(uint32_t lcore_id) {
+    uint16_t i;
+
+    for (i = 0; i < lb_cfg->nb_decices; i++) {
+        if (lb_cfg->devices[i].kni_lcores[lcore_id])
+            return 1;
+    }
+    return 0;
+}
+
+/*
+ * The worker lcores listed by the lcores option poll the device, or else
+ * those of its socket, or else all of them when the socket has none.
+ * The queues and packets of the device stay on its socket, only the
+ * lcores of other sockets reach them across the NUMA nodes.
+ */
+static int
+init_lcore_conf(struct lb_device *dev, struct lb_device_conf *conf) {
+    uint32_t lcore_id;
+
+    if (conf->nb_lcores > 0) {
+        for (lcore_id = 0; lcore_id < RTE_MAX_LCORE; lcore_id++) {
+            if (!conf->lcores[lcore_id])
+                continue;
+            if (!rte_lcore_is_enabled(lcore_id) ||
+                lcore_id == rte_get_master_lcore()) {
+                RTE_LOG(ERR, USER1, "%s(): lcore%u of %s is not a worker.\n",
+                        __func__, lcore_id, conf->name);
+                return -1;
+            }
+            lcore_conf_add(dev, lcore_id);
+        }
+    } else {
+        RTE_LCORE_FOREACH_SLAVE(lcore_id) {
+            if (rte_lcore_to_socket_id(lcore_id) == dev->socket_id &&
+                !kni_lcore_is_configured(lcore_id))
+                lcore_conf_add(dev, lcore_id);
+        }
+        if (dev->nb_rxq == 0) {
+            RTE_LCORE_FOREACH_SLAVE(lcore_id) {
+                if (!kni_lcore_is_configured(lcore_id))
+                    lcore_conf_add(dev, lcore_id);
+            }
+        }
+    }
+    if (dev->nb_rxq == 0) {
+        RTE_LOG(ERR, USER1, "%s(): No worker lcore polls %s.\n", __func__,
+                conf->name);
+        return -1;
+    }
+
+    RTE_LCORE_FOREACH_SLAVE(lcore_id) {
+        if (dev->lcore_conf[lcore_id].rxq_enable &&
+            rte_lcore_to_socket_id(lcore_id) != dev->socket_id) {
+            RTE_LOG(WARNING, USER1,
+                    "%s(): lcore%u on socket%u polls %s on socket%u.\n",
+                    __func__, lcore_id, rte_lcore_to_socket_id(lcore_id),
+                    conf->name, dev->socket_id);
+        }
+    }
+
+    lcore_id = rte_get_master_lcore();
+    dev->lcore_conf[lcore_id].txq_id = dev->nb_rxq;
+    dev->nb_txq = dev->nb_rxq + 1;
+    dev->rxq_per_lcore = conf->rxq_per_lcore != 0 ? conf->rxq_per_lcore : 1;
+
+    return 0;
+}
+
 static uint32_t
 rxq_to_lcore_id(struct lb_device *dev, uint16_t rxq_id) {
     uint32_t lcore_id;
@@ -496,6 +637,46 @@ rxq_to_lcore_id(struct lb_device *dev, uint16_t rxq_id) {
     return lcore_id;
 }
 
+static int
+laddr_init(struct lb_device *dev, uint32_t lcore_id, struct lb_laddr *laddr,
+           uint32_t lip, uint16_t rxq_id, uint16_t nb_ranges) {
+    char name[RTE_RING_NAMESIZE];
+    uint32_t socket_id = rte_lcore_to_socket_id(lcore_id);
+    uint16_t lo, hi;
+
+    laddr->ipv4 = lip;
+    laddr->port_id = dev->port_id;
+    laddr->rxq_id = rxq_id;
+
+    /* Without partition the single range holds all ports. */
+    if (nb_ranges == 1)
+        rxq_id = 0;
+
+    snprintf(name, sizeof(name), "tcpport%p", laddr);
+    lb_lport_range(LB_MIN_L4_PORT, LB_MAX_L4_PORT, nb_ranges, rxq_id, &lo,
+                   &hi);
+    laddr->ports[LB_IPPROTO_TCP] = l4_ports_create(name, lo, hi, socket_id);
+    laddr->nb_ports[LB_IPPROTO_TCP] = hi - lo;
+
+    snprintf(name, sizeof(name), "udpport%p", laddr);
+    lb_lport_range(LB_MIN_L4_PORT, LB_UDP_ONEPACKET_MIN_PORT, nb_ranges, rxq_id,
+                   &lo, &hi);
+    laddr->ports[LB_IPPROTO_UDP] = l4_ports_create(name, lo, hi, socket_id);
+    laddr->nb_ports[LB_IPPROTO_UDP] = hi - lo;
+
+    lb_lport_range(LB_UDP_ONEPACKET_MIN_PORT, LB_MAX_L4_PORT, nb_ranges, rxq_id,
+                   &lo, &hi);
+    laddr->udp_onepacket_min = lo;
+    laddr->udp_onepacket_nb = hi - lo;
+
+    if (laddr->ports[LB_IPPROTO_TCP] == NULL ||
+        laddr->ports[LB_IPPROTO_UDP] == NULL) {
+        RTE_LOG(ERR, USER1, "%s(): l4_ports_create failed.\n", __func__);
+        return -1;
+    }
+    return 0;
+}
+
 static int
 init_laddr_list(struct lb_device *dev, uint32_t lips[], uint32_t nb_lips) {
     uint32_t i;
@@ -503,14 +684,29 @@ init_laddr_list(struct lb_device *dev, uint32_t lips[], uint32_t nb_lips) {
     uint32_t lcore_id;
     struct lb_laddr_list *laddr_list;
     struct lb_laddr *laddr;
-    char name[RTE_RING_NAMESIZE];
 
-    if (nb_lips < dev->nb_rxq) {
-        RTE_LOG(ERR, USER1,
+    if (!dev->lport_partition && nb_lips < dev->nb_rxq) {
+        RTE_LOG(INFO, USER1,
                 "%s(): The number of local IPv4 is less than the number of "
-                "RX queue of %s.\n",
+                "RX queue of %s, partition the local ports.\n",
                 __func__, dev->name);
-        return -1;
+        dev->lport_partition = 1;
+    }
+
+    if (dev->lport_partition) {
+        RTE_LCORE_FOREACH_SLAVE(lcore_id) {
+            if (!dev->lcore_conf[lcore_id].rxq_enable)
+                continue;
+            rxq_id = dev->lcore_conf[lcore_id].rxq_id;
+            laddr_list = &dev->laddr_list[lcore_id];
+            for (i = 0; i < nb_lips; i++) {
+                laddr = &laddr_list->entries[laddr_list->nb++];
+                if (laddr_init(dev, lcore_id, laddr, lips[i], rxq_id,
+                               dev->nb_rxq) < 0)
+                    return -1;
+            }
+        }
+        return 0;
     }
 
     for (i = 0; i < nb_lips; i++) {
@@ -525,26 +721,74 @@ init_laddr_list(struct lb_device *dev, uint32_t lips[], uint32_t nb_lips) {
 
         laddr_list = &dev->laddr_list[lcore_id];
         laddr = &laddr_list->entries[laddr_list->nb++];
+        if (laddr_init(dev, lcore_id, laddr, lips[i], rxq_id, 1) < 0)
+            return -1;
+    }
+    return 0;
+}
 
-        laddr->ipv4 = lips[i];
-        laddr->port_id = dev->port_id;
-        laddr->rxq_id = rxq_id;
-
-        snprintf(name, sizeof(name), "tcpport%p", laddr);
-        laddr->ports[LB_IPPROTO_TCP] = l4_ports_create(
-            name, LB_MIN_L4_PORT, LB_MAX_L4_PORT, dev->socket_id);
+/* NIC counters sampled each second by the master, see lb_rate.h. */
+enum {
+    NETDEV_RATE_IPACKETS,
+    NETDEV_RATE_OPACKETS,
+    NETDEV_RATE_IBYTES,
+    NETDEV_RATE_OBYTES,
+    NETDEV_RATE_IMISSED,
+    NETDEV_RATE_IERRORS,
+    NETDEV_RATE_OERRORS,
+    NETDEV_RATE_RX_NOMBUF,
+    NETDEV_RATE_MAX,
+};
+
+static const char *netdev_rate_names[] = {
+    [NETDEV_RATE_IPACKETS] = "RX-pps",
+    [NETDEV_RATE_OPACKETS] = "TX-pps",
+    [NETDEV_RATE_IBYTES] = "RX-Bps",
+    [NETDEV_RATE_OBYTES] = "TX-Bps",
+    [NETDEV_RATE_IMISSED] = "RX-misses-ps",
+    [NETDEV_RATE_IERRORS] = "RX-errors-ps",
+    [NETDEV_RATE_OERRORS] = "TX-errors-ps",
+    [NETDEV_RATE_RX_NOMBUF] = "RX-nombuf-ps",
+};
+
+static struct lb_rate netdev_rates[RTE_MAX_ETHPORTS];
+static struct rte_timer netdev_rate_timer;
 
-        snprintf(name, sizeof(name), "udpport%p", laddr);
-        laddr->ports[LB_IPPROTO_UDP] = l4_ports_create(
-            name, LB_MIN_L4_PORT, LB_MAX_L4_PORT, dev->socket_id);
+static void
+netdev_rate_timer_cb(__attribute__((unused)) struct rte_timer *t,
+                     __attribute__((unused)) void *arg) {
+    uint64_t counters[NETDEV_RATE_MAX];
+    struct rte_eth_stats stats;
+    struct lb_device *dev;
+    uint64_t now = rte_rdtsc();
+    uint16_t i;
 
-        if (laddr->ports[LB_IPPROTO_TCP] == NULL ||
-            laddr->ports[LB_IPPROTO_UDP] == NULL) {
-            RTE_LOG(ERR, USER1, "%s(): l4_ports_create failed.\n", __func__);
-            return -1;
-        }
+    RTE_BUILD_BUG_ON(NETDEV_RATE_MAX > LB_RATE_MAX_COUNTERS);
+    LB_DEVICE_FOREACH(i, dev) {
+        if (rte_eth_stats_get(dev->port_id, &stats) < 0)
+            continue;
+        counters[NETDEV_RATE_IPACKETS] = stats.ipackets;
+        counters[NETDEV_RATE_OPACKETS] = stats.opackets;
+        counters[NETDEV_RATE_IBYTES] = stats.ibytes;
+        counters[NETDEV_RATE_OBYTES] = stats.obytes;
+        counters[NETDEV_RATE_IMISSED] = stats.imissed;
+        counters[NETDEV_RATE_IERRORS] = stats.ierrors;
+        counters[NETDEV_RATE_OERRORS] = stats.oerrors;
+        counters[NETDEV_RATE_RX_NOMBUF] = stats.rx_nombuf;
+        lb_rate_sample(&netdev_rates[dev->port_id], counters,
+                       NETDEV_RATE_MAX, now);
     }
-    return 0;
+}
+
+static void
+netdev_rate_get(struct lb_device *dev, uint32_t window, uint64_t *rates) {
+    uint64_t delta[NETDEV_RATE_MAX], cycles;
+    uint32_t i;
+
+    cycles = lb_rate_delta(&netdev_rates[dev->port_id], window,
+                           NETDEV_RATE_MAX, delta);
+    for (i = 0; i < NETDEV_RATE_MAX; i++)
+        rates[i] = lb_rate_per_sec(delta[i], cycles);
 }
 
 int
@@ -554,8 +798,6 @@ lb_device_init(struct lb_device_conf *configs, uint16_t num) {
     struct lb_device_conf *conf;
     struct lb_device *dev;
     int socket_id;
-    uint32_t lcore_id;
-    uint16_t qid;
 
     rc = lb_device_conf_check_and_adjust(configs, num);
     if (rc < 0) {
@@ -563,8 +805,6 @@ lb_device_init(struct lb_device_conf *configs, uint16_t num) {
         return rc;
     }
 
-    rte_kni_init(num);
-
     for (i = 0; i < num; i++) {
         conf = &configs[i];
 
@@ -579,8 +819,14 @@ lb_device_init(struct lb_device_conf *configs, uint16_t num) {
                 return -1;
             }
             if (socket_id != -1 && socket_id != tmp_sid) {
-                RTE_LOG(WARNING, USER1, "%s(): Slave port on different NUMA.\n",
-                        __func__);
+                char pci_name[PCI_PRI_STR_SIZE];
+
+                rte_pci_device_name(&conf->pcis[j], pci_name,
+                                    sizeof(pci_name));
+                RTE_LOG(WARNING, USER1,
+                        "%s(): Slave port %s of %s is on socket%d, the bond "
+                        "on socket%d, its packets cross the NUMA nodes.\n",
+                        __func__, pci_name, conf->name, tmp_sid, socket_id);
                 continue;
             }
             socket_id = tmp_sid;
@@ -613,9 +859,9 @@ lb_device_init(struct lb_device_conf *configs, uint16_t num) {
             }
             dev->type = LB_DEV_T_BOND;
             dev->port_id = rc;
-            for (i = 0; i < conf->nb_pcis; i++) {
+            for (j = 0; j < conf->nb_pcis; j++) {
                 dev->slave_ports[dev->nb_slaves++] =
-                    dpdk_dev_port_id_get_by_pci(&conf->pcis[i]);
+                    dpdk_dev_port_id_get_by_pci(&conf->pcis[j]);
             }
         } else {
             rc = dpdk_dev_port_id_get_by_pci(&conf->pcis[0]);
@@ -628,28 +874,36 @@ lb_device_init(struct lb_device_conf *configs, uint16_t num) {
             dev->port_id = rc;
         }
 
-        qid = 0;
-        RTE_LCORE_FOREACH_SLAVE(lcore_id) {
-            if (rte_lcore_to_socket_id(lcore_id) == dev->socket_id) {
-                dev->lcore_conf[lcore_id].rxq_enable = 1;
-                dev->lcore_conf[lcore_id].rxq_id = qid;
-                dev->lcore_conf[lcore_id].txq_id = qid;
-                qid++;
-            }
+        rc = init_lcore_conf(dev, conf);
+        if (rc < 0) {
+            RTE_LOG(ERR, USER1, "%s(): init lcore conf failed.\n", __func__);
+            return rc;
         }
-        lcore_id = rte_get_master_lcore();
-        dev->lcore_conf[lcore_id].txq_id = qid;
 
-        dev->nb_rxq = qid;
-        dev->nb_txq = qid + 1;
+        rc = lb_kni_lcores_init(dev, conf);
+        if (rc < 0) {
+            RTE_LOG(ERR, USER1, "%s(): init kni lcores failed.\n", __func__);
+            return rc;
+        }
 
         dev->rxq_size = conf->rxqsize;
         dev->txq_size = conf->txqsize;
         dev->rx_offload = conf->rxoffload;
         dev->tx_offload = conf->txoffload;
+        dev->mtu = conf->mtu != 0 ? conf->mtu : ETHER_MTU;
+        /* One mbuf per frame unless configured otherwise. */
+        dev->mbuf_size = RTE_MIN(
+            RTE_MAX((uint32_t)RTE_MBUF_DEFAULT_DATAROOM,
+                    RTE_ALIGN_CEIL(LB_MTU_TO_FRAME_LEN(dev->mtu), 1024)),
+            (uint32_t)(UINT16_MAX - RTE_PKTMBUF_HEADROOM));
+        if (conf->mbufsize != 0)
+            dev->mbuf_size = conf->mbufsize;
+        dev->gue_port = rte_cpu_to_be_16(
+            conf->gue_port != 0 ? conf->gue_port : LB_GUE_DEFAULT_PORT);
         dev->ipv4 = conf->ipv4;
         dev->netmask = conf->netmask;
         dev->gw = conf->gw;
+        dev->lport_partition = conf->lport_partition;
         memcpy(dev->name, conf->name, sizeof(dev->name));
 
         rc = init_laddr_list(dev, conf->lips, conf->nb_lips);
@@ -664,7 +918,7 @@ lb_device_init(struct lb_device_conf *configs, uint16_t num) {
             return rc;
         }
 
-        rc = init_kni(dev);
+        rc = lb_kni_init(dev, conf);
         if (rc < 0) {
             RTE_LOG(ERR, USER1, "%s(): init kni failed.\n", __func__);
             return rc;
@@ -676,13 +930,6 @@ lb_device_init(struct lb_device_conf *configs, uint16_t num) {
             return rc;
         }
 
-        rc = init_master_worker_ring(dev);
-        if (rc < 0) {
-            RTE_LOG(ERR, USER1, "%s(): init master-worker ring failed.\n",
-                    __func__);
-            return rc;
-        }
-
         rc = dpdk_dev_config_and_set_ipfilter(
             dev->port_id, dev, dev->type == LB_DEV_T_NORM ? 1 : 0);
         if (rc < 0) {
@@ -712,6 +959,19 @@ lb_device_init(struct lb_device_conf *configs, uint16_t num) {
             }
         }
 
+        /*
+         * The bond reconfigures its slaves on start, the filters are lost.
+         * Partitioned local ports are steered by port, not by address.
+         */
+        if (dev->type == LB_DEV_T_BOND || dev->lport_partition) {
+            rc = lb_steer_init(dev);
+            if (rc < 0) {
+                RTE_LOG(ERR, USER1, "%s(): init software steering failed.\n",
+                        __func__);
+                return rc;
+            }
+        }
+
         rc = rte_eth_dev_start(dev->port_id);
         if (rc < 0) {
             RTE_LOG(ERR, USER1, "%s(): start port%u failed.\n", __func__,
@@ -720,47 +980,31 @@ lb_device_init(struct lb_device_conf *configs, uint16_t num) {
         }
     }
 
-    return 0;
+    rc = lb_kni_lcores_check();
+    if (rc < 0)
+        return rc;
+
+    rte_timer_init(&netdev_rate_timer);
+    return rte_timer_reset(&netdev_rate_timer, MS_TO_CYCLES(LB_RATE_PERIOD_MS),
+                           PERIODICAL, rte_get_master_lcore(),
+                           netdev_rate_timer_cb, NULL);
 }
 
 /* UNIXCTL COMMANDS */
 
 /*
     Returns:
-        throughput = [pps_rx, pps_tx, bps_rx, bps_tx]
+        throughput = [pps_rx, pps_tx, bps_rx, bps_tx] over the last second
 */
 static void
-netdev_throughput_get(struct rte_eth_stats *stats, uint64_t throughput[]) {
-    static uint64_t prev_pkts_rx, prev_bytes_rx;
-    static uint64_t prev_pkts_tx, prev_bytes_tx;
-    static uint64_t prev_cycles;
-    uint64_t diff_pkts_rx, diff_pkts_tx, diff_cycles;
-    uint64_t diff_bytes_rx, diff_bytes_tx;
-
-    diff_cycles = prev_cycles;
-    prev_cycles = rte_rdtsc();
-
-    if (diff_cycles > 0) {
-        diff_cycles = prev_cycles - diff_cycles;
-    }
-
-    diff_pkts_rx = stats->ipackets - prev_pkts_rx;
-    diff_pkts_tx = stats->opackets - prev_pkts_tx;
-    prev_pkts_rx = stats->ipackets;
-    prev_pkts_tx = stats->opackets;
-    throughput[0] =
-        diff_cycles > 0 ? diff_pkts_rx * rte_get_tsc_hz() / diff_cycles : 0;
-    throughput[1] =
-        diff_cycles > 0 ? diff_pkts_tx * rte_get_tsc_hz() / diff_cycles : 0;
-
-    diff_bytes_rx = stats->ibytes - prev_bytes_rx;
-    diff_bytes_tx = stats->obytes - prev_bytes_tx;
-    prev_bytes_rx = stats->ibytes;
-    prev_bytes_tx = stats->obytes;
-    throughput[2] =
-        diff_cycles > 0 ? diff_bytes_rx * rte_get_tsc_hz() / diff_cycles : 0;
-    throughput[3] =
-        diff_cycles > 0 ? diff_bytes_tx * rte_get_tsc_hz() / diff_cycles : 0;
+netdev_throughput_get(struct lb_device *dev, uint64_t throughput[]) {
+    uint64_t rates[NETDEV_RATE_MAX];
+
+    netdev_rate_get(dev, LB_RATE_W_1S, rates);
+    throughput[0] = rates[NETDEV_RATE_IPACKETS];
+    throughput[1] = rates[NETDEV_RATE_OPACKETS];
+    throughput[2] = rates[NETDEV_RATE_IBYTES];
+    throughput[3] = rates[NETDEV_RATE_OBYTES];
 }
 
 static void
@@ -794,7 +1038,7 @@ netdev_show_stats_cmd_cb(int fd, char *argv[], int argc) {
             tx_dropped += dev->lcore_stats[lcore_id].tx_dropped;
             rx_dropped += dev->lcore_stats[lcore_id].rx_dropped;
         }
-        netdev_throughput_get(&stats, throughput);
+        netdev_throughput_get(dev, throughput);
 
         mbuf_in_use = rte_mempool_in_use_count(dev->mp);
         mbuf_avail = rte_mempool_avail_count(dev->mp);
@@ -882,6 +1126,62 @@ netdev_show_stats_cmd_cb(int fd, char *argv[], int argc) {
 UNIXCTL_CMD_REGISTER("netdev/stats", "[--json].", "Show NIC packet statistics.",
                      0, 1, netdev_show_stats_cmd_cb);
 
+static void
+netdev_rate_cmd_cb(int fd, char *argv[], int argc) {
+    int json_fmt = 0, json_first_obj = 1;
+    uint64_t rates[NETDEV_RATE_MAX];
+    struct lb_device *dev;
+    uint32_t window, k;
+    uint16_t i;
+
+    if (argc > 0) {
+        if (strcmp(argv[0], "--json") != 0) {
+            unixctl_command_reply_error(fd, "Invalid parameter: %s.\n",
+                                        argv[0]);
+            return;
+        }
+        json_fmt = 1;
+    }
+
+    if (json_fmt)
+        unixctl_command_reply(fd, "[");
+    LB_DEVICE_FOREACH(i, dev) {
+        if (json_fmt) {
+            unixctl_command_reply(fd, json_first_obj ? "{" : ",{");
+            json_first_obj = 0;
+            unixctl_command_reply(fd, JSON_KV_S_FMT("dev", ","), dev->name);
+        } else {
+            unixctl_command_reply(fd, NORM_KV_S_FMT("dev", "\n"), dev->name);
+        }
+        for (window = 0; window < LB_RATE_W_MAX; window++) {
+            netdev_rate_get(dev, window, rates);
+            if (json_fmt)
+                unixctl_command_reply(fd, "%s\"%s\":{", window ? "," : "",
+                                      lb_rate_window_names[window]);
+            else
+                unixctl_command_reply(fd, "  %s\n",
+                                      lb_rate_window_names[window]);
+            for (k = 0; k < NETDEV_RATE_MAX; k++) {
+                if (json_fmt)
+                    unixctl_command_reply(fd, "\"%s\":%" PRIu64 "%s",
+                                          netdev_rate_names[k], rates[k],
+                                          k + 1 < NETDEV_RATE_MAX ? "," : "}");
+                else
+                    unixctl_command_reply(fd, "    %s: %" PRIu64 "\n",
+                                          netdev_rate_names[k], rates[k]);
+            }
+        }
+        if (json_fmt)
+            unixctl_command_reply(fd, "}");
+    }
+    if (json_fmt)
+        unixctl_command_reply(fd, "]\n");
+}
+
+UNIXCTL_CMD_REGISTER("netdev/rate", "[--json].",
+                     "Show NIC rates over the last 1, 10 and 60 seconds.", 0, 1,
+                     netdev_rate_cmd_cb);
+
 static void
 netdev_reset_stats_cmd_cb(__attribute__((unused)) int fd,
                           __attribute__((unused)) char *argv[],
@@ -892,6 +1192,8 @@ netdev_reset_stats_cmd_cb(__attribute__((unused)) int fd,
     LB_DEVICE_FOREACH(i, dev) {
         rte_eth_stats_reset(dev->port_id);
         memset(dev->lcore_stats, 0, sizeof(dev->lcore_stats));
+        /* The samples before the reset are above the counters. */
+        lb_rate_reset(&netdev_rates[dev->port_id]);
     }
 }
 
@@ -944,7 +1246,12 @@ netdev_show_hwinfo_cmd_cb(int fd, __attribute__((unused)) char *argv[],
         mac_addr_tostring(&dev->ha, mac, sizeof(mac));
         unixctl_command_reply(fd, "  hw: %s\n", mac);
 
-        unixctl_command_reply(fd, "  rxq-num: %u\n", dev->nb_rxq);
+        unixctl_command_reply(fd, "  rxq-num: %u\n",
+                              dev->nb_rxq * dev->rxq_per_lcore);
+        unixctl_command_reply(fd, "  rxq-per-lcore: %u\n", dev->rxq_per_lcore);
+        unixctl_command_reply(fd, "  kni: %s\n",
+                              lb_kni_type_name(dev->kni_type));
+        unixctl_command_reply(fd, "  kni-lcores: %u\n", dev->nb_kni_lcores);
         memset(&link_params, 0, sizeof(link_params));
         rte_eth_link_get_nowait(dev->port_id, &link_params);
         unixctl_command_reply(fd, "  link-status: %s\n",
@@ -1230,7 +1537,7 @@ laddr_stats_cmd_cb(int fd, char *argv[], int argc) {
                         avail = rte_ring_count(laddr->ports[j]);
                         avail_lports[lcore_id][j] += avail;
                         inuse_lports[lcore_id][j] +=
-                            LB_MAX_L4_PORT - LB_MIN_L4_PORT - avail;
+                            laddr->nb_ports[j] - avail;
                     }
                 }
             }
@@ -11,14 +11,25 @@
 #include <rte_ring.h>
 
 #include "lb_arp.h"
+#include "lb_capture.h"
 #include "lb_config.h"
+#include "lb_drop.h"
+#include "lb_perf.h"
 #include "lb_proto.h"
+#include "lb_trace.h"
 
 #define PKT_MAX_BURST 32
 
 #define LB_MIN_L4_PORT (1024)
 #define LB_MAX_L4_PORT (65535)
 
+/* UDP ports [61440, 65535) of local addresses serve one-packet services. */
+#define LB_UDP_ONEPACKET_MIN_PORT (61440)
+#define LB_UDP_ONEPACKET_NB_PORTS (LB_MAX_L4_PORT - LB_UDP_ONEPACKET_MIN_PORT)
+
+#define LB_MTU_TO_FRAME_LEN(mtu)                                               \
+    ((uint32_t)(mtu) + ETHER_HDR_LEN + ETHER_CRC_LEN)
+
 enum {
     LB_DEV_T_NORM = 0, /* Normal port. */
     LB_DEV_T_BOND,     /* Bond port. */
@@ -29,8 +40,17 @@ struct lb_laddr {
     uint16_t port_id;
     uint16_t rxq_id;
     struct rte_ring *ports[LB_IPPROTO_MAX];
+    /* Number of ports put in each ring. */
+    uint16_t nb_ports[LB_IPPROTO_MAX];
+    /* UDP one-packet ports [udp_onepacket_min, +nb) of this entry. */
+    uint16_t udp_onepacket_min;
+    uint16_t udp_onepacket_nb;
+    /* Flow cache of the UDP one-packet ports, owned by the UDP module. */
+    void *udp_flows;
 };
 
+struct lb_steer;
+
 struct lb_laddr_list {
     uint32_t nb;
     struct lb_laddr entries[LB_MAX_LADDR];
@@ -44,12 +64,29 @@ struct lb_device {
 
     struct ether_addr ha;
     uint16_t mtu;
+    /* Data room of the mbufs, larger frames are received in segments. */
+    uint16_t mbuf_size;
+
+    /* UDP destination port of GUE tunnels, network byte order. */
+    uint16_t gue_port;
 
     uint32_t ipv4;
     uint32_t netmask;
     uint32_t gw;
 
+    /*
+     * Every lcore owns all local addresses and a share of their ports,
+     * replies are steered by destination port, see lb_lport_to_rxq().
+     */
+    uint8_t lport_partition;
+
+    /*
+     * nb_rxq is the number of polling lcores, each one polls the queues
+     * rxq_id + k * nb_rxq for k < rxq_per_lcore. Local addresses are only
+     * steered to the first one, rxq_id.
+     */
     uint16_t nb_rxq, nb_txq;
+    uint16_t rxq_per_lcore;
     uint16_t rxq_size, txq_size;
 
     uint32_t rx_offload;
@@ -59,6 +96,8 @@ struct lb_device {
         uint32_t rxq_enable;
         uint16_t rxq_id;
         uint16_t txq_id;
+        uint32_t kni_enable;
+        uint16_t kni_id;
     } lcore_conf[RTE_MAX_LCORE];
 
     struct {
@@ -70,15 +109,24 @@ struct lb_device {
 
     char name[RTE_KNI_NAMESIZE];
 
-    struct rte_kni *kni;
-
     struct rte_mempool *mp;
 
-    /* master-worker threads communication */
-    struct rte_ring *ring;
+    /*
+     * Packets for the kernel, see lb_kni.c. Every worker has a SPSC ring
+     * to each kni lcore, kni_rings[rxq_id][kni_id].
+     */
+    uint32_t kni_type;
+    struct rte_kni *kni;
+    uint16_t kni_port_id;
+    uint16_t nb_kni_lcores;
+    uint16_t kni_ring_next[LB_MAX_KNI_LCORES];
+    struct rte_ring *kni_rings[RTE_MAX_LCORE][LB_MAX_KNI_LCORES];
 
     struct lb_laddr_list laddr_list[RTE_MAX_LCORE];
 
+    /* Software steering of the local addresses, NULL if the NIC does it. */
+    struct lb_steer *steer;
+
     uint32_t nb_slaves;
     uint32_t slave_ports[RTE_MAX_ETHPORTS];
 };
@@ -89,8 +137,8 @@ extern uint16_t lb_device_count;
 #define LB_DEVICE_FOREACH(i, dev)                                              \
     for (i = 0; (dev = lb_devices[i]) != NULL; i++)
 
-static inline int
-lb_is_laddr_exist(uint32_t lip, struct lb_device *dev) {
+static inline struct lb_laddr *
+lb_laddr_find(uint32_t lip, struct lb_device *dev) {
     struct lb_laddr_list *list;
     uint32_t lcore_id = rte_lcore_id();
     uint32_t i;
@@ -98,9 +146,49 @@ lb_is_laddr_exist(uint32_t lip, struct lb_device *dev) {
     list = &dev->laddr_list[lcore_id];
     for (i = 0; i < list->nb; i++) {
         if (lip == list->entries[i].ipv4)
-            return 1;
+            return &list->entries[i];
     }
-    return 0;
+    return NULL;
+}
+
+static inline int
+lb_is_laddr_exist(uint32_t lip, struct lb_device *dev) {
+    return lb_laddr_find(lip, dev) != NULL;
+}
+
+/*
+ * Split the ports [min, max) in nb_rxq ranges, the last one takes the
+ * remainder.
+ */
+static inline void
+lb_lport_range(uint16_t min, uint16_t max, uint16_t nb_rxq, uint16_t rxq_id,
+               uint16_t *lo, uint16_t *hi) {
+    uint16_t span = (max - min) / nb_rxq;
+
+    *lo = min + rxq_id * span;
+    *hi = rxq_id == nb_rxq - 1 ? max : *lo + span;
+}
+
+/* RX queue owning the local port, host order, UINT16_MAX if none. */
+static inline uint16_t
+lb_lport_to_rxq(struct lb_device *dev, enum lb_proto_type type,
+                uint16_t port) {
+    uint16_t min, max, rxq_id;
+
+    if (port < LB_MIN_L4_PORT || port >= LB_MAX_L4_PORT)
+        return UINT16_MAX;
+    if (type == LB_IPPROTO_TCP) {
+        min = LB_MIN_L4_PORT;
+        max = LB_MAX_L4_PORT;
+    } else if (port < LB_UDP_ONEPACKET_MIN_PORT) {
+        min = LB_MIN_L4_PORT;
+        max = LB_UDP_ONEPACKET_MIN_PORT;
+    } else {
+        min = LB_UDP_ONEPACKET_MIN_PORT;
+        max = LB_MAX_L4_PORT;
+    }
+    rxq_id = (port - min) / ((max - min) / dev->nb_rxq);
+    return rxq_id < dev->nb_rxq ? rxq_id : dev->nb_rxq - 1;
 }
 
 static inline int
@@ -162,6 +250,7 @@ lb_device_tx_mbuf(struct rte_mbuf *m, struct lb_device *dev) {
     lcore_id = rte_lcore_id();
     txq_id = dev->lcore_conf[lcore_id].txq_id;
     tx_buffer = dev->tx_buffer[lcore_id];
+    lb_capture(m, LB_CAPTURE_P_TX);
     rte_eth_tx_buffer(dev->port_id, txq_id, tx_buffer, m);
 }
 
@@ -171,17 +260,51 @@ lb_device_output(struct rte_mbuf *m, struct ipv4_hdr *iph,
     struct ether_hdr *eth;
     int rc;
 
+    lb_perf_mark(LB_PERF_REWRITE);
     eth = rte_pktmbuf_mtod(m, struct ether_hdr *);
 
     rc = lb_device_dst_mac_find(iph->dst_addr, &eth->d_addr, dev);
     if (rc < 0) {
-        rte_pktmbuf_free(m);
+        LB_TRACE(arp_miss, iph->dst_addr, dev->port_id);
+        lb_drop(m, LB_DROP_ARP_MISS);
         return rc;
     }
     ether_addr_copy(&dev->ha, &eth->s_addr);
     eth->ether_type = rte_cpu_to_be_16(ETHER_TYPE_IPv4);
 
     lb_device_tx_mbuf(m, dev);
+    lb_perf_mark(LB_PERF_OUTPUT);
+    return 0;
+}
+
+/*
+ * Direct server return: the IP packet is sent unchanged to the MAC address
+ * of the real service, so the real service must be on-link.
+ */
+static inline int
+lb_device_dr_output(struct rte_mbuf *m, uint32_t rip, struct lb_device *dev) {
+    struct ether_hdr *eth;
+    int rc;
+
+    lb_perf_mark(LB_PERF_REWRITE);
+    if (!IS_SAME_NETWORK(rip, dev->ipv4, dev->netmask)) {
+        lb_drop(m, LB_DROP_NOT_ON_LINK);
+        return -1;
+    }
+
+    eth = rte_pktmbuf_mtod(m, struct ether_hdr *);
+
+    rc = lb_arp_find(rip, &eth->d_addr, dev);
+    if (rc < 0) {
+        lb_arp_request(rip, dev);
+        LB_TRACE(arp_miss, rip, dev->port_id);
+        lb_drop(m, LB_DROP_ARP_MISS);
+        return rc;
+    }
+    ether_addr_copy(&dev->ha, &eth->s_addr);
+
+    lb_device_tx_mbuf(m, dev);
+    lb_perf_mark(LB_PERF_OUTPUT);
     return 0;
 }
 
@@ -0,0 +1,80 @@
+/* Copyright (c) 2018. TIG developer. */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <rte_lcore.h>
+
+#include <unixctl_command.h>
+
+#include "lb_drop.h"
+#include "lb_format.h"
+
+struct lb_drop_lcore lb_drop_lcores[RTE_MAX_LCORE];
+
+static const char *drop_reason_names[] = {
+    [LB_DROP_UNSUPPORTED] = "unsupported",
+    [LB_DROP_FRAG] = "frag",
+    [LB_DROP_OVERLOAD] = "overload",
+    [LB_DROP_NO_VS] = "no_vs",
+    [LB_DROP_MAX_CONNS] = "max_conns",
+    [LB_DROP_NO_RS] = "no_rs",
+    [LB_DROP_RS_DOWN] = "rs_down",
+    [LB_DROP_NO_CONN] = "no_conn",
+    [LB_DROP_CONN_FULL] = "conn_full",
+    [LB_DROP_NO_LPORT] = "no_lport",
+    [LB_DROP_TCP_STATE] = "tcp_state",
+    [LB_DROP_SYNPROXY] = "synproxy",
+    [LB_DROP_ONEPACKET] = "onepacket",
+    [LB_DROP_ICMP] = "icmp",
+    [LB_DROP_NO_HEADROOM] = "no_headroom",
+    [LB_DROP_TOO_BIG] = "too_big",
+    [LB_DROP_NOT_ON_LINK] = "not_on_link",
+    [LB_DROP_ARP_MISS] = "arp_miss",
+    [LB_DROP_RING_FULL] = "ring_full",
+    [LB_DROP_TX_FULL] = "tx_full",
+};
+
+const char *
+lb_drop_name(uint32_t reason) {
+    return drop_reason_names[reason];
+}
+
+static void
+drop_stats_cmd_cb(int fd, char *argv[], int argc) {
+    uint64_t pkts[LB_DROP_MAX] = {0};
+    uint32_t lcore_id, i;
+    int json_fmt = 0;
+
+    if (argc > 0) {
+        if (strcmp(argv[0], "--json") != 0) {
+            unixctl_command_reply_error(fd, "Invalid parameter: %s.\n",
+                                        argv[0]);
+            return;
+        }
+        json_fmt = 1;
+    }
+
+    RTE_LCORE_FOREACH(lcore_id) {
+        for (i = 0; i < LB_DROP_MAX; i++)
+            pkts[i] += lb_drop_lcores[lcore_id].pkts[i];
+    }
+
+    if (json_fmt)
+        unixctl_command_reply(fd, "{");
+    for (i = 0; i < LB_DROP_MAX; i++) {
+        if (json_fmt)
+            unixctl_command_reply(fd, "\"%s\":%" PRIu64 "%s",
+                                  drop_reason_names[i], pkts[i],
+                                  i + 1 < LB_DROP_MAX ? "," : "");
+        else
+            unixctl_command_reply(fd, "%s: %" PRIu64 "\n",
+                                  drop_reason_names[i], pkts[i]);
+    }
+    if (json_fmt)
+        unixctl_command_reply(fd, "}\n");
+}
+
+UNIXCTL_CMD_REGISTER("drop/stats", "[--json].",
+                     "Show the packets dropped by reason.", 0, 1,
+                     drop_stats_cmd_cb);
@@ -0,0 +1,71 @@
+/* Copyright (c) 2018. TIG developer. */
+
+#ifndef __LB_DROP_H__
+#define __LB_DROP_H__
+
+#include <rte_lcore.h>
+#include <rte_mbuf.h>
+
+#include "lb_capture.h"
+#include "lb_trace.h"
+
+/*
+ * Why a packet was dropped, or answered with a reset instead of being
+ * forwarded. Counted where the decision is taken, the packet may be
+ * freed by a caller with lb_drop_free().
+ */
+enum {
+    LB_DROP_UNSUPPORTED, /* Ether type or L4 protocol not served. */
+    LB_DROP_FRAG,        /* Fragment not learned or not prepared. */
+    LB_DROP_OVERLOAD,    /* New connection shed by an overloaded worker. */
+    LB_DROP_NO_VS,       /* No virtual service for the destination. */
+    LB_DROP_MAX_CONNS,   /* Virtual service at its max connections. */
+    LB_DROP_NO_RS,       /* No available real service to schedule. */
+    LB_DROP_RS_DOWN,     /* Real service of the connection went down. */
+    LB_DROP_NO_CONN,     /* Not a connection start and no connection. */
+    LB_DROP_CONN_FULL,   /* Connection table or pool full. */
+    LB_DROP_NO_LPORT,    /* No local address or port left. */
+    LB_DROP_TCP_STATE,   /* Packet invalid in the TCP state. */
+    LB_DROP_SYNPROXY,    /* ACK without a valid SYN cookie. */
+    LB_DROP_ONEPACKET,   /* One-packet UDP slot busy or reply unknown. */
+    LB_DROP_ICMP,        /* ICMP invalid, rate limited or without conn. */
+    LB_DROP_NO_HEADROOM, /* No room for a translated or tunnel header. */
+    LB_DROP_TOO_BIG,     /* Larger than the MTU and not fragmentable. */
+    LB_DROP_NOT_ON_LINK, /* DR real service not on the device subnet. */
+    LB_DROP_ARP_MISS,    /* No ARP entry for the next hop yet. */
+    LB_DROP_RING_FULL,   /* Ring to another lcore full. */
+    LB_DROP_TX_FULL,     /* TX queue full. */
+    LB_DROP_MAX,
+};
+
+struct lb_drop_lcore {
+    uint64_t pkts[LB_DROP_MAX];
+} __rte_cache_aligned;
+
+extern struct lb_drop_lcore lb_drop_lcores[RTE_MAX_LCORE];
+
+static inline void
+lb_drop_count(uint32_t reason) {
+    lb_drop_lcores[rte_lcore_id()].pkts[reason]++;
+    LB_TRACE(drop, reason, NULL, 0);
+}
+
+static inline void
+lb_drop(struct rte_mbuf *m, uint32_t reason) {
+    lb_drop_lcores[rte_lcore_id()].pkts[reason]++;
+    LB_TRACE(drop, reason, rte_pktmbuf_mtod(m, void *),
+             rte_pktmbuf_data_len(m));
+    lb_capture(m, LB_CAPTURE_P_DROP);
+    rte_pktmbuf_free(m);
+}
+
+/* Free a packet whose drop was counted by lb_drop_count(). */
+static inline void
+lb_drop_free(struct rte_mbuf *m) {
+    lb_capture(m, LB_CAPTURE_P_DROP);
+    rte_pktmbuf_free(m);
+}
+
+const char *lb_drop_name(uint32_t reason);
+
+#endif
@@ -0,0 +1,629 @@
+/* Copyright (c) 2018. TIG developer. */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <rte_cycles.h>
+#include <rte_lcore.h>
+#include <rte_log.h>
+#include <rte_ring.h>
+#include <rte_timer.h>
+
+#include <metrics_shm.h>
+#include <unixctl_command.h>
+
+#include "lb_clock.h"
+#include "lb_config.h"
+#include "lb_device.h"
+#include "lb_drop.h"
+#include "lb_exporter.h"
+#include "lb_format.h"
+#include "lb_metrics.h"
+#include "lb_parser.h"
+
+/*
+ * HTTP clients of the OpenMetrics text, served by the master like the
+ * unixctl commands. A scrape refills a private metrics region, so all
+ * the counters are read in one pass, and the response is written
+ * without blocking over the next rounds of the timer.
+ */
+#define EXPORTER_POLL_MS 5
+#define EXPORTER_MAX_CLIENTS 4
+#define EXPORTER_REQ_SIZE 2048
+#define EXPORTER_TIMEOUT_MS 5000
+
+struct exporter_buf {
+    char *data;
+    size_t len;
+    size_t size;
+    int error;
+};
+
+struct exporter_client {
+    int fd;
+    uint64_t start_tsc;
+    size_t req_len;
+    char req[EXPORTER_REQ_SIZE];
+    char head[256];
+    size_t head_len;
+    struct exporter_buf body;
+    size_t sent;
+};
+
+/* Entry fields of the metrics region exported as one family each. */
+enum {
+    EXPORTER_U64,
+    EXPORTER_U32,
+    EXPORTER_I32,
+};
+
+struct exporter_field {
+    const char *name;
+    const char *type;
+    const char *help;
+    size_t off;
+    uint32_t kind;
+    /* Names of the METRICS_SHM_DIRS directions of an array field. */
+    const char *const *dirs;
+};
+
+typedef void (*exporter_labels_t)(struct metrics_shm_header *h,
+                                  const void *entry, char *buf, size_t len);
+
+static int exporter_fd = -1;
+static struct exporter_client exporter_clients[EXPORTER_MAX_CLIENTS];
+static struct metrics_shm_header *exporter_region;
+static struct rte_timer exporter_timer;
+static uint64_t exporter_scrapes;
+static uint64_t exporter_scrape_cycles;
+
+static const char *const exporter_vs_dirs[] = {"c2v", "r2v"};
+static const char *const exporter_rs_dirs[] = {"v2r", "r2v"};
+
+#define F(n, t, h, s, f, k, d)                                                 \
+    { .name = n, .type = t, .help = h, .off = offsetof(s, f), .kind = k,       \
+      .dirs = d }
+
+static const struct exporter_field exporter_lcore_fields[] = {
+    F("lcore_busy_cycles", "counter", "TSC cycles of rounds with packets.",
+      struct metrics_shm_lcore, busy_cycles, EXPORTER_U64, NULL),
+    F("lcore_idle_cycles", "counter", "TSC cycles of rounds without packets.",
+      struct metrics_shm_lcore, idle_cycles, EXPORTER_U64, NULL),
+    F("lcore_busy_rounds", "counter", "Rounds with packets.",
+      struct metrics_shm_lcore, busy_rounds, EXPORTER_U64, NULL),
+    F("lcore_idle_rounds", "counter", "Rounds without packets.",
+      struct metrics_shm_lcore, idle_rounds, EXPORTER_U64, NULL),
+    F("lcore_drops", "counter", "Packets dropped by the lcore.",
+      struct metrics_shm_lcore, drops, EXPORTER_U64, NULL),
+    F("lcore_stalled", "gauge", "1 while the watchdog sees the lcore stalled.",
+      struct metrics_shm_lcore, stalled, EXPORTER_U32, NULL),
+};
+
+static const struct exporter_field exporter_port_fields[] = {
+    F("netdev_rx_packets", "counter", "Packets received.",
+      struct metrics_shm_port, ipackets, EXPORTER_U64, NULL),
+    F("netdev_tx_packets", "counter", "Packets sent.",
+      struct metrics_shm_port, opackets, EXPORTER_U64, NULL),
+    F("netdev_rx_bytes", "counter", "Bytes received.",
+      struct metrics_shm_port, ibytes, EXPORTER_U64, NULL),
+    F("netdev_tx_bytes", "counter", "Bytes sent.",
+      struct metrics_shm_port, obytes, EXPORTER_U64, NULL),
+    F("netdev_rx_missed", "counter", "Packets the NIC dropped, RX queues full.",
+      struct metrics_shm_port, imissed, EXPORTER_U64, NULL),
+    F("netdev_rx_errors", "counter", "Erroneous packets received.",
+      struct metrics_shm_port, ierrors, EXPORTER_U64, NULL),
+    F("netdev_tx_errors", "counter", "Packets that failed to be sent.",
+      struct metrics_shm_port, oerrors, EXPORTER_U64, NULL),
+    F("netdev_rx_nombuf", "counter", "RX mbuf allocation failures.",
+      struct metrics_shm_port, rx_nombuf, EXPORTER_U64, NULL),
+    F("netdev_rx_dropped", "counter", "Packets dropped by the workers.",
+      struct metrics_shm_port, rx_dropped, EXPORTER_U64, NULL),
+    F("netdev_tx_dropped", "counter", "Packets the TX queues refused.",
+      struct metrics_shm_port, tx_dropped, EXPORTER_U64, NULL),
+    F("netdev_mbuf_in_use", "gauge", "Mbufs of the device pool in use.",
+      struct metrics_shm_port, mbuf_in_use, EXPORTER_U32, NULL),
+    F("netdev_mbuf_avail", "gauge", "Mbufs of the device pool available.",
+      struct metrics_shm_port, mbuf_avail, EXPORTER_U32, NULL),
+};
+
+static const struct exporter_field exporter_vs_fields[] = {
+    F("vs_conns", "counter", "Connections of the virtual service.",
+      struct metrics_shm_vs, conns, EXPORTER_U64, NULL),
+    F("vs_active_conns", "gauge", "Active connections of the virtual service.",
+      struct metrics_shm_vs, active_conns, EXPORTER_I32, NULL),
+    F("vs_packets", "counter", "Packets of the virtual service.",
+      struct metrics_shm_vs, packets, EXPORTER_U64, exporter_vs_dirs),
+    F("vs_bytes", "counter", "Bytes of the virtual service.",
+      struct metrics_shm_vs, bytes, EXPORTER_U64, exporter_vs_dirs),
+    F("vs_drops", "counter", "Packets of the virtual service dropped.",
+      struct metrics_shm_vs, drops, EXPORTER_U64, exporter_vs_dirs),
+};
+
+static const struct exporter_field exporter_rs_fields[] = {
+    F("rs_conns", "counter", "Connections of the real service.",
+      struct metrics_shm_rs, conns, EXPORTER_U64, NULL),
+    F("rs_active_conns", "gauge", "Active connections of the real service.",
+      struct metrics_shm_rs, active_conns, EXPORTER_I32, NULL),
+    F("rs_weight", "gauge", "Weight of the real service.",
+      struct metrics_shm_rs, weight, EXPORTER_I32, NULL),
+    F("rs_packets", "counter", "Packets of the real service.",
+      struct metrics_shm_rs, packets, EXPORTER_U64, exporter_rs_dirs),
+    F("rs_bytes", "counter", "Bytes of the real service.",
+      struct metrics_shm_rs, bytes, EXPORTER_U64, exporter_rs_dirs),
+};
+
+#undef F
+
+static void __attribute__((format(printf, 2, 3)))
+exporter_printf(struct exporter_buf *b, const char *fmt, ...) {
+    va_list ap;
+    size_t size;
+    char *data;
+    int n;
+
+    if (b->error)
+        return;
+    for (;;) {
+        va_start(ap, fmt);
+        n = vsnprintf(b->data + b->len, b->size - b->len, fmt, ap);
+        va_end(ap);
+        if (n < 0) {
+            b->error = 1;
+            return;
+        }
+        if ((size_t)n < b->size - b->len) {
+            b->len += n;
+            return;
+        }
+        size = b->size != 0 ? b->size * 2 : 65536;
+        while (size - b->len <= (size_t)n)
+            size *= 2;
+        data = realloc(b->data, size);
+        if (data == NULL) {
+            b->error = 1;
+            return;
+        }
+        b->data = data;
+        b->size = size;
+    }
+}
+
+static void
+exporter_family(struct exporter_buf *b, const struct exporter_field *f) {
+    exporter_printf(b, "# TYPE jupiter_%s %s\n# HELP jupiter_%s %s\n",
+                    f->name, f->type, f->name, f->help);
+}
+
+static void
+exporter_sample(struct exporter_buf *b, const struct exporter_field *f,
+                const char *labels, const char *p) {
+    const char *suffix = strcmp(f->type, "counter") == 0 ? "_total" : "";
+
+    switch (f->kind) {
+    case EXPORTER_U64:
+        exporter_printf(b, "jupiter_%s%s{%s} %" PRIu64 "\n", f->name, suffix,
+                        labels, *(const uint64_t *)p);
+        break;
+    case EXPORTER_U32:
+        exporter_printf(b, "jupiter_%s%s{%s} %" PRIu32 "\n", f->name, suffix,
+                        labels, *(const uint32_t *)p);
+        break;
+    default:
+        exporter_printf(b, "jupiter_%s%s{%s} %" PRId32 "\n", f->name, suffix,
+                        labels, *(const int32_t *)p);
+        break;
+    }
+}
+
+/* One family per field, a sample per entry of a table of the region. */
+static void
+exporter_table(struct exporter_buf *b, struct metrics_shm_header *h,
+               const struct exporter_field *fields, uint32_t nb_fields,
+               uint64_t off, uint32_t size, uint32_t nb,
+               exporter_labels_t labels_fn) {
+    const struct exporter_field *f;
+    const char *entry;
+    char labels[256], dir_labels[300];
+    uint32_t i, j, dir;
+
+    for (j = 0; j < nb_fields; j++) {
+        f = &fields[j];
+        exporter_family(b, f);
+        for (i = 0; i < nb; i++) {
+            entry = (const char *)h + off + (uint64_t)i * size;
+            labels_fn(h, entry, labels, sizeof(labels));
+            if (f->dirs == NULL) {
+                exporter_sample(b, f, labels, entry + f->off);
+                continue;
+            }
+            for (dir = 0; dir < METRICS_SHM_DIRS; dir++) {
+                snprintf(dir_labels, sizeof(dir_labels), "%s,dir=\"%s\"",
+                         labels, f->dirs[dir]);
+                exporter_sample(b, f, dir_labels,
+                                entry + f->off + dir * sizeof(uint64_t));
+            }
+        }
+    }
+}
+
+static void
+exporter_lcore_labels(__attribute__((unused)) struct metrics_shm_header *h,
+                      const void *entry, char *buf, size_t len) {
+    const struct metrics_shm_lcore *l = entry;
+
+    snprintf(buf, len, "lcore=\"%u\"", l->lcore_id);
+}
+
+static void
+exporter_port_labels(__attribute__((unused)) struct metrics_shm_header *h,
+                     const void *entry, char *buf, size_t len) {
+    const struct metrics_shm_port *p = entry;
+
+    snprintf(buf, len, "dev=\"%s\",port=\"%u\"", p->name, p->port_id);
+}
+
+static const char *
+exporter_proto_name(uint8_t proto) {
+    if (proto == IPPROTO_TCP)
+        return "tcp";
+    if (proto == IPPROTO_UDP)
+        return "udp";
+    return "oth";
+}
+
+static int
+exporter_vs_labels_fmt(const struct metrics_shm_vs *vs, char *buf,
+                       size_t len) {
+    char vip[32];
+
+    ipv4_addr_tostring(vs->vip, vip, sizeof(vip));
+    return snprintf(buf, len, "vip=\"%s\",vport=\"%u\",proto=\"%s\"", vip,
+                    rte_be_to_cpu_16(vs->vport),
+                    exporter_proto_name(vs->proto));
+}
+
+static void
+exporter_vs_labels(__attribute__((unused)) struct metrics_shm_header *h,
+                   const void *entry, char *buf, size_t len) {
+    exporter_vs_labels_fmt(entry, buf, len);
+}
+
+static void
+exporter_rs_labels(struct metrics_shm_header *h, const void *entry,
+                   char *buf, size_t len) {
+    const struct metrics_shm_rs *rs = entry;
+    char rip[32];
+    int n;
+
+    n = exporter_vs_labels_fmt(METRICS_SHM_ENTRY(h, vs, rs->vs), buf, len);
+    if (n < 0 || (size_t)n >= len)
+        return;
+    ipv4_addr_tostring(rs->rip, rip, sizeof(rip));
+    snprintf(buf + n, len - n, ",rip=\"%s\",rport=\"%u\"", rip,
+             rte_be_to_cpu_16(rs->rport));
+}
+
+static void
+exporter_conn_tables(struct exporter_buf *b,
+                     struct metrics_shm_header *h) {
+    const struct metrics_shm_lcore *l;
+    uint32_t i;
+
+    exporter_printf(b, "# TYPE jupiter_conn_table_used gauge\n"
+                       "# HELP jupiter_conn_table_used Connections of the "
+                       "table of a worker.\n");
+    for (i = 0; i < h->nb_lcores; i++) {
+        l = METRICS_SHM_ENTRY(h, lcore, i);
+        if (!l->worker)
+            continue;
+        exporter_printf(b,
+                        "jupiter_conn_table_used{lcore=\"%u\",proto=\"tcp\"} "
+                        "%u\njupiter_conn_table_used{lcore=\"%u\","
+                        "proto=\"udp\"} %u\n",
+                        l->lcore_id, l->tcp_conns, l->lcore_id, l->udp_conns);
+    }
+    exporter_printf(b, "# TYPE jupiter_conn_table_size gauge\n"
+                       "# HELP jupiter_conn_table_size Connections the table "
+                       "of a worker holds at most.\n");
+    for (i = 0; i < h->nb_lcores; i++) {
+        l = METRICS_SHM_ENTRY(h, lcore, i);
+        if (!l->worker)
+            continue;
+        exporter_printf(b,
+                        "jupiter_conn_table_size{lcore=\"%u\",proto=\"tcp\"} "
+                        "%u\njupiter_conn_table_size{lcore=\"%u\","
+                        "proto=\"udp\"} %u\n",
+                        l->lcore_id, l->tcp_conns_max, l->lcore_id,
+                        l->udp_conns_max);
+    }
+}
+
+/* Local ports of each worker summed over its addresses, as laddr/stats. */
+static void
+exporter_laddrs(struct exporter_buf *b) {
+    static const char *const protos[] = {
+        [LB_IPPROTO_TCP] = "tcp",
+        [LB_IPPROTO_UDP] = "udp",
+    };
+    struct lb_laddr_list *list;
+    struct lb_device *dev;
+    uint32_t lcore_id, i, type, avail;
+    uint64_t nb_avail, nb_inuse;
+    uint16_t devid;
+    int inuse;
+
+    for (inuse = 0; inuse < 2; inuse++) {
+        exporter_printf(b,
+                        "# TYPE jupiter_laddr_lports_%s gauge\n"
+                        "# HELP jupiter_laddr_lports_%s Local ports %s.\n",
+                        inuse ? "inuse" : "avail", inuse ? "inuse" : "avail",
+                        inuse ? "in use" : "available");
+        LB_DEVICE_FOREACH(devid, dev) {
+            RTE_LCORE_FOREACH_SLAVE(lcore_id) {
+                list = &dev->laddr_list[lcore_id];
+                if (list->nb == 0)
+                    continue;
+                for (type = LB_IPPROTO_TCP; type <= LB_IPPROTO_UDP; type++) {
+                    nb_avail = 0;
+                    nb_inuse = 0;
+                    for (i = 0; i < list->nb; i++) {
+                        if (list->entries[i].ports[type] == NULL)
+                            continue;
+                        avail = rte_ring_count(list->entries[i].ports[type]);
+                        nb_avail += avail;
+                        nb_inuse += list->entries[i].nb_ports[type] - avail;
+                    }
+                    exporter_printf(
+                        b,
+                        "jupiter_laddr_lports_%s{dev=\"%s\",lcore=\"%u\","
+                        "proto=\"%s\"} %" PRIu64 "\n",
+                        inuse ? "inuse" : "avail", dev->name, lcore_id,
+                        protos[type], inuse ? nb_inuse : nb_avail);
+                }
+            }
+        }
+    }
+}
+
+static void
+exporter_drops(struct exporter_buf *b) {
+    uint64_t pkts;
+    uint32_t lcore_id, r;
+
+    exporter_printf(b, "# TYPE jupiter_drop_packets counter\n"
+                       "# HELP jupiter_drop_packets Packets dropped by "
+                       "reason.\n");
+    for (r = 0; r < LB_DROP_MAX; r++) {
+        pkts = 0;
+        RTE_LCORE_FOREACH(lcore_id) {
+            pkts += lb_drop_lcores[lcore_id].pkts[r];
+        }
+        exporter_printf(b, "jupiter_drop_packets_total{reason=\"%s\"} "
+                           "%" PRIu64 "\n",
+                        lb_drop_name(r), pkts);
+    }
+}
+
+static void
+exporter_render(struct exporter_buf *b) {
+    struct metrics_shm_header *h = exporter_region;
+
+    lb_metrics_region_update(h);
+    exporter_table(b, h, exporter_lcore_fields,
+                   RTE_DIM(exporter_lcore_fields), h->lcore_off,
+                   h->lcore_size, h->nb_lcores, exporter_lcore_labels);
+    exporter_conn_tables(b, h);
+    exporter_table(b, h, exporter_port_fields, RTE_DIM(exporter_port_fields),
+                   h->port_off, h->port_size, h->nb_ports,
+                   exporter_port_labels);
+    exporter_table(b, h, exporter_vs_fields, RTE_DIM(exporter_vs_fields),
+                   h->vs_off, h->vs_size, h->nb_vs, exporter_vs_labels);
+    exporter_table(b, h, exporter_rs_fields, RTE_DIM(exporter_rs_fields),
+                   h->rs_off, h->rs_size, h->nb_rs, exporter_rs_labels);
+    exporter_laddrs(b);
+    exporter_drops(b);
+    exporter_printf(b, "# EOF\n");
+}
+
+static void
+exporter_client_close(struct exporter_client *c) {
+    close(c->fd);
+    free(c->body.data);
+    memset(c, 0, sizeof(*c));
+    c->fd = -1;
+}
+
+static void
+exporter_respond(struct exporter_client *c) {
+    uint64_t start = rte_rdtsc();
+
+    if (strncmp(c->req, "GET /metrics ", 13) != 0 &&
+        strncmp(c->req, "GET / ", 6) != 0) {
+        c->head_len = snprintf(c->head, sizeof(c->head),
+                               "HTTP/1.0 404 Not Found\r\n"
+                               "Content-Length: 0\r\n"
+                               "Connection: close\r\n\r\n");
+        return;
+    }
+    exporter_render(&c->body);
+    if (c->body.error) {
+        c->body.len = 0;
+        c->head_len = snprintf(c->head, sizeof(c->head),
+                               "HTTP/1.0 500 Internal Server Error\r\n"
+                               "Content-Length: 0\r\n"
+                               "Connection: close\r\n\r\n");
+        return;
+    }
+    c->head_len = snprintf(c->head, sizeof(c->head),
+                           "HTTP/1.0 200 OK\r\n"
+                           "Content-Type: application/openmetrics-text; "
+                           "version=1.0.0; charset=utf-8\r\n"
+                           "Content-Length: %zu\r\n"
+                           "Connection: close\r\n\r\n",
+                           c->body.len);
+    exporter_scrapes++;
+    exporter_scrape_cycles = rte_rdtsc() - start;
+}
+
+/* Returns 1 when the client is done with. */
+static int
+exporter_client_run(struct exporter_client *c) {
+    size_t total;
+    ssize_t n;
+
+    if (c->head_len == 0) {
+        n = recv(c->fd, c->req + c->req_len, sizeof(c->req) - 1 - c->req_len,
+                 MSG_DONTWAIT);
+        if (n == 0)
+            return 1;
+        if (n < 0)
+            return errno != EAGAIN && errno != EWOULDBLOCK;
+        c->req_len += n;
+        c->req[c->req_len] = '\0';
+        if (strstr(c->req, "\r\n\r\n") == NULL &&
+            c->req_len < sizeof(c->req) - 1)
+            return 0;
+        exporter_respond(c);
+    }
+
+    total = c->head_len + c->body.len;
+    while (c->sent < total) {
+        if (c->sent < c->head_len)
+            n = send(c->fd, c->head + c->sent, c->head_len - c->sent,
+                     MSG_DONTWAIT | MSG_NOSIGNAL);
+        else
+            n = send(c->fd, c->body.data + c->sent - c->head_len,
+                     total - c->sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n < 0)
+            return errno != EAGAIN && errno != EWOULDBLOCK;
+        c->sent += n;
+    }
+    return 1;
+}
+
+static void
+exporter_timer_cb(__attribute__((unused)) struct rte_timer *t,
+                  __attribute__((unused)) void *arg) {
+    struct exporter_client *c;
+    uint64_t now = rte_rdtsc();
+    uint32_t i;
+    int fd;
+
+    for (i = 0; i < EXPORTER_MAX_CLIENTS; i++) {
+        c = &exporter_clients[i];
+        if (c->fd < 0) {
+            fd = accept(exporter_fd, NULL, NULL);
+            if (fd < 0)
+                continue;
+            c->fd = fd;
+            c->start_tsc = now;
+        }
+        if (exporter_client_run(c) ||
+            now - c->start_tsc > MS_TO_CYCLES(EXPORTER_TIMEOUT_MS))
+            exporter_client_close(c);
+    }
+}
+
+static int
+exporter_listen(const char *listen_addr) {
+    struct sockaddr_un un;
+    struct sockaddr_in in;
+    struct sockaddr *sa;
+    socklen_t salen;
+    uint32_t ip;
+    uint16_t port;
+    int fd, on = 1;
+
+    if (listen_addr[0] == '/') {
+        memset(&un, 0, sizeof(un));
+        un.sun_family = AF_UNIX;
+        if (strlen(listen_addr) >= sizeof(un.sun_path))
+            return -1;
+        strcpy(un.sun_path, listen_addr);
+        unlink(listen_addr);
+        sa = (struct sockaddr *)&un;
+        salen = sizeof(un);
+    } else {
+        if (parse_ipv4_port(listen_addr, &ip, &port) < 0)
+            return -1;
+        memset(&in, 0, sizeof(in));
+        in.sin_family = AF_INET;
+        in.sin_addr.s_addr = ip;
+        in.sin_port = port;
+        sa = (struct sockaddr *)&in;
+        salen = sizeof(in);
+    }
+
+    fd = socket(sa->sa_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (fd < 0)
+        return -1;
+    if (sa->sa_family == AF_INET)
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (bind(fd, sa, salen) < 0 || listen(fd, EXPORTER_MAX_CLIENTS) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int
+lb_exporter_init(void) {
+    struct lb_exporter_conf *conf = &lb_cfg->exporter;
+    uint64_t size;
+    uint32_t i;
+
+    if (conf->listen[0] == '\0')
+        return 0;
+
+    size = lb_metrics_region_size();
+    exporter_region = calloc(1, size);
+    if (exporter_region == NULL) {
+        RTE_LOG(ERR, USER1, "%s(): Not enough memory.\n", __func__);
+        return -1;
+    }
+    lb_metrics_region_init(exporter_region, size, 0);
+
+    exporter_fd = exporter_listen(conf->listen);
+    if (exporter_fd < 0) {
+        RTE_LOG(ERR, USER1, "%s(): Cannot listen on %s, %s.\n", __func__,
+                conf->listen, strerror(errno));
+        return -1;
+    }
+    for (i = 0; i < EXPORTER_MAX_CLIENTS; i++)
+        exporter_clients[i].fd = -1;
+
+    rte_timer_init(&exporter_timer);
+    return rte_timer_reset(&exporter_timer, MS_TO_CYCLES(EXPORTER_POLL_MS),
+                           PERIODICAL, rte_get_master_lcore(),
+                           exporter_timer_cb, NULL);
+}
+
+static void
+exporter_stats_cmd_cb(int fd, __attribute__((unused)) char *argv[],
+                      __attribute__((unused)) int argc) {
+    if (exporter_fd < 0) {
+        unixctl_command_reply(fd, "enabled: no\n");
+        return;
+    }
+    unixctl_command_reply(fd, "enabled: yes\n");
+    unixctl_command_reply(fd, NORM_KV_S_FMT("listen", "\n"),
+                          lb_cfg->exporter.listen);
+    unixctl_command_reply(fd, NORM_KV_64_FMT("scrapes", "\n"),
+                          exporter_scrapes);
+    unixctl_command_reply(fd, NORM_KV_64_FMT("scrape_us", "\n"),
+                          exporter_scrape_cycles * US_PER_S / rte_get_tsc_hz());
+}
+
+UNIXCTL_CMD_REGISTER("exporter/stats", "",
+                     "Show the state of the OpenMetrics exporter.", 0, 0,
+                     exporter_stats_cmd_cb);
@@ -0,0 +1,8 @@
+/* Copyright (c) 2018. TIG developer. */
+
+#ifndef __LB_EXPORTER_H__
+#define __LB_EXPORTER_H__
+
+int lb_exporter_init(void);
+
+#endif
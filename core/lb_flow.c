@@ -0,0 +1,520 @@
+/* Copyright (c) 2018. TIG developer. */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <rte_byteorder.h>
+#include <rte_ethdev.h>
+#include <rte_flow.h>
+#include <rte_ip.h>
+#include <rte_log.h>
+#include <rte_tcp.h>
+#include <rte_udp.h>
+
+#include <unixctl_command.h>
+
+#include "lb_flow.h"
+#include "lb_format.h"
+#include "lb_kni.h"
+#include "lb_parser.h"
+
+#define LB_FLOW_MAX_RULES 4096
+
+/* Drop rules match before the steering ones, lower is first. */
+#define LB_FLOW_PRIO_DROP 0
+#define LB_FLOW_PRIO_STEER 1
+
+/*
+ * NIC steering through rte_flow. The rules are created by the master thread
+ * only, at init and from the commands, so the table takes no lock.
+ */
+enum {
+    LB_FLOW_T_LADDR = 0, /* Local address to its queue. */
+    LB_FLOW_T_LPORT,     /* Local port range to its queue. */
+    LB_FLOW_T_VIP,       /* VIP spread over all queues. */
+    LB_FLOW_T_DROP,      /* Source prefix dropped by the NIC. */
+};
+
+struct lb_flow_rule {
+    struct rte_flow *flow;
+    uint16_t port_id;
+    uint8_t type;
+    uint8_t proto;
+    uint32_t ip;
+    uint32_t mask;
+    uint16_t min, max;
+    uint16_t rxq_id;
+    uint32_t refcnt;
+};
+
+static struct lb_flow_rule lb_flow_rules[LB_FLOW_MAX_RULES];
+static uint32_t lb_flow_nb_rules;
+
+/* Ports whose local addresses are steered by rte_flow. */
+static uint8_t lb_flow_ports[RTE_MAX_ETHPORTS];
+
+static const char *const flow_type_names[] = {
+    [LB_FLOW_T_LADDR] = "laddr",
+    [LB_FLOW_T_LPORT] = "lport",
+    [LB_FLOW_T_VIP] = "vip",
+    [LB_FLOW_T_DROP] = "drop",
+};
+
+/*
+ * Steering rules go below the drop rules. PMDs without priorities refuse
+ * the steering rules rather than put them level with the drop rules, the
+ * caller falls back to the legacy filters or to software steering.
+ */
+static struct rte_flow *
+flow_create(uint16_t port_id, uint32_t priority,
+            const struct rte_flow_item pattern[],
+            const struct rte_flow_action actions[]) {
+    struct rte_flow_attr attr;
+    struct rte_flow_error error;
+    struct rte_flow *flow;
+    int rc;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.ingress = 1;
+    attr.priority = priority;
+
+    rc = rte_flow_validate(port_id, &attr, pattern, actions, &error);
+    if (rc < 0) {
+        RTE_LOG(DEBUG, USER1, "%s(): Port%u refuses the flow, %s.\n",
+                __func__, port_id,
+                error.message ? error.message : "unknown reason");
+        return NULL;
+    }
+
+    flow = rte_flow_create(port_id, &attr, pattern, actions, &error);
+    if (flow == NULL) {
+        RTE_LOG(ERR, USER1, "%s(): Port%u create flow failed, %s.\n",
+                __func__, port_id,
+                error.message ? error.message : "unknown reason");
+    }
+    return flow;
+}
+
+static struct lb_flow_rule *
+flow_rule_find(uint16_t port_id, uint8_t type, uint32_t ip, uint32_t mask) {
+    struct lb_flow_rule *rule;
+    uint32_t i;
+
+    for (i = 0; i < lb_flow_nb_rules; i++) {
+        rule = &lb_flow_rules[i];
+        if (rule->port_id == port_id && rule->type == type && rule->ip == ip &&
+            rule->mask == mask)
+            return rule;
+    }
+    return NULL;
+}
+
+static struct lb_flow_rule *
+flow_rule_alloc(void) {
+    struct lb_flow_rule *rule;
+
+    if (lb_flow_nb_rules == LB_FLOW_MAX_RULES) {
+        RTE_LOG(ERR, USER1, "%s(): No space in the flow table.\n", __func__);
+        return NULL;
+    }
+    rule = &lb_flow_rules[lb_flow_nb_rules++];
+    memset(rule, 0, sizeof(*rule));
+    return rule;
+}
+
+static void
+flow_rule_free(struct lb_flow_rule *rule) {
+    struct rte_flow_error error;
+
+    if (rte_flow_destroy(rule->port_id, rule->flow, &error) < 0) {
+        RTE_LOG(ERR, USER1, "%s(): Port%u destroy flow failed, %s.\n",
+                __func__, rule->port_id,
+                error.message ? error.message : "unknown reason");
+    }
+    *rule = lb_flow_rules[--lb_flow_nb_rules];
+}
+
+static void
+flow_ipv4_dst_item(struct rte_flow_item *item, struct rte_flow_item_ipv4 *spec,
+                   struct rte_flow_item_ipv4 *mask, uint32_t ip) {
+    memset(spec, 0, sizeof(*spec));
+    memset(mask, 0, sizeof(*mask));
+    spec->hdr.dst_addr = ip;
+    mask->hdr.dst_addr = UINT32_MAX;
+    item->type = RTE_FLOW_ITEM_TYPE_IPV4;
+    item->spec = spec;
+    item->last = NULL;
+    item->mask = mask;
+}
+
+int
+lb_flow_laddr_add(uint16_t port_id, uint32_t lip, uint16_t rxq_id) {
+    struct rte_flow_item pattern[3];
+    struct rte_flow_action actions[2];
+    struct rte_flow_item_ipv4 ip_spec, ip_mask;
+    struct rte_flow_action_queue queue;
+    struct lb_flow_rule *rule;
+    struct rte_flow *flow;
+
+    memset(pattern, 0, sizeof(pattern));
+    memset(actions, 0, sizeof(actions));
+    pattern[0].type = RTE_FLOW_ITEM_TYPE_ETH;
+    flow_ipv4_dst_item(&pattern[1], &ip_spec, &ip_mask, lip);
+    pattern[2].type = RTE_FLOW_ITEM_TYPE_END;
+
+    queue.index = rxq_id;
+    actions[0].type = RTE_FLOW_ACTION_TYPE_QUEUE;
+    actions[0].conf = &queue;
+    actions[1].type = RTE_FLOW_ACTION_TYPE_END;
+
+    flow = flow_create(port_id, LB_FLOW_PRIO_STEER, pattern, actions);
+    if (flow == NULL)
+        return -1;
+
+    rule = flow_rule_alloc();
+    if (rule == NULL) {
+        rte_flow_destroy(port_id, flow, NULL);
+        return -1;
+    }
+    rule->flow = flow;
+    rule->port_id = port_id;
+    rule->type = LB_FLOW_T_LADDR;
+    rule->ip = lip;
+    rule->mask = UINT32_MAX;
+    rule->rxq_id = rxq_id;
+    lb_flow_ports[port_id] = 1;
+
+    RTE_LOG(INFO, USER1,
+            "%s(): Port%u add flow, dst-ip:" IPv4_BE_FMT ", rxq:%u\n",
+            __func__, port_id, IPv4_BE_ARG(lip), rxq_id);
+    return 0;
+}
+
+/*
+ * The ports [min, max) of a partitioned local address, as a spec/last
+ * range on the destination port. Fewer PMDs take ranges than addresses,
+ * the caller keeps software steering behind these rules.
+ */
+int
+lb_flow_lport_add(uint16_t port_id, uint32_t lip, uint8_t proto, uint16_t min,
+                  uint16_t max, uint16_t rxq_id) {
+    struct rte_flow_item pattern[4];
+    struct rte_flow_action actions[2];
+    struct rte_flow_item_ipv4 ip_spec, ip_mask;
+    struct rte_flow_item_tcp tcp_spec, tcp_last, tcp_mask;
+    struct rte_flow_item_udp udp_spec, udp_last, udp_mask;
+    struct rte_flow_action_queue queue;
+    struct lb_flow_rule *rule;
+    struct rte_flow *flow;
+
+    memset(pattern, 0, sizeof(pattern));
+    memset(actions, 0, sizeof(actions));
+    pattern[0].type = RTE_FLOW_ITEM_TYPE_ETH;
+    flow_ipv4_dst_item(&pattern[1], &ip_spec, &ip_mask, lip);
+    ip_spec.hdr.next_proto_id = proto;
+    ip_mask.hdr.next_proto_id = UINT8_MAX;
+    if (proto == IPPROTO_TCP) {
+        memset(&tcp_spec, 0, sizeof(tcp_spec));
+        memset(&tcp_last, 0, sizeof(tcp_last));
+        memset(&tcp_mask, 0, sizeof(tcp_mask));
+        tcp_spec.hdr.dst_port = rte_cpu_to_be_16(min);
+        tcp_last.hdr.dst_port = rte_cpu_to_be_16(max - 1);
+        tcp_mask.hdr.dst_port = UINT16_MAX;
+        pattern[2].type = RTE_FLOW_ITEM_TYPE_TCP;
+        pattern[2].spec = &tcp_spec;
+        pattern[2].last = &tcp_last;
+        pattern[2].mask = &tcp_mask;
+    } else {
+        memset(&udp_spec, 0, sizeof(udp_spec));
+        memset(&udp_last, 0, sizeof(udp_last));
+        memset(&udp_mask, 0, sizeof(udp_mask));
+        udp_spec.hdr.dst_port = rte_cpu_to_be_16(min);
+        udp_last.hdr.dst_port = rte_cpu_to_be_16(max - 1);
+        udp_mask.hdr.dst_port = UINT16_MAX;
+        pattern[2].type = RTE_FLOW_ITEM_TYPE_UDP;
+        pattern[2].spec = &udp_spec;
+        pattern[2].last = &udp_last;
+        pattern[2].mask = &udp_mask;
+    }
+    pattern[3].type = RTE_FLOW_ITEM_TYPE_END;
+
+    queue.index = rxq_id;
+    actions[0].type = RTE_FLOW_ACTION_TYPE_QUEUE;
+    actions[0].conf = &queue;
+    actions[1].type = RTE_FLOW_ACTION_TYPE_END;
+
+    flow = flow_create(port_id, LB_FLOW_PRIO_STEER, pattern, actions);
+    if (flow == NULL)
+        return -1;
+
+    rule = flow_rule_alloc();
+    if (rule == NULL) {
+        rte_flow_destroy(port_id, flow, NULL);
+        return -1;
+    }
+    rule->flow = flow;
+    rule->port_id = port_id;
+    rule->type = LB_FLOW_T_LPORT;
+    rule->proto = proto;
+    rule->ip = lip;
+    rule->mask = UINT32_MAX;
+    rule->min = min;
+    rule->max = max;
+    rule->rxq_id = rxq_id;
+    lb_flow_ports[port_id] = 1;
+    return 0;
+}
+
+static struct rte_flow *
+flow_vip_create(uint16_t port_id, uint32_t vip) {
+    struct rte_flow_item pattern[3];
+    struct rte_flow_action actions[2];
+    struct rte_flow_item_ipv4 ip_spec, ip_mask;
+    struct rte_eth_dev_info info;
+    struct rte_eth_rss_conf rss_conf;
+    union {
+        struct rte_flow_action_rss rss;
+        uint8_t buf[sizeof(struct rte_flow_action_rss) +
+                    sizeof(uint16_t) * RTE_MAX_QUEUES_PER_PORT];
+    } action;
+    uint16_t i;
+
+    rte_eth_dev_info_get(port_id, &info);
+    memset(&rss_conf, 0, sizeof(rss_conf));
+    rss_conf.rss_hf = ETH_RSS_PROTO_MASK & info.flow_type_rss_offloads;
+    action.rss.rss_conf = &rss_conf;
+    action.rss.num = info.nb_rx_queues;
+    for (i = 0; i < info.nb_rx_queues; i++)
+        action.rss.queue[i] = i;
+
+    memset(pattern, 0, sizeof(pattern));
+    memset(actions, 0, sizeof(actions));
+    pattern[0].type = RTE_FLOW_ITEM_TYPE_ETH;
+    flow_ipv4_dst_item(&pattern[1], &ip_spec, &ip_mask, vip);
+    pattern[2].type = RTE_FLOW_ITEM_TYPE_END;
+
+    actions[0].type = RTE_FLOW_ACTION_TYPE_RSS;
+    actions[0].conf = &action.rss;
+    actions[1].type = RTE_FLOW_ACTION_TYPE_END;
+
+    return flow_create(port_id, LB_FLOW_PRIO_STEER, pattern, actions);
+}
+
+/*
+ * Client traffic to a VIP is spread over all queues by an explicit RSS
+ * group, so it never depends on what the default RSS of the PMD leaves
+ * once the steering rules exist. A VIP shared by several services is
+ * referenced once per service.
+ */
+void
+lb_flow_vip_get(uint32_t vip) {
+    struct lb_flow_rule *rule;
+    struct rte_flow *flow;
+    uint16_t port_id;
+
+    for (port_id = 0; port_id < RTE_MAX_ETHPORTS; port_id++) {
+        if (!lb_flow_ports[port_id])
+            continue;
+        rule = flow_rule_find(port_id, LB_FLOW_T_VIP, vip, UINT32_MAX);
+        if (rule != NULL) {
+            rule->refcnt++;
+            continue;
+        }
+        flow = flow_vip_create(port_id, vip);
+        if (flow == NULL) {
+            RTE_LOG(WARNING, USER1,
+                    "%s(): Port%u cannot add RSS flow, vip:" IPv4_BE_FMT ".\n",
+                    __func__, port_id, IPv4_BE_ARG(vip));
+            continue;
+        }
+        rule = flow_rule_alloc();
+        if (rule == NULL) {
+            rte_flow_destroy(port_id, flow, NULL);
+            continue;
+        }
+        rule->flow = flow;
+        rule->port_id = port_id;
+        rule->type = LB_FLOW_T_VIP;
+        rule->ip = vip;
+        rule->mask = UINT32_MAX;
+        rule->refcnt = 1;
+    }
+}
+
+void
+lb_flow_vip_put(uint32_t vip) {
+    struct lb_flow_rule *rule;
+    uint16_t port_id;
+
+    for (port_id = 0; port_id < RTE_MAX_ETHPORTS; port_id++) {
+        if (!lb_flow_ports[port_id])
+            continue;
+        rule = flow_rule_find(port_id, LB_FLOW_T_VIP, vip, UINT32_MAX);
+        if (rule != NULL && --rule->refcnt == 0)
+            flow_rule_free(rule);
+    }
+}
+
+static struct rte_flow *
+flow_drop_create(uint16_t port_id, uint32_t ip, uint32_t mask) {
+    struct rte_flow_item pattern[3];
+    struct rte_flow_action actions[2];
+    struct rte_flow_item_ipv4 ip_spec, ip_mask;
+
+    memset(pattern, 0, sizeof(pattern));
+    memset(actions, 0, sizeof(actions));
+    memset(&ip_spec, 0, sizeof(ip_spec));
+    memset(&ip_mask, 0, sizeof(ip_mask));
+    ip_spec.hdr.src_addr = ip;
+    ip_mask.hdr.src_addr = mask;
+    pattern[0].type = RTE_FLOW_ITEM_TYPE_ETH;
+    pattern[1].type = RTE_FLOW_ITEM_TYPE_IPV4;
+    pattern[1].spec = &ip_spec;
+    pattern[1].mask = &ip_mask;
+    pattern[2].type = RTE_FLOW_ITEM_TYPE_END;
+
+    actions[0].type = RTE_FLOW_ACTION_TYPE_DROP;
+    actions[1].type = RTE_FLOW_ACTION_TYPE_END;
+
+    return flow_create(port_id, LB_FLOW_PRIO_DROP, pattern, actions);
+}
+
+/* UNIXCTL COMMANDS */
+
+static int
+flow_prefix_parse(char *token, uint32_t *ip, uint32_t *mask) {
+    struct in_addr addr;
+    char *slash;
+    uint8_t depth = 32;
+
+    slash = strchr(token, '/');
+    if (slash != NULL) {
+        *slash = '\0';
+        if (parser_read_uint8(&depth, slash + 1) < 0 || depth > 32 ||
+            depth == 0)
+            return -1;
+    }
+    if (parse_ipv4_addr(token, &addr) < 0)
+        return -1;
+
+    *mask = rte_cpu_to_be_32(UINT32_MAX << (32 - depth));
+    *ip = addr.s_addr & *mask;
+    return 0;
+}
+
+static void
+flow_drop_cmd_cb(int fd, char *argv[], __attribute((unused)) int argc) {
+    struct lb_flow_rule *rule;
+    struct rte_flow *flow;
+    uint32_t ip, mask, nb = 0;
+    uint16_t port_id;
+    int add;
+
+    if (strcmp(argv[0], "add") == 0) {
+        add = 1;
+    } else if (strcmp(argv[0], "del") == 0) {
+        add = 0;
+    } else {
+        unixctl_command_reply_error(fd, "Invalid parameter: %s.\n", argv[0]);
+        return;
+    }
+    if (flow_prefix_parse(argv[1], &ip, &mask) < 0) {
+        unixctl_command_reply_error(fd, "Invalid parameter: %s.\n", argv[1]);
+        return;
+    }
+
+    for (port_id = 0; port_id < RTE_MAX_ETHPORTS; port_id++) {
+        if (!rte_eth_dev_is_valid_port(port_id) || lb_kni_is_port(port_id))
+            continue;
+        rule = flow_rule_find(port_id, LB_FLOW_T_DROP, ip, mask);
+        if (!add) {
+            if (rule != NULL) {
+                flow_rule_free(rule);
+                nb++;
+            }
+            continue;
+        }
+        if (rule != NULL)
+            continue;
+        flow = flow_drop_create(port_id, ip, mask);
+        if (flow == NULL)
+            continue;
+        rule = flow_rule_alloc();
+        if (rule == NULL) {
+            rte_flow_destroy(port_id, flow, NULL);
+            continue;
+        }
+        rule->flow = flow;
+        rule->port_id = port_id;
+        rule->type = LB_FLOW_T_DROP;
+        rule->ip = ip;
+        rule->mask = mask;
+        nb++;
+    }
+
+    if (add && nb == 0)
+        unixctl_command_reply_error(fd, "No port takes the drop rule.\n");
+}
+
+UNIXCTL_CMD_REGISTER("flow/drop", "add|del IP[/DEPTH].",
+                     "Drop the packets from a source prefix in the NIC.", 2, 2,
+                     flow_drop_cmd_cb);
+
+static void
+flow_list_cmd_cb(int fd, char *argv[], int argc) {
+    struct lb_flow_rule *rule;
+    uint32_t i;
+    int json_fmt = 0;
+
+    if (argc > 0) {
+        if (strcmp(argv[0], "--json") != 0) {
+            unixctl_command_reply_error(fd, "Invalid parameter: %s.\n",
+                                        argv[0]);
+            return;
+        }
+        json_fmt = 1;
+    }
+
+    if (json_fmt)
+        unixctl_command_reply(fd, "[");
+    else
+        unixctl_command_reply(fd, "port  type   ip                  rxq   "
+                                  "ports\n");
+    for (i = 0; i < lb_flow_nb_rules; i++) {
+        char ip[32], buf[48];
+
+        rule = &lb_flow_rules[i];
+        ipv4_addr_tostring(rule->ip, ip, sizeof(ip));
+        snprintf(buf, sizeof(buf), "%s/%u", ip,
+                 __builtin_popcount(rule->mask));
+        if (json_fmt) {
+            unixctl_command_reply(fd, i == 0 ? "{" : ",{");
+            unixctl_command_reply(fd, JSON_KV_32_FMT("port", ","),
+                                  rule->port_id);
+            unixctl_command_reply(fd, JSON_KV_S_FMT("type", ","),
+                                  flow_type_names[rule->type]);
+            unixctl_command_reply(fd, JSON_KV_S_FMT("ip", ","), buf);
+            unixctl_command_reply(fd, JSON_KV_32_FMT("rxq", ","),
+                                  rule->rxq_id);
+            unixctl_command_reply(fd, JSON_KV_32_FMT("min_port", ","),
+                                  rule->min);
+            unixctl_command_reply(fd, JSON_KV_32_FMT("max_port", "}"),
+                                  rule->max);
+        } else if (rule->type == LB_FLOW_T_LPORT) {
+            unixctl_command_reply(fd, "%-4u  %-5s  %-18s  %-4u  %s %u-%u\n",
+                                  rule->port_id, flow_type_names[rule->type],
+                                  buf, rule->rxq_id,
+                                  rule->proto == IPPROTO_TCP ? "tcp" : "udp",
+                                  rule->min, rule->max - 1);
+        } else {
+            unixctl_command_reply(fd, "%-4u  %-5s  %-18s  %-4u  -\n",
+                                  rule->port_id, flow_type_names[rule->type],
+                                  buf, rule->rxq_id);
+        }
+    }
+    if (json_fmt)
+        unixctl_command_reply(fd, "]\n");
+}
+
+UNIXCTL_CMD_REGISTER("flow/list", "[--json].", "List the NIC flow rules.", 0, 1,
+                     flow_list_cmd_cb);
@@ -0,0 +1,14 @@
+/* Copyright (c) 2018. TIG developer. */
+
+#ifndef __LB_FLOW_H__
+#define __LB_FLOW_H__
+
+#include <stdint.h>
+
+int lb_flow_laddr_add(uint16_t port_id, uint32_t lip, uint16_t rxq_id);
+int lb_flow_lport_add(uint16_t port_id, uint32_t lip, uint8_t proto,
+                      uint16_t min, uint16_t max, uint16_t rxq_id);
+void lb_flow_vip_get(uint32_t vip);
+void lb_flow_vip_put(uint32_t vip);
+
+#endif
@@ -0,0 +1,529 @@
+/* Copyright (c) 2018. TIG developer. */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <rte_byteorder.h>
+#include <rte_cycles.h>
+#include <rte_errno.h>
+#include <rte_lcore.h>
+#include <rte_log.h>
+#include <rte_mempool.h>
+#include <rte_ring.h>
+
+#include <unixctl_command.h>
+
+#include "lb_clock.h"
+#include "lb_config.h"
+#include "lb_conn.h"
+#include "lb_format.h"
+#include "lb_ipfix.h"
+#include "lb_parser.h"
+#include "lb_service.h"
+
+/*
+ * One new TCP or UDP connection in sample_rate counts its packets and
+ * bytes. It queues a record of the counts on a ring of its lcore every
+ * active timeout and when it ends, the counts start over after each
+ * record. In the packet mode, one packet in sample_rate is recorded
+ * alone with the addresses of its connection. A writer thread drains the
+ * rings into IPFIX messages (RFC 7011) sent to the collector over UDP, or
+ * appended to a file. The reply counters use the reverse information
+ * elements of RFC 5103. NAT64 connections are not sampled, their client
+ * side is IPv6.
+ */
+#define IPFIX_DEFAULT_SAMPLE_RATE 1024
+#define IPFIX_DEFAULT_ACTIVE_TIMEOUT 60
+#define IPFIX_POOL_SIZE 8191
+#define IPFIX_POOL_CACHE 64
+#define IPFIX_RING_SIZE 1024
+#define IPFIX_BURST 32
+#define IPFIX_WRITER_SLEEP_US 10000
+/* Fits the path MTU of most collectors. */
+#define IPFIX_MSG_MAX 1400
+/* Messages between two exports of the template. */
+#define IPFIX_TEMPLATE_MSGS 64
+
+#define IPFIX_VERSION 10
+#define IPFIX_SET_TEMPLATE 2
+#define IPFIX_TEMPLATE_ID 256
+#define IPFIX_ENTERPRISE_BIT 0x8000
+#define IPFIX_REVERSE_PEN 29305
+
+struct ipfix_rec {
+    uint32_t cip, vip, lip, rip;
+    uint16_t cport, vport, lport, rport;
+    uint8_t proto;
+    uint32_t sampling;
+    uint32_t start, end;
+    uint64_t packets[LB_DIR_MAX];
+    uint64_t bytes[LB_DIR_MAX];
+};
+
+struct ipfix_field {
+    uint16_t id;
+    uint16_t len;
+    uint32_t pen;
+};
+
+/* The template, in the order ipfix_rec_encode() writes the fields. */
+static const struct ipfix_field ipfix_fields[] = {
+    {8, 4, 0},   /* sourceIPv4Address */
+    {12, 4, 0},  /* destinationIPv4Address */
+    {7, 2, 0},   /* sourceTransportPort */
+    {11, 2, 0},  /* destinationTransportPort */
+    {4, 1, 0},   /* protocolIdentifier */
+    {225, 4, 0}, /* postNATSourceIPv4Address */
+    {226, 4, 0}, /* postNATDestinationIPv4Address */
+    {227, 2, 0}, /* postNAPTSourceTransportPort */
+    {228, 2, 0}, /* postNAPTDestinationTransportPort */
+    {2, 8, 0},   /* packetDeltaCount */
+    {1, 8, 0},   /* octetDeltaCount */
+    {2 | IPFIX_ENTERPRISE_BIT, 8, IPFIX_REVERSE_PEN},
+    {1 | IPFIX_ENTERPRISE_BIT, 8, IPFIX_REVERSE_PEN},
+    {152, 8, 0}, /* flowStartMilliseconds */
+    {153, 8, 0}, /* flowEndMilliseconds */
+    {34, 4, 0},  /* samplingInterval */
+};
+
+uint32_t lb_ipfix_sample_rate;
+uint8_t lb_ipfix_sample_packets;
+uint32_t lb_ipfix_active_timeout;
+struct lb_ipfix_lcore lb_ipfix_lcores[RTE_MAX_LCORE];
+
+static struct rte_mempool *ipfix_mp;
+static pthread_t ipfix_writer_tid;
+static uint32_t ipfix_rec_len;
+
+/* Writer state. */
+static int ipfix_fd = -1;
+static FILE *ipfix_fp;
+static uint8_t ipfix_msg[IPFIX_MSG_MAX];
+static uint32_t ipfix_msg_len;
+static uint32_t ipfix_set_off;
+static uint32_t ipfix_msg_recs;
+static uint32_t ipfix_seq;
+static uint64_t ipfix_base_ms;
+static uint32_t ipfix_base_clock;
+static uint64_t ipfix_msgs;
+static uint64_t ipfix_records;
+static uint64_t ipfix_errors;
+
+static struct ipfix_rec *
+ipfix_rec_get(struct lb_conn *conn) {
+    struct ipfix_rec *rec;
+
+    if (rte_mempool_get(ipfix_mp, (void **)&rec) < 0) {
+        lb_ipfix_lcores[rte_lcore_id()].nomem++;
+        return NULL;
+    }
+    rec->cip = conn->cip;
+    rec->cport = conn->cport;
+    rec->vip = conn->vip;
+    rec->vport = conn->vport;
+    /* The replies bypass us, the client address reaches the rs. */
+    if (conn->laddr != NULL) {
+        rec->lip = conn->lip;
+        rec->lport = conn->lport;
+    } else {
+        rec->lip = conn->cip;
+        rec->lport = conn->cport;
+    }
+    rec->rip = conn->rip;
+    rec->rport = conn->rport;
+    rec->proto = conn->real_service->virt_service->proto;
+    rec->sampling = lb_ipfix_sample_rate;
+    return rec;
+}
+
+static void
+ipfix_rec_put(struct ipfix_rec *rec) {
+    struct lb_ipfix_lcore *il = &lb_ipfix_lcores[rte_lcore_id()];
+
+    if (rte_ring_sp_enqueue(il->ring, rec) < 0) {
+        rte_mempool_put(ipfix_mp, rec);
+        il->ring_full++;
+    }
+}
+
+/* The counts since the last record, which start over. */
+static void
+ipfix_record_counts(struct lb_conn *conn, uint32_t end) {
+    struct ipfix_rec *rec;
+
+    rec = ipfix_rec_get(conn);
+    if (rec != NULL) {
+        rec->start = conn->export_time;
+        rec->end = end;
+        rec->packets[LB_DIR_ORIGINAL] = conn->packets[LB_DIR_ORIGINAL];
+        rec->packets[LB_DIR_REPLY] = conn->packets[LB_DIR_REPLY];
+        rec->bytes[LB_DIR_ORIGINAL] = conn->bytes[LB_DIR_ORIGINAL];
+        rec->bytes[LB_DIR_REPLY] = conn->bytes[LB_DIR_REPLY];
+        ipfix_rec_put(rec);
+    }
+    memset(conn->packets, 0, sizeof(conn->packets));
+    memset(conn->bytes, 0, sizeof(conn->bytes));
+    conn->export_time = end;
+}
+
+void
+lb_ipfix_record(struct lb_conn *conn) {
+    /* Nothing new since the last active timeout record. */
+    if (conn->export_time != conn->create_time &&
+        conn->packets[LB_DIR_ORIGINAL] == 0 &&
+        conn->packets[LB_DIR_REPLY] == 0)
+        return;
+    ipfix_record_counts(conn, conn->use_time);
+}
+
+void
+lb_ipfix_record_active(struct lb_conn *conn) {
+    ipfix_record_counts(conn, LB_CLOCK());
+}
+
+void
+lb_ipfix_record_packet(struct lb_conn *conn, struct rte_mbuf *m,
+                       uint8_t dir) {
+    struct ipfix_rec *rec;
+
+    rec = ipfix_rec_get(conn);
+    if (rec == NULL)
+        return;
+    rec->start = LB_CLOCK();
+    rec->end = rec->start;
+    memset(rec->packets, 0, sizeof(rec->packets));
+    memset(rec->bytes, 0, sizeof(rec->bytes));
+    rec->packets[dir] = 1;
+    rec->bytes[dir] = m->pkt_len;
+    ipfix_rec_put(rec);
+}
+
+static inline void
+ipfix_put16(uint16_t v) {
+    v = rte_cpu_to_be_16(v);
+    memcpy(ipfix_msg + ipfix_msg_len, &v, sizeof(v));
+    ipfix_msg_len += sizeof(v);
+}
+
+static inline void
+ipfix_put32(uint32_t v) {
+    v = rte_cpu_to_be_32(v);
+    memcpy(ipfix_msg + ipfix_msg_len, &v, sizeof(v));
+    ipfix_msg_len += sizeof(v);
+}
+
+static inline void
+ipfix_put64(uint64_t v) {
+    v = rte_cpu_to_be_64(v);
+    memcpy(ipfix_msg + ipfix_msg_len, &v, sizeof(v));
+    ipfix_msg_len += sizeof(v);
+}
+
+/* Addresses and ports are kept in network order. */
+static inline void
+ipfix_put_raw(const void *p, uint32_t len) {
+    memcpy(ipfix_msg + ipfix_msg_len, p, len);
+    ipfix_msg_len += len;
+}
+
+static uint64_t
+ipfix_clock_to_ms(uint32_t clock) {
+    return ipfix_base_ms +
+           (int64_t)(int32_t)(clock - ipfix_base_clock) * MS_PER_S /
+               LB_CLOCK_HZ;
+}
+
+static void
+ipfix_set_end(void) {
+    uint16_t len = rte_cpu_to_be_16(ipfix_msg_len - ipfix_set_off);
+
+    memcpy(ipfix_msg + ipfix_set_off + 2, &len, sizeof(len));
+}
+
+static void
+ipfix_msg_begin(void) {
+    uint32_t i;
+
+    /* The header is filled by ipfix_msg_send(). */
+    ipfix_msg_len = 16;
+    ipfix_msg_recs = 0;
+
+    if (ipfix_msgs % IPFIX_TEMPLATE_MSGS == 0) {
+        ipfix_set_off = ipfix_msg_len;
+        ipfix_put16(IPFIX_SET_TEMPLATE);
+        ipfix_put16(0);
+        ipfix_put16(IPFIX_TEMPLATE_ID);
+        ipfix_put16(RTE_DIM(ipfix_fields));
+        for (i = 0; i < RTE_DIM(ipfix_fields); i++) {
+            ipfix_put16(ipfix_fields[i].id);
+            ipfix_put16(ipfix_fields[i].len);
+            if (ipfix_fields[i].id & IPFIX_ENTERPRISE_BIT)
+                ipfix_put32(ipfix_fields[i].pen);
+        }
+        ipfix_set_end();
+    }
+
+    ipfix_set_off = ipfix_msg_len;
+    ipfix_put16(IPFIX_TEMPLATE_ID);
+    ipfix_put16(0);
+}
+
+static void
+ipfix_msg_send(void) {
+    uint32_t len;
+    ssize_t n;
+
+    if (ipfix_msg_recs == 0)
+        return;
+    ipfix_set_end();
+    len = ipfix_msg_len;
+    ipfix_msg_len = 0;
+    ipfix_put16(IPFIX_VERSION);
+    ipfix_put16(len);
+    ipfix_put32(time(NULL));
+    ipfix_put32(ipfix_seq);
+    /* Observation domain. */
+    ipfix_put32(0);
+
+    if (ipfix_fp != NULL)
+        n = fwrite(ipfix_msg, len, 1, ipfix_fp) == 1 ? (ssize_t)len : -1;
+    else
+        n = send(ipfix_fd, ipfix_msg, len, 0);
+    if (n != (ssize_t)len)
+        ipfix_errors++;
+
+    /* The sequence counts the data records, sent or not. */
+    ipfix_seq += ipfix_msg_recs;
+    ipfix_records += ipfix_msg_recs;
+    ipfix_msgs++;
+    ipfix_msg_begin();
+}
+
+static void
+ipfix_rec_encode(const struct ipfix_rec *rec) {
+    if (ipfix_msg_len + ipfix_rec_len > IPFIX_MSG_MAX)
+        ipfix_msg_send();
+
+    ipfix_put_raw(&rec->cip, 4);
+    ipfix_put_raw(&rec->vip, 4);
+    ipfix_put_raw(&rec->cport, 2);
+    ipfix_put_raw(&rec->vport, 2);
+    ipfix_put_raw(&rec->proto, 1);
+    ipfix_put_raw(&rec->lip, 4);
+    ipfix_put_raw(&rec->rip, 4);
+    ipfix_put_raw(&rec->lport, 2);
+    ipfix_put_raw(&rec->rport, 2);
+    ipfix_put64(rec->packets[LB_DIR_ORIGINAL]);
+    ipfix_put64(rec->bytes[LB_DIR_ORIGINAL]);
+    ipfix_put64(rec->packets[LB_DIR_REPLY]);
+    ipfix_put64(rec->bytes[LB_DIR_REPLY]);
+    ipfix_put64(ipfix_clock_to_ms(rec->start));
+    ipfix_put64(ipfix_clock_to_ms(rec->end));
+    ipfix_put32(rec->sampling);
+    ipfix_msg_recs++;
+}
+
+static void *
+ipfix_writer(__attribute__((unused)) void *arg) {
+    struct ipfix_rec *recs[IPFIX_BURST];
+    struct rte_ring *r;
+    uint32_t lcore_id, n, i, total;
+
+    ipfix_msg_begin();
+    for (;;) {
+        total = 0;
+        RTE_LCORE_FOREACH(lcore_id) {
+            r = lb_ipfix_lcores[lcore_id].ring;
+            n = rte_ring_sc_dequeue_burst(r, (void **)recs, IPFIX_BURST,
+                                          NULL);
+            for (i = 0; i < n; i++)
+                ipfix_rec_encode(recs[i]);
+            if (n != 0)
+                rte_mempool_put_bulk(ipfix_mp, (void **)recs, n);
+            total += n;
+        }
+        if (total == 0) {
+            ipfix_msg_send();
+            if (ipfix_fp != NULL)
+                fflush(ipfix_fp);
+            usleep(IPFIX_WRITER_SLEEP_US);
+        }
+    }
+    return NULL;
+}
+
+static int
+ipfix_output_open(const struct lb_ipfix_conf *conf) {
+    struct sockaddr_in sin;
+    uint32_t ip;
+    uint16_t port;
+
+    if (conf->file[0] != '\0') {
+        ipfix_fp = fopen(conf->file, "a");
+        return ipfix_fp != NULL ? 0 : -1;
+    }
+
+    if (parse_ipv4_port(conf->collector, &ip, &port) < 0)
+        return -1;
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = ip;
+    sin.sin_port = port;
+    ipfix_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (ipfix_fd < 0)
+        return -1;
+    if (connect(ipfix_fd, (struct sockaddr *)&sin, sizeof(sin)) < 0) {
+        close(ipfix_fd);
+        ipfix_fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+int
+lb_ipfix_init(void) {
+    struct lb_ipfix_conf *conf = &lb_cfg->ipfix;
+    char name[RTE_RING_NAMESIZE];
+    struct timespec ts;
+    uint32_t lcore_id, rate, i;
+    int rc;
+
+    if (conf->collector[0] == '\0' && conf->file[0] == '\0')
+        return 0;
+    rate = conf->sample_rate != 0 ? conf->sample_rate
+                                  : IPFIX_DEFAULT_SAMPLE_RATE;
+    lb_ipfix_active_timeout = SEC_TO_LB_CLOCK(
+        conf->active_timeout != 0 ? conf->active_timeout
+                                  : IPFIX_DEFAULT_ACTIVE_TIMEOUT);
+
+    for (i = 0; i < RTE_DIM(ipfix_fields); i++)
+        ipfix_rec_len += ipfix_fields[i].len;
+
+    ipfix_mp = rte_mempool_create("ipfix_mp", IPFIX_POOL_SIZE,
+                                  sizeof(struct ipfix_rec), IPFIX_POOL_CACHE,
+                                  0, NULL, NULL, NULL, NULL, SOCKET_ID_ANY, 0);
+    if (ipfix_mp == NULL) {
+        RTE_LOG(ERR, USER1, "%s(): Create mempool failed, %s.\n", __func__,
+                rte_strerror(rte_errno));
+        return -1;
+    }
+    RTE_LCORE_FOREACH(lcore_id) {
+        snprintf(name, sizeof(name), "ipfix_ring%u", lcore_id);
+        lb_ipfix_lcores[lcore_id].ring =
+            rte_ring_create(name, IPFIX_RING_SIZE,
+                            rte_lcore_to_socket_id(lcore_id),
+                            RING_F_SP_ENQ | RING_F_SC_DEQ);
+        if (lb_ipfix_lcores[lcore_id].ring == NULL) {
+            RTE_LOG(ERR, USER1, "%s(): Create ring %s failed, %s.\n",
+                    __func__, name, rte_strerror(rte_errno));
+            return -1;
+        }
+        lb_ipfix_lcores[lcore_id].skip = rate;
+    }
+
+    if (ipfix_output_open(conf) < 0) {
+        RTE_LOG(ERR, USER1, "%s(): Cannot open %s, %s.\n", __func__,
+                conf->file[0] != '\0' ? conf->file : conf->collector,
+                strerror(errno));
+        return -1;
+    }
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ipfix_base_ms = (uint64_t)ts.tv_sec * MS_PER_S + ts.tv_nsec / 1000000;
+    ipfix_base_clock = LB_CLOCK();
+
+    rc = pthread_create(&ipfix_writer_tid, NULL, ipfix_writer, NULL);
+    if (rc != 0) {
+        RTE_LOG(ERR, USER1, "%s(): Cannot start the writer, %s.\n",
+                __func__, strerror(rc));
+        return -1;
+    }
+    lb_ipfix_sample_packets = conf->sample_packets;
+    lb_ipfix_sample_rate = rate;
+    return 0;
+}
+
+static void
+ipfix_stats_cmd_cb(int fd, char *argv[], int argc) {
+    struct lb_ipfix_lcore *il;
+    uint32_t lcore_id;
+    int json_fmt = 0, json_first_obj = 1;
+
+    if (argc > 0) {
+        if (strcmp(argv[0], "--json") != 0) {
+            unixctl_command_reply_error(fd, "Invalid parameter: %s.\n",
+                                        argv[0]);
+            return;
+        }
+        json_fmt = 1;
+    }
+
+    if (json_fmt) {
+        unixctl_command_reply(fd, "{");
+        unixctl_command_reply(fd, JSON_KV_S_FMT("sample_mode", ","),
+                              lb_ipfix_sample_packets ? "packet"
+                                                      : "connection");
+        unixctl_command_reply(fd, JSON_KV_32_FMT("sample_rate", ","),
+                              lb_ipfix_sample_rate);
+        unixctl_command_reply(fd, JSON_KV_32_FMT("active_timeout", ","),
+                              LB_CLOCK_TO_SEC(lb_ipfix_active_timeout));
+        unixctl_command_reply(fd, JSON_KV_64_FMT("messages", ","), ipfix_msgs);
+        unixctl_command_reply(fd, JSON_KV_64_FMT("records", ","),
+                              ipfix_records);
+        unixctl_command_reply(fd, JSON_KV_64_FMT("errors", ","), ipfix_errors);
+        unixctl_command_reply(fd, "\"lcores\":[");
+    } else {
+        unixctl_command_reply(fd, NORM_KV_S_FMT("sample_mode", "\n"),
+                              lb_ipfix_sample_packets ? "packet"
+                                                      : "connection");
+        unixctl_command_reply(fd, NORM_KV_32_FMT("sample_rate", "\n"),
+                              lb_ipfix_sample_rate);
+        unixctl_command_reply(fd, NORM_KV_32_FMT("active_timeout", "\n"),
+                              LB_CLOCK_TO_SEC(lb_ipfix_active_timeout));
+        unixctl_command_reply(fd, NORM_KV_64_FMT("messages", "\n"),
+                              ipfix_msgs);
+        unixctl_command_reply(fd, NORM_KV_64_FMT("records", "\n"),
+                              ipfix_records);
+        unixctl_command_reply(fd, NORM_KV_64_FMT("errors", "\n"),
+                              ipfix_errors);
+    }
+    if (lb_ipfix_sample_rate != 0) {
+        RTE_LCORE_FOREACH(lcore_id) {
+            il = &lb_ipfix_lcores[lcore_id];
+            if (json_fmt) {
+                unixctl_command_reply(fd, json_first_obj ? "{" : ",{");
+                json_first_obj = 0;
+                unixctl_command_reply(fd, JSON_KV_32_FMT("lcore", ","),
+                                      lcore_id);
+                unixctl_command_reply(fd, JSON_KV_64_FMT("sampled", ","),
+                                      il->sampled);
+                unixctl_command_reply(fd, JSON_KV_64_FMT("nomem", ","),
+                                      il->nomem);
+                unixctl_command_reply(fd, JSON_KV_64_FMT("ring_full", "}"),
+                                      il->ring_full);
+            } else {
+                unixctl_command_reply(fd, "lcore%u\n", lcore_id);
+                unixctl_command_reply(fd, NORM_KV_64_FMT("  sampled", "\n"),
+                                      il->sampled);
+                unixctl_command_reply(fd, NORM_KV_64_FMT("  nomem", "\n"),
+                                      il->nomem);
+                unixctl_command_reply(fd, NORM_KV_64_FMT("  ring_full", "\n"),
+                                      il->ring_full);
+            }
+        }
+    }
+    if (json_fmt)
+        unixctl_command_reply(fd, "]}\n");
+}
+
+UNIXCTL_CMD_REGISTER("ipfix/stats", "[--json].",
+                     "Show the connections or packets sampled by each lcore "
+                     "and the IPFIX records exported.",
+                     0, 1, ipfix_stats_cmd_cb);
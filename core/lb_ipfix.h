@@ -0,0 +1,75 @@
+/* Copyright (c) 2018. TIG developer. */
+
+#ifndef __LB_IPFIX_H__
+#define __LB_IPFIX_H__
+
+#include <rte_branch_prediction.h>
+#include <rte_lcore.h>
+#include <rte_mbuf.h>
+#include <rte_ring.h>
+
+#include "lb_clock.h"
+#include "lb_conn.h"
+
+struct lb_ipfix_lcore {
+    /* Connections or packets left before the next sampled one. */
+    uint32_t skip;
+    struct rte_ring *ring;
+    uint64_t sampled;
+    uint64_t nomem;
+    uint64_t ring_full;
+} __rte_cache_aligned;
+
+/* 0 while no IPFIX section is configured. */
+extern uint32_t lb_ipfix_sample_rate;
+/* Sample packets instead of connections. */
+extern uint8_t lb_ipfix_sample_packets;
+/* In LB_CLOCK units. */
+extern uint32_t lb_ipfix_active_timeout;
+extern struct lb_ipfix_lcore lb_ipfix_lcores[RTE_MAX_LCORE];
+
+static inline int
+__lb_ipfix_sample(void) {
+    struct lb_ipfix_lcore *il = &lb_ipfix_lcores[rte_lcore_id()];
+
+    if (--il->skip != 0)
+        return 0;
+    il->skip = lb_ipfix_sample_rate;
+    il->sampled++;
+    return 1;
+}
+
+/* Whether the new connection is recorded, one in lb_ipfix_sample_rate. */
+static inline int
+lb_ipfix_sample(void) {
+    if (likely(lb_ipfix_sample_rate == 0) || lb_ipfix_sample_packets)
+        return 0;
+    return __lb_ipfix_sample();
+}
+
+void lb_ipfix_record(struct lb_conn *conn);
+void lb_ipfix_record_active(struct lb_conn *conn);
+void lb_ipfix_record_packet(struct lb_conn *conn, struct rte_mbuf *m,
+                            uint8_t dir);
+int lb_ipfix_init(void);
+
+/*
+ * Count a packet of the connection. A sampled connection exports its
+ * counters every active timeout, or else one packet in
+ * lb_ipfix_sample_rate is exported on its own.
+ */
+static inline void
+lb_ipfix_count(struct lb_conn *conn, struct rte_mbuf *m, uint8_t dir) {
+    if (unlikely(conn->flags & LB_CONN_F_SAMPLED)) {
+        conn->packets[dir] += 1;
+        conn->bytes[dir] += m->pkt_len;
+        if (unlikely(LB_CLOCK() - conn->export_time >=
+                     lb_ipfix_active_timeout))
+            lb_ipfix_record_active(conn);
+    } else if (unlikely(lb_ipfix_sample_packets) &&
+               !(conn->flags & LB_CONN_F_NAT64) && __lb_ipfix_sample()) {
+        lb_ipfix_record_packet(conn, m, dir);
+    }
+}
+
+#endif
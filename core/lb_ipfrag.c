@@ -0,0 +1,408 @@
+/* Copyright (c) 2018. TIG developer. */
+
+#include <string.h>
+#include <sys/queue.h>
+
+#include <rte_errno.h>
+#include <rte_hash.h>
+#include <rte_hash_crc.h>
+#include <rte_ip.h>
+#include <rte_ip_frag.h>
+#include <rte_malloc.h>
+#include <rte_mbuf.h>
+#include <rte_timer.h>
+
+#include <unixctl_command.h>
+
+#include "lb_clock.h"
+#include "lb_config.h"
+#include "lb_device.h"
+#include "lb_drop.h"
+#include "lb_format.h"
+#include "lb_ipfrag.h"
+#include "lb_service.h"
+#include "lb_tunnel.h"
+
+#define IPFRAG_DEFAULT_TABLE_SIZE 4096
+#define IPFRAG_DEFAULT_TIMEOUT 2
+#define IPFRAG_MAX_PENDING 8
+#define IPFRAG_TIMER_CYCLE MS_TO_CYCLES(500)
+
+struct ipfrag_key {
+    uint32_t sip, dip;
+    uint16_t id;
+    uint8_t proto;
+    uint8_t pad;
+} __attribute__((__packed__));
+
+/*
+ * Fragments are not reassembled. The first fragment goes through the
+ * protocol handler and leaves its translation here, the others follow it.
+ * Fragments arriving before the first one are held until it is learned.
+ */
+struct ipfrag_flow {
+    struct ipfrag_key key;
+    uint8_t learned;
+    uint8_t fwd_mode;
+    uint8_t nb_pending;
+    uint32_t sip, dip;
+    uint32_t nexthop;
+    uint32_t create_time;
+    struct lb_device *dev;
+    struct rte_mbuf *pending[IPFRAG_MAX_PENDING];
+    TAILQ_ENTRY(ipfrag_flow) next;
+};
+
+/*
+ * The flows all have the same timeout and are never refreshed, the
+ * expire list in creation order is also in expiry order.
+ */
+struct ipfrag_table {
+    struct rte_hash *hash;
+    struct ipfrag_flow *flows;
+    uint32_t size;
+    uint32_t count;
+    TAILQ_HEAD(, ipfrag_flow) expire_list;
+    struct rte_timer timer;
+} __rte_cache_aligned;
+
+static struct ipfrag_table ipfrag_tbls[RTE_MAX_LCORE];
+static uint32_t ipfrag_timeout;
+
+static struct {
+    uint64_t learned;
+    uint64_t forwarded;
+    uint64_t pending;
+    uint64_t pending_drop;
+    uint64_t no_space;
+    uint64_t expired;
+    uint64_t bad_first;
+    uint64_t handed_over;
+} __rte_cache_aligned ipfrag_stats[RTE_MAX_LCORE];
+
+static void
+ipfrag_flow_free(struct ipfrag_table *t, struct ipfrag_flow *flow) {
+    uint32_t cid = rte_lcore_id();
+    uint8_t i;
+
+    for (i = 0; i < flow->nb_pending; i++) {
+        lb_drop(flow->pending[i], LB_DROP_FRAG);
+        ipfrag_stats[cid].expired++;
+    }
+    rte_hash_del_key(t->hash, &flow->key);
+    TAILQ_REMOVE(&t->expire_list, flow, next);
+    t->count--;
+}
+
+static inline void
+ipfrag_key_init(struct ipfrag_key *key, const struct ipv4_hdr *iph) {
+    key->sip = iph->src_addr;
+    key->dip = iph->dst_addr;
+    key->id = iph->packet_id;
+    key->proto = iph->next_proto_id;
+    key->pad = 0;
+}
+
+static struct ipfrag_flow *
+ipfrag_flow_get(struct ipfrag_table *t, struct ipv4_hdr *iph) {
+    struct ipfrag_key key;
+    struct ipfrag_flow *flow;
+    uint32_t now = LB_CLOCK();
+    int pos;
+
+    ipfrag_key_init(&key, iph);
+    pos = rte_hash_lookup(t->hash, &key);
+    if (pos >= 0) {
+        flow = &t->flows[pos];
+        if (now - flow->create_time <= ipfrag_timeout)
+            return flow;
+        /* The IP ID wrapped, start over. */
+        ipfrag_flow_free(t, flow);
+    }
+
+    pos = rte_hash_add_key(t->hash, &key);
+    if (pos < 0) {
+        ipfrag_stats[rte_lcore_id()].no_space++;
+        return NULL;
+    }
+
+    t->count++;
+    flow = &t->flows[pos];
+    flow->key = key;
+    flow->learned = 0;
+    flow->nb_pending = 0;
+    flow->create_time = now;
+    TAILQ_INSERT_TAIL(&t->expire_list, flow, next);
+    return flow;
+}
+
+static int
+ipfrag_xmit(struct ipfrag_flow *flow, struct rte_mbuf *m,
+            struct ipv4_hdr *iph) {
+    switch (flow->fwd_mode) {
+    case LB_VS_FWD_DR:
+        return lb_device_dr_output(m, flow->nexthop, flow->dev);
+    case LB_VS_FWD_IPIP:
+        return lb_tunnel_xmit(m, iph, flow->nexthop, LB_TUNNEL_IPIP,
+                              flow->dev);
+    case LB_VS_FWD_GUE:
+        return lb_tunnel_xmit(m, iph, flow->nexthop, LB_TUNNEL_GUE,
+                              flow->dev);
+    default:
+        iph->time_to_live = 63;
+        iph->src_addr = flow->sip;
+        iph->dst_addr = flow->dip;
+        iph->hdr_checksum = 0;
+        iph->hdr_checksum = rte_ipv4_cksum(iph);
+        return lb_device_output(m, iph, flow->dev);
+    }
+}
+
+int
+lb_ipfrag_forward(struct rte_mbuf *m, struct ipv4_hdr *iph,
+                  struct lb_device *dev) {
+    struct ipfrag_table *t;
+    struct ipfrag_flow *flow;
+    uint32_t cid = rte_lcore_id();
+
+    t = &ipfrag_tbls[cid];
+    flow = ipfrag_flow_get(t, iph);
+    if (flow == NULL) {
+        lb_drop(m, LB_DROP_FRAG);
+        return 0;
+    }
+
+    if (flow->learned) {
+        ipfrag_stats[cid].forwarded++;
+        return ipfrag_xmit(flow, m, iph);
+    }
+
+    if (flow->nb_pending == IPFRAG_MAX_PENDING) {
+        ipfrag_stats[cid].pending_drop++;
+        lb_drop(m, LB_DROP_FRAG);
+        return 0;
+    }
+    flow->dev = dev;
+    flow->pending[flow->nb_pending++] = m;
+    ipfrag_stats[cid].pending++;
+    return 0;
+}
+
+void
+__lb_ipfrag_learn(struct ipv4_hdr *iph, uint32_t sip, uint32_t dip,
+                  uint8_t fwd_mode, uint32_t nexthop, struct lb_device *dev) {
+    struct ipfrag_table *t;
+    struct ipfrag_flow *flow;
+    struct rte_mbuf *m;
+    uint32_t cid = rte_lcore_id();
+    uint8_t i;
+
+    t = &ipfrag_tbls[cid];
+    flow = ipfrag_flow_get(t, iph);
+    if (flow == NULL)
+        return;
+
+    flow->sip = sip;
+    flow->dip = dip;
+    flow->fwd_mode = fwd_mode;
+    flow->nexthop = nexthop;
+    flow->dev = dev;
+    flow->learned = 1;
+    ipfrag_stats[cid].learned++;
+
+    for (i = 0; i < flow->nb_pending; i++) {
+        m = flow->pending[i];
+        ipfrag_stats[cid].forwarded++;
+        ipfrag_xmit(flow, m,
+                    rte_pktmbuf_mtod_offset(m, struct ipv4_hdr *,
+                                            ETHER_HDR_LEN));
+    }
+    flow->nb_pending = 0;
+}
+
+/*
+ * The first fragment is steered to another lcore, hand it the fragments
+ * held here for the same packet. Those not fitting in pkts are dropped.
+ */
+uint16_t
+lb_ipfrag_take_pending(const struct ipv4_hdr *iph, struct rte_mbuf **pkts,
+                       uint16_t n) {
+    struct ipfrag_table *t;
+    struct ipfrag_flow *flow;
+    struct ipfrag_key key;
+    uint32_t cid = rte_lcore_id();
+    uint16_t i, nb;
+    int pos;
+
+    t = &ipfrag_tbls[cid];
+    ipfrag_key_init(&key, iph);
+    pos = rte_hash_lookup(t->hash, &key);
+    if (pos < 0)
+        return 0;
+    flow = &t->flows[pos];
+    if (flow->learned)
+        return 0;
+
+    nb = RTE_MIN(n, (uint16_t)flow->nb_pending);
+    for (i = 0; i < nb; i++)
+        pkts[i] = flow->pending[i];
+    ipfrag_stats[cid].handed_over += nb;
+    /* The rest is dropped with the flow. */
+    memmove(flow->pending, flow->pending + nb,
+            (flow->nb_pending - nb) * sizeof(flow->pending[0]));
+    flow->nb_pending -= nb;
+    ipfrag_flow_free(t, flow);
+    return nb;
+}
+
+/*
+ * The packet checksum covers the whole L4 payload, so the sum of the part
+ * in the first fragment, checksum field included, is the negation of the
+ * sum of the rest. That is the checksum of the first fragment as received.
+ */
+int
+lb_ipfrag_first_prepare(struct rte_mbuf *m, struct ipv4_hdr *iph,
+                        const void *l4h, uint16_t l4_hlen,
+                        uint16_t *cksum_rest) {
+    if (rte_be_to_cpu_16(iph->total_length) < IPv4_HLEN(iph) + l4_hlen) {
+        ipfrag_stats[rte_lcore_id()].bad_first++;
+        return -1;
+    }
+
+    *cksum_rest = lb_ipv4_udptcp_cksum_mbuf(m, iph, l4h);
+    return 0;
+}
+
+static void
+ipfrag_expire_cb(__attribute((unused)) struct rte_timer *timer, void *arg) {
+    struct ipfrag_table *t = arg;
+    struct ipfrag_flow *flow;
+    uint32_t now = LB_CLOCK();
+
+    while ((flow = TAILQ_FIRST(&t->expire_list)) != NULL &&
+           now - flow->create_time > ipfrag_timeout)
+        ipfrag_flow_free(t, flow);
+}
+
+int
+lb_ipfrag_init(void) {
+    struct rte_hash_parameters param;
+    char name[RTE_HASH_NAMESIZE];
+    struct ipfrag_table *t;
+    uint32_t lcore_id, socket_id, size;
+
+    size = lb_cfg->ipfrag.table_size ? lb_cfg->ipfrag.table_size
+                                     : IPFRAG_DEFAULT_TABLE_SIZE;
+    ipfrag_timeout = SEC_TO_LB_CLOCK(
+        lb_cfg->ipfrag.timeout ? lb_cfg->ipfrag.timeout
+                               : IPFRAG_DEFAULT_TIMEOUT);
+
+    RTE_LCORE_FOREACH_SLAVE(lcore_id) {
+        t = &ipfrag_tbls[lcore_id];
+        socket_id = rte_lcore_to_socket_id(lcore_id);
+
+        memset(&param, 0, sizeof(param));
+        snprintf(name, sizeof(name), "ipfrag%u", lcore_id);
+        param.name = name;
+        param.entries = size;
+        param.key_len = sizeof(struct ipfrag_key);
+        param.hash_func = rte_hash_crc;
+        param.socket_id = socket_id;
+
+        t->hash = rte_hash_create(&param);
+        if (t->hash == NULL) {
+            RTE_LOG(ERR, USER1, "%s(): Create hash table %s failed, %s.\n",
+                    __func__, name, rte_strerror(rte_errno));
+            return -1;
+        }
+
+        t->flows = rte_zmalloc_socket("ipfrag-flows",
+                                      sizeof(struct ipfrag_flow) * size,
+                                      RTE_CACHE_LINE_SIZE, socket_id);
+        if (t->flows == NULL) {
+            RTE_LOG(ERR, USER1, "%s(): Alloc ipfrag flows failed.\n",
+                    __func__);
+            return -1;
+        }
+        t->size = size;
+        TAILQ_INIT(&t->expire_list);
+
+        rte_timer_init(&t->timer);
+        rte_timer_reset(&t->timer, IPFRAG_TIMER_CYCLE, PERIODICAL, lcore_id,
+                        ipfrag_expire_cb, t);
+    }
+
+    RTE_LOG(INFO, USER1, "%s(): ipfrag table size %u, timeout %us.\n",
+            __func__, size, LB_CLOCK_TO_SEC(ipfrag_timeout));
+    return 0;
+}
+
+static void
+ipfrag_stats_cmd_cb(int fd, char *argv[], int argc) {
+    uint64_t learned = 0, forwarded = 0, pending = 0, pending_drop = 0;
+    uint64_t no_space = 0, expired = 0, bad_first = 0, handed_over = 0;
+    uint32_t lcore_id, inuse = 0, size = 0;
+    int json_fmt = 0;
+
+    if (argc > 0) {
+        if (strcmp(argv[0], "--json") != 0) {
+            unixctl_command_reply_error(fd, "Invalid parameter: %s.\n",
+                                        argv[0]);
+            return;
+        }
+        json_fmt = 1;
+    }
+
+    RTE_LCORE_FOREACH_SLAVE(lcore_id) {
+        learned += ipfrag_stats[lcore_id].learned;
+        forwarded += ipfrag_stats[lcore_id].forwarded;
+        pending += ipfrag_stats[lcore_id].pending;
+        pending_drop += ipfrag_stats[lcore_id].pending_drop;
+        no_space += ipfrag_stats[lcore_id].no_space;
+        expired += ipfrag_stats[lcore_id].expired;
+        bad_first += ipfrag_stats[lcore_id].bad_first;
+        handed_over += ipfrag_stats[lcore_id].handed_over;
+        inuse += ipfrag_tbls[lcore_id].count;
+        size += ipfrag_tbls[lcore_id].size;
+    }
+
+    if (json_fmt) {
+        unixctl_command_reply(fd, "{");
+        unixctl_command_reply(fd, JSON_KV_32_FMT("size", ","), size);
+        unixctl_command_reply(fd, JSON_KV_32_FMT("inuse", ","), inuse);
+        unixctl_command_reply(fd, JSON_KV_32_FMT("timeout", ","),
+                              LB_CLOCK_TO_SEC(ipfrag_timeout));
+        unixctl_command_reply(fd, JSON_KV_64_FMT("learned", ","), learned);
+        unixctl_command_reply(fd, JSON_KV_64_FMT("forwarded", ","), forwarded);
+        unixctl_command_reply(fd, JSON_KV_64_FMT("pending", ","), pending);
+        unixctl_command_reply(fd, JSON_KV_64_FMT("pending_drop", ","),
+                              pending_drop);
+        unixctl_command_reply(fd, JSON_KV_64_FMT("no_space", ","), no_space);
+        unixctl_command_reply(fd, JSON_KV_64_FMT("expired", ","), expired);
+        unixctl_command_reply(fd, JSON_KV_64_FMT("bad_first", ","), bad_first);
+        unixctl_command_reply(fd, JSON_KV_64_FMT("handed_over", ""),
+                              handed_over);
+        unixctl_command_reply(fd, "}\n");
+    } else {
+        unixctl_command_reply(fd, NORM_KV_32_FMT("size", "\n"), size);
+        unixctl_command_reply(fd, NORM_KV_32_FMT("inuse", "\n"), inuse);
+        unixctl_command_reply(fd, NORM_KV_32_FMT("timeout", "\n"),
+                              LB_CLOCK_TO_SEC(ipfrag_timeout));
+        unixctl_command_reply(fd, NORM_KV_64_FMT("learned", "\n"), learned);
+        unixctl_command_reply(fd, NORM_KV_64_FMT("forwarded", "\n"),
+                              forwarded);
+        unixctl_command_reply(fd, NORM_KV_64_FMT("pending", "\n"), pending);
+        unixctl_command_reply(fd, NORM_KV_64_FMT("pending_drop", "\n"),
+                              pending_drop);
+        unixctl_command_reply(fd, NORM_KV_64_FMT("no_space", "\n"), no_space);
+        unixctl_command_reply(fd, NORM_KV_64_FMT("expired", "\n"), expired);
+        unixctl_command_reply(fd, NORM_KV_64_FMT("bad_first", "\n"),
+                              bad_first);
+        unixctl_command_reply(fd, NORM_KV_64_FMT("handed_over", "\n"),
+                              handed_over);
+    }
+}
+
+UNIXCTL_CMD_REGISTER("ipfrag/stats", "[--json].",
+                     "Show IP fragment table usage and statistics.", 0, 1,
+                     ipfrag_stats_cmd_cb);
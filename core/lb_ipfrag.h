@@ -0,0 +1,65 @@
+/* Copyright (c) 2018. TIG developer. */
+
+#ifndef __LB_IPFRAG_H__
+#define __LB_IPFRAG_H__
+
+#include <rte_ip.h>
+#include <rte_ip_frag.h>
+#include <rte_mbuf.h>
+
+#include "lb_mbuf.h"
+
+struct lb_device;
+
+int lb_ipfrag_forward(struct rte_mbuf *m, struct ipv4_hdr *iph,
+                      struct lb_device *dev);
+void __lb_ipfrag_learn(struct ipv4_hdr *iph, uint32_t sip, uint32_t dip,
+                       uint8_t fwd_mode, uint32_t nexthop,
+                       struct lb_device *dev);
+int lb_ipfrag_first_prepare(struct rte_mbuf *m, struct ipv4_hdr *iph,
+                            const void *l4h, uint16_t l4_hlen,
+                            uint16_t *cksum_rest);
+uint16_t lb_ipfrag_take_pending(const struct ipv4_hdr *iph,
+                                struct rte_mbuf **pkts, uint16_t n);
+int lb_ipfrag_init(void);
+
+static inline int
+lb_ipfrag_is_first(const struct ipv4_hdr *iph) {
+    return (iph->fragment_offset & rte_cpu_to_be_16(IPV4_HDR_OFFSET_MASK)) ==
+           0;
+}
+
+/*
+ * Record how the first fragment is forwarded, called before it is
+ * rewritten. The following fragments are sent with the same addresses.
+ */
+static inline void
+lb_ipfrag_learn(struct ipv4_hdr *iph, uint32_t sip, uint32_t dip,
+                uint8_t fwd_mode, uint32_t nexthop, struct lb_device *dev) {
+    if (unlikely(rte_ipv4_frag_pkt_is_fragmented(iph)))
+        __lb_ipfrag_learn(iph, sip, dip, fwd_mode, nexthop, dev);
+}
+
+/*
+ * The first fragment only holds part of the L4 payload, its checksum is
+ * completed with the rest returned by lb_ipfrag_first_prepare(), unused
+ * for the packets not fragmented.
+ */
+static inline uint16_t
+lb_ipv4_udptcp_cksum(const struct rte_mbuf *m, const struct ipv4_hdr *iph,
+                     const void *l4h, uint16_t cksum_rest) {
+    uint16_t cksum = lb_ipv4_udptcp_cksum_mbuf(m, iph, l4h);
+    uint32_t sum;
+
+    if (likely(!rte_ipv4_frag_pkt_is_fragmented(iph)))
+        return cksum;
+
+    /* Add the sum of the rest to the one of the first fragment. */
+    sum = (uint16_t)~cksum + (uint32_t)cksum_rest;
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    cksum = (uint16_t)~sum;
+    return cksum == 0 ? 0xffff : cksum;
+}
+
+#endif
@@ -0,0 +1,439 @@
+/* Copyright (c) 2018. TIG developer. */
+
+#include <netinet/in.h>
+
+#include <rte_ether.h>
+#include <rte_ip.h>
+#include <rte_ip_frag.h>
+#include <rte_mbuf.h>
+#include <rte_memcpy.h>
+#include <rte_ring.h>
+#include <rte_tcp.h>
+#include <rte_udp.h>
+
+#include <unixctl_command.h>
+
+#include "lb_conn.h"
+#include "lb_device.h"
+#include "lb_drop.h"
+#include "lb_format.h"
+#include "lb_ipv6.h"
+#include "lb_kni.h"
+#include "lb_mbuf.h"
+#include "lb_perf.h"
+#include "lb_proto.h"
+#include "lb_proto_icmp.h"
+#include "lb_service.h"
+
+#define ICMP6_ECHO_REQUEST 128
+#define ICMP6_ECHO_REPLY 129
+#define ND_NEIGHBOR_SOLICIT 135
+#define ND_NEIGHBOR_ADVERT 136
+
+#define ND_OPT_TARGET_LINKADDR 2
+
+#define ND_NA_FLAG_SOLICITED 0x40000000
+#define ND_NA_FLAG_OVERRIDE 0x20000000
+
+#define IPv6_HLEN (sizeof(struct ipv6_hdr))
+#define IPv6_VERSION (6 << 28)
+
+struct icmp6_hdr {
+    uint8_t type;
+    uint8_t code;
+    uint16_t cksum;
+    uint32_t data;
+} __attribute__((__packed__));
+
+struct nd_opt_linkaddr {
+    uint8_t type;
+    uint8_t len; /* In units of 8 bytes. */
+    struct ether_addr ha;
+} __attribute__((__packed__));
+
+static struct {
+    uint64_t to_ipv4;
+    uint64_t to_ipv6;
+    uint64_t nd_advert;
+    uint64_t echo;
+    uint64_t to_kni;
+    uint64_t too_big;
+    uint64_t no_headroom;
+    uint64_t unsupported;
+    uint64_t invalid;
+} __rte_cache_aligned ipv6_stats[RTE_MAX_LCORE];
+
+static inline int
+ipv6_addr_is_unspec(const uint8_t *addr) {
+    static const uint8_t unspec[16];
+
+    return memcmp(addr, unspec, sizeof(unspec)) == 0;
+}
+
+static inline uint16_t
+icmp6_cksum(struct ipv6_hdr *ip6h, struct icmp6_hdr *icmp6h) {
+    icmp6h->cksum = 0;
+    return rte_ipv6_udptcp_cksum(ip6h, icmp6h);
+}
+
+/*
+ * Answer the neighbor solicitations for the NAT64 addresses, the kernel
+ * knows nothing about them. Other solicitations go to the kernel.
+ */
+static int
+ipv6_nd_solicit_input(struct rte_mbuf *m, struct ipv6_hdr *ip6h,
+                      struct icmp6_hdr *icmp6h, struct lb_device *dev) {
+    static const uint8_t all_nodes[16] = {0xff, 0x02, [15] = 0x01};
+    struct ether_hdr *eth;
+    struct nd_opt_linkaddr *opt;
+    uint8_t *target;
+    uint16_t plen;
+
+    plen = sizeof(struct icmp6_hdr) + 16;
+    if (rte_be_to_cpu_16(ip6h->payload_len) < plen ||
+        rte_pktmbuf_data_len(m) < ETHER_HDR_LEN + IPv6_HLEN + plen ||
+        ip6h->hop_limits != 255 || icmp6h->code != 0)
+        return -1;
+
+    target = (uint8_t *)(icmp6h + 1);
+    if (!lb_is_vip6_exist(target))
+        return -1;
+
+    plen += sizeof(struct nd_opt_linkaddr);
+    if (ETHER_HDR_LEN + IPv6_HLEN + plen >
+        rte_pktmbuf_data_len(m) + rte_pktmbuf_tailroom(m))
+        return -1;
+    lb_pktmbuf_trim_segs(m);
+    m->data_len = m->pkt_len = ETHER_HDR_LEN + IPv6_HLEN + plen;
+
+    eth = rte_pktmbuf_mtod(m, struct ether_hdr *);
+    ether_addr_copy(&eth->s_addr, &eth->d_addr);
+    ether_addr_copy(&dev->ha, &eth->s_addr);
+
+    if (ipv6_addr_is_unspec(ip6h->src_addr)) {
+        rte_memcpy(ip6h->dst_addr, all_nodes, 16);
+        icmp6h->data = rte_cpu_to_be_32(ND_NA_FLAG_OVERRIDE);
+    } else {
+        rte_memcpy(ip6h->dst_addr, ip6h->src_addr, 16);
+        icmp6h->data =
+            rte_cpu_to_be_32(ND_NA_FLAG_SOLICITED | ND_NA_FLAG_OVERRIDE);
+    }
+    rte_memcpy(ip6h->src_addr, target, 16);
+    ip6h->payload_len = rte_cpu_to_be_16(plen);
+    ip6h->hop_limits = 255;
+
+    icmp6h->type = ND_NEIGHBOR_ADVERT;
+    opt = (struct nd_opt_linkaddr *)(target + 16);
+    opt->type = ND_OPT_TARGET_LINKADDR;
+    opt->len = 1;
+    ether_addr_copy(&dev->ha, &opt->ha);
+    icmp6h->cksum = icmp6_cksum(ip6h, icmp6h);
+
+    ipv6_stats[rte_lcore_id()].nd_advert++;
+    lb_device_tx_mbuf(m, dev);
+    return 0;
+}
+
+static int
+ipv6_echo_input(struct rte_mbuf *m, struct ipv6_hdr *ip6h,
+                struct icmp6_hdr *icmp6h, struct lb_device *dev) {
+    struct ether_hdr *eth;
+    uint8_t tmpaddr[16];
+
+    if (!lb_is_vip6_exist(ip6h->dst_addr))
+        return -1;
+
+    eth = rte_pktmbuf_mtod(m, struct ether_hdr *);
+    ether_addr_copy(&eth->s_addr, &eth->d_addr);
+    ether_addr_copy(&dev->ha, &eth->s_addr);
+
+    rte_memcpy(tmpaddr, ip6h->src_addr, 16);
+    rte_memcpy(ip6h->src_addr, ip6h->dst_addr, 16);
+    rte_memcpy(ip6h->dst_addr, tmpaddr, 16);
+    ip6h->hop_limits = 64;
+
+    icmp6h->type = ICMP6_ECHO_REPLY;
+    icmp6h->cksum = icmp6_cksum(ip6h, icmp6h);
+
+    ipv6_stats[rte_lcore_id()].echo++;
+    lb_device_tx_mbuf(m, dev);
+    return 0;
+}
+
+static int
+ipv6_icmp6_input(struct rte_mbuf *m, struct ipv6_hdr *ip6h,
+                 struct lb_device *dev) {
+    struct icmp6_hdr *icmp6h;
+
+    if (rte_pktmbuf_data_len(m) <
+        ETHER_HDR_LEN + IPv6_HLEN + sizeof(struct icmp6_hdr))
+        return -1;
+
+    icmp6h = (struct icmp6_hdr *)(ip6h + 1);
+    switch (icmp6h->type) {
+    case ND_NEIGHBOR_SOLICIT:
+        return ipv6_nd_solicit_input(m, ip6h, icmp6h, dev);
+    case ICMP6_ECHO_REQUEST:
+        return ipv6_echo_input(m, ip6h, icmp6h, dev);
+    default:
+        return -1;
+    }
+}
+
+/* The whole L4 header is in the first segment and within the payload. */
+static int
+ipv6_l4_check(const struct rte_mbuf *m, const struct ipv6_hdr *ip6h) {
+    const struct tcp_hdr *th;
+    uint32_t plen, hlen;
+
+    plen = rte_be_to_cpu_16(ip6h->payload_len);
+    if (plen > rte_pktmbuf_pkt_len(m) - ETHER_HDR_LEN - IPv6_HLEN)
+        return -1;
+    if (ip6h->proto == IPPROTO_TCP) {
+        if (plen < sizeof(struct tcp_hdr) ||
+            rte_pktmbuf_data_len(m) <
+                ETHER_HDR_LEN + IPv6_HLEN + sizeof(struct tcp_hdr))
+            return -1;
+        th = (const struct tcp_hdr *)(ip6h + 1);
+        hlen = (th->data_off >> 4) << 2;
+        if (hlen < sizeof(struct tcp_hdr))
+            return -1;
+    } else {
+        hlen = sizeof(struct udp_hdr);
+    }
+    if (plen < hlen ||
+        rte_pktmbuf_data_len(m) < ETHER_HDR_LEN + IPv6_HLEN + hlen)
+        return -1;
+    return 0;
+}
+
+void
+lb_ipv6_input(struct rte_mbuf *m, struct lb_device *dev) {
+    struct ipv6_hdr *ip6h;
+    struct lb_proto *p;
+    uint32_t cid = rte_lcore_id();
+
+    if (rte_pktmbuf_data_len(m) < ETHER_HDR_LEN + IPv6_HLEN) {
+        ipv6_stats[cid].unsupported++;
+        lb_drop(m, LB_DROP_UNSUPPORTED);
+        return;
+    }
+
+    ip6h = rte_pktmbuf_mtod_offset(m, struct ipv6_hdr *, ETHER_HDR_LEN);
+
+    if (ip6h->proto == IPPROTO_ICMPV6 && ipv6_icmp6_input(m, ip6h, dev) == 0)
+        return;
+
+    if (!lb_is_vip6_exist(ip6h->dst_addr)) {
+        ipv6_stats[cid].to_kni++;
+        lb_kni_enqueue(m,
+                       ((const uint32_t *)ip6h->src_addr)[3] ^
+                           ((const uint32_t *)ip6h->dst_addr)[3],
+                       dev);
+        return;
+    }
+
+    /* Extension headers, fragments included, are not translated. */
+    if (ip6h->proto == IPPROTO_TCP || ip6h->proto == IPPROTO_UDP) {
+        if (ipv6_l4_check(m, ip6h) < 0) {
+            ipv6_stats[cid].invalid++;
+            lb_drop(m, LB_DROP_UNSUPPORTED);
+            return;
+        }
+        p = lb_proto_get(ip6h->proto);
+        if (p != NULL && p->nat64_handle != NULL) {
+            lb_perf_mark(LB_PERF_CLASSIFY);
+            p->nat64_handle(m, ip6h, dev);
+            return;
+        }
+    }
+
+    ipv6_stats[cid].unsupported++;
+    lb_drop(m, LB_DROP_UNSUPPORTED);
+}
+
+/*
+ * Replace the IPv6 header by an IPv4 header in place, the L4 checksum is
+ * left to the caller. The ethernet header is rebuilt on output.
+ */
+struct ipv4_hdr *
+lb_nat64_6to4(struct rte_mbuf *m, uint32_t sip, uint32_t dip) {
+    struct ipv6_hdr *ip6h;
+    struct ipv4_hdr *iph;
+    uint16_t plen;
+    uint8_t tos, proto, ttl;
+
+    ip6h = rte_pktmbuf_mtod_offset(m, struct ipv6_hdr *, ETHER_HDR_LEN);
+    plen = rte_be_to_cpu_16(ip6h->payload_len);
+    tos = (rte_be_to_cpu_32(ip6h->vtc_flow) >> 20) & 0xff;
+    proto = ip6h->proto;
+    ttl = ip6h->hop_limits;
+
+    if (rte_pktmbuf_adj(m, IPv6_HLEN - sizeof(struct ipv4_hdr)) == NULL) {
+        lb_drop_count(LB_DROP_UNSUPPORTED);
+        return NULL;
+    }
+
+    iph = rte_pktmbuf_mtod_offset(m, struct ipv4_hdr *, ETHER_HDR_LEN);
+    iph->version_ihl = 0x45;
+    iph->type_of_service = tos;
+    iph->total_length = rte_cpu_to_be_16(plen + sizeof(struct ipv4_hdr));
+    iph->packet_id = 0;
+    iph->fragment_offset = rte_cpu_to_be_16(IPV4_HDR_DF_FLAG);
+    iph->time_to_live = ttl > 1 ? ttl - 1 : 1;
+    iph->next_proto_id = proto;
+    iph->src_addr = sip;
+    iph->dst_addr = dip;
+    iph->hdr_checksum = 0;
+    iph->hdr_checksum = rte_ipv4_cksum(iph);
+
+    ipv6_stats[rte_lcore_id()].to_ipv4++;
+    return iph;
+}
+
+/*
+ * Replace the IPv4 header of a reply by an IPv6 header towards the client
+ * of the NAT64 connection, with the L4 checksum, and send it to the next
+ * hop the client was seen behind.
+ */
+int
+lb_nat64_4to6_output(struct rte_mbuf *m, struct ipv4_hdr *iph,
+                     struct lb_conn *conn, struct lb_device *dev) {
+    uint32_t cid = rte_lcore_id();
+    struct ether_hdr *eth;
+    struct ipv6_hdr *ip6h;
+    struct tcp_hdr *th;
+    struct udp_hdr *uh;
+    uint16_t plen;
+    uint8_t tos, proto, ttl;
+
+    if (IPv4_HLEN(iph) != sizeof(struct ipv4_hdr) ||
+        rte_ipv4_frag_pkt_is_fragmented(iph)) {
+        ipv6_stats[cid].unsupported++;
+        lb_drop_count(LB_DROP_UNSUPPORTED);
+        goto drop;
+    }
+
+    plen = rte_be_to_cpu_16(iph->total_length) - sizeof(struct ipv4_hdr);
+    if (plen + IPv6_HLEN > dev->mtu) {
+        /*
+         * IPv6 packets are not fragmented on the way, the real service
+         * is told the MTU left once the header grows, DF set or not.
+         */
+        ipv6_stats[cid].too_big++;
+        lb_drop_count(LB_DROP_TOO_BIG);
+        lb_icmp_send_frag_needed(
+            iph, dev->mtu - (IPv6_HLEN - sizeof(struct ipv4_hdr)), dev);
+        goto drop;
+    }
+    tos = iph->type_of_service;
+    proto = iph->next_proto_id;
+    ttl = iph->time_to_live;
+
+    if (rte_pktmbuf_prepend(m, IPv6_HLEN - sizeof(struct ipv4_hdr)) == NULL) {
+        ipv6_stats[cid].no_headroom++;
+        lb_drop_count(LB_DROP_NO_HEADROOM);
+        goto drop;
+    }
+
+    ip6h = rte_pktmbuf_mtod_offset(m, struct ipv6_hdr *, ETHER_HDR_LEN);
+    ip6h->vtc_flow = rte_cpu_to_be_32(IPv6_VERSION | (uint32_t)tos << 20);
+    ip6h->payload_len = rte_cpu_to_be_16(plen);
+    ip6h->proto = proto;
+    ip6h->hop_limits = ttl > 1 ? ttl - 1 : 1;
+    rte_memcpy(ip6h->src_addr, conn->vip6, 16);
+    rte_memcpy(ip6h->dst_addr, conn->cip6, 16);
+
+    /* The UDP checksum is mandatory over IPv6. */
+    if (proto == IPPROTO_TCP) {
+        th = (struct tcp_hdr *)(ip6h + 1);
+        th->cksum = 0;
+        th->cksum = lb_ipv6_udptcp_cksum_mbuf(m, ip6h, th);
+    } else {
+        uh = (struct udp_hdr *)(ip6h + 1);
+        uh->dgram_cksum = 0;
+        uh->dgram_cksum = lb_ipv6_udptcp_cksum_mbuf(m, ip6h, uh);
+    }
+
+    eth = rte_pktmbuf_mtod(m, struct ether_hdr *);
+    ether_addr_copy(&conn->cha, &eth->d_addr);
+    ether_addr_copy(&dev->ha, &eth->s_addr);
+    eth->ether_type = rte_cpu_to_be_16(ETHER_TYPE_IPv6);
+
+    ipv6_stats[cid].to_ipv6++;
+    lb_perf_mark(LB_PERF_REWRITE);
+    lb_device_tx_mbuf(m, dev);
+    lb_perf_mark(LB_PERF_OUTPUT);
+    return 0;
+
+drop:
+    lb_drop_free(m);
+    return -1;
+}
+
+static void
+ipv6_stats_cmd_cb(int fd, char *argv[], int argc) {
+    uint64_t to_ipv4 = 0, to_ipv6 = 0, nd_advert = 0, echo = 0, to_kni = 0;
+    uint64_t too_big = 0, no_headroom = 0, unsupported = 0, invalid = 0;
+    uint32_t lcore_id;
+    int json_fmt = 0;
+
+    if (argc > 0) {
+        if (strcmp(argv[0], "--json") != 0) {
+            unixctl_command_reply_error(fd, "Invalid parameter: %s.\n",
+                                        argv[0]);
+            return;
+        }
+        json_fmt = 1;
+    }
+
+    RTE_LCORE_FOREACH_SLAVE(lcore_id) {
+        to_ipv4 += ipv6_stats[lcore_id].to_ipv4;
+        to_ipv6 += ipv6_stats[lcore_id].to_ipv6;
+        nd_advert += ipv6_stats[lcore_id].nd_advert;
+        echo += ipv6_stats[lcore_id].echo;
+        to_kni += ipv6_stats[lcore_id].to_kni;
+        too_big += ipv6_stats[lcore_id].too_big;
+        no_headroom += ipv6_stats[lcore_id].no_headroom;
+        unsupported += ipv6_stats[lcore_id].unsupported;
+        invalid += ipv6_stats[lcore_id].invalid;
+    }
+
+    if (json_fmt) {
+        unixctl_command_reply(fd, "{");
+        unixctl_command_reply(fd, JSON_KV_64_FMT("nat64_to_ipv4", ","),
+                              to_ipv4);
+        unixctl_command_reply(fd, JSON_KV_64_FMT("nat64_to_ipv6", ","),
+                              to_ipv6);
+        unixctl_command_reply(fd, JSON_KV_64_FMT("nd_advert", ","),
+                              nd_advert);
+        unixctl_command_reply(fd, JSON_KV_64_FMT("echo", ","), echo);
+        unixctl_command_reply(fd, JSON_KV_64_FMT("to_kni", ","), to_kni);
+        unixctl_command_reply(fd, JSON_KV_64_FMT("too_big", ","), too_big);
+        unixctl_command_reply(fd, JSON_KV_64_FMT("no_headroom", ","),
+                              no_headroom);
+        unixctl_command_reply(fd, JSON_KV_64_FMT("unsupported", ","),
+                              unsupported);
+        unixctl_command_reply(fd, JSON_KV_64_FMT("invalid", ""), invalid);
+        unixctl_command_reply(fd, "}\n");
+    } else {
+        unixctl_command_reply(fd, NORM_KV_64_FMT("nat64_to_ipv4", "\n"),
+                              to_ipv4);
+        unixctl_command_reply(fd, NORM_KV_64_FMT("nat64_to_ipv6", "\n"),
+                              to_ipv6);
+        unixctl_command_reply(fd, NORM_KV_64_FMT("nd_advert", "\n"),
+                              nd_advert);
+        unixctl_command_reply(fd, NORM_KV_64_FMT("echo", "\n"), echo);
+        unixctl_command_reply(fd, NORM_KV_64_FMT("to_kni", "\n"), to_kni);
+        unixctl_command_reply(fd, NORM_KV_64_FMT("too_big", "\n"), too_big);
+        unixctl_command_reply(fd, NORM_KV_64_FMT("no_headroom", "\n"),
+                              no_headroom);
+        unixctl_command_reply(fd, NORM_KV_64_FMT("unsupported", "\n"),
+                              unsupported);
+        unixctl_command_reply(fd, NORM_KV_64_FMT("invalid", "\n"), invalid);
+    }
+}
+
+UNIXCTL_CMD_REGISTER("ipv6/stats", "[--json].",
+                     "Show IPv6 and NAT64 statistics.", 0, 1,
+                     ipv6_stats_cmd_cb);
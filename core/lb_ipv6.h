@@ -0,0 +1,25 @@
+/* Copyright (c) 2018. TIG developer. */
+
+#ifndef __LB_IPV6_H__
+#define __LB_IPV6_H__
+
+#include <rte_hash_crc.h>
+#include <rte_ip.h>
+#include <rte_mbuf.h>
+
+struct lb_conn;
+struct lb_device;
+
+void lb_ipv6_input(struct rte_mbuf *m, struct lb_device *dev);
+struct ipv4_hdr *lb_nat64_6to4(struct rte_mbuf *m, uint32_t sip,
+                               uint32_t dip);
+int lb_nat64_4to6_output(struct rte_mbuf *m, struct ipv4_hdr *iph,
+                         struct lb_conn *conn, struct lb_device *dev);
+
+/* IPv6 clients are scheduled by their address folded to 32 bits. */
+static inline uint32_t
+lb_ipv6_addr_hash(const uint8_t *addr) {
+    return rte_hash_crc(addr, 16, 0);
+}
+
+#endif
@@ -0,0 +1,425 @@
+/* Copyright (c) 2018. TIG developer. */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <rte_bus_pci.h>
+#include <rte_bus_vdev.h>
+#include <rte_errno.h>
+#include <rte_ethdev.h>
+#include <rte_ether.h>
+#include <rte_kni.h>
+#include <rte_lcore.h>
+#include <rte_log.h>
+#include <rte_mbuf.h>
+#include <rte_ring.h>
+
+#include "lb_arp.h"
+#include "lb_config.h"
+#include "lb_device.h"
+#include "lb_drop.h"
+#include "lb_kni.h"
+#include "lb_parser.h"
+
+/*
+ * The exception path: packets the workers do not handle, such as ARP,
+ * OSPF and those to the kni ip, go to the kernel and the kernel replies
+ * through the device. A tap or virtio-user interface has one queue per
+ * kni lcore, so the path scales with them; the KNI has a single one and
+ * is only served by the first kni lcore.
+ */
+
+static const char *kni_type_names[] = {
+    [LB_KNI_T_TAP] = "tap",
+    [LB_KNI_T_VIRTIO_USER] = "virtio-user",
+    [LB_KNI_T_KNI] = "kni",
+};
+
+static int
+kni_get_mac(const char *name, struct ether_addr *ha) {
+    int fd;
+    struct ifreq req;
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        RTE_LOG(ERR, USER1, "%s(): Create SOCK_STREAM socket failed, %s\n",
+                __func__, strerror(errno));
+        return -1;
+    }
+
+    /* Get KNI MAC */
+    memset(&req, 0, sizeof(struct ifreq));
+    strncpy(req.ifr_name, name, IFNAMSIZ);
+    req.ifr_addr.sa_family = AF_INET;
+
+    if (ioctl(fd, SIOCGIFHWADDR, &req) < 0) {
+        RTE_LOG(ERR, USER1, "%s(): Set MAC failed, %s\n", __func__,
+                strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    close(fd);
+    memcpy(ha->addr_bytes, req.ifr_hwaddr.sa_data, ETHER_ADDR_LEN);
+
+    return 0;
+}
+
+static int
+kni_create(struct lb_device *dev) {
+    static int kni_inited;
+    struct rte_kni_conf kni_conf;
+    struct rte_kni_ops kni_ops;
+    struct rte_eth_dev_info info;
+
+    if (!kni_inited) {
+        rte_kni_init(lb_cfg->nb_decices);
+        kni_inited = 1;
+    }
+
+    memset(&info, 0, sizeof(info));
+    rte_eth_dev_info_get(dev->port_id, &info);
+
+    memset(&kni_conf, 0, sizeof(kni_conf));
+    memcpy(kni_conf.name, dev->name, RTE_KNI_NAMESIZE);
+    kni_conf.core_id = rte_get_master_lcore();
+    kni_conf.force_bind = 1;
+    kni_conf.group_id = dev->port_id;
+    kni_conf.mbuf_size = dev->mbuf_size;
+    kni_conf.mtu = dev->mtu;
+    if (info.pci_dev) {
+        kni_conf.addr = info.pci_dev->addr;
+        kni_conf.id = info.pci_dev->id;
+    }
+
+    kni_ops.port_id = dev->port_id;
+    kni_ops.change_mtu = NULL;
+    kni_ops.config_network_if = NULL;
+
+    dev->kni = rte_kni_alloc(dev->mp, &kni_conf, &kni_ops);
+    if (dev->kni == NULL) {
+        RTE_LOG(ERR, USER1, "%s(): Create kni %s failed.\n", __func__,
+                dev->name);
+        return -1;
+    }
+
+    if (kni_get_mac(dev->name, &dev->ha) < 0) {
+        RTE_LOG(ERR, USER1, "%s(): kni_set_mac failed.\n", __func__);
+        return -1;
+    }
+    return 0;
+}
+
+static int
+kni_vdev_setup(struct lb_device *dev, uint16_t port_id) {
+    struct rte_eth_conf port_conf;
+    uint16_t nb_rxd, nb_txd;
+    uint16_t q;
+    int rc;
+
+    if (dev->kni_type == LB_KNI_T_TAP) {
+        /* A tap rx descriptor is one segment of a packet. */
+        nb_rxd = LB_MTU_TO_FRAME_LEN(dev->mtu) / dev->mbuf_size + 1;
+    } else {
+        nb_rxd = dev->rxq_size;
+    }
+    nb_txd = dev->txq_size;
+
+    memset(&port_conf, 0, sizeof(port_conf));
+    rc = rte_eth_dev_configure(port_id, dev->nb_kni_lcores,
+                               dev->nb_kni_lcores, &port_conf);
+    if (rc < 0) {
+        RTE_LOG(ERR, USER1, "%s(): Config port%u failed, %s.\n", __func__,
+                port_id, strerror(-rc));
+        return rc;
+    }
+
+    for (q = 0; q < dev->nb_kni_lcores; q++) {
+        rc = rte_eth_rx_queue_setup(port_id, q, nb_rxd, dev->socket_id, NULL,
+                                    dev->mp);
+        if (rc < 0) {
+            RTE_LOG(ERR, USER1, "%s(): Setup port%u rxq%u failed, %s.\n",
+                    __func__, port_id, q, strerror(-rc));
+            return rc;
+        }
+        rc = rte_eth_tx_queue_setup(port_id, q, nb_txd, dev->socket_id, NULL);
+        if (rc < 0) {
+            RTE_LOG(ERR, USER1, "%s(): Setup port%u txq%u failed, %s.\n",
+                    __func__, port_id, q, strerror(-rc));
+            return rc;
+        }
+    }
+
+    if (dev->kni_type == LB_KNI_T_TAP &&
+        rte_eth_dev_default_mac_addr_set(port_id, &dev->ha) < 0) {
+        RTE_LOG(WARNING, USER1, "%s(): Set the MAC of %s failed.\n", __func__,
+                dev->name);
+    }
+    if (rte_eth_dev_set_mtu(port_id, dev->mtu) < 0) {
+        RTE_LOG(WARNING, USER1, "%s(): Set the mtu of %s to %u failed.\n",
+                __func__, dev->name, dev->mtu);
+    }
+
+    rc = rte_eth_dev_start(port_id);
+    if (rc < 0) {
+        RTE_LOG(ERR, USER1, "%s(): Start port%u failed, %s.\n", __func__,
+                port_id, strerror(-rc));
+        return rc;
+    }
+    return 0;
+}
+
+/* A tap or virtio-user port named after the device, with its MAC. */
+static int
+kni_vdev_create(struct lb_device *dev) {
+    char name[RTE_ETH_NAME_MAX_LEN];
+    char args[256];
+    char mac[32];
+    uint16_t port_id;
+
+    /* The bond takes the MAC of its first slave. */
+    rte_eth_macaddr_get(dev->type == LB_DEV_T_BOND ? dev->slave_ports[0]
+                                                   : dev->port_id,
+                        &dev->ha);
+    mac_addr_tostring(&dev->ha, mac, sizeof(mac));
+
+    if (dev->kni_type == LB_KNI_T_TAP) {
+        snprintf(name, sizeof(name), "net_tap_%s", dev->name);
+        snprintf(args, sizeof(args), "iface=%s", dev->name);
+    } else {
+        snprintf(name, sizeof(name), "net_virtio_user_%s", dev->name);
+        snprintf(args, sizeof(args),
+                 "path=/dev/vhost-net,iface=%s,queues=%u,queue_size=%u,mac=%s",
+                 dev->name, dev->nb_kni_lcores, dev->rxq_size, mac);
+    }
+
+    if (rte_vdev_init(name, args) < 0) {
+        RTE_LOG(ERR, USER1, "%s(): Create %s failed.\n", __func__, name);
+        return -1;
+    }
+    if (rte_eth_dev_get_port_by_name(name, &port_id) != 0 ||
+        kni_vdev_setup(dev, port_id) < 0) {
+        RTE_LOG(ERR, USER1, "%s(): Setup %s failed.\n", __func__, name);
+        rte_vdev_uninit(name);
+        return -1;
+    }
+
+    dev->kni_port_id = port_id;
+    return 0;
+}
+
+static int
+kni_rings_create(struct lb_device *dev) {
+    char rname[RTE_RING_NAMESIZE];
+    uint16_t i, j;
+
+    for (i = 0; i < dev->nb_rxq; i++) {
+        for (j = 0; j < dev->nb_kni_lcores; j++) {
+            snprintf(rname, sizeof(rname), "kniring%u_%u_%u", dev->port_id, i,
+                     j);
+            dev->kni_rings[i][j] =
+                rte_ring_create(rname, LB_KNI_RING_SIZE, dev->socket_id,
+                                RING_F_SP_ENQ | RING_F_SC_DEQ |
+                                    RING_F_EXACT_SZ);
+            if (dev->kni_rings[i][j] == NULL) {
+                RTE_LOG(ERR, USER1, "%s(): Create kni ring %s failed, %s.\n",
+                        __func__, rname, rte_strerror(rte_errno));
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+static void
+kni_lcore_add(struct lb_device *dev, uint32_t lcore_id) {
+    dev->lcore_conf[lcore_id].kni_enable = 1;
+    dev->lcore_conf[lcore_id].kni_id = dev->nb_kni_lcores++;
+    /* The master already has its own txq. */
+    if (lcore_id != rte_get_master_lcore())
+        dev->lcore_conf[lcore_id].txq_id = dev->nb_txq++;
+}
+
+/*
+ * The kni lcores pass the packets of the device to the kernel, the master
+ * when none is configured. They cannot poll the device.
+ */
+int
+lb_kni_lcores_init(struct lb_device *dev, struct lb_device_conf *conf) {
+    uint32_t lcore_id;
+
+    if (conf->nb_kni_lcores == 0) {
+        kni_lcore_add(dev, rte_get_master_lcore());
+        return 0;
+    }
+
+    for (lcore_id = 0; lcore_id < RTE_MAX_LCORE; lcore_id++) {
+        if (!conf->kni_lcores[lcore_id])
+            continue;
+        if (!rte_lcore_is_enabled(lcore_id) ||
+            dev->lcore_conf[lcore_id].rxq_enable) {
+            RTE_LOG(ERR, USER1, "%s(): lcore%u of %s cannot be a kni lcore.\n",
+                    __func__, lcore_id, conf->name);
+            return -1;
+        }
+        kni_lcore_add(dev, lcore_id);
+    }
+    return 0;
+}
+
+int
+lb_kni_init(struct lb_device *dev, struct lb_device_conf *conf) {
+    uint32_t lcore_id;
+
+    dev->kni_type = conf->kni_type;
+    if (dev->kni_type != LB_KNI_T_KNI && kni_vdev_create(dev) < 0) {
+        RTE_LOG(WARNING, USER1, "%s(): Create %s of %s failed, use kni.\n",
+                __func__, kni_type_names[dev->kni_type], dev->name);
+        dev->kni_type = LB_KNI_T_KNI;
+    }
+
+    if (dev->kni_type == LB_KNI_T_KNI) {
+        if (kni_create(dev) < 0)
+            return -1;
+        if (dev->nb_kni_lcores > 1) {
+            RTE_LOG(WARNING, USER1,
+                    "%s(): The kni of %s has one queue, only the first kni "
+                    "lcore serves it.\n",
+                    __func__, dev->name);
+            RTE_LCORE_FOREACH(lcore_id) {
+                if (dev->lcore_conf[lcore_id].kni_id != 0)
+                    dev->lcore_conf[lcore_id].kni_enable = 0;
+            }
+            dev->nb_kni_lcores = 1;
+        }
+    }
+
+    return kni_rings_create(dev);
+}
+
+/*
+ * A lcore other than the master either polls devices or serves the
+ * kernel interfaces, the loop it runs depends on it.
+ */
+int
+lb_kni_lcores_check(void) {
+    struct lb_device *dev, *dev2;
+    uint16_t i, j;
+    uint32_t lcore_id;
+
+    RTE_LCORE_FOREACH_SLAVE(lcore_id) {
+        LB_DEVICE_FOREACH(i, dev) {
+            if (!dev->lcore_conf[lcore_id].kni_enable)
+                continue;
+            LB_DEVICE_FOREACH(j, dev2) {
+                if (dev2->lcore_conf[lcore_id].rxq_enable) {
+                    RTE_LOG(ERR, USER1,
+                            "%s(): lcore%u is a kni lcore of %s and polls "
+                            "%s.\n",
+                            __func__, lcore_id, dev->name, dev2->name);
+                    return -1;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+int
+lb_kni_lcore_is_enabled(uint32_t lcore_id) {
+    struct lb_device *dev;
+    uint16_t i;
+
+    LB_DEVICE_FOREACH(i, dev) {
+        if (dev->lcore_conf[lcore_id].kni_enable)
+            return 1;
+    }
+    return 0;
+}
+
+int
+lb_kni_is_port(uint16_t port_id) {
+    struct lb_device *dev;
+    uint16_t i;
+
+    LB_DEVICE_FOREACH(i, dev) {
+        if (dev->kni_type != LB_KNI_T_KNI && dev->kni_port_id == port_id)
+            return 1;
+    }
+    return 0;
+}
+
+const char *
+lb_kni_type_name(uint32_t type) {
+    return kni_type_names[type];
+}
+
+static inline uint16_t
+kni_rx_burst(struct lb_device *dev, uint16_t kni_id, struct rte_mbuf **pkts,
+             uint16_t n) {
+    if (dev->kni_type == LB_KNI_T_KNI)
+        return rte_kni_rx_burst(dev->kni, pkts, n);
+    return rte_eth_rx_burst(dev->kni_port_id, kni_id, pkts, n);
+}
+
+static inline uint16_t
+kni_tx_burst(struct lb_device *dev, uint16_t kni_id, struct rte_mbuf **pkts,
+             uint16_t n) {
+    if (dev->kni_type == LB_KNI_T_KNI)
+        return rte_kni_tx_burst(dev->kni, pkts, n);
+    return rte_eth_tx_burst(dev->kni_port_id, kni_id, pkts, n);
+}
+
+/*
+ * One round of the kni lcore on the device: the packets of the kernel are
+ * sent out, then at most LB_KNI_BURST_BUDGET packets of the workers go to
+ * the kernel, starting from the ring after the last one served, so a storm
+ * does not hold the lcore nor favour a worker.
+ */
+void
+lb_kni_poll(struct lb_device *dev, uint32_t lcore_id) {
+    uint16_t kni_id = dev->lcore_conf[lcore_id].kni_id;
+    uint16_t txq_id = dev->lcore_conf[lcore_id].txq_id;
+    struct rte_eth_dev_tx_buffer *tx_buffer = dev->tx_buffer[lcore_id];
+    struct rte_mbuf *pkts[PKT_MAX_BURST];
+    struct ether_hdr *ethh;
+    uint32_t budget = LB_KNI_BURST_BUDGET;
+    uint16_t i, j, n, nb_tx, rxq_id;
+
+    if (dev->kni_type == LB_KNI_T_KNI)
+        rte_kni_handle_request(dev->kni);
+
+    n = kni_rx_burst(dev, kni_id, pkts, PKT_MAX_BURST);
+    for (j = 0; j < n; j++) {
+        rte_eth_tx_buffer(dev->port_id, txq_id, tx_buffer, pkts[j]);
+    }
+    rte_eth_tx_buffer_flush(dev->port_id, txq_id, tx_buffer);
+
+    rxq_id = dev->kni_ring_next[kni_id];
+    for (i = 0; i < dev->nb_rxq && budget > 0; i++) {
+        n = rte_ring_sc_dequeue_burst(
+            dev->kni_rings[rxq_id][kni_id], (void **)pkts,
+            RTE_MIN(budget, (uint32_t)PKT_MAX_BURST), NULL);
+        budget -= n;
+        if (kni_id == 0) {
+            for (j = 0; j < n; j++) {
+                ethh = rte_pktmbuf_mtod(pkts[j], struct ether_hdr *);
+                if (ethh->ether_type == rte_be_to_cpu_16(ETHER_TYPE_ARP))
+                    lb_arp_input(pkts[j], dev);
+            }
+        }
+        nb_tx = kni_tx_burst(dev, kni_id, pkts, n);
+        for (j = nb_tx; j < n; j++) {
+            lb_drop(pkts[j], LB_DROP_TX_FULL);
+        }
+        if (++rxq_id == dev->nb_rxq)
+            rxq_id = 0;
+    }
+    dev->kni_ring_next[kni_id] = rxq_id;
+}
@@ -0,0 +1,45 @@
+/* Copyright (c) 2018. TIG developer. */
+
+#ifndef __LB_KNI_H__
+#define __LB_KNI_H__
+
+#include <rte_lcore.h>
+#include <rte_mbuf.h>
+#include <rte_ring.h>
+
+#include "lb_config.h"
+#include "lb_device.h"
+#include "lb_drop.h"
+
+/* Entries of a worker to kni lcore ring. */
+#define LB_KNI_RING_SIZE (PKT_MAX_BURST * 4)
+
+/* Packets a kni lcore takes from the workers of a device per round. */
+#define LB_KNI_BURST_BUDGET (PKT_MAX_BURST * 4)
+
+/*
+ * Pass a packet to the kernel. The packets with the same hash, such as
+ * those between two hosts, go through the same kni lcore and keep their
+ * order; ARP uses 0, only the first kni lcore updates the ARP table.
+ */
+static inline void
+lb_kni_enqueue(struct rte_mbuf *m, uint32_t hash, struct lb_device *dev) {
+    uint16_t rxq_id = dev->lcore_conf[rte_lcore_id()].rxq_id;
+    uint16_t kni_id;
+
+    hash ^= hash >> 16;
+    hash ^= hash >> 8;
+    kni_id = hash % dev->nb_kni_lcores;
+    if (rte_ring_sp_enqueue(dev->kni_rings[rxq_id][kni_id], m) < 0)
+        lb_drop(m, LB_DROP_RING_FULL);
+}
+
+int lb_kni_lcores_init(struct lb_device *dev, struct lb_device_conf *conf);
+int lb_kni_init(struct lb_device *dev, struct lb_device_conf *conf);
+int lb_kni_lcores_check(void);
+int lb_kni_lcore_is_enabled(uint32_t lcore_id);
+int lb_kni_is_port(uint16_t port_id);
+const char *lb_kni_type_name(uint32_t type);
+void lb_kni_poll(struct lb_device *dev, uint32_t lcore_id);
+
+#endif
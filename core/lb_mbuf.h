@@ -0,0 +1,73 @@
+/* Copyright (c) 2018. TIG developer. */
+
+#ifndef __LB_MBUF_H__
+#define __LB_MBUF_H__
+
+#include <rte_ip.h>
+#include <rte_mbuf.h>
+
+/*
+ * Frames larger than the mbuf data room are received in several segments.
+ * The headers always sit in the first one, the payload may not, so the
+ * checksums below walk the segments instead of the first buffer.
+ */
+
+static inline uint16_t
+lb_cksum_finish(uint32_t cksum) {
+    cksum = ((cksum & 0xffff0000) >> 16) + (cksum & 0xffff);
+    cksum = ((cksum & 0xffff0000) >> 16) + (cksum & 0xffff);
+    cksum = (~cksum) & 0xffff;
+    if (cksum == 0)
+        cksum = 0xffff;
+    return (uint16_t)cksum;
+}
+
+/* Same as rte_ipv4_udptcp_cksum(), for segmented packets too. */
+static inline uint16_t
+lb_ipv4_udptcp_cksum_mbuf(const struct rte_mbuf *m, const struct ipv4_hdr *iph,
+                          const void *l4h) {
+    uint32_t off, len;
+    uint16_t raw;
+
+    if (likely(m->nb_segs == 1))
+        return rte_ipv4_udptcp_cksum(iph, l4h);
+
+    off = (const char *)l4h - rte_pktmbuf_mtod(m, const char *);
+    len = rte_be_to_cpu_16(iph->total_length) - sizeof(struct ipv4_hdr);
+    if (rte_raw_cksum_mbuf(m, off, len, &raw) < 0)
+        return 0;
+    return lb_cksum_finish((uint32_t)raw + rte_ipv4_phdr_cksum(iph, 0));
+}
+
+/* Same as rte_ipv6_udptcp_cksum(), for segmented packets too. */
+static inline uint16_t
+lb_ipv6_udptcp_cksum_mbuf(const struct rte_mbuf *m, const struct ipv6_hdr *ip6h,
+                          const void *l4h) {
+    uint32_t off, len;
+    uint16_t raw;
+
+    if (likely(m->nb_segs == 1))
+        return rte_ipv6_udptcp_cksum(ip6h, l4h);
+
+    off = (const char *)l4h - rte_pktmbuf_mtod(m, const char *);
+    len = rte_be_to_cpu_16(ip6h->payload_len);
+    if (rte_raw_cksum_mbuf(m, off, len, &raw) < 0)
+        return 0;
+    return lb_cksum_finish((uint32_t)raw + rte_ipv6_phdr_cksum(ip6h, 0));
+}
+
+/*
+ * Free every segment but the first, before the packet is turned into a
+ * reply built from its headers only.
+ */
+static inline void
+lb_pktmbuf_trim_segs(struct rte_mbuf *m) {
+    if (likely(m->next == NULL))
+        return;
+    rte_pktmbuf_free(m->next);
+    m->next = NULL;
+    m->nb_segs = 1;
+    m->pkt_len = m->data_len;
+}
+
+#endif
@@ -0,0 +1,272 @@
+/* Copyright (c) 2018. TIG developer. */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <rte_atomic.h>
+#include <rte_cycles.h>
+#include <rte_ethdev.h>
+#include <rte_lcore.h>
+#include <rte_log.h>
+#include <rte_mempool.h>
+#include <rte_timer.h>
+
+#include <metrics_shm.h>
+#include <unixctl_command.h>
+
+#include "lb_clock.h"
+#include "lb_config.h"
+#include "lb_conn.h"
+#include "lb_device.h"
+#include "lb_drop.h"
+#include "lb_format.h"
+#include "lb_metrics.h"
+#include "lb_proto.h"
+#include "lb_service.h"
+#include "lb_watchdog.h"
+
+/*
+ * The master rewrites the region every interval under the sequence
+ * number, see metrics_shm.h. The region is sized at start for LB_MAX_VS
+ * virtual services and METRICS_MAX_RS real services, a tmpfs file only
+ * takes the pages written.
+ */
+#define METRICS_DEFAULT_INTERVAL_MS 100
+#define METRICS_MAX_RS (LB_MAX_VS * 4)
+
+static struct metrics_shm_header *metrics_hdr;
+static uint64_t metrics_updates;
+static uint64_t metrics_update_cycles;
+static struct rte_timer metrics_timer;
+
+static void
+metrics_conn_table(struct lb_conn_table *ct, uint32_t *conns, uint32_t *max) {
+    if (ct == NULL || ct->mp == NULL)
+        return;
+    *conns = rte_mempool_in_use_count(ct->mp);
+    *max = ct->mp->size;
+}
+
+static void
+metrics_lcores(struct metrics_shm_header *h) {
+    struct metrics_shm_lcore *ml;
+    struct lb_watchdog_lcore *wl;
+    struct lb_proto *p;
+    uint32_t lcore_id, i = 0, r;
+
+    RTE_LCORE_FOREACH(lcore_id) {
+        ml = METRICS_SHM_ENTRY(h, lcore, i++);
+        wl = &lb_watchdog_lcores[lcore_id];
+        memset(ml, 0, sizeof(*ml));
+        ml->lcore_id = lcore_id;
+        ml->socket_id = rte_lcore_to_socket_id(lcore_id);
+        ml->worker = wl->enabled;
+        ml->stalled = wl->wd.stalled;
+        ml->busy_rounds = wl->busy_rounds;
+        ml->idle_rounds = wl->idle_rounds;
+        ml->busy_cycles = wl->busy_cycles;
+        ml->idle_cycles = wl->idle_cycles;
+        for (r = 0; r < LB_DROP_MAX; r++)
+            ml->drops += lb_drop_lcores[lcore_id].pkts[r];
+        if (!wl->enabled)
+            continue;
+        p = lb_protos[LB_IPPROTO_TCP];
+        if (p != NULL && p->conn_table != NULL)
+            metrics_conn_table(p->conn_table(lcore_id), &ml->tcp_conns,
+                               &ml->tcp_conns_max);
+        p = lb_protos[LB_IPPROTO_UDP];
+        if (p != NULL && p->conn_table != NULL)
+            metrics_conn_table(p->conn_table(lcore_id), &ml->udp_conns,
+                               &ml->udp_conns_max);
+    }
+    h->nb_lcores = i;
+}
+
+static void
+metrics_ports(struct metrics_shm_header *h) {
+    struct metrics_shm_port *mp;
+    struct rte_eth_stats stats;
+    struct lb_device *dev;
+    uint32_t lcore_id;
+    uint16_t devid;
+    uint32_t i = 0;
+
+    LB_DEVICE_FOREACH(devid, dev) {
+        mp = METRICS_SHM_ENTRY(h, port, i++);
+        memset(mp, 0, sizeof(*mp));
+        snprintf(mp->name, sizeof(mp->name), "%s", dev->name);
+        mp->port_id = dev->port_id;
+        mp->socket_id = dev->socket_id;
+        if (rte_eth_stats_get(dev->port_id, &stats) == 0) {
+            mp->ipackets = stats.ipackets;
+            mp->opackets = stats.opackets;
+            mp->ibytes = stats.ibytes;
+            mp->obytes = stats.obytes;
+            mp->imissed = stats.imissed;
+            mp->ierrors = stats.ierrors;
+            mp->oerrors = stats.oerrors;
+            mp->rx_nombuf = stats.rx_nombuf;
+        }
+        RTE_LCORE_FOREACH(lcore_id) {
+            mp->rx_dropped += dev->lcore_stats[lcore_id].rx_dropped;
+            mp->tx_dropped += dev->lcore_stats[lcore_id].tx_dropped;
+        }
+        mp->mbuf_in_use = rte_mempool_in_use_count(dev->mp);
+        mp->mbuf_avail = rte_mempool_avail_count(dev->mp);
+    }
+    h->nb_ports = i;
+}
+
+/* Refill a region, on the master. */
+void
+lb_metrics_region_update(struct metrics_shm_header *h) {
+    struct timespec ts;
+
+    metrics_lcores(h);
+    metrics_ports(h);
+    lb_service_metrics(h);
+    h->used = h->rs_off + (uint64_t)h->nb_rs * h->rs_size;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    h->update_ns = (uint64_t)ts.tv_sec * NS_PER_S + ts.tv_nsec;
+}
+
+uint64_t
+lb_metrics_region_size(void) {
+    return RTE_ALIGN(sizeof(struct metrics_shm_header), RTE_CACHE_LINE_SIZE) +
+           rte_lcore_count() * sizeof(struct metrics_shm_lcore) +
+           lb_device_count * sizeof(struct metrics_shm_port) +
+           LB_MAX_VS * sizeof(struct metrics_shm_vs) +
+           METRICS_MAX_RS * sizeof(struct metrics_shm_rs);
+}
+
+void
+lb_metrics_region_init(struct metrics_shm_header *h, uint64_t size,
+                       uint32_t interval_ms) {
+    uint64_t off = RTE_ALIGN(sizeof(*h), RTE_CACHE_LINE_SIZE);
+
+    h->magic = METRICS_SHM_MAGIC;
+    h->version = METRICS_SHM_VERSION;
+    h->size = size;
+    h->used = off;
+    h->tsc_hz = rte_get_tsc_hz();
+    h->pid = getpid();
+    h->interval_ms = interval_ms;
+    h->lcore_size = sizeof(struct metrics_shm_lcore);
+    h->lcore_off = off;
+    h->port_size = sizeof(struct metrics_shm_port);
+    h->port_off = off + rte_lcore_count() * sizeof(struct metrics_shm_lcore);
+    h->vs_size = sizeof(struct metrics_shm_vs);
+    h->vs_off =
+        h->port_off + lb_device_count * sizeof(struct metrics_shm_port);
+    h->rs_size = sizeof(struct metrics_shm_rs);
+    h->rs_off = h->vs_off;
+    h->max_vs = LB_MAX_VS;
+    h->max_rs = METRICS_MAX_RS;
+}
+
+static void
+metrics_timer_cb(__attribute__((unused)) struct rte_timer *t,
+                 __attribute__((unused)) void *arg) {
+    struct metrics_shm_header *h = metrics_hdr;
+    uint64_t start = rte_rdtsc();
+
+    h->seq++;
+    rte_smp_wmb();
+    lb_metrics_region_update(h);
+    rte_smp_wmb();
+    h->seq++;
+
+    metrics_updates++;
+    metrics_update_cycles = rte_rdtsc() - start;
+}
+
+/*
+ * A new file each start, readers still mapping the previous one see its
+ * update time stop.
+ */
+static struct metrics_shm_header *
+metrics_region_create(const char *path, uint64_t size) {
+    void *base;
+    int fd;
+
+    unlink(path);
+    fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0)
+        return NULL;
+    if (ftruncate(fd, size) < 0) {
+        close(fd);
+        unlink(path);
+        return NULL;
+    }
+    base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        unlink(path);
+        return NULL;
+    }
+    return base;
+}
+
+int
+lb_metrics_init(void) {
+    struct lb_metrics_conf *conf = &lb_cfg->metrics;
+    struct metrics_shm_header *h;
+    uint32_t interval_ms;
+    uint64_t size;
+
+    if (conf->path[0] == '\0')
+        return 0;
+    interval_ms = conf->interval_ms != 0 ? conf->interval_ms
+                                         : METRICS_DEFAULT_INTERVAL_MS;
+
+    size = lb_metrics_region_size();
+    h = metrics_region_create(conf->path, size);
+    if (h == NULL) {
+        RTE_LOG(ERR, USER1, "%s(): Cannot create metrics region %s, %s.\n",
+                __func__, conf->path, strerror(errno));
+        return -1;
+    }
+    lb_metrics_region_init(h, size, interval_ms);
+    metrics_hdr = h;
+
+    rte_timer_init(&metrics_timer);
+    return rte_timer_reset(&metrics_timer, MS_TO_CYCLES(interval_ms),
+                           PERIODICAL, rte_get_master_lcore(),
+                           metrics_timer_cb, NULL);
+}
+
+static void
+metrics_stats_cmd_cb(int fd, __attribute__((unused)) char *argv[],
+                     __attribute__((unused)) int argc) {
+    struct metrics_shm_header *h = metrics_hdr;
+
+    if (h == NULL) {
+        unixctl_command_reply(fd, "enabled: no\n");
+        return;
+    }
+    unixctl_command_reply(fd, "enabled: yes\n");
+    unixctl_command_reply(fd, NORM_KV_S_FMT("path", "\n"),
+                          lb_cfg->metrics.path);
+    unixctl_command_reply(fd, NORM_KV_32_FMT("interval_ms", "\n"),
+                          h->interval_ms);
+    unixctl_command_reply(fd, NORM_KV_64_FMT("size", "\n"), h->size);
+    unixctl_command_reply(fd, NORM_KV_64_FMT("used", "\n"), h->used);
+    unixctl_command_reply(fd, NORM_KV_64_FMT("updates", "\n"),
+                          metrics_updates);
+    unixctl_command_reply(fd, NORM_KV_64_FMT("update_us", "\n"),
+                          metrics_update_cycles * US_PER_S / rte_get_tsc_hz());
+    unixctl_command_reply(fd, NORM_KV_32_FMT("vs_truncated", "\n"),
+                          h->vs_truncated);
+    unixctl_command_reply(fd, NORM_KV_32_FMT("rs_truncated", "\n"),
+                          h->rs_truncated);
+}
+
+UNIXCTL_CMD_REGISTER("metrics/stats", "",
+                     "Show the state of the shared memory metrics region.", 0,
+                     0, metrics_stats_cmd_cb);
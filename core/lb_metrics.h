@@ -0,0 +1,16 @@
+/* Copyright (c) 2018. TIG developer. */
+
+#ifndef __LB_METRICS_H__
+#define __LB_METRICS_H__
+
+#include <stdint.h>
+
+struct metrics_shm_header;
+
+uint64_t lb_metrics_region_size(void);
+void lb_metrics_region_init(struct metrics_shm_header *h, uint64_t size,
+                            uint32_t interval_ms);
+void lb_metrics_region_update(struct metrics_shm_header *h);
+int lb_metrics_init(void);
+
+#endif
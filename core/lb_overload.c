@@ -0,0 +1,187 @@
+/* Copyright (c) 2018. TIG developer. */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <rte_cycles.h>
+#include <rte_ethdev.h>
+#include <rte_lcore.h>
+#include <rte_log.h>
+#include <rte_mempool.h>
+
+#include <unixctl_command.h>
+
+#include "lb_clock.h"
+#include "lb_config.h"
+#include "lb_device.h"
+#include "lb_format.h"
+#include "lb_overload.h"
+
+/*
+ * A worker is overloaded when one of its RX queues fills past rxq_high
+ * percent, when less than mbuf_low percent of the mbufs of a device are
+ * free, or when a round of its loop takes longer than round_max_us. It
+ * then sheds new connections until all the measures are back under half
+ * of their thresholds. Control packets for the kernel are never shed.
+ */
+#define OVERLOAD_CHECK_US 100
+
+static uint32_t overload_rxq_high;
+static uint32_t overload_mbuf_low;
+static uint32_t overload_round_max_us;
+
+uint32_t lb_overload_enabled;
+uint64_t lb_overload_check_cycles;
+struct lb_overload_lcore lb_overload_lcores[RTE_MAX_LCORE];
+
+static const char *overload_shed_names[] = {
+    [LB_SHED_TCP_SYN] = "tcp_syn",
+    [LB_SHED_UDP_NEW] = "udp_new",
+    [LB_SHED_ICMP_ECHO] = "icmp_echo",
+};
+
+void
+lb_overload_check(struct lb_overload_lcore *ol, uint64_t now) {
+    struct lb_device *dev;
+    uint32_t rxq_used = 0, mbuf_free = 100, round_us;
+    uint32_t used, avail;
+    uint16_t i;
+    int count;
+
+    for (i = 0; i < ol->nb_queues; i++) {
+        dev = ol->queues[i].dev;
+        count = rte_eth_rx_queue_count(dev->port_id, ol->queues[i].rxq_id);
+        if (count > 0) {
+            used = (uint32_t)count * 100 / dev->rxq_size;
+            if (used > rxq_used)
+                rxq_used = used;
+        }
+        avail = rte_mempool_avail_count(dev->mp) * 100 / dev->mp->size;
+        if (avail < mbuf_free)
+            mbuf_free = avail;
+    }
+    round_us = ol->round_max * US_PER_S / rte_get_timer_hz();
+
+    ol->rxq_used = rxq_used;
+    ol->mbuf_free = mbuf_free;
+    ol->round_us = round_us;
+    ol->round_max = 0;
+    ol->check_tsc = now;
+
+    if (!ol->shed) {
+        if ((overload_rxq_high && rxq_used >= overload_rxq_high) ||
+            (overload_mbuf_low && mbuf_free <= overload_mbuf_low) ||
+            (overload_round_max_us && round_us >= overload_round_max_us)) {
+            ol->shed = 1;
+            ol->enters++;
+        }
+    } else {
+        if ((!overload_rxq_high || rxq_used < overload_rxq_high / 2) &&
+            (!overload_mbuf_low || mbuf_free > overload_mbuf_low * 2) &&
+            (!overload_round_max_us ||
+             round_us < overload_round_max_us / 2)) {
+            ol->shed = 0;
+        }
+    }
+}
+
+void
+lb_overload_lcore_init(uint32_t lcore_id) {
+    struct lb_overload_lcore *ol = &lb_overload_lcores[lcore_id];
+    struct lb_device *dev;
+    uint16_t devid, k;
+
+    LB_DEVICE_FOREACH(devid, dev) {
+        if (!dev->lcore_conf[lcore_id].rxq_enable)
+            continue;
+        for (k = 0; k < dev->rxq_per_lcore; k++) {
+            ol->queues[ol->nb_queues].dev = dev;
+            ol->queues[ol->nb_queues].rxq_id =
+                dev->lcore_conf[lcore_id].rxq_id + k * dev->nb_rxq;
+            ol->nb_queues++;
+        }
+    }
+    ol->check_tsc = rte_rdtsc();
+}
+
+int
+lb_overload_init(void) {
+    struct lb_overload_conf *conf = &lb_cfg->overload;
+
+    overload_rxq_high = conf->rxq_high;
+    overload_mbuf_low = conf->mbuf_low;
+    overload_round_max_us = conf->round_max_us;
+    lb_overload_check_cycles = US_TO_CYCLES(OVERLOAD_CHECK_US);
+    lb_overload_enabled =
+        overload_rxq_high || overload_mbuf_low || overload_round_max_us;
+    return 0;
+}
+
+static void
+overload_stats_cmd_cb(int fd, char *argv[], int argc) {
+    struct lb_overload_lcore *ol;
+    uint32_t lcore_id, i;
+    int json_fmt = 0, json_first_obj = 1;
+
+    if (argc > 0) {
+        if (strcmp(argv[0], "--json") != 0) {
+            unixctl_command_reply_error(fd, "Invalid parameter: %s.\n",
+                                        argv[0]);
+            return;
+        }
+        json_fmt = 1;
+    }
+
+    if (json_fmt)
+        unixctl_command_reply(fd, "[");
+    RTE_LCORE_FOREACH_SLAVE(lcore_id) {
+        ol = &lb_overload_lcores[lcore_id];
+        if (ol->nb_queues == 0)
+            continue;
+        if (json_fmt) {
+            unixctl_command_reply(fd, json_first_obj ? "{" : ",{");
+            json_first_obj = 0;
+            unixctl_command_reply(fd, JSON_KV_32_FMT("lcore", ","), lcore_id);
+            unixctl_command_reply(fd, JSON_KV_32_FMT("shedding", ","),
+                                  ol->shed);
+            unixctl_command_reply(fd, JSON_KV_32_FMT("rxq_used", ","),
+                                  ol->rxq_used);
+            unixctl_command_reply(fd, JSON_KV_32_FMT("mbuf_free", ","),
+                                  ol->mbuf_free);
+            unixctl_command_reply(fd, JSON_KV_32_FMT("round_us", ","),
+                                  ol->round_us);
+            unixctl_command_reply(fd, JSON_KV_64_FMT("enters", ","),
+                                  ol->enters);
+            for (i = 0; i < LB_SHED_MAX; i++) {
+                unixctl_command_reply(fd, "\"shed_%s\":%" PRIu64 "%s",
+                                      overload_shed_names[i],
+                                      ol->shed_pkts[i],
+                                      i + 1 < LB_SHED_MAX ? "," : "}");
+            }
+        } else {
+            unixctl_command_reply(fd, "lcore%u\n", lcore_id);
+            unixctl_command_reply(fd, NORM_KV_S_FMT("  shedding", "\n"),
+                                  ol->shed ? "yes" : "no");
+            unixctl_command_reply(fd, NORM_KV_32_FMT("  rxq_used(%%)", "\n"),
+                                  ol->rxq_used);
+            unixctl_command_reply(fd, NORM_KV_32_FMT("  mbuf_free(%%)", "\n"),
+                                  ol->mbuf_free);
+            unixctl_command_reply(fd, NORM_KV_32_FMT("  round_us", "\n"),
+                                  ol->round_us);
+            unixctl_command_reply(fd, NORM_KV_64_FMT("  enters", "\n"),
+                                  ol->enters);
+            for (i = 0; i < LB_SHED_MAX; i++) {
+                unixctl_command_reply(fd, "  shed_%s: %" PRIu64 "\n",
+                                      overload_shed_names[i],
+                                      ol->shed_pkts[i]);
+            }
+        }
+    }
+    if (json_fmt)
+        unixctl_command_reply(fd, "]\n");
+}
+
+UNIXCTL_CMD_REGISTER("overload/stats", "[--json].",
+                     "Show the load measures and the new connections shed "
+                     "by each worker.",
+                     0, 1, overload_stats_cmd_cb);
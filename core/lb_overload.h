@@ -0,0 +1,88 @@
+/* Copyright (c) 2018. TIG developer. */
+
+#ifndef __LB_OVERLOAD_H__
+#define __LB_OVERLOAD_H__
+
+#include <rte_branch_prediction.h>
+#include <rte_cycles.h>
+#include <rte_lcore.h>
+
+#include "lb_config.h"
+
+#define LB_OVERLOAD_MAX_QUEUES (RTE_MAX_ETHPORTS * LB_MAX_RXQ_PER_LCORE)
+
+/* New work shed by an overloaded worker, established flows never are. */
+enum {
+    LB_SHED_TCP_SYN,
+    LB_SHED_UDP_NEW,
+    LB_SHED_ICMP_ECHO,
+    LB_SHED_MAX,
+};
+
+struct lb_device;
+
+struct lb_overload_lcore {
+    uint32_t shed;
+    uint64_t check_tsc;
+    uint64_t round_tsc;
+    /* Longest round with packets since the last check. */
+    uint64_t round_max;
+    uint16_t nb_queues;
+    struct {
+        struct lb_device *dev;
+        uint16_t rxq_id;
+    } queues[LB_OVERLOAD_MAX_QUEUES];
+    /* Last measures, in percent and microseconds. */
+    uint32_t rxq_used;
+    uint32_t mbuf_free;
+    uint32_t round_us;
+    uint64_t enters;
+    uint64_t shed_pkts[LB_SHED_MAX];
+} __rte_cache_aligned;
+
+extern uint32_t lb_overload_enabled;
+extern uint64_t lb_overload_check_cycles;
+extern struct lb_overload_lcore lb_overload_lcores[RTE_MAX_LCORE];
+
+void lb_overload_check(struct lb_overload_lcore *ol, uint64_t now);
+
+static inline void
+lb_overload_round_begin(uint32_t lcore_id) {
+    if (likely(!lb_overload_enabled))
+        return;
+    lb_overload_lcores[lcore_id].round_tsc = rte_rdtsc();
+}
+
+/*
+ * Called by a worker after a round, before it backs off when idle, so
+ * the sleeps are not taken for latency.
+ */
+static inline void
+lb_overload_round_end(uint32_t lcore_id) {
+    struct lb_overload_lcore *ol = &lb_overload_lcores[lcore_id];
+    uint64_t now;
+
+    if (likely(!lb_overload_enabled))
+        return;
+    now = rte_rdtsc();
+    if (now - ol->round_tsc > ol->round_max)
+        ol->round_max = now - ol->round_tsc;
+    if (now - ol->check_tsc >= lb_overload_check_cycles)
+        lb_overload_check(ol, now);
+}
+
+/* Whether the worker drops this new work, counted if so. */
+static inline int
+lb_overload_shed(uint32_t type) {
+    struct lb_overload_lcore *ol = &lb_overload_lcores[rte_lcore_id()];
+
+    if (likely(!ol->shed))
+        return 0;
+    ol->shed_pkts[type]++;
+    return 1;
+}
+
+int lb_overload_init(void);
+void lb_overload_lcore_init(uint32_t lcore_id);
+
+#endif
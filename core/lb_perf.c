@@ -0,0 +1,161 @@
+/* Copyright (c) 2018. TIG developer. */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <rte_atomic.h>
+#include <rte_cycles.h>
+#include <rte_lcore.h>
+
+#include <unixctl_command.h>
+
+#include "lb_format.h"
+#include "lb_perf.h"
+
+uint32_t lb_perf_enabled;
+struct lb_perf_lcore lb_perf_lcores[RTE_MAX_LCORE];
+
+static const char *perf_stage_names[] = {
+    [LB_PERF_RX] = "rx",
+    [LB_PERF_CLASSIFY] = "classify",
+    [LB_PERF_CONN_LOOKUP] = "conn_lookup",
+    [LB_PERF_SCHEDULE] = "schedule",
+    [LB_PERF_REWRITE] = "rewrite",
+    [LB_PERF_OUTPUT] = "output",
+    [LB_PERF_TX_FLUSH] = "tx_flush",
+    [LB_PERF_PACKET] = "packet",
+    [LB_PERF_BURST] = "burst",
+};
+
+/* Upper bound of the bucket holding the quantile @pct of the samples. */
+static uint64_t
+perf_quantile(const struct lb_perf_stage *s, uint32_t pct) {
+    uint64_t sum = 0, rank;
+    uint32_t i;
+
+    if (s->count == 0)
+        return 0;
+    rank = (s->count * pct + 99) / 100;
+    for (i = 0; i < LB_PERF_BUCKETS - 1; i++) {
+        sum += s->hist[i];
+        if (sum >= rank)
+            break;
+    }
+    return 2ULL << i;
+}
+
+static void
+perf_stages_sum(struct lb_perf_stage *stages) {
+    struct lb_perf_stage *s;
+    uint32_t lcore_id, i, k;
+
+    memset(stages, 0, sizeof(*stages) * LB_PERF_MAX);
+    RTE_LCORE_FOREACH(lcore_id) {
+        for (i = 0; i < LB_PERF_MAX; i++) {
+            s = &lb_perf_lcores[lcore_id].stages[i];
+            stages[i].count += s->count;
+            stages[i].cycles += s->cycles;
+            for (k = 0; k < LB_PERF_BUCKETS; k++)
+                stages[i].hist[k] += s->hist[k];
+        }
+    }
+}
+
+static void
+perf_stages_normal(int fd, struct lb_perf_stage *stages) {
+    struct lb_perf_stage *s;
+    uint32_t i, k;
+
+    unixctl_command_reply(fd, NORM_KV_S_FMT("accounting", "\n"),
+                          lb_perf_enabled ? "on" : "off");
+    unixctl_command_reply(fd, NORM_KV_64_FMT("tsc-hz", "\n"),
+                          rte_get_tsc_hz());
+    for (i = 0; i < LB_PERF_MAX; i++) {
+        s = &stages[i];
+        unixctl_command_reply(fd,
+                              "%s: count %" PRIu64 ", avg %" PRIu64
+                              ", p50 < %" PRIu64 ", p99 < %" PRIu64 "\n",
+                              perf_stage_names[i], s->count,
+                              s->count ? s->cycles / s->count : 0,
+                              perf_quantile(s, 50), perf_quantile(s, 99));
+        for (k = 0; k < LB_PERF_BUCKETS; k++) {
+            if (s->hist[k] == 0)
+                continue;
+            unixctl_command_reply(fd,
+                                  "  [%" PRIu64 ", %" PRIu64 "): %" PRIu64
+                                  "\n",
+                                  1ULL << k, 2ULL << k, s->hist[k]);
+        }
+    }
+}
+
+static void
+perf_stages_json(int fd, struct lb_perf_stage *stages) {
+    struct lb_perf_stage *s;
+    uint32_t i, k;
+
+    unixctl_command_reply(fd, "{");
+    unixctl_command_reply(fd, JSON_KV_32_FMT("enabled", ","),
+                          lb_perf_enabled);
+    unixctl_command_reply(fd, JSON_KV_64_FMT("tsc_hz", ","),
+                          rte_get_tsc_hz());
+    unixctl_command_reply(fd, "\"stages\":[");
+    for (i = 0; i < LB_PERF_MAX; i++) {
+        s = &stages[i];
+        unixctl_command_reply(fd, i == 0 ? "{" : ",{");
+        unixctl_command_reply(fd, JSON_KV_S_FMT("stage", ","),
+                              perf_stage_names[i]);
+        unixctl_command_reply(fd, JSON_KV_64_FMT("count", ","), s->count);
+        unixctl_command_reply(fd, JSON_KV_64_FMT("cycles", ","), s->cycles);
+        unixctl_command_reply(fd, "\"hist\":[");
+        for (k = 0; k < LB_PERF_BUCKETS; k++) {
+            unixctl_command_reply(fd, "%" PRIu64 "%s", s->hist[k],
+                                  k + 1 < LB_PERF_BUCKETS ? "," : "]}");
+        }
+    }
+    unixctl_command_reply(fd, "]}\n");
+}
+
+/*
+ * The counters are reset under the feet of the workers, a sample being
+ * added at the same time may survive.
+ */
+static void
+perf_stages_cmd_cb(int fd, char *argv[], int argc) {
+    struct lb_perf_stage stages[LB_PERF_MAX];
+    uint32_t lcore_id;
+
+    if (argc > 0 && strcmp(argv[0], "on") == 0) {
+        lb_perf_enabled = 1;
+        rte_wmb();
+        return;
+    }
+    if (argc > 0 && strcmp(argv[0], "off") == 0) {
+        lb_perf_enabled = 0;
+        rte_wmb();
+        return;
+    }
+    if (argc > 0 && strcmp(argv[0], "reset") == 0) {
+        RTE_LCORE_FOREACH(lcore_id) {
+            memset(lb_perf_lcores[lcore_id].stages, 0,
+                   sizeof(lb_perf_lcores[lcore_id].stages));
+        }
+        return;
+    }
+    if (argc > 0 && strcmp(argv[0], "--json") != 0) {
+        unixctl_command_reply_error(fd, "Invalid parameter: %s.\n", argv[0]);
+        return;
+    }
+
+    perf_stages_sum(stages);
+    if (argc > 0)
+        perf_stages_json(fd, stages);
+    else
+        perf_stages_normal(fd, stages);
+}
+
+UNIXCTL_CMD_REGISTER("perf/stages", "[on|off|reset|--json].",
+                     "Switch the cycle accounting of the forwarding stages, "
+                     "or show their cycle histograms.",
+                     0, 1, perf_stages_cmd_cb);
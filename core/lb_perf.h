@@ -0,0 +1,115 @@
+/* Copyright (c) 2018. TIG developer. */
+
+#ifndef __LB_PERF_H__
+#define __LB_PERF_H__
+
+#include <rte_branch_prediction.h>
+#include <rte_cycles.h>
+#include <rte_lcore.h>
+
+/* Histogram buckets, bucket k counts [2^k, 2^(k+1)) cycles. */
+#define LB_PERF_BUCKETS 32
+
+/*
+ * Stages of the forwarding loop. The per-packet stages are chained by
+ * marks, each one takes the cycles since the previous mark of the packet;
+ * a stage a packet skips, such as scheduling for an existing connection,
+ * is not counted for it.
+ */
+enum {
+    LB_PERF_RX,          /* RX burst and steering, per burst. */
+    LB_PERF_CLASSIFY,    /* Ether type and protocol dispatch. */
+    LB_PERF_CONN_LOOKUP, /* Connection table lookup. */
+    LB_PERF_SCHEDULE,    /* Scheduling and connection creation. */
+    LB_PERF_REWRITE,     /* Address, port, sequence and checksum rewrite. */
+    LB_PERF_OUTPUT,      /* ARP lookup and TX buffering. */
+    LB_PERF_TX_FLUSH,    /* TX buffer flush, per round. */
+    LB_PERF_PACKET,      /* Whole handling of a packet. */
+    LB_PERF_BURST,       /* Whole handling of an RX burst. */
+    LB_PERF_MAX,
+};
+
+struct lb_perf_stage {
+    uint64_t count;
+    uint64_t cycles;
+    uint64_t hist[LB_PERF_BUCKETS];
+};
+
+struct lb_perf_lcore {
+    /* TSC of the last mark and of the start of the packet, 0 outside. */
+    uint64_t mark;
+    uint64_t packet_tsc;
+    struct lb_perf_stage stages[LB_PERF_MAX];
+} __rte_cache_aligned;
+
+extern uint32_t lb_perf_enabled;
+extern struct lb_perf_lcore lb_perf_lcores[RTE_MAX_LCORE];
+
+static inline void
+lb_perf_add(struct lb_perf_lcore *pl, uint32_t stage, uint64_t cycles) {
+    struct lb_perf_stage *s = &pl->stages[stage];
+    uint32_t bucket;
+
+    bucket = 63 - __builtin_clzll(cycles | 1);
+    if (bucket >= LB_PERF_BUCKETS)
+        bucket = LB_PERF_BUCKETS - 1;
+    s->count++;
+    s->cycles += cycles;
+    s->hist[bucket]++;
+}
+
+/* TSC to pass to lb_perf_end(), 0 when the accounting is off. */
+static inline uint64_t
+lb_perf_begin(void) {
+    if (likely(!lb_perf_enabled))
+        return 0;
+    return rte_rdtsc();
+}
+
+static inline void
+lb_perf_end(uint32_t stage, uint64_t begin) {
+    if (likely(begin == 0))
+        return;
+    lb_perf_add(&lb_perf_lcores[rte_lcore_id()], stage, rte_rdtsc() - begin);
+}
+
+static inline void
+lb_perf_packet_begin(void) {
+    struct lb_perf_lcore *pl;
+
+    if (likely(!lb_perf_enabled))
+        return;
+    pl = &lb_perf_lcores[rte_lcore_id()];
+    pl->packet_tsc = rte_rdtsc();
+    pl->mark = pl->packet_tsc;
+}
+
+static inline void
+lb_perf_mark(uint32_t stage) {
+    struct lb_perf_lcore *pl;
+    uint64_t now;
+
+    if (likely(!lb_perf_enabled))
+        return;
+    pl = &lb_perf_lcores[rte_lcore_id()];
+    if (pl->mark == 0)
+        return;
+    now = rte_rdtsc();
+    lb_perf_add(pl, stage, now - pl->mark);
+    pl->mark = now;
+}
+
+static inline void
+lb_perf_packet_end(void) {
+    struct lb_perf_lcore *pl;
+
+    if (likely(!lb_perf_enabled))
+        return;
+    pl = &lb_perf_lcores[rte_lcore_id()];
+    if (pl->packet_tsc != 0)
+        lb_perf_add(pl, LB_PERF_PACKET, rte_rdtsc() - pl->packet_tsc);
+    pl->packet_tsc = 0;
+    pl->mark = 0;
+}
+
+#endif
@@ -0,0 +1,315 @@
+/* Copyright (c) 2018. TIG developer. */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <rte_atomic.h>
+#include <rte_ethdev.h>
+#include <rte_interrupts.h>
+#include <rte_lcore.h>
+#include <rte_log.h>
+
+#include <unixctl_command.h>
+
+#include "lb_config.h"
+#include "lb_device.h"
+#include "lb_format.h"
+#include "lb_poll.h"
+
+/*
+ * Empty polls before an idle worker backs off: it pauses for as many
+ * polls again, then sleeps from 1us doubling up to max_sleep_us. In
+ * interrupt mode it then waits for its RX queues, at most
+ * POLL_INTR_TIMEOUT_MS so its timers and the packets steered to it by
+ * other lcores are not held for long.
+ */
+#define POLL_DEFAULT_IDLE_POLLS 256
+#define POLL_DEFAULT_MAX_SLEEP_US 100
+#define POLL_PAUSES 64
+#define POLL_INTR_TIMEOUT_MS 10
+
+uint32_t lb_poll_mode = LB_POLL_M_BUSY;
+uint32_t lb_poll_idle_polls = POLL_DEFAULT_IDLE_POLLS;
+static uint32_t poll_max_sleep_us = POLL_DEFAULT_MAX_SLEEP_US;
+/* The configured mode, interrupts are only set up at start. */
+static uint32_t poll_conf_mode = LB_POLL_M_BUSY;
+
+struct lb_poll_lcore lb_poll_lcores[RTE_MAX_LCORE];
+
+static const char *poll_mode_names[] = {
+    [LB_POLL_M_BUSY] = "busy",
+    [LB_POLL_M_ADAPTIVE] = "adaptive",
+    [LB_POLL_M_INTERRUPT] = "interrupt",
+};
+
+static const char *poll_state_names[] = {
+    [LB_POLL_S_BUSY] = "busy",
+    [LB_POLL_S_PAUSE] = "pause",
+    [LB_POLL_S_SLEEP] = "sleep",
+    [LB_POLL_S_INTR] = "interrupt",
+};
+
+static inline void
+poll_state_set(struct lb_poll_lcore *pl, uint32_t state) {
+    if (pl->state != state) {
+        pl->state = state;
+        pl->transitions[state]++;
+    }
+}
+
+void
+lb_poll_wakeup(struct lb_poll_lcore *pl) {
+    poll_state_set(pl, LB_POLL_S_BUSY);
+    pl->sleep_us = 0;
+}
+
+static void
+poll_sleep(struct lb_poll_lcore *pl) {
+    struct timespec ts;
+
+    poll_state_set(pl, LB_POLL_S_SLEEP);
+    pl->sleep_us = pl->sleep_us != 0
+                       ? RTE_MIN(pl->sleep_us * 2, poll_max_sleep_us)
+                       : 1;
+    ts.tv_sec = 0;
+    ts.tv_nsec = pl->sleep_us * 1000;
+    nanosleep(&ts, NULL);
+    pl->slept_us += pl->sleep_us;
+}
+
+/*
+ * A packet arriving between the last poll and the enable raises no
+ * interrupt, the timeout bounds its delay.
+ */
+static void
+poll_intr_wait(struct lb_poll_lcore *pl) {
+    struct rte_epoll_event events[LB_POLL_MAX_QUEUES];
+    uint16_t i;
+    int n;
+
+    poll_state_set(pl, LB_POLL_S_INTR);
+    for (i = 0; i < pl->nb_queues; i++) {
+        rte_eth_dev_rx_intr_enable(pl->queues[i].port_id,
+                                   pl->queues[i].rxq_id);
+    }
+    n = rte_epoll_wait(RTE_EPOLL_PER_THREAD, events, pl->nb_queues,
+                       POLL_INTR_TIMEOUT_MS);
+    for (i = 0; i < pl->nb_queues; i++) {
+        rte_eth_dev_rx_intr_disable(pl->queues[i].port_id,
+                                    pl->queues[i].rxq_id);
+    }
+    pl->intr_waits++;
+    if (n > 0)
+        pl->intr_wakeups++;
+}
+
+/* Send the packets buffered for TX before the lcore sleeps on them. */
+static void
+poll_tx_flush(void) {
+    uint32_t lcore_id = rte_lcore_id();
+    struct lb_device *dev;
+    uint16_t devid;
+
+    LB_DEVICE_FOREACH(devid, dev) {
+        if (!dev->lcore_conf[lcore_id].rxq_enable ||
+            dev->tx_buffer[lcore_id] == NULL)
+            continue;
+        rte_eth_tx_buffer_flush(dev->port_id,
+                                dev->lcore_conf[lcore_id].txq_id,
+                                dev->tx_buffer[lcore_id]);
+    }
+}
+
+void
+lb_poll_backoff(struct lb_poll_lcore *pl) {
+    uint32_t i;
+
+    if (pl->nb_idle < 2 * lb_poll_idle_polls) {
+        poll_state_set(pl, LB_POLL_S_PAUSE);
+        for (i = 0; i < POLL_PAUSES; i++)
+            rte_pause();
+        return;
+    }
+    poll_tx_flush();
+    if (lb_poll_mode == LB_POLL_M_INTERRUPT && pl->intr &&
+        pl->sleep_us >= poll_max_sleep_us) {
+        poll_intr_wait(pl);
+        return;
+    }
+    poll_sleep(pl);
+}
+
+int
+lb_poll_intr_enabled(void) {
+    return poll_conf_mode == LB_POLL_M_INTERRUPT;
+}
+
+/*
+ * Called by the worker itself, the RX interrupts are registered in the
+ * epoll instance of its thread. Without the interrupts of all its queues
+ * the worker only sleeps.
+ */
+void
+lb_poll_lcore_init(uint32_t lcore_id) {
+    struct lb_poll_lcore *pl = &lb_poll_lcores[lcore_id];
+    struct lb_device *dev;
+    uint16_t devid, k, i;
+    int rc;
+
+    LB_DEVICE_FOREACH(devid, dev) {
+        if (!dev->lcore_conf[lcore_id].rxq_enable)
+            continue;
+        for (k = 0; k < dev->rxq_per_lcore; k++) {
+            pl->queues[pl->nb_queues].port_id = dev->port_id;
+            pl->queues[pl->nb_queues].rxq_id =
+                dev->lcore_conf[lcore_id].rxq_id + k * dev->nb_rxq;
+            pl->nb_queues++;
+        }
+    }
+
+    if (!lb_poll_intr_enabled() || pl->nb_queues == 0)
+        return;
+
+    for (i = 0; i < pl->nb_queues; i++) {
+        rc = rte_eth_dev_rx_intr_ctl_q(
+            pl->queues[i].port_id, pl->queues[i].rxq_id, RTE_EPOLL_PER_THREAD,
+            RTE_INTR_EVENT_ADD, (void *)(uintptr_t)i);
+        if (rc < 0) {
+            RTE_LOG(WARNING, USER1,
+                    "%s(): lcore%u cannot wait for the interrupts of port%u "
+                    "rxq%u, it only sleeps when idle.\n",
+                    __func__, lcore_id, pl->queues[i].port_id,
+                    pl->queues[i].rxq_id);
+            return;
+        }
+    }
+    pl->intr = 1;
+}
+
+int
+lb_poll_init(void) {
+    struct lb_poll_conf *conf = &lb_cfg->poll;
+
+    poll_conf_mode = conf->mode;
+    lb_poll_mode = conf->mode;
+    if (conf->idle_polls != 0)
+        lb_poll_idle_polls = conf->idle_polls;
+    if (conf->max_sleep_us != 0)
+        poll_max_sleep_us = conf->max_sleep_us;
+    return 0;
+}
+
+static void
+poll_mode_cmd_cb(int fd, char *argv[], int argc) {
+    uint32_t mode;
+
+    if (argc == 0) {
+        unixctl_command_reply(fd, "mode: %s\n", poll_mode_names[lb_poll_mode]);
+        unixctl_command_reply(fd, "idle-polls: %u\n", lb_poll_idle_polls);
+        unixctl_command_reply(fd, "max-sleep-us: %u\n", poll_max_sleep_us);
+        return;
+    }
+
+    for (mode = 0; mode < RTE_DIM(poll_mode_names); mode++) {
+        if (strcmp(argv[0], poll_mode_names[mode]) == 0)
+            break;
+    }
+    if (mode == RTE_DIM(poll_mode_names)) {
+        unixctl_command_reply_error(fd, "Invalid parameter: %s.\n", argv[0]);
+        return;
+    }
+    if (mode == LB_POLL_M_INTERRUPT && !lb_poll_intr_enabled()) {
+        unixctl_command_reply_error(
+            fd, "RX interrupts are only set up by the interrupt mode of "
+                "the config file.\n");
+        return;
+    }
+    lb_poll_mode = mode;
+    rte_wmb();
+}
+
+UNIXCTL_CMD_REGISTER("poll/mode", "[busy|adaptive|interrupt].",
+                     "Show or set the poll mode of the workers.", 0, 1,
+                     poll_mode_cmd_cb);
+
+static void
+poll_stats_cmd_cb(int fd, char *argv[], int argc) {
+    struct lb_poll_lcore *pl;
+    struct lb_device *dev;
+    uint16_t devid;
+    uint32_t lcore_id;
+    int json_fmt = 0, json_first_obj = 1;
+    int worker;
+
+    if (argc > 0) {
+        if (strcmp(argv[0], "--json") != 0) {
+            unixctl_command_reply_error(fd, "Invalid parameter: %s.\n",
+                                        argv[0]);
+            return;
+        }
+        json_fmt = 1;
+    }
+
+    if (json_fmt)
+        unixctl_command_reply(fd, "[");
+    RTE_LCORE_FOREACH_SLAVE(lcore_id) {
+        worker = 0;
+        LB_DEVICE_FOREACH(devid, dev) {
+            if (dev->lcore_conf[lcore_id].rxq_enable)
+                worker = 1;
+        }
+        if (!worker)
+            continue;
+        pl = &lb_poll_lcores[lcore_id];
+        if (json_fmt) {
+            unixctl_command_reply(fd, json_first_obj ? "{" : ",{");
+            json_first_obj = 0;
+            unixctl_command_reply(fd, JSON_KV_32_FMT("lcore", ","), lcore_id);
+            unixctl_command_reply(fd, JSON_KV_S_FMT("state", ","),
+                                  poll_state_names[pl->state]);
+            unixctl_command_reply(fd, JSON_KV_32_FMT("interrupt", ","),
+                                  pl->intr);
+            unixctl_command_reply(fd, JSON_KV_64_FMT("to_busy", ","),
+                                  pl->transitions[LB_POLL_S_BUSY]);
+            unixctl_command_reply(fd, JSON_KV_64_FMT("to_pause", ","),
+                                  pl->transitions[LB_POLL_S_PAUSE]);
+            unixctl_command_reply(fd, JSON_KV_64_FMT("to_sleep", ","),
+                                  pl->transitions[LB_POLL_S_SLEEP]);
+            unixctl_command_reply(fd, JSON_KV_64_FMT("to_interrupt", ","),
+                                  pl->transitions[LB_POLL_S_INTR]);
+            unixctl_command_reply(fd, JSON_KV_64_FMT("slept_us", ","),
+                                  pl->slept_us);
+            unixctl_command_reply(fd, JSON_KV_64_FMT("intr_waits", ","),
+                                  pl->intr_waits);
+            unixctl_command_reply(fd, JSON_KV_64_FMT("intr_wakeups", "}"),
+                                  pl->intr_wakeups);
+        } else {
+            unixctl_command_reply(fd, "lcore%u\n", lcore_id);
+            unixctl_command_reply(fd, NORM_KV_S_FMT("  state", "\n"),
+                                  poll_state_names[pl->state]);
+            unixctl_command_reply(fd, NORM_KV_S_FMT("  interrupt", "\n"),
+                                  pl->intr ? "yes" : "no");
+            unixctl_command_reply(fd, NORM_KV_64_FMT("  to_busy", "\n"),
+                                  pl->transitions[LB_POLL_S_BUSY]);
+            unixctl_command_reply(fd, NORM_KV_64_FMT("  to_pause", "\n"),
+                                  pl->transitions[LB_POLL_S_PAUSE]);
+            unixctl_command_reply(fd, NORM_KV_64_FMT("  to_sleep", "\n"),
+                                  pl->transitions[LB_POLL_S_SLEEP]);
+            unixctl_command_reply(fd, NORM_KV_64_FMT("  to_interrupt", "\n"),
+                                  pl->transitions[LB_POLL_S_INTR]);
+            unixctl_command_reply(fd, NORM_KV_64_FMT("  slept_us", "\n"),
+                                  pl->slept_us);
+            unixctl_command_reply(fd, NORM_KV_64_FMT("  intr_waits", "\n"),
+                                  pl->intr_waits);
+            unixctl_command_reply(fd, NORM_KV_64_FMT("  intr_wakeups", "\n"),
+                                  pl->intr_wakeups);
+        }
+    }
+    if (json_fmt)
+        unixctl_command_reply(fd, "]\n");
+}
+
+UNIXCTL_CMD_REGISTER("poll/stats", "[--json].",
+                     "Show the poll states and transitions of the workers.", 0,
+                     1, poll_stats_cmd_cb);
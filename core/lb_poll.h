@@ -0,0 +1,72 @@
+/* Copyright (c) 2018. TIG developer. */
+
+#ifndef __LB_POLL_H__
+#define __LB_POLL_H__
+
+#include <rte_branch_prediction.h>
+#include <rte_lcore.h>
+
+#include "lb_config.h"
+
+/* RX queues a worker waits on in interrupt mode. */
+#define LB_POLL_MAX_QUEUES (RTE_MAX_ETHPORTS * LB_MAX_RXQ_PER_LCORE)
+
+/* States of a worker, from the busiest to the idlest. */
+enum {
+    LB_POLL_S_BUSY,
+    LB_POLL_S_PAUSE,
+    LB_POLL_S_SLEEP,
+    LB_POLL_S_INTR,
+    LB_POLL_S_MAX,
+};
+
+struct lb_poll_lcore {
+    uint32_t state;
+    /* Empty polls in a row. */
+    uint32_t nb_idle;
+    uint32_t sleep_us;
+    /* RX interrupts of all its queues are registered. */
+    uint32_t intr;
+    uint16_t nb_queues;
+    struct {
+        uint16_t port_id;
+        uint16_t rxq_id;
+    } queues[LB_POLL_MAX_QUEUES];
+    /* Times the lcore entered each state. */
+    uint64_t transitions[LB_POLL_S_MAX];
+    uint64_t slept_us;
+    uint64_t intr_waits;
+    uint64_t intr_wakeups;
+} __rte_cache_aligned;
+
+extern uint32_t lb_poll_mode;
+extern uint32_t lb_poll_idle_polls;
+extern struct lb_poll_lcore lb_poll_lcores[RTE_MAX_LCORE];
+
+void lb_poll_wakeup(struct lb_poll_lcore *pl);
+void lb_poll_backoff(struct lb_poll_lcore *pl);
+
+/*
+ * Called by a worker after each round with the packets it received. An
+ * idle worker pauses, then sleeps longer and longer, then waits for RX
+ * interrupts; the first packet brings it back to busy polling.
+ */
+static inline void
+lb_poll_idle(uint32_t lcore_id, uint32_t nb_rx) {
+    struct lb_poll_lcore *pl = &lb_poll_lcores[lcore_id];
+
+    if (nb_rx != 0) {
+        pl->nb_idle = 0;
+        if (unlikely(pl->state != LB_POLL_S_BUSY))
+            lb_poll_wakeup(pl);
+        return;
+    }
+    if (lb_poll_mode != LB_POLL_M_BUSY && ++pl->nb_idle >= lb_poll_idle_polls)
+        lb_poll_backoff(pl);
+}
+
+int lb_poll_init(void);
+void lb_poll_lcore_init(uint32_t lcore_id);
+int lb_poll_intr_enabled(void);
+
+#endif
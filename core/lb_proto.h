@@ -24,6 +24,7 @@ enum {
 };
 
 struct lb_device;
+struct lb_conn_table;
 
 struct lb_proto {
     uint8_t id;
@@ -31,6 +32,11 @@ struct lb_proto {
     int (*init)(void);
     int (*fullnat_handle)(struct rte_mbuf *, struct ipv4_hdr *,
                           struct lb_device *dev);
+    /* IPv6 client packets of NAT64 services, NULL if not supported. */
+    int (*nat64_handle)(struct rte_mbuf *, struct ipv6_hdr *,
+                        struct lb_device *dev);
+    /* Connection table of an lcore, NULL if the protocol keeps none. */
+    struct lb_conn_table *(*conn_table)(uint32_t lcore_id);
 };
 
 #define IPv4_HLEN(iph) (((iph)->version_ihl & IPV4_HDR_IHL_MASK) << 2)
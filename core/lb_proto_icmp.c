@@ -1,24 +1,360 @@
 /* Copyright (c) 2018. TIG developer. */
 
+#include <rte_ethdev.h>
+#include <rte_hash.h>
 #include <rte_icmp.h>
 #include <rte_ip.h>
 #include <rte_ip_frag.h>
+#include <rte_lcore.h>
+#include <rte_malloc.h>
 #include <rte_mbuf.h>
+#include <rte_ring.h>
+#include <rte_tcp.h>
+#include <rte_thash.h>
 
+#include <unixctl_command.h>
+
+#include "lb_clock.h"
+#include "lb_conn.h"
 #include "lb_device.h"
+#include "lb_drop.h"
+#include "lb_format.h"
+#include "lb_ipfrag.h"
+#include "lb_mbuf.h"
+#include "lb_overload.h"
+#include "lb_parser.h"
 #include "lb_proto.h"
+#include "lb_proto_icmp.h"
 #include "lb_service.h"
+#include "lb_tunnel.h"
+
+#define ICMP_DEST_UNREACH 3
+#define ICMP_SOURCE_QUENCH 4
+#define ICMP_TIME_EXCEEDED 11
+#define ICMP_PARAMETERPROB 12
+
+#define ICMP_FRAG_NEEDED 4
+
+#define ICMP_RELAY_RING_SIZE (PKT_MAX_BURST * 8)
+#define ICMP_RSS_KEY_LEN 52
+
+/* ICMP errors sent or translated per second on each lcore, 0 is unlimited. */
+static uint32_t icmp_ratelimit = 1000;
+
+static struct {
+    uint32_t tokens;
+    uint32_t last;
+} icmp_buckets[RTE_MAX_LCORE];
+
+static struct {
+    uint64_t echo;
+    uint64_t err_to_client;
+    uint64_t err_to_backend;
+    uint64_t err_oneway;
+    uint64_t frag_needed;
+    uint64_t no_conn;
+    uint64_t ratelimited;
+    uint64_t invalid;
+    uint64_t relayed;
+    uint64_t relay_full;
+} __rte_cache_aligned icmp_stats[RTE_MAX_LCORE];
+
+/*
+ * The connections are only looked up by the lcore owning them. An error
+ * not matching a connection of its lcore is passed once to the owner,
+ * worked out from the quoted packet, through its MPSC ring.
+ */
+struct icmp_dev {
+    struct rte_ring *rings[RTE_MAX_LCORE];
+    /* Lcore polling each rxq_id. */
+    uint16_t lcores[RTE_MAX_LCORE];
+    /* RSS of the packets from the clients, reta_size is 0 if unknown. */
+    uint16_t reta_size;
+    uint16_t reta[ETH_RSS_RETA_SIZE_512];
+    uint8_t rss_key[ICMP_RSS_KEY_LEN];
+};
+
+static struct icmp_dev *icmp_devs[RTE_MAX_ETHPORTS];
+
+static int
+icmp_ratelimit_allow(void) {
+    uint32_t cid = rte_lcore_id();
+    uint32_t rate = icmp_ratelimit;
+    uint32_t now = LB_CLOCK();
+    uint64_t add;
+
+    if (rate == 0)
+        return 1;
+
+    add = (uint64_t)(now - icmp_buckets[cid].last) * rate / LB_CLOCK_HZ;
+    if (add > 0) {
+        icmp_buckets[cid].tokens =
+            RTE_MIN((uint64_t)rate, icmp_buckets[cid].tokens + add);
+        icmp_buckets[cid].last = now;
+    }
+    if (icmp_buckets[cid].tokens == 0) {
+        icmp_stats[cid].ratelimited++;
+        return 0;
+    }
+    icmp_buckets[cid].tokens--;
+    return 1;
+}
 
 static uint32_t
-icmp_cksum(const struct ipv4_hdr *iph, const struct icmp_hdr *icmph) {
+icmp_cksum(const struct rte_mbuf *m, const struct ipv4_hdr *iph,
+           const struct icmp_hdr *icmph) {
     uint16_t cksum;
-    size_t len;
+    uint32_t off, len;
 
+    off = (const char *)icmph - rte_pktmbuf_mtod(m, const char *);
     len = rte_be_to_cpu_16(iph->total_length) - sizeof(struct ipv4_hdr);
-    cksum = rte_raw_cksum(icmph, len);
+    if (rte_raw_cksum_mbuf(m, off, len, &cksum) < 0)
+        return 0;
     return (cksum == 0xffff) ? cksum : ~cksum;
 }
 
+/*
+ * Tell the sender of @iph that the packet does not fit in @mtu, the
+ * error is sent from the original destination address.
+ */
+void
+lb_icmp_send_frag_needed(struct ipv4_hdr *iph, uint16_t mtu,
+                         struct lb_device *dev) {
+    struct rte_mbuf *m;
+    struct ipv4_hdr *niph;
+    struct icmp_hdr *icmph;
+    uint16_t dlen, tlen;
+
+    if (!icmp_ratelimit_allow())
+        return;
+
+    /* The original IP header and the first 8 bytes of its payload. */
+    dlen = RTE_MIN(rte_be_to_cpu_16(iph->total_length), IPv4_HLEN(iph) + 8);
+    tlen = sizeof(struct ipv4_hdr) + sizeof(struct icmp_hdr) + dlen;
+
+    m = lb_device_pktmbuf_alloc(dev);
+    if (m == NULL)
+        return;
+    if (rte_pktmbuf_append(m, ETHER_HDR_LEN + tlen) == NULL) {
+        rte_pktmbuf_free(m);
+        return;
+    }
+
+    niph = rte_pktmbuf_mtod_offset(m, struct ipv4_hdr *, ETHER_HDR_LEN);
+    icmph = (struct icmp_hdr *)(niph + 1);
+    rte_memcpy(icmph + 1, iph, dlen);
+
+    niph->version_ihl = 0x45;
+    niph->type_of_service = 0;
+    niph->total_length = rte_cpu_to_be_16(tlen);
+    niph->packet_id = 0;
+    niph->fragment_offset = 0;
+    niph->time_to_live = 64;
+    niph->next_proto_id = IPPROTO_ICMP;
+    niph->src_addr = iph->dst_addr;
+    niph->dst_addr = iph->src_addr;
+    niph->hdr_checksum = 0;
+    niph->hdr_checksum = rte_ipv4_cksum(niph);
+
+    icmph->icmp_type = ICMP_DEST_UNREACH;
+    icmph->icmp_code = ICMP_FRAG_NEEDED;
+    icmph->icmp_ident = 0;
+    icmph->icmp_seq_nb = rte_cpu_to_be_16(mtu);
+    icmph->icmp_cksum = 0;
+    icmph->icmp_cksum = icmp_cksum(m, niph, icmph);
+
+    icmp_stats[rte_lcore_id()].frag_needed++;
+    lb_device_output(m, niph, dev);
+}
+
+static inline int
+icmp_is_error(uint8_t type) {
+    return type == ICMP_DEST_UNREACH || type == ICMP_SOURCE_QUENCH ||
+           type == ICMP_TIME_EXCEEDED || type == ICMP_PARAMETERPROB;
+}
+
+/* RX queue owning the local address lip:lport, UINT16_MAX if none. */
+static uint16_t
+icmp_laddr_rxq(struct lb_device *dev, uint32_t lip, uint16_t lport,
+               enum lb_proto_type type) {
+    struct lb_laddr_list *list;
+    uint32_t lcore_id, i;
+
+    if (dev->lport_partition) {
+        if (!lb_is_laddr_exist(lip, dev))
+            return UINT16_MAX;
+        return lb_lport_to_rxq(dev, type, rte_be_to_cpu_16(lport));
+    }
+    RTE_LCORE_FOREACH_SLAVE(lcore_id) {
+        list = &dev->laddr_list[lcore_id];
+        for (i = 0; i < list->nb; i++) {
+            if (list->entries[i].ipv4 == lip)
+                return list->entries[i].rxq_id;
+        }
+    }
+    return UINT16_MAX;
+}
+
+/*
+ * Lcore owning the connection of the packet quoted by an error, it was
+ * sent either from a local address or from a VIP. The connections to a
+ * VIP belong to the RX queue the NIC hashed the client packets to.
+ * Returns RTE_MAX_LCORE if unknown.
+ */
+static uint32_t
+icmp_owner(struct lb_device *dev, const struct ipv4_hdr *ciph,
+           const uint16_t *ports) {
+    struct icmp_dev *idev = icmp_devs[dev->port_id];
+    struct rte_ipv4_tuple t;
+    enum lb_proto_type type;
+    uint32_t hash;
+    uint16_t rxq_id;
+
+    type = ciph->next_proto_id == IPPROTO_TCP ? LB_IPPROTO_TCP
+                                              : LB_IPPROTO_UDP;
+    rxq_id = icmp_laddr_rxq(dev, ciph->src_addr, ports[0], type);
+    if (rxq_id == UINT16_MAX) {
+        if (idev->reta_size == 0)
+            return RTE_MAX_LCORE;
+        t.src_addr = rte_be_to_cpu_32(ciph->dst_addr);
+        t.dst_addr = rte_be_to_cpu_32(ciph->src_addr);
+        t.sport = rte_be_to_cpu_16(ports[1]);
+        t.dport = rte_be_to_cpu_16(ports[0]);
+        hash = rte_softrss((uint32_t *)&t, RTE_THASH_V4_L4_LEN,
+                           idev->rss_key);
+        /* Each lcore polls the queues rxq_id + k * nb_rxq. */
+        rxq_id = idev->reta[hash % idev->reta_size] % dev->nb_rxq;
+    }
+    return idev->lcores[rxq_id];
+}
+
+static int
+icmp_relay(struct rte_mbuf *m, uint32_t lcore_id, struct lb_device *dev) {
+    struct rte_ring *r = icmp_devs[dev->port_id]->rings[lcore_id];
+    uint32_t cid = rte_lcore_id();
+
+    if (rte_ring_mp_enqueue(r, m) < 0) {
+        icmp_stats[cid].relay_full++;
+        lb_drop(m, LB_DROP_RING_FULL);
+        return 0;
+    }
+    icmp_stats[cid].relayed++;
+    return 0;
+}
+
+static int
+icmp_error_handle(struct rte_mbuf *m, struct ipv4_hdr *iph,
+                  struct icmp_hdr *icmph, int relayed,
+                  struct lb_device *dev) {
+    struct ipv4_hdr *ciph;
+    struct tcp_hdr *cth;
+    uint16_t *ports;
+    struct ipv4_4tuple tuple;
+    struct lb_conn *conn;
+    struct lb_proto *p;
+    uint32_t cid = rte_lcore_id();
+    uint32_t seq, owner;
+
+    ciph = (struct ipv4_hdr *)(icmph + 1);
+    if (rte_pktmbuf_data_len(m) <
+            ETHER_HDR_LEN + IPv4_HLEN(iph) + sizeof(struct icmp_hdr) +
+                sizeof(struct ipv4_hdr) + 8 ||
+        rte_pktmbuf_data_len(m) < ETHER_HDR_LEN + IPv4_HLEN(iph) +
+                                      sizeof(struct icmp_hdr) +
+                                      IPv4_HLEN(ciph) + 8 ||
+        (ciph->next_proto_id != IPPROTO_TCP &&
+         ciph->next_proto_id != IPPROTO_UDP) ||
+        !lb_ipfrag_is_first(ciph)) {
+        icmp_stats[cid].invalid++;
+        goto drop;
+    }
+
+    p = lb_proto_get(ciph->next_proto_id);
+    if (p == NULL || p->conn_table == NULL) {
+        icmp_stats[cid].invalid++;
+        goto drop;
+    }
+
+    /* Limited by the lcore receiving it, before it is passed on. */
+    if (!relayed && !icmp_ratelimit_allow())
+        goto drop;
+
+    /* The quoted packet was sent by us, look it up as its answer. */
+    ports = (uint16_t *)((char *)ciph + IPv4_HLEN(ciph));
+    IPv4_4TUPLE(&tuple, ciph->dst_addr, ports[1], ciph->src_addr, ports[0]);
+    if (rte_hash_lookup_data(p->conn_table(cid)->hash, &tuple,
+                             (void **)&conn) < 0) {
+        if (!relayed && icmp_devs[dev->port_id] != NULL) {
+            owner = icmp_owner(dev, ciph, ports);
+            if (owner != cid && owner < RTE_MAX_LCORE)
+                return icmp_relay(m, owner, dev);
+        }
+        icmp_stats[cid].no_conn++;
+        goto drop;
+    }
+
+    if (conn->cip == tuple.sip && conn->cport == tuple.sport) {
+        /* Error on the way to the client. */
+        if (conn->flags & LB_CONN_F_ONEWAY) {
+            /* The real service owns the VIP, hand it the error as is. */
+            icmp_stats[cid].err_oneway++;
+            if (conn->flags & LB_CONN_F_DR)
+                return lb_device_dr_output(m, conn->rip, dev);
+            return lb_tunnel_xmit(m, iph, conn->rip,
+                                  (conn->flags & LB_CONN_F_GUE)
+                                      ? LB_TUNNEL_GUE
+                                      : LB_TUNNEL_IPIP,
+                                  dev);
+        }
+        icmp_stats[cid].err_to_backend++;
+        ciph->src_addr = conn->rip;
+        ciph->dst_addr = conn->lip;
+        ports[0] = conn->rport;
+        ports[1] = conn->lport;
+        if (ciph->next_proto_id == IPPROTO_TCP &&
+            (conn->flags & LB_CONN_F_SYNPROXY)) {
+            cth = (struct tcp_hdr *)ports;
+            seq = rte_be_to_cpu_32(cth->sent_seq) + conn->proxy.oft;
+            cth->sent_seq = rte_cpu_to_be_32(seq);
+        }
+        iph->src_addr = conn->lip;
+        iph->dst_addr = conn->rip;
+    } else {
+        /* Error on the way to the real service. */
+        if (conn->flags & LB_CONN_F_NAT64) {
+            /* Not translated to ICMPv6. */
+            icmp_stats[cid].invalid++;
+            goto drop;
+        }
+        icmp_stats[cid].err_to_client++;
+        ciph->src_addr = conn->cip;
+        ciph->dst_addr = conn->vip;
+        ports[0] = conn->cport;
+        ports[1] = conn->vport;
+        if (ciph->next_proto_id == IPPROTO_TCP) {
+            cth = (struct tcp_hdr *)ports;
+            seq = rte_be_to_cpu_32(cth->sent_seq) - conn->tseq.oft;
+            cth->sent_seq = rte_cpu_to_be_32(seq);
+        }
+        iph->src_addr = conn->vip;
+        iph->dst_addr = conn->cip;
+    }
+
+    ciph->hdr_checksum = 0;
+    ciph->hdr_checksum = rte_ipv4_cksum(ciph);
+    iph->time_to_live = 63;
+    iph->hdr_checksum = 0;
+    iph->hdr_checksum = rte_ipv4_cksum(iph);
+    icmph->icmp_cksum = 0;
+    icmph->icmp_cksum = icmp_cksum(m, iph, icmph);
+
+    return lb_device_output(m, iph, dev);
+
+drop:
+    lb_drop(m, LB_DROP_ICMP);
+    return 0;
+}
+
 static int
 icmp_fullnat_handle(struct rte_mbuf *m, struct ipv4_hdr *iph,
                     struct lb_device *dev) {
@@ -26,20 +362,28 @@ icmp_fullnat_handle(struct rte_mbuf *m, struct ipv4_hdr *iph,
     uint32_t tmpaddr;
 
     if (rte_ipv4_frag_pkt_is_fragmented(iph)) {
-        rte_pktmbuf_free(m);
+        lb_drop(m, LB_DROP_FRAG);
         return 0;
     }
 
+    icmph = (struct icmp_hdr *)((char *)iph + IPv4_HLEN(iph));
+    if (icmp_is_error(icmph->icmp_type))
+        return icmp_error_handle(m, iph, icmph, 0, dev);
+
     if (!lb_is_vip_exist(iph->dst_addr) &&
         !lb_is_laddr_exist(iph->dst_addr, dev)) {
-        rte_pktmbuf_free(m);
+        lb_drop(m, LB_DROP_NO_VS);
         return 0;
     }
 
-    icmph = (struct icmp_hdr *)((char *)iph + IPv4_HLEN(iph));
     if (!((icmph->icmp_type == IP_ICMP_ECHO_REQUEST) &&
           (icmph->icmp_code == 0))) {
-        rte_pktmbuf_free(m);
+        lb_drop(m, LB_DROP_UNSUPPORTED);
+        return 0;
+    }
+
+    if (lb_overload_shed(LB_SHED_ICMP_ECHO)) {
+        lb_drop(m, LB_DROP_OVERLOAD);
         return 0;
     }
 
@@ -51,13 +395,109 @@ icmp_fullnat_handle(struct rte_mbuf *m, struct ipv4_hdr *iph,
 
     icmph->icmp_type = IP_ICMP_ECHO_REPLY;
     icmph->icmp_cksum = 0;
-    icmph->icmp_cksum = icmp_cksum(iph, icmph);
+    icmph->icmp_cksum = icmp_cksum(m, iph, icmph);
+
+    icmp_stats[rte_lcore_id()].echo++;
 
     return lb_device_output(m, iph, dev);
 }
 
+/* Handle the errors passed by the other lcores polling the device. */
+uint16_t
+lb_icmp_relay_drain(struct lb_device *dev) {
+    struct icmp_dev *idev = icmp_devs[dev->port_id];
+    struct rte_mbuf *pkts[PKT_MAX_BURST];
+    struct ipv4_hdr *iph;
+    uint16_t i, n;
+
+    if (idev == NULL)
+        return 0;
+    n = rte_ring_sc_dequeue_burst(idev->rings[rte_lcore_id()],
+                                  (void **)pkts, PKT_MAX_BURST, NULL);
+    for (i = 0; i < n; i++) {
+        iph = rte_pktmbuf_mtod_offset(pkts[i], struct ipv4_hdr *,
+                                      ETHER_HDR_LEN);
+        icmp_error_handle(pkts[i], iph,
+                          (struct icmp_hdr *)((char *)iph + IPv4_HLEN(iph)),
+                          1, dev);
+    }
+    return n;
+}
+
+/* Read the RSS key and redirection table the NIC hashes the clients with. */
+static void
+icmp_rss_init(struct icmp_dev *idev, struct lb_device *dev) {
+    struct rte_eth_rss_reta_entry64
+        reta_conf[ETH_RSS_RETA_SIZE_512 / RTE_RETA_GROUP_SIZE];
+    struct rte_eth_rss_conf rss_conf;
+    struct rte_eth_dev_info info;
+    uint16_t i;
+
+    rte_eth_dev_info_get(dev->port_id, &info);
+    if (info.reta_size == 0 || info.reta_size > ETH_RSS_RETA_SIZE_512 ||
+        info.hash_key_size > ICMP_RSS_KEY_LEN)
+        goto unknown;
+
+    memset(&rss_conf, 0, sizeof(rss_conf));
+    rss_conf.rss_key = idev->rss_key;
+    rss_conf.rss_key_len = ICMP_RSS_KEY_LEN;
+    if (rte_eth_dev_rss_hash_conf_get(dev->port_id, &rss_conf) < 0)
+        goto unknown;
+
+    memset(reta_conf, 0, sizeof(reta_conf));
+    for (i = 0; i < info.reta_size / RTE_RETA_GROUP_SIZE; i++)
+        reta_conf[i].mask = UINT64_MAX;
+    if (rte_eth_dev_rss_reta_query(dev->port_id, reta_conf,
+                                   info.reta_size) < 0)
+        goto unknown;
+    for (i = 0; i < info.reta_size; i++)
+        idev->reta[i] =
+            reta_conf[i / RTE_RETA_GROUP_SIZE].reta[i % RTE_RETA_GROUP_SIZE];
+    idev->reta_size = info.reta_size;
+    return;
+
+unknown:
+    RTE_LOG(INFO, USER1,
+            "%s(): Port%u RSS is unknown, errors to a VIP are only handled "
+            "by the lcore receiving them.\n",
+            __func__, dev->port_id);
+}
+
 static int
 icmp_init(void) {
+    char name[RTE_RING_NAMESIZE];
+    struct icmp_dev *idev;
+    struct lb_device *dev;
+    uint32_t lcore_id;
+    uint16_t devid;
+
+    LB_DEVICE_FOREACH(devid, dev) {
+        if (dev->nb_rxq <= 1)
+            continue;
+        idev = rte_zmalloc_socket("icmp-dev", sizeof(*idev),
+                                  RTE_CACHE_LINE_SIZE, dev->socket_id);
+        if (idev == NULL) {
+            RTE_LOG(ERR, USER1, "%s(): Not enough memory.\n", __func__);
+            return -1;
+        }
+        icmp_devs[dev->port_id] = idev;
+        RTE_LCORE_FOREACH_SLAVE(lcore_id) {
+            if (!dev->lcore_conf[lcore_id].rxq_enable)
+                continue;
+            idev->lcores[dev->lcore_conf[lcore_id].rxq_id] = lcore_id;
+            snprintf(name, sizeof(name), "icmp%u_%u", dev->port_id,
+                     lcore_id);
+            idev->rings[lcore_id] =
+                rte_ring_create(name, ICMP_RELAY_RING_SIZE, dev->socket_id,
+                                RING_F_SC_DEQ);
+            if (idev->rings[lcore_id] == NULL) {
+                RTE_LOG(ERR, USER1, "%s(): Create ring %s failed.\n",
+                        __func__, name);
+                return -1;
+            }
+        }
+        icmp_rss_init(idev, dev);
+    }
     return 0;
 }
 
@@ -69,3 +509,95 @@ static struct lb_proto proto_icmp = {
 };
 
 LB_PROTO_REGISTER(proto_icmp);
+
+static void
+icmp_stats_cmd_cb(int fd, char *argv[], int argc) {
+    uint64_t echo = 0, err_to_client = 0, err_to_backend = 0, err_oneway = 0;
+    uint64_t frag_needed = 0, no_conn = 0, ratelimited = 0, invalid = 0;
+    uint64_t relayed = 0, relay_full = 0;
+    uint32_t lcore_id;
+    int json_fmt = 0;
+
+    if (argc > 0) {
+        if (strcmp(argv[0], "--json") != 0) {
+            unixctl_command_reply_error(fd, "Invalid parameter: %s.\n",
+                                        argv[0]);
+            return;
+        }
+        json_fmt = 1;
+    }
+
+    RTE_LCORE_FOREACH_SLAVE(lcore_id) {
+        echo += icmp_stats[lcore_id].echo;
+        err_to_client += icmp_stats[lcore_id].err_to_client;
+        err_to_backend += icmp_stats[lcore_id].err_to_backend;
+        err_oneway += icmp_stats[lcore_id].err_oneway;
+        frag_needed += icmp_stats[lcore_id].frag_needed;
+        no_conn += icmp_stats[lcore_id].no_conn;
+        ratelimited += icmp_stats[lcore_id].ratelimited;
+        invalid += icmp_stats[lcore_id].invalid;
+        relayed += icmp_stats[lcore_id].relayed;
+        relay_full += icmp_stats[lcore_id].relay_full;
+    }
+
+    if (json_fmt) {
+        unixctl_command_reply(fd, "{");
+        unixctl_command_reply(fd, JSON_KV_64_FMT("echo", ","), echo);
+        unixctl_command_reply(fd, JSON_KV_64_FMT("err_to_client", ","),
+                              err_to_client);
+        unixctl_command_reply(fd, JSON_KV_64_FMT("err_to_backend", ","),
+                              err_to_backend);
+        unixctl_command_reply(fd, JSON_KV_64_FMT("err_oneway", ","),
+                              err_oneway);
+        unixctl_command_reply(fd, JSON_KV_64_FMT("frag_needed", ","),
+                              frag_needed);
+        unixctl_command_reply(fd, JSON_KV_64_FMT("no_conn", ","), no_conn);
+        unixctl_command_reply(fd, JSON_KV_64_FMT("ratelimited", ","),
+                              ratelimited);
+        unixctl_command_reply(fd, JSON_KV_64_FMT("invalid", ","), invalid);
+        unixctl_command_reply(fd, JSON_KV_64_FMT("relayed", ","), relayed);
+        unixctl_command_reply(fd, JSON_KV_64_FMT("relay_full", ""),
+                              relay_full);
+        unixctl_command_reply(fd, "}\n");
+    } else {
+        unixctl_command_reply(fd, NORM_KV_64_FMT("echo", "\n"), echo);
+        unixctl_command_reply(fd, NORM_KV_64_FMT("err_to_client", "\n"),
+                              err_to_client);
+        unixctl_command_reply(fd, NORM_KV_64_FMT("err_to_backend", "\n"),
+                              err_to_backend);
+        unixctl_command_reply(fd, NORM_KV_64_FMT("err_oneway", "\n"),
+                              err_oneway);
+        unixctl_command_reply(fd, NORM_KV_64_FMT("frag_needed", "\n"),
+                              frag_needed);
+        unixctl_command_reply(fd, NORM_KV_64_FMT("no_conn", "\n"), no_conn);
+        unixctl_command_reply(fd, NORM_KV_64_FMT("ratelimited", "\n"),
+                              ratelimited);
+        unixctl_command_reply(fd, NORM_KV_64_FMT("invalid", "\n"), invalid);
+        unixctl_command_reply(fd, NORM_KV_64_FMT("relayed", "\n"), relayed);
+        unixctl_command_reply(fd, NORM_KV_64_FMT("relay_full", "\n"),
+                              relay_full);
+    }
+}
+
+UNIXCTL_CMD_REGISTER("icmp/stats", "[--json].", "Show ICMP statistics.", 0, 1,
+                     icmp_stats_cmd_cb);
+
+static void
+icmp_ratelimit_cmd_cb(int fd, char *argv[], int argc) {
+    uint32_t rate;
+
+    if (argc == 0) {
+        unixctl_command_reply(fd, "%u\n", icmp_ratelimit);
+        return;
+    }
+
+    if (parser_read_uint32(&rate, argv[0]) < 0) {
+        unixctl_command_reply_error(fd, "Invalid parameter: %s.\n", argv[0]);
+        return;
+    }
+    icmp_ratelimit = rate;
+}
+
+UNIXCTL_CMD_REGISTER("icmp/ratelimit", "[PPS].",
+                     "Show or set ICMP errors per second of each lcore.", 0, 1,
+                     icmp_ratelimit_cmd_cb);
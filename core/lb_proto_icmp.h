@@ -0,0 +1,14 @@
+/* Copyright (c) 2018. TIG developer. */
+
+#ifndef __LB_PROTO_ICMP_H__
+#define __LB_PROTO_ICMP_H__
+
+#include <rte_ip.h>
+
+struct lb_device;
+
+void lb_icmp_send_frag_needed(struct ipv4_hdr *iph, uint16_t mtu,
+                              struct lb_device *dev);
+uint16_t lb_icmp_relay_drain(struct lb_device *dev);
+
+#endif
@@ -14,11 +14,20 @@
 #include "lb_clock.h"
 #include "lb_conn.h"
 #include "lb_device.h"
+#include "lb_drop.h"
 #include "lb_format.h"
+#include "lb_ipfix.h"
+#include "lb_ipfrag.h"
+#include "lb_ipv6.h"
+#include "lb_mbuf.h"
+#include "lb_overload.h"
+#include "lb_perf.h"
 #include "lb_proto.h"
 #include "lb_synproxy.h"
 #include "lb_tcp_secret_seq.h"
 #include "lb_toa.h"
+#include "lb_trace.h"
+#include "lb_tunnel.h"
 
 //#define TCP_DEBUG
 #ifdef TCP_DEBUG
@@ -260,25 +269,22 @@ get_conntrack_index(const struct tcp_hdr *th) {
 }
 
 static void
-tcp_set_conntack_state(struct lb_conn *conn, struct tcp_hdr *th, int dir) {
-    uint32_t index;
-    uint32_t old_state;
-    uint32_t new_state;
+tcp_conn_update_state(struct lb_conn *conn, uint32_t new_state) {
     uint32_t lcore_id = rte_lcore_id();
     struct lb_real_service *rs = conn->real_service;
     struct lb_virt_service *vs = rs->virt_service;
     uint32_t timeout;
 
-    index = get_conntrack_index(th);
-    old_state = conn->state;
-    new_state = tcp_conntracks[dir][index][old_state];
+    if (new_state != conn->state)
+        LB_TRACE(tcp_state, conn, conn->cip, conn->cport, conn->state,
+                 new_state);
     if (!(conn->flags & LB_CONN_F_ACTIVE) &&
         (new_state == TCP_CONNTRACK_ESTABLISHED)) {
         conn->flags |= LB_CONN_F_ACTIVE;
         rte_atomic32_add(&rs->active_conns, 1);
         rte_atomic32_add(&vs->active_conns, 1);
-        vs->stats[lcore_id].conns += 1;
-        rs->stats[lcore_id].conns += 1;
+        lb_vs_stats(vs, lcore_id)->conns += 1;
+        lb_rs_stats(rs, lcore_id)->conns += 1;
     } else if ((conn->flags & LB_CONN_F_ACTIVE) &&
                (new_state != TCP_CONNTRACK_ESTABLISHED)) {
         conn->flags &= ~LB_CONN_F_ACTIVE;
@@ -310,6 +316,45 @@ tcp_set_conntack_state(struct lb_conn *conn, struct tcp_hdr *th, int dir) {
     }
 }
 
+static void
+tcp_set_conntack_state(struct lb_conn *conn, struct tcp_hdr *th, int dir) {
+    uint32_t index;
+
+    index = get_conntrack_index(th);
+    tcp_conn_update_state(conn, tcp_conntracks[dir][index][conn->state]);
+}
+
+/*
+ * In DR and tunnel modes the replies of the real service bypass us, so
+ * the state is guessed from the packets of the client only.
+ */
+static void
+tcp_oneway_set_conntrack_state(struct lb_conn *conn, struct tcp_hdr *th) {
+    uint32_t new_state;
+
+    switch (get_conntrack_index(th)) {
+    case TCP_SYN_SET:
+        new_state = TCP_CONNTRACK_SYN_RECV;
+        break;
+    case TCP_FIN_SET:
+        new_state = TCP_CONNTRACK_FIN_WAIT;
+        break;
+    case TCP_ACK_SET:
+        if (conn->state == TCP_CONNTRACK_SYN_RECV)
+            new_state = TCP_CONNTRACK_ESTABLISHED;
+        else
+            new_state = conn->state;
+        break;
+    case TCP_RST_SET:
+        new_state = TCP_CONNTRACK_CLOSE;
+        break;
+    default:
+        return;
+    }
+
+    tcp_conn_update_state(conn, new_state);
+}
+
 static void
 tcp_set_packet_stats(struct lb_conn *conn, struct rte_mbuf *m, uint8_t dir) {
     struct lb_real_service *rs;
@@ -319,10 +364,11 @@ tcp_set_packet_stats(struct lb_conn *conn, struct rte_mbuf *m, uint8_t dir) {
     cid = rte_lcore_id();
     rs = conn->real_service;
     vs = rs->virt_service;
-    vs->stats[cid].bytes[dir] += m->pkt_len;
-    vs->stats[cid].packets[dir] += 1;
-    rs->stats[cid].bytes[dir] += m->pkt_len;
-    rs->stats[cid].packets[dir] += 1;
+    lb_vs_stats(vs, cid)->bytes[dir] += m->pkt_len;
+    lb_vs_stats(vs, cid)->packets[dir] += 1;
+    lb_rs_stats(rs, cid)->bytes[dir] += m->pkt_len;
+    lb_rs_stats(rs, cid)->packets[dir] += 1;
+    lb_ipfix_count(conn, m, dir);
 }
 
 static void
@@ -366,26 +412,83 @@ tcp_conn_schedule(struct lb_conn_table *ct, struct ipv4_hdr *iph,
     struct lb_real_service *rs;
     struct lb_conn *conn;
 
-    if (!SYN(th) || ACK(th) || RST(th) || FIN(th))
+    if (!SYN(th) || ACK(th) || RST(th) || FIN(th)) {
+        lb_drop_count(LB_DROP_NO_CONN);
         return NULL;
+    }
 
     vs = lb_vs_get(iph->dst_addr, th->dst_port, iph->next_proto_id);
-    if (vs == NULL)
+    if (vs == NULL) {
+        lb_drop_count(LB_DROP_NO_VS);
         return NULL;
+    }
 
     if (lb_vs_check_max_conn(vs)) {
+        lb_drop_count(LB_DROP_MAX_CONNS);
+        lb_vs_drop(vs, LB_DIR_ORIGINAL);
         lb_vs_put(vs);
         return NULL;
     }
 
     rs = lb_vs_get_rs(vs, iph->src_addr, th->src_port);
     if (rs == NULL) {
+        lb_drop_count(LB_DROP_NO_RS);
+        lb_vs_drop(vs, LB_DIR_ORIGINAL);
         lb_vs_put(vs);
         return NULL;
     }
 
-    conn = lb_conn_new(ct, iph->src_addr, th->src_port, rs, 0, dev);
+    conn = lb_conn_new(ct, iph->src_addr, th->src_port, rs,
+                       lb_conn_fwd_flags(vs), dev);
     if (conn == NULL) {
+        lb_vs_drop(vs, LB_DIR_ORIGINAL);
+        lb_vs_put(vs);
+        lb_vs_put_rs(rs);
+        return NULL;
+    }
+
+    lb_vs_put(vs);
+
+    return conn;
+}
+
+static struct lb_conn *
+tcp_conn_schedule6(struct lb_conn_table *ct, struct ipv6_hdr *ip6h,
+                   struct tcp_hdr *th, struct lb_device *dev) {
+    struct lb_virt_service *vs;
+    struct lb_real_service *rs;
+    struct lb_conn *conn;
+
+    if (!SYN(th) || ACK(th) || RST(th) || FIN(th)) {
+        lb_drop_count(LB_DROP_NO_CONN);
+        return NULL;
+    }
+
+    vs = lb_vs_get6(ip6h->dst_addr, th->dst_port, IPPROTO_TCP);
+    if (vs == NULL) {
+        lb_drop_count(LB_DROP_NO_VS);
+        return NULL;
+    }
+
+    if (lb_vs_check_max_conn(vs)) {
+        lb_drop_count(LB_DROP_MAX_CONNS);
+        lb_vs_drop(vs, LB_DIR_ORIGINAL);
+        lb_vs_put(vs);
+        return NULL;
+    }
+
+    rs = lb_vs_get_rs(vs, lb_ipv6_addr_hash(ip6h->src_addr), th->src_port);
+    if (rs == NULL) {
+        lb_drop_count(LB_DROP_NO_RS);
+        lb_vs_drop(vs, LB_DIR_ORIGINAL);
+        lb_vs_put(vs);
+        return NULL;
+    }
+
+    conn = lb_conn_new6(ct, ip6h->src_addr, th->src_port, ip6h->dst_addr, rs,
+                        dev);
+    if (conn == NULL) {
+        lb_vs_drop(vs, LB_DIR_ORIGINAL);
         lb_vs_put(vs);
         lb_vs_put_rs(rs);
         return NULL;
@@ -442,11 +545,14 @@ tcp_response_rst(struct rte_mbuf *m, struct ipv4_hdr *iph, struct tcp_hdr *th,
     uint32_t seq, ack;
     uint8_t tcp_flags;
 
+    /* The packet is not forwarded, it is reused as the reset. */
+    lb_capture(m, LB_CAPTURE_P_DROP);
     if (RST(th)) {
         rte_pktmbuf_free(m);
         return;
     }
 
+    lb_pktmbuf_trim_segs(m);
     rte_pktmbuf_reset(m);
     m->pkt_len = m->data_len =
         ETHER_HDR_LEN + sizeof(struct ipv4_hdr) + sizeof(struct tcp_hdr);
@@ -497,9 +603,12 @@ tcp_response_rst(struct rte_mbuf *m, struct ipv4_hdr *iph, struct tcp_hdr *th,
 static int
 tcp_fullnat_recv_client(struct rte_mbuf *m, struct ipv4_hdr *iph,
                         struct tcp_hdr *th, struct lb_conn_table *ct,
-                        struct lb_conn *conn, struct lb_device *dev) {
+                        struct lb_conn *conn, uint16_t cksum_rest,
+                        struct lb_device *dev) {
     if (conn != NULL) {
         if (conn->state == TCP_CONNTRACK_CLOSE) {
+            lb_drop_count(LB_DROP_TCP_STATE);
+            lb_vs_drop(conn->real_service->virt_service, LB_DIR_ORIGINAL);
             tcp_response_rst(m, iph, th, dev);
             return 0;
         }
@@ -523,6 +632,7 @@ tcp_fullnat_recv_client(struct rte_mbuf *m, struct ipv4_hdr *iph,
             return 0;
         }
         conn = tcp_conn_schedule(ct, iph, th, dev);
+        lb_perf_mark(LB_PERF_SCHEDULE);
         if (conn == NULL) {
             TCP_PRINT(IPv4_TCP_FMT " [CONN SCHEDULE DROP]\n",
                       IPv4_TCP_ARG(iph, th));
@@ -536,7 +646,8 @@ tcp_fullnat_recv_client(struct rte_mbuf *m, struct ipv4_hdr *iph,
         (!SYN(th) && ACK(th) && !RST(th) && !FIN(th))) {
         TCP_PRINT(IPv4_TCP_FMT " [SYNPROXY SYN_SENT DROP]\n",
                   IPv4_TCP_ARG(iph, th));
-        rte_pktmbuf_free(conn->proxy.ack_mbuf);
+        if (conn->proxy.ack_mbuf != NULL)
+            lb_drop(conn->proxy.ack_mbuf, LB_DROP_TCP_STATE);
         conn->proxy.ack_mbuf = m;
         return 0;
     }
@@ -544,11 +655,27 @@ tcp_fullnat_recv_client(struct rte_mbuf *m, struct ipv4_hdr *iph,
     if (!(conn->real_service->flags & LB_RS_F_AVAILABLE)) {
         TCP_PRINT(IPv4_TCP_FMT " [RS NOT AVAILABLE DROP]\n",
                   IPv4_TCP_ARG(iph, th));
+        lb_drop_count(LB_DROP_RS_DOWN);
+        lb_vs_drop(conn->real_service->virt_service, LB_DIR_ORIGINAL);
         lb_conn_expire(ct, conn);
         tcp_response_rst(m, iph, th, dev);
         return 0;
     }
 
+    if (conn->flags & LB_CONN_F_ONEWAY) {
+        tcp_oneway_set_conntrack_state(conn, th);
+        tcp_set_packet_stats(conn, m, LB_DIR_ORIGINAL);
+        lb_ipfrag_learn(iph, iph->src_addr, iph->dst_addr,
+                        conn->real_service->virt_service->fwd_mode, conn->rip,
+                        dev);
+        if (conn->flags & LB_CONN_F_DR)
+            return lb_device_dr_output(m, conn->rip, dev);
+        return lb_tunnel_xmit(m, iph, conn->rip,
+                              (conn->flags & LB_CONN_F_GUE) ? LB_TUNNEL_GUE
+                                                            : LB_TUNNEL_IPIP,
+                              dev);
+    }
+
     if (SYN(th)) {
         tcp_opt_remove_timestamp(th);
         tcp_secret_seq_init(conn->lip, conn->rip, conn->lport, conn->rport,
@@ -557,12 +684,13 @@ tcp_fullnat_recv_client(struct rte_mbuf *m, struct ipv4_hdr *iph,
 
     if ((conn->flags & LB_CONN_F_TOA) &&
         (conn->state == TCP_CONNTRACK_SYN_RECV) && !SYN(th) && ACK(th) &&
-        !RST(th) && !FIN(th))
+        !RST(th) && !FIN(th) && !rte_ipv4_frag_pkt_is_fragmented(iph))
         tcp_opt_add_toa(m, iph, th, conn->cip, conn->cport);
 
     tcp_set_conntack_state(conn, th, LB_DIR_ORIGINAL);
     tcp_set_packet_stats(conn, m, LB_DIR_ORIGINAL);
 
+    lb_ipfrag_learn(iph, conn->lip, conn->rip, LB_VS_FWD_FNAT, 0, dev);
     iph->src_addr = conn->lip;
     iph->dst_addr = conn->rip;
     th->src_port = conn->lport;
@@ -572,7 +700,7 @@ tcp_fullnat_recv_client(struct rte_mbuf *m, struct ipv4_hdr *iph,
     iph->hdr_checksum = 0;
     iph->hdr_checksum = rte_ipv4_cksum(iph);
     th->cksum = 0;
-    th->cksum = rte_ipv4_udptcp_cksum(iph, th);
+    th->cksum = lb_ipv4_udptcp_cksum(m, iph, th, cksum_rest);
 
     return lb_device_output(m, iph, dev);
 }
@@ -580,13 +708,21 @@ tcp_fullnat_recv_client(struct rte_mbuf *m, struct ipv4_hdr *iph,
 static int
 tcp_fullnat_recv_backend(struct rte_mbuf *m, struct ipv4_hdr *iph,
                          struct tcp_hdr *th, struct lb_conn *conn,
-                         struct lb_device *dev) {
+                         uint16_t cksum_rest, struct lb_device *dev) {
     if (synproxy_recv_backend_synack(m, iph, th, conn, dev) == 0)
         return 0;
 
     tcp_set_conntack_state(conn, th, LB_DIR_REPLY);
     tcp_set_packet_stats(conn, m, LB_DIR_REPLY);
 
+    if (conn->flags & LB_CONN_F_NAT64) {
+        th->src_port = conn->vport;
+        th->dst_port = conn->cport;
+        tcp_secret_seq_adjust_backend(th, &conn->tseq);
+        return lb_nat64_4to6_output(m, iph, conn, dev);
+    }
+
+    lb_ipfrag_learn(iph, conn->vip, conn->cip, LB_VS_FWD_FNAT, 0, dev);
     iph->src_addr = conn->vip;
     iph->dst_addr = conn->cip;
     th->src_port = conn->vport;
@@ -596,7 +732,7 @@ tcp_fullnat_recv_backend(struct rte_mbuf *m, struct ipv4_hdr *iph,
     iph->hdr_checksum = 0;
     iph->hdr_checksum = rte_ipv4_cksum(iph);
     th->cksum = 0;
-    th->cksum = rte_ipv4_udptcp_cksum(iph, th);
+    th->cksum = lb_ipv4_udptcp_cksum(m, iph, th, cksum_rest);
 
     return lb_device_output(m, iph, dev);
 }
@@ -607,27 +743,124 @@ tcp_fullnat_handle(struct rte_mbuf *m, struct ipv4_hdr *iph,
     struct lb_conn_table *ct;
     struct lb_conn *conn;
     struct tcp_hdr *th;
+    uint16_t cksum_rest = 0;
     uint8_t dir;
+    int rc;
 
     ct = &lb_conn_tbls[rte_lcore_id()];
     th = TCP_HDR(iph);
 
+    if (unlikely(rte_ipv4_frag_pkt_is_fragmented(iph))) {
+        if (!lb_ipfrag_is_first(iph))
+            return lb_ipfrag_forward(m, iph, dev);
+        rc = lb_ipfrag_first_prepare(m, iph, th, sizeof(*th), &cksum_rest);
+        if (rc < 0) {
+            lb_drop(m, LB_DROP_FRAG);
+            return 0;
+        }
+    }
+
     TCP_PRINT(IPv4_TCP_FMT " [NEW PACKET]\n", IPv4_TCP_ARG(iph, th));
 
+    if (SYN(th) && !ACK(th) && lb_overload_shed(LB_SHED_TCP_SYN)) {
+        lb_drop(m, LB_DROP_OVERLOAD);
+        return 0;
+    }
+
     if (synproxy_recv_client_syn(m, iph, th, dev) == 0)
         return 0;
 
     conn = lb_conn_find(ct, iph->src_addr, iph->dst_addr, th->src_port,
                         th->dst_port, &dir);
+    lb_perf_mark(LB_PERF_CONN_LOOKUP);
     if (dir == LB_DIR_REPLY) {
         TCP_PRINT(IPv4_TCP_FMT " [REPLY]\n", IPv4_TCP_ARG(iph, th));
-        return tcp_fullnat_recv_backend(m, iph, th, conn, dev);
+        return tcp_fullnat_recv_backend(m, iph, th, conn, cksum_rest, dev);
     } else {
         TCP_PRINT(IPv4_TCP_FMT " [ORIGINAL]\n", IPv4_TCP_ARG(iph, th));
-        return tcp_fullnat_recv_client(m, iph, th, ct, conn, dev);
+        return tcp_fullnat_recv_client(m, iph, th, ct, conn, cksum_rest,
+                                       dev);
     }
 }
 
+/*
+ * NAT64 client side, full NAT without synproxy and TOA. Replies are
+ * translated back in tcp_fullnat_recv_backend().
+ */
+static int
+tcp_nat64_handle(struct rte_mbuf *m, struct ipv6_hdr *ip6h,
+                 struct lb_device *dev) {
+    struct lb_conn_table *ct;
+    struct lb_conn *conn;
+    struct ether_hdr *eth;
+    struct ipv4_hdr *iph;
+    struct tcp_hdr *th;
+
+    ct = &lb_conn_tbls[rte_lcore_id()];
+    eth = rte_pktmbuf_mtod(m, struct ether_hdr *);
+    th = (struct tcp_hdr *)(ip6h + 1);
+
+    conn = lb_conn_find6(ct, ip6h->src_addr, ip6h->dst_addr, th->src_port,
+                         th->dst_port);
+    lb_perf_mark(LB_PERF_CONN_LOOKUP);
+    if (conn != NULL && conn->state == TCP_CONNTRACK_TIME_WAIT &&
+        SYN(th) && !ACK(th) && !RST(th) && !FIN(th)) {
+        lb_conn_expire(ct, conn);
+        conn = NULL;
+    }
+
+    if (conn == NULL) {
+        if (SYN(th) && !ACK(th) && lb_overload_shed(LB_SHED_TCP_SYN)) {
+            lb_drop_count(LB_DROP_OVERLOAD);
+            goto drop;
+        }
+        conn = tcp_conn_schedule6(ct, ip6h, th, dev);
+        lb_perf_mark(LB_PERF_SCHEDULE);
+        if (conn == NULL)
+            goto drop;
+    }
+
+    if (conn->state == TCP_CONNTRACK_CLOSE) {
+        lb_drop_count(LB_DROP_TCP_STATE);
+        lb_vs_drop(conn->real_service->virt_service, LB_DIR_ORIGINAL);
+        goto drop;
+    }
+
+    if (!(conn->real_service->flags & LB_RS_F_AVAILABLE)) {
+        lb_drop_count(LB_DROP_RS_DOWN);
+        lb_vs_drop(conn->real_service->virt_service, LB_DIR_ORIGINAL);
+        lb_conn_expire(ct, conn);
+        goto drop;
+    }
+
+    /* Replies go back through the router the client is behind. */
+    ether_addr_copy(&eth->s_addr, &conn->cha);
+
+    if (SYN(th)) {
+        tcp_opt_remove_timestamp(th);
+        tcp_secret_seq_init(conn->lip, conn->rip, conn->lport, conn->rport,
+                            rte_be_to_cpu_32(th->sent_seq), &conn->tseq);
+    }
+
+    tcp_set_conntack_state(conn, th, LB_DIR_ORIGINAL);
+    tcp_set_packet_stats(conn, m, LB_DIR_ORIGINAL);
+
+    iph = lb_nat64_6to4(m, conn->lip, conn->rip);
+    if (iph == NULL)
+        goto drop;
+    th->src_port = conn->lport;
+    th->dst_port = conn->rport;
+    tcp_secret_seq_adjust_client(th, &conn->tseq);
+    th->cksum = 0;
+    th->cksum = lb_ipv4_udptcp_cksum_mbuf(m, iph, th);
+
+    return lb_device_output(m, iph, dev);
+
+drop:
+    lb_drop_free(m);
+    return 0;
+}
+
 static int
 tcp_fullnat_init(void) {
     uint32_t lcore_id;
@@ -652,11 +885,18 @@ tcp_fullnat_init(void) {
     return 0;
 }
 
+static struct lb_conn_table *
+tcp_conn_table(uint32_t lcore_id) {
+    return &lb_conn_tbls[lcore_id];
+}
+
 static struct lb_proto proto_tcp = {
     .id = IPPROTO_TCP,
     .type = LB_IPPROTO_TCP,
     .init = tcp_fullnat_init,
     .fullnat_handle = tcp_fullnat_handle,
+    .nat64_handle = tcp_nat64_handle,
+    .conn_table = tcp_conn_table,
 };
 
 LB_PROTO_REGISTER(proto_tcp);
@@ -1,6 +1,8 @@
 /* Copyright (c) 2018. TIG developer. */
 
+#include <rte_hash_crc.h>
 #include <rte_ip.h>
+#include <rte_malloc.h>
 #include <rte_mempool.h>
 #include <rte_udp.h>
 
@@ -8,14 +10,51 @@
 
 #include "lb_clock.h"
 #include "lb_conn.h"
+#include "lb_drop.h"
 #include "lb_format.h"
+#include "lb_ipfix.h"
+#include "lb_ipfrag.h"
+#include "lb_ipv6.h"
+#include "lb_overload.h"
+#include "lb_perf.h"
 #include "lb_proto.h"
+#include "lb_tunnel.h"
 
 #define UDP_MAX_CONN (1 << 20)
 
+#define UDP_ONEPACKET_TIMEOUT (2 * LB_CLOCK_HZ)
+#define UDP_ONEPACKET_PROBES 4
+
+/*
+ * One-packet services keep no connection. The client mapping of a datagram
+ * is parked in the slot of a reserved local port, the reply is matched by
+ * the port it comes back to and releases the slot. The reply does not tell
+ * which datagram it answers, so a slot left without a reply is held for
+ * another timeout before a new client takes it, its late reply is dropped
+ * instead of reaching the new client.
+ */
+struct udp_flow {
+    uint32_t cip, vip, rip;
+    uint16_t cport, vport, rport;
+    uint32_t use_time;
+    uint32_t timeout;
+    /* Sent and not answered yet. */
+    uint8_t pending;
+    struct lb_real_service *real_service;
+};
+
 static struct lb_conn_table lb_conn_tbls[RTE_MAX_LCORE];
 static uint32_t udp_timeout = 30 * LB_CLOCK_HZ;
 
+static uint32_t udp_flow_sweep[RTE_MAX_LCORE];
+
+static struct {
+    uint64_t queries;
+    uint64_t replies;
+    uint64_t no_slot;
+    uint64_t reply_miss;
+} __rte_cache_aligned udp_onepacket_stats[RTE_MAX_LCORE];
+
 static void
 udp_set_conntrack_state(struct lb_conn *conn, __rte_unused struct udp_hdr *uh,
                         int dir) {
@@ -29,8 +68,8 @@ udp_set_conntrack_state(struct lb_conn *conn, __rte_unused struct udp_hdr *uh,
             conn->timeout = vs->est_timeout ? vs->est_timeout : udp_timeout;
             rte_atomic32_add(&rs->active_conns, 1);
             rte_atomic32_add(&vs->active_conns, 1);
-            vs->stats[lcore_id].conns += 1;
-            rs->stats[lcore_id].conns += 1;
+            lb_vs_stats(vs, lcore_id)->conns += 1;
+            lb_rs_stats(rs, lcore_id)->conns += 1;
         }
     } else {
         if (conn->flags & LB_CONN_F_ACTIVE) {
@@ -48,10 +87,11 @@ udp_set_packet_stats(struct lb_conn *conn, struct rte_mbuf *m, uint8_t dir) {
     struct lb_virt_service *vs = rs->virt_service;
     uint32_t cid = rte_lcore_id();
 
-    vs->stats[cid].bytes[dir] += m->pkt_len;
-    vs->stats[cid].packets[dir] += 1;
-    rs->stats[cid].bytes[dir] += m->pkt_len;
-    rs->stats[cid].packets[dir] += 1;
+    lb_vs_stats(vs, cid)->bytes[dir] += m->pkt_len;
+    lb_vs_stats(vs, cid)->packets[dir] += 1;
+    lb_rs_stats(rs, cid)->bytes[dir] += m->pkt_len;
+    lb_rs_stats(rs, cid)->packets[dir] += 1;
+    lb_ipfix_count(conn, m, dir);
 }
 
 static int
@@ -62,84 +102,300 @@ udp_conn_timer_expire_cb(struct lb_conn *conn, uint32_t ctime) {
         return -1;
 }
 
-static struct lb_conn *
-udp_conn_schedule(struct lb_conn_table *ct, struct ipv4_hdr *iph,
-                  struct udp_hdr *uh, struct lb_device *dev) {
-    struct lb_virt_service *vs = NULL;
-    struct lb_real_service *rs = NULL;
-    struct lb_conn *conn = NULL;
-
-    if ((vs = lb_vs_get(iph->dst_addr, uh->dst_port, iph->next_proto_id)) &&
-        (rs = lb_vs_get_rs(vs, iph->src_addr, uh->src_port)) &&
-        (conn = lb_conn_new(ct, iph->src_addr, uh->src_port, rs, 0, dev))) {
-        lb_vs_put(vs);
-        return conn;
+static int
+udp_fullnat_xmit(struct rte_mbuf *m, struct ipv4_hdr *iph, struct udp_hdr *uh,
+                 uint32_t sip, uint16_t sport, uint32_t dip, uint16_t dport,
+                 uint16_t cksum_rest, struct lb_device *dev) {
+    lb_ipfrag_learn(iph, sip, dip, LB_VS_FWD_FNAT, 0, dev);
+
+    iph->time_to_live = 63;
+    iph->src_addr = sip;
+    iph->dst_addr = dip;
+    uh->src_port = sport;
+    uh->dst_port = dport;
+    iph->hdr_checksum = 0;
+    iph->hdr_checksum = rte_ipv4_cksum(iph);
+    if (uh->dgram_cksum != 0) {
+        uh->dgram_cksum = 0;
+        uh->dgram_cksum = lb_ipv4_udptcp_cksum(m, iph, uh, cksum_rest);
     }
-    if (vs != NULL) {
-        lb_vs_put(vs);
+
+    return lb_device_output(m, iph, dev);
+}
+
+static struct lb_conn *
+udp_conn_schedule(struct lb_conn_table *ct, struct lb_virt_service *vs,
+                  struct ipv4_hdr *iph, struct udp_hdr *uh,
+                  struct lb_device *dev) {
+    struct lb_real_service *rs;
+    struct lb_conn *conn;
+
+    rs = lb_vs_get_rs(vs, iph->src_addr, uh->src_port);
+    if (rs == NULL) {
+        lb_drop_count(LB_DROP_NO_RS);
+        lb_vs_drop(vs, LB_DIR_ORIGINAL);
+        return NULL;
     }
-    if (rs != NULL) {
+
+    conn = lb_conn_new(ct, iph->src_addr, uh->src_port, rs, 0, dev);
+    if (conn == NULL) {
+        lb_vs_drop(vs, LB_DIR_ORIGINAL);
         lb_vs_put_rs(rs);
+        return NULL;
     }
 
-    return NULL;
+    return conn;
+}
+
+/*
+ * DR and tunnel modes keep no UDP connection, every datagram is scheduled
+ * and sent to the real service with the client address.
+ */
+static int
+udp_oneway_xmit(struct rte_mbuf *m, struct ipv4_hdr *iph, struct udp_hdr *uh,
+                struct lb_virt_service *vs, struct lb_device *dev) {
+    struct lb_real_service *rs;
+    uint32_t cid = rte_lcore_id();
+    int rc;
+
+    rs = lb_vs_get_rs(vs, iph->src_addr, uh->src_port);
+    lb_perf_mark(LB_PERF_SCHEDULE);
+    if (rs == NULL) {
+        lb_vs_drop(vs, LB_DIR_ORIGINAL);
+        lb_drop(m, LB_DROP_NO_RS);
+        return 0;
+    }
+
+    lb_vs_stats(vs, cid)->conns += 1;
+    lb_vs_stats(vs, cid)->bytes[LB_DIR_ORIGINAL] += m->pkt_len;
+    lb_vs_stats(vs, cid)->packets[LB_DIR_ORIGINAL] += 1;
+    lb_rs_stats(rs, cid)->conns += 1;
+    lb_rs_stats(rs, cid)->bytes[LB_DIR_ORIGINAL] += m->pkt_len;
+    lb_rs_stats(rs, cid)->packets[LB_DIR_ORIGINAL] += 1;
+
+    lb_ipfrag_learn(iph, iph->src_addr, iph->dst_addr, vs->fwd_mode, rs->rip,
+                    dev);
+    if (vs->fwd_mode == LB_VS_FWD_DR)
+        rc = lb_device_dr_output(m, rs->rip, dev);
+    else
+        rc = lb_tunnel_xmit(m, iph, rs->rip,
+                            vs->fwd_mode == LB_VS_FWD_GUE ? LB_TUNNEL_GUE
+                                                          : LB_TUNNEL_IPIP,
+                            dev);
+    lb_vs_put_rs(rs);
+
+    return rc;
+}
+
+/* The reply is awaited. */
+static inline int
+udp_flow_open(struct udp_flow *flow, uint32_t now) {
+    return flow->real_service != NULL && now - flow->use_time <= flow->timeout;
+}
+
+/* A new client may take the slot. */
+static inline int
+udp_flow_free(struct udp_flow *flow, uint32_t now) {
+    return !flow->pending || now - flow->use_time > 2 * flow->timeout;
+}
+
+static inline void
+udp_flow_release(struct udp_flow *flow) {
+    lb_vs_put_rs(flow->real_service);
+    flow->real_service = NULL;
+}
+
+static int
+udp_onepacket_xmit(struct rte_mbuf *m, struct ipv4_hdr *iph, struct udp_hdr *uh,
+                   struct lb_virt_service *vs, uint16_t cksum_rest,
+                   struct lb_device *dev) {
+    struct lb_laddr_list *list;
+    struct lb_laddr *laddr;
+    struct lb_real_service *rs;
+    struct udp_flow *flows, *flow;
+    uint32_t cid = rte_lcore_id();
+    uint32_t now = LB_CLOCK();
+    uint32_t hash, idx, i;
+    int retrans = 0;
+
+    list = &dev->laddr_list[cid];
+    if (list->nb == 0) {
+        lb_drop_count(LB_DROP_NO_LPORT);
+        goto drop;
+    }
+
+    hash = rte_hash_crc_4byte(iph->src_addr, iph->dst_addr);
+    hash = rte_hash_crc_4byte((uint32_t)uh->src_port << 16 | uh->dst_port,
+                              hash);
+    laddr = &list->entries[(hash >> 16) % list->nb];
+    flows = laddr->udp_flows;
+
+    /* Release one stale slot per datagram, idle slots drop their RS. */
+    flow = &flows[udp_flow_sweep[cid]++ % laddr->udp_onepacket_nb];
+    if (flow->real_service != NULL && !udp_flow_open(flow, now))
+        udp_flow_release(flow);
+
+    for (i = 0; i < UDP_ONEPACKET_PROBES; i++) {
+        idx = (hash + i) % laddr->udp_onepacket_nb;
+        flow = &flows[idx];
+        /* Retransmission of the same client, it keeps its slot. */
+        retrans = flow->pending && flow->cip == iph->src_addr &&
+                  flow->cport == uh->src_port && flow->vip == iph->dst_addr &&
+                  flow->vport == uh->dst_port;
+        if (retrans || udp_flow_free(flow, now))
+            break;
+    }
+    if (i == UDP_ONEPACKET_PROBES) {
+        udp_onepacket_stats[cid].no_slot++;
+        lb_drop_count(LB_DROP_ONEPACKET);
+        goto drop;
+    }
+
+    rs = lb_vs_get_rs(vs, iph->src_addr, uh->src_port);
+    lb_perf_mark(LB_PERF_SCHEDULE);
+    if (rs == NULL) {
+        lb_drop_count(LB_DROP_NO_RS);
+        goto drop;
+    }
+
+    if (flow->real_service != NULL)
+        udp_flow_release(flow);
+    flow->cip = iph->src_addr;
+    flow->cport = uh->src_port;
+    flow->vip = iph->dst_addr;
+    flow->vport = uh->dst_port;
+    flow->rip = rs->rip;
+    flow->rport = rs->rport;
+    flow->use_time = now;
+    flow->timeout = vs->est_timeout ? vs->est_timeout : UDP_ONEPACKET_TIMEOUT;
+    flow->pending = 1;
+    flow->real_service = rs;
+
+    udp_onepacket_stats[cid].queries++;
+    /* A client flow is one connection, however many times it is sent. */
+    if (!retrans) {
+        lb_vs_stats(vs, cid)->conns += 1;
+        lb_rs_stats(rs, cid)->conns += 1;
+    }
+    lb_vs_stats(vs, cid)->bytes[LB_DIR_ORIGINAL] += m->pkt_len;
+    lb_vs_stats(vs, cid)->packets[LB_DIR_ORIGINAL] += 1;
+    lb_rs_stats(rs, cid)->bytes[LB_DIR_ORIGINAL] += m->pkt_len;
+    lb_rs_stats(rs, cid)->packets[LB_DIR_ORIGINAL] += 1;
+
+    return udp_fullnat_xmit(
+        m, iph, uh, laddr->ipv4,
+        rte_cpu_to_be_16(laddr->udp_onepacket_min + idx), rs->rip, rs->rport,
+        cksum_rest, dev);
+
+drop:
+    lb_vs_drop(vs, LB_DIR_ORIGINAL);
+    lb_drop_free(m);
+    return 0;
+}
+
+static int
+udp_onepacket_recv_backend(struct rte_mbuf *m, struct ipv4_hdr *iph,
+                           struct udp_hdr *uh, struct lb_laddr *laddr,
+                           uint16_t cksum_rest, struct lb_device *dev) {
+    struct lb_real_service *rs;
+    struct lb_virt_service *vs;
+    struct udp_flow *flow;
+    uint32_t cid = rte_lcore_id();
+    uint16_t idx;
+
+    /* The slots of a partitioned address only cover the lcore's ports. */
+    idx = rte_be_to_cpu_16(uh->dst_port) - laddr->udp_onepacket_min;
+    if (idx >= laddr->udp_onepacket_nb) {
+        udp_onepacket_stats[cid].reply_miss++;
+        lb_drop(m, LB_DROP_ONEPACKET);
+        return 0;
+    }
+    flow = (struct udp_flow *)laddr->udp_flows + idx;
+    rs = flow->real_service;
+    if (!udp_flow_open(flow, LB_CLOCK()) || flow->rip != iph->src_addr ||
+        flow->rport != uh->src_port) {
+        udp_onepacket_stats[cid].reply_miss++;
+        lb_drop(m, LB_DROP_ONEPACKET);
+        return 0;
+    }
+
+    vs = rs->virt_service;
+    udp_onepacket_stats[cid].replies++;
+    lb_vs_stats(vs, cid)->bytes[LB_DIR_REPLY] += m->pkt_len;
+    lb_vs_stats(vs, cid)->packets[LB_DIR_REPLY] += 1;
+    lb_rs_stats(rs, cid)->bytes[LB_DIR_REPLY] += m->pkt_len;
+    lb_rs_stats(rs, cid)->packets[LB_DIR_REPLY] += 1;
+
+    flow->pending = 0;
+    udp_flow_release(flow);
+
+    return udp_fullnat_xmit(m, iph, uh, flow->vip, flow->vport, flow->cip,
+                            flow->cport, cksum_rest, dev);
 }
 
 static int
 udp_fullnat_recv_client(struct rte_mbuf *m, struct ipv4_hdr *iph,
                         struct udp_hdr *uh, struct lb_conn_table *ct,
-                        struct lb_conn *conn, struct lb_device *dev) {
+                        struct lb_conn *conn, uint16_t cksum_rest,
+                        struct lb_device *dev) {
+    struct lb_virt_service *vs;
+
     if (conn != NULL) {
         lb_conn_expire(ct, conn);
         conn = NULL;
+    } else if (lb_overload_shed(LB_SHED_UDP_NEW)) {
+        lb_drop(m, LB_DROP_OVERLOAD);
+        return 0;
+    }
+
+    vs = lb_vs_get(iph->dst_addr, uh->dst_port, iph->next_proto_id);
+    if (vs == NULL) {
+        lb_drop(m, LB_DROP_NO_VS);
+        return 0;
+    }
+
+    if (vs->fwd_mode != LB_VS_FWD_FNAT) {
+        udp_oneway_xmit(m, iph, uh, vs, dev);
+        lb_vs_put(vs);
+        return 0;
+    }
+
+    if (vs->flags & LB_VS_F_ONEPACKET) {
+        udp_onepacket_xmit(m, iph, uh, vs, cksum_rest, dev);
+        lb_vs_put(vs);
+        return 0;
     }
 
+    conn = udp_conn_schedule(ct, vs, iph, uh, dev);
+    lb_perf_mark(LB_PERF_SCHEDULE);
+    lb_vs_put(vs);
     if (conn == NULL) {
-        conn = udp_conn_schedule(ct, iph, uh, dev);
-        if (conn == NULL) {
-            rte_pktmbuf_free(m);
-            return 0;
-        }
+        lb_drop_free(m);
+        return 0;
     }
 
     udp_set_conntrack_state(conn, uh, LB_DIR_ORIGINAL);
     udp_set_packet_stats(conn, m, LB_DIR_ORIGINAL);
 
-    iph->time_to_live = 63;
-    iph->src_addr = conn->lip;
-    iph->dst_addr = conn->rip;
-    uh->src_port = conn->lport;
-    uh->dst_port = conn->rport;
-    iph->hdr_checksum = 0;
-    iph->hdr_checksum = rte_ipv4_cksum(iph);
-    if (uh->dgram_cksum != 0) {
-        uh->dgram_cksum = 0;
-        uh->dgram_cksum = rte_ipv4_udptcp_cksum(iph, uh);
-    }
-
-    return lb_device_output(m, iph, dev);
+    return udp_fullnat_xmit(m, iph, uh, conn->lip, conn->lport, conn->rip,
+                            conn->rport, cksum_rest, dev);
 }
 
 static int
 udp_fullnat_recv_backend(struct rte_mbuf *m, struct ipv4_hdr *iph,
                          struct udp_hdr *uh, struct lb_conn *conn,
-                         struct lb_device *dev) {
+                         uint16_t cksum_rest, struct lb_device *dev) {
     udp_set_conntrack_state(conn, uh, LB_DIR_REPLY);
     udp_set_packet_stats(conn, m, LB_DIR_REPLY);
 
-    iph->time_to_live = 63;
-    iph->src_addr = conn->vip;
-    iph->dst_addr = conn->cip;
-    uh->src_port = conn->vport;
-    uh->dst_port = conn->cport;
-    iph->hdr_checksum = 0;
-    iph->hdr_checksum = rte_ipv4_cksum(iph);
-    if (uh->dgram_cksum != 0) {
-        uh->dgram_cksum = 0;
-        uh->dgram_cksum = rte_ipv4_udptcp_cksum(iph, uh);
+    if (conn->flags & LB_CONN_F_NAT64) {
+        uh->src_port = conn->vport;
+        uh->dst_port = conn->cport;
+        return lb_nat64_4to6_output(m, iph, conn, dev);
     }
 
-    return lb_device_output(m, iph, dev);
+    return udp_fullnat_xmit(m, iph, uh, conn->vip, conn->vport, conn->cip,
+                            conn->cport, cksum_rest, dev);
 }
 
 static int
@@ -147,23 +403,142 @@ udp_fullnat_handle(struct rte_mbuf *m, struct ipv4_hdr *iph,
                    struct lb_device *dev) {
     struct lb_conn_table *ct;
     struct lb_conn *conn;
+    struct lb_laddr *laddr;
     struct udp_hdr *uh;
+    uint16_t dport, cksum_rest = 0;
     uint8_t dir;
     int rc;
 
     ct = &lb_conn_tbls[rte_lcore_id()];
     uh = UDP_HDR(iph);
 
+    if (unlikely(rte_ipv4_frag_pkt_is_fragmented(iph))) {
+        if (!lb_ipfrag_is_first(iph))
+            return lb_ipfrag_forward(m, iph, dev);
+        rc = lb_ipfrag_first_prepare(m, iph, uh, sizeof(*uh), &cksum_rest);
+        if (rc < 0) {
+            lb_drop(m, LB_DROP_FRAG);
+            return 0;
+        }
+    }
+
+    /* Reserved ports never carry connections, skip the conn table. */
+    dport = rte_be_to_cpu_16(uh->dst_port);
+    if (dport >= LB_UDP_ONEPACKET_MIN_PORT && dport < LB_MAX_L4_PORT &&
+        (laddr = lb_laddr_find(iph->dst_addr, dev)) != NULL)
+        return udp_onepacket_recv_backend(m, iph, uh, laddr, cksum_rest,
+                                          dev);
+
     conn = lb_conn_find(ct, iph->src_addr, iph->dst_addr, uh->src_port,
                         uh->dst_port, &dir);
+    lb_perf_mark(LB_PERF_CONN_LOOKUP);
     if (dir == LB_DIR_REPLY)
-        rc = udp_fullnat_recv_backend(m, iph, uh, conn, dev);
+        rc = udp_fullnat_recv_backend(m, iph, uh, conn, cksum_rest, dev);
     else
-        rc = udp_fullnat_recv_client(m, iph, uh, ct, conn, dev);
+        rc = udp_fullnat_recv_client(m, iph, uh, ct, conn, cksum_rest, dev);
 
     return rc;
 }
 
+/*
+ * NAT64 client side, always scheduled with a connection like the IPv4
+ * full NAT datagrams. Replies are translated back in
+ * udp_fullnat_recv_backend().
+ */
+static int
+udp_nat64_handle(struct rte_mbuf *m, struct ipv6_hdr *ip6h,
+                 struct lb_device *dev) {
+    struct lb_conn_table *ct;
+    struct lb_conn *conn;
+    struct lb_virt_service *vs;
+    struct lb_real_service *rs;
+    struct ether_hdr *eth;
+    struct ipv4_hdr *iph;
+    struct udp_hdr *uh;
+
+    ct = &lb_conn_tbls[rte_lcore_id()];
+    eth = rte_pktmbuf_mtod(m, struct ether_hdr *);
+    uh = (struct udp_hdr *)(ip6h + 1);
+
+    conn = lb_conn_find6(ct, ip6h->src_addr, ip6h->dst_addr, uh->src_port,
+                         uh->dst_port);
+    lb_perf_mark(LB_PERF_CONN_LOOKUP);
+    if (conn != NULL)
+        lb_conn_expire(ct, conn);
+    else if (lb_overload_shed(LB_SHED_UDP_NEW)) {
+        lb_drop_count(LB_DROP_OVERLOAD);
+        goto drop;
+    }
+
+    vs = lb_vs_get6(ip6h->dst_addr, uh->dst_port, IPPROTO_UDP);
+    if (vs == NULL) {
+        lb_drop_count(LB_DROP_NO_VS);
+        goto drop;
+    }
+
+    rs = lb_vs_get_rs(vs, lb_ipv6_addr_hash(ip6h->src_addr), uh->src_port);
+    if (rs == NULL) {
+        lb_drop_count(LB_DROP_NO_RS);
+        lb_vs_drop(vs, LB_DIR_ORIGINAL);
+        lb_vs_put(vs);
+        goto drop;
+    }
+    lb_vs_put(vs);
+
+    conn = lb_conn_new6(ct, ip6h->src_addr, uh->src_port, ip6h->dst_addr, rs,
+                        dev);
+    lb_perf_mark(LB_PERF_SCHEDULE);
+    if (conn == NULL) {
+        lb_vs_drop(rs->virt_service, LB_DIR_ORIGINAL);
+        lb_vs_put_rs(rs);
+        goto drop;
+    }
+    ether_addr_copy(&eth->s_addr, &conn->cha);
+
+    udp_set_conntrack_state(conn, uh, LB_DIR_ORIGINAL);
+    udp_set_packet_stats(conn, m, LB_DIR_ORIGINAL);
+
+    iph = lb_nat64_6to4(m, conn->lip, conn->rip);
+    if (iph == NULL)
+        goto drop;
+
+    return udp_fullnat_xmit(m, iph, uh, conn->lip, conn->lport, conn->rip,
+                            conn->rport, 0, dev);
+
+drop:
+    lb_drop_free(m);
+    return 0;
+}
+
+static int
+udp_onepacket_init(void) {
+    struct lb_device *dev;
+    struct lb_laddr_list *list;
+    struct lb_laddr *laddr;
+    uint32_t lcore_id, i;
+    uint16_t devid;
+
+    LB_DEVICE_FOREACH(devid, dev) {
+        RTE_LCORE_FOREACH_SLAVE(lcore_id) {
+            list = &dev->laddr_list[lcore_id];
+            for (i = 0; i < list->nb; i++) {
+                laddr = &list->entries[i];
+                laddr->udp_flows = rte_zmalloc_socket(
+                    "udp-flows",
+                    sizeof(struct udp_flow) * laddr->udp_onepacket_nb,
+                    RTE_CACHE_LINE_SIZE, rte_lcore_to_socket_id(lcore_id));
+                if (laddr->udp_flows == NULL) {
+                    RTE_LOG(ERR, USER1, "%s(): Alloc udp flows failed.\n",
+                            __func__);
+                    return -1;
+                }
+            }
+        }
+    }
+
+    return 0;
+}
+
 static int
 udp_fullnat_init(void) {
     uint32_t lcore_id;
@@ -171,6 +546,10 @@ udp_fullnat_init(void) {
     int rc;
     uint32_t size;
 
+    rc = udp_onepacket_init();
+    if (rc < 0)
+        return rc;
+
     size = UDP_MAX_CONN / (rte_lcore_count() - 1);
     RTE_LCORE_FOREACH_SLAVE(lcore_id) {
         ct = &lb_conn_tbls[lcore_id];
@@ -187,11 +566,18 @@ udp_fullnat_init(void) {
     return 0;
 }
 
+static struct lb_conn_table *
+udp_conn_table(uint32_t lcore_id) {
+    return &lb_conn_tbls[lcore_id];
+}
+
 static struct lb_proto proto_udp = {
     .id = IPPROTO_UDP,
     .type = LB_IPPROTO_UDP,
     .init = udp_fullnat_init,
     .fullnat_handle = udp_fullnat_handle,
+    .nat64_handle = udp_nat64_handle,
+    .conn_table = udp_conn_table,
 };
 
 LB_PROTO_REGISTER(proto_udp);
@@ -289,4 +675,47 @@ udp_conn_stats_cmd_cb(int fd, char *argv[], int argc) {
 
 UNIXCTL_CMD_REGISTER("udp/conn/stats", "[--json].",
                      "Show the number of UDP connections.", 0, 1,
-                     udp_conn_stats_cmd_cb);
\ No newline at end of file
+                     udp_conn_stats_cmd_cb);
+
+static void
+udp_onepacket_stats_cmd_cb(int fd, char *argv[], int argc) {
+    uint64_t queries = 0, replies = 0, no_slot = 0, reply_miss = 0;
+    uint32_t lcore_id;
+    int json_fmt = 0;
+
+    if (argc > 0) {
+        if (strcmp(argv[0], "--json") != 0) {
+            unixctl_command_reply_error(fd, "Invalid parameter: %s.\n",
+                                        argv[0]);
+            return;
+        }
+        json_fmt = 1;
+    }
+
+    RTE_LCORE_FOREACH_SLAVE(lcore_id) {
+        queries += udp_onepacket_stats[lcore_id].queries;
+        replies += udp_onepacket_stats[lcore_id].replies;
+        no_slot += udp_onepacket_stats[lcore_id].no_slot;
+        reply_miss += udp_onepacket_stats[lcore_id].reply_miss;
+    }
+
+    if (json_fmt) {
+        unixctl_command_reply(fd, "{");
+        unixctl_command_reply(fd, JSON_KV_64_FMT("queries", ","), queries);
+        unixctl_command_reply(fd, JSON_KV_64_FMT("replies", ","), replies);
+        unixctl_command_reply(fd, JSON_KV_64_FMT("no_slot", ","), no_slot);
+        unixctl_command_reply(fd, JSON_KV_64_FMT("reply_miss", ""),
+                              reply_miss);
+        unixctl_command_reply(fd, "}\n");
+    } else {
+        unixctl_command_reply(fd, NORM_KV_64_FMT("queries", "\n"), queries);
+        unixctl_command_reply(fd, NORM_KV_64_FMT("replies", "\n"), replies);
+        unixctl_command_reply(fd, NORM_KV_64_FMT("no_slot", "\n"), no_slot);
+        unixctl_command_reply(fd, NORM_KV_64_FMT("reply_miss", "\n"),
+                              reply_miss);
+    }
+}
+
+UNIXCTL_CMD_REGISTER("udp/onepacket/stats", "[--json].",
+                     "Show UDP one-packet scheduling statistics.", 0, 1,
+                     udp_onepacket_stats_cmd_cb);
@@ -0,0 +1,67 @@
+/* Copyright (c) 2018. TIG developer. */
+
+#include <string.h>
+
+#include <rte_cycles.h>
+
+#include "lb_rate.h"
+
+const char *lb_rate_window_names[LB_RATE_W_MAX] = {
+    [LB_RATE_W_1S] = "1s",
+    [LB_RATE_W_10S] = "10s",
+    [LB_RATE_W_60S] = "60s",
+};
+
+static const uint32_t rate_window_secs[LB_RATE_W_MAX] = {
+    [LB_RATE_W_1S] = 1,
+    [LB_RATE_W_10S] = 10,
+    [LB_RATE_W_60S] = 60,
+};
+
+void
+lb_rate_reset(struct lb_rate *r) {
+    r->next = 0;
+    r->nb_samples = 0;
+}
+
+void
+lb_rate_sample(struct lb_rate *r, const uint64_t *counters, uint32_t n,
+               uint64_t tsc) {
+    r->tsc[r->next] = tsc;
+    memcpy(r->counters[r->next], counters, n * sizeof(uint64_t));
+    r->next = (r->next + 1) % LB_RATE_SLOTS;
+    if (r->nb_samples < LB_RATE_SLOTS)
+        r->nb_samples++;
+}
+
+/*
+ * The increase of the first n counters over a window, or over the samples
+ * there are when the ring is younger. Returns the cycles between the two
+ * samples, 0 without two samples.
+ */
+uint64_t
+lb_rate_delta(const struct lb_rate *r, uint32_t window, uint32_t n,
+              uint64_t *delta) {
+    uint32_t back = rate_window_secs[window];
+    uint32_t last, first, i;
+
+    if (r->nb_samples < 2) {
+        memset(delta, 0, n * sizeof(uint64_t));
+        return 0;
+    }
+    if (back > r->nb_samples - 1)
+        back = r->nb_samples - 1;
+    last = (r->next + LB_RATE_SLOTS - 1) % LB_RATE_SLOTS;
+    first = (last + LB_RATE_SLOTS - back) % LB_RATE_SLOTS;
+    for (i = 0; i < n; i++)
+        delta[i] = r->counters[last][i] - r->counters[first][i];
+    return r->tsc[last] - r->tsc[first];
+}
+
+/* In double, a minute of bytes times the TSC rate overflows 64 bits. */
+uint64_t
+lb_rate_per_sec(uint64_t delta, uint64_t cycles) {
+    if (cycles == 0)
+        return 0;
+    return (uint64_t)((double)delta * rte_get_tsc_hz() / cycles);
+}
@@ -0,0 +1,40 @@
+/* Copyright (c) 2018. TIG developer. */
+
+#ifndef __LB_RATE_H__
+#define __LB_RATE_H__
+
+#include <stdint.h>
+
+/*
+ * Samples of cumulative counters taken by the master once per second, so
+ * the rates over the last 1, 10 and 60 seconds are differences of two
+ * samples. A ring holds the 60 seconds plus the newest sample.
+ */
+#define LB_RATE_SLOTS 61
+#define LB_RATE_MAX_COUNTERS 8
+#define LB_RATE_PERIOD_MS 1000
+
+enum {
+    LB_RATE_W_1S,
+    LB_RATE_W_10S,
+    LB_RATE_W_60S,
+    LB_RATE_W_MAX,
+};
+
+struct lb_rate {
+    uint32_t next;
+    uint32_t nb_samples;
+    uint64_t tsc[LB_RATE_SLOTS];
+    uint64_t counters[LB_RATE_SLOTS][LB_RATE_MAX_COUNTERS];
+};
+
+extern const char *lb_rate_window_names[LB_RATE_W_MAX];
+
+void lb_rate_reset(struct lb_rate *r);
+void lb_rate_sample(struct lb_rate *r, const uint64_t *counters, uint32_t n,
+                    uint64_t tsc);
+uint64_t lb_rate_delta(const struct lb_rate *r, uint32_t window, uint32_t n,
+                       uint64_t *delta);
+uint64_t lb_rate_per_sec(uint64_t delta, uint64_t cycles);
+
+#endif
@@ -1,5 +1,6 @@
 /* Copyright (c) 2018. TIG developer. */
 
+#include <arpa/inet.h>
 #include <sys/queue.h>
 
 #include <rte_errno.h>
@@ -8,23 +9,41 @@
 #include <rte_hash_crc.h>
 #include <rte_log.h>
 #include <rte_malloc.h>
+#include <rte_memcpy.h>
 #include <rte_rwlock.h>
+#include <rte_spinlock.h>
+#include <rte_timer.h>
 
+#include <metrics_shm.h>
 #include <unixctl_command.h>
 
 #include "lb_clock.h"
+#include "lb_conn.h"
 #include "lb_device.h"
+#include "lb_flow.h"
 #include "lb_format.h"
 #include "lb_parser.h"
+#include "lb_rate.h"
 #include "lb_scheduler.h"
 #include "lb_service.h"
+#include "lb_trace.h"
 
 #define virt_service_key(ip, port, proto)                                      \
     (((uint64_t)(ip) << 32) | ((uint64_t)(port) << 16) | (uint64_t)(proto))
 
+struct virt_service_key6 {
+    uint8_t vip6[16];
+    uint16_t vport;
+    uint8_t proto;
+    uint8_t pad;
+} __attribute__((__packed__));
+
 struct lb_vs_table {
     struct rte_hash *vs_htbl;
     struct rte_hash *vip_htbl;
+    /* NAT64 services by IPv6 address. */
+    struct rte_hash *vs6_htbl;
+    struct rte_hash *vip6_htbl;
     rte_rwlock_t rwlock;
 } __rte_cache_aligned;
 
@@ -57,17 +76,225 @@ vs_tbl_get_next(int sid) {
     for (socket_id = vs_tbl_get_next(-1); socket_id < RTE_MAX_NUMA_NODES;      \
          socket_id = vs_tbl_get_next(socket_id))
 
+struct lb_service_stats **lb_service_stats_arenas[RTE_MAX_LCORE];
+
+/* Stats ids in use, freed by the workers dropping the last reference. */
+static uint64_t service_stats_ids[LB_SERVICE_STATS_MAX / 64];
+static uint32_t service_stats_next;
+static rte_spinlock_t service_stats_lock = RTE_SPINLOCK_INITIALIZER;
+
+/*
+ * Counters of a stats id sampled each second by the master, see
+ * lb_rate.h. Active conns are not cumulative, their rate is the change
+ * over the window.
+ */
+enum {
+    SERVICE_RATE_CONNS,
+    SERVICE_RATE_PACKETS,
+    SERVICE_RATE_BYTES = SERVICE_RATE_PACKETS + LB_DIR_MAX,
+    SERVICE_RATE_DROPS = SERVICE_RATE_BYTES + LB_DIR_MAX,
+    SERVICE_RATE_ACTIVE_CONNS = SERVICE_RATE_DROPS + LB_DIR_MAX,
+    SERVICE_RATE_MAX,
+};
+
+static struct lb_rate *service_rates[LB_SERVICE_STATS_MAX_CHUNKS];
+static struct rte_timer service_rate_timer;
+
+static inline struct lb_rate *
+service_rate_get(uint32_t stats_id) {
+    uint32_t chunk = stats_id >> LB_SERVICE_STATS_CHUNK_SHIFT;
+    uint32_t idx = stats_id & (LB_SERVICE_STATS_CHUNK_SIZE - 1);
+
+    return &service_rates[chunk][idx];
+}
+
+static int
+service_stats_chunk_alloc(uint32_t chunk) {
+    struct lb_service_stats *stats;
+    uint32_t lcore_id;
+
+    if (service_rates[chunk] == NULL) {
+        service_rates[chunk] = rte_zmalloc(
+            "service_rates",
+            LB_SERVICE_STATS_CHUNK_SIZE * sizeof(struct lb_rate),
+            RTE_CACHE_LINE_SIZE);
+        if (service_rates[chunk] == NULL)
+            return -1;
+    }
+
+    RTE_LCORE_FOREACH(lcore_id) {
+        if (lb_service_stats_arenas[lcore_id] == NULL ||
+            lb_service_stats_arenas[lcore_id][chunk] != NULL)
+            continue;
+        stats = rte_zmalloc_socket(
+            "service_stats", LB_SERVICE_STATS_CHUNK_SIZE * sizeof(*stats),
+            RTE_CACHE_LINE_SIZE, rte_lcore_to_socket_id(lcore_id));
+        if (stats == NULL)
+            return -1;
+        lb_service_stats_arenas[lcore_id][chunk] = stats;
+    }
+    return 0;
+}
+
+/*
+ * The stats of a reused id are cleared here, no worker writes them once
+ * the service that had it is freed.
+ */
+static int
+service_stats_id_alloc(uint32_t *stats_id) {
+    uint32_t id, i, lcore_id;
+    int rc = -1;
+
+    rte_spinlock_lock(&service_stats_lock);
+    for (i = 0; i < LB_SERVICE_STATS_MAX; i++) {
+        id = (service_stats_next + i) % LB_SERVICE_STATS_MAX;
+        if (service_stats_ids[id / 64] & (1ULL << (id % 64)))
+            continue;
+        if (service_stats_chunk_alloc(id >> LB_SERVICE_STATS_CHUNK_SHIFT) < 0)
+            break;
+        RTE_LCORE_FOREACH(lcore_id) {
+            if (lb_service_stats_arenas[lcore_id] == NULL)
+                continue;
+            memset(lb_service_stats_get(id, lcore_id), 0,
+                   sizeof(struct lb_service_stats));
+        }
+        lb_rate_reset(service_rate_get(id));
+        service_stats_ids[id / 64] |= 1ULL << (id % 64);
+        service_stats_next = id + 1;
+        *stats_id = id;
+        rc = 0;
+        break;
+    }
+    rte_spinlock_unlock(&service_stats_lock);
+    return rc;
+}
+
+static void
+service_stats_id_free(uint32_t stats_id) {
+    rte_spinlock_lock(&service_stats_lock);
+    service_stats_ids[stats_id / 64] &= ~(1ULL << (stats_id % 64));
+    rte_spinlock_unlock(&service_stats_lock);
+}
+
+/* Sum the stats of a service over the workers. */
+static void
+service_stats_sum(uint32_t stats_id, struct lb_service_stats *sum) {
+    struct lb_service_stats *stats;
+    uint32_t lcore_id, dir;
+
+    RTE_LCORE_FOREACH(lcore_id) {
+        if (lb_service_stats_arenas[lcore_id] == NULL)
+            continue;
+        stats = lb_service_stats_get(stats_id, lcore_id);
+        for (dir = 0; dir < LB_DIR_MAX; dir++) {
+            sum->packets[dir] += stats->packets[dir];
+            sum->bytes[dir] += stats->bytes[dir];
+            sum->drops[dir] += stats->drops[dir];
+        }
+        sum->conns += stats->conns;
+    }
+}
+
+static void
+service_rate_sample(uint32_t stats_id, int32_t active_conns, uint64_t now) {
+    struct lb_service_stats sum = {0};
+    uint64_t counters[SERVICE_RATE_MAX];
+    uint32_t dir;
+
+    RTE_BUILD_BUG_ON(SERVICE_RATE_MAX > LB_RATE_MAX_COUNTERS);
+    service_stats_sum(stats_id, &sum);
+    counters[SERVICE_RATE_CONNS] = sum.conns;
+    for (dir = 0; dir < LB_DIR_MAX; dir++) {
+        counters[SERVICE_RATE_PACKETS + dir] = sum.packets[dir];
+        counters[SERVICE_RATE_BYTES + dir] = sum.bytes[dir];
+        counters[SERVICE_RATE_DROPS + dir] = sum.drops[dir];
+    }
+    counters[SERVICE_RATE_ACTIVE_CONNS] = (uint64_t)(int64_t)active_conns;
+    lb_rate_sample(service_rate_get(stats_id), counters, SERVICE_RATE_MAX,
+                   now);
+}
+
+/*
+ * Runs on the master like the commands changing the services, so the
+ * services in the tables and their lists stay until it returns.
+ */
+static void
+service_rate_timer_cb(__attribute__((unused)) struct rte_timer *t,
+                      __attribute__((unused)) void *arg) {
+    struct lb_virt_service *vs;
+    struct lb_real_service *rs;
+    uint32_t socket_id;
+    uint64_t now = rte_rdtsc();
+    const void *key;
+    uint32_t next;
+
+    VS_TBL_FOREACH_SOCKET(socket_id) {
+        next = 0;
+        while (rte_hash_iterate(lb_vs_tbls[socket_id]->vs_htbl, &key,
+                                (void **)&vs, &next) >= 0) {
+            service_rate_sample(vs->stats_id,
+                                rte_atomic32_read(&vs->active_conns), now);
+            LIST_FOREACH(rs, &vs->real_services, next) {
+                service_rate_sample(rs->stats_id,
+                                    rte_atomic32_read(&rs->active_conns), now);
+            }
+        }
+    }
+}
+
+/* Add the rates of a stats id over a window to those of the replicas. */
+static void
+service_rate_add(uint32_t stats_id, uint32_t window, uint64_t *rates) {
+    uint64_t delta[SERVICE_RATE_MAX], cycles;
+    uint32_t i;
+
+    cycles = lb_rate_delta(service_rate_get(stats_id), window,
+                           SERVICE_RATE_MAX, delta);
+    for (i = 0; i < SERVICE_RATE_ACTIVE_CONNS; i++)
+        rates[i] += lb_rate_per_sec(delta[i], cycles);
+    rates[SERVICE_RATE_ACTIVE_CONNS] += delta[SERVICE_RATE_ACTIVE_CONNS];
+}
+
+/* Only the workers count service stats, other lcores have no arena. */
+static int
+service_stats_init(void) {
+    struct lb_device *dev;
+    uint32_t lcore_id;
+    uint16_t devid;
+    int worker;
+
+    RTE_LCORE_FOREACH(lcore_id) {
+        worker = 0;
+        LB_DEVICE_FOREACH(devid, dev) {
+            if (dev->lcore_conf[lcore_id].rxq_enable)
+                worker = 1;
+        }
+        if (!worker)
+            continue;
+        lb_service_stats_arenas[lcore_id] = rte_zmalloc_socket(
+            "service_stats_arena",
+            LB_SERVICE_STATS_MAX_CHUNKS * sizeof(struct lb_service_stats *),
+            RTE_CACHE_LINE_SIZE, rte_lcore_to_socket_id(lcore_id));
+        if (lb_service_stats_arenas[lcore_id] == NULL)
+            return -1;
+    }
+    return 0;
+}
+
+/*
+ * One replica of the tables per socket with an enabled lcore, every lcore
+ * only reads the replica of its own socket.
+ */
 int
 lb_service_init(void) {
-    uint16_t devid;
-    struct lb_device *dev;
+    uint32_t lcore_id;
     uint32_t socket_id;
     char name[RTE_HASH_NAMESIZE];
     struct rte_hash_parameters param;
     struct lb_vs_table *t;
 
-    LB_DEVICE_FOREACH(devid, dev) {
-        socket_id = dev->socket_id;
+    RTE_LCORE_FOREACH(lcore_id) {
+        socket_id = rte_lcore_to_socket_id(lcore_id);
 
         if (lb_vs_tbls[socket_id] != NULL)
             continue;
@@ -108,12 +335,52 @@ lb_service_init(void) {
             return -1;
         }
 
+        memset(&param, 0, sizeof(param));
+        snprintf(name, sizeof(name), "vs6_htbl%u", socket_id);
+        param.name = name;
+        param.entries = LB_MAX_VS;
+        param.key_len = sizeof(struct virt_service_key6);
+        param.socket_id = socket_id;
+        param.hash_func = rte_hash_crc;
+
+        t->vs6_htbl = rte_hash_create(&param);
+        if (t->vs6_htbl == NULL) {
+            RTE_LOG(ERR, USER1, "%s(): Create hash table %s failed, %s.",
+                    __func__, name, rte_strerror(rte_errno));
+            return -1;
+        }
+
+        memset(&param, 0, sizeof(param));
+        snprintf(name, sizeof(name), "vip6_htbl%u", socket_id);
+        param.name = name;
+        param.entries = LB_MAX_VS;
+        param.key_len = 16;
+        param.socket_id = socket_id;
+        param.hash_func = rte_hash_crc;
+
+        t->vip6_htbl = rte_hash_create(&param);
+        if (t->vip6_htbl == NULL) {
+            RTE_LOG(ERR, USER1, "%s(): Create hash table %s failed, %s.",
+                    __func__, name, rte_strerror(rte_errno));
+            return -1;
+        }
+
         rte_rwlock_init(&t->rwlock);
 
         lb_vs_tbls[socket_id] = t;
     }
 
-    return 0;
+    if (service_stats_init() < 0) {
+        RTE_LOG(ERR, USER1, "%s(): Not enough memory for service stats.",
+                __func__);
+        return -1;
+    }
+
+    rte_timer_init(&service_rate_timer);
+    return rte_timer_reset(&service_rate_timer,
+                           MS_TO_CYCLES(LB_RATE_PERIOD_MS), PERIODICAL,
+                           rte_get_master_lcore(), service_rate_timer_cb,
+                           NULL);
 }
 
 int
@@ -190,6 +457,91 @@ vs_tbl_del(struct lb_vs_table *t, struct lb_virt_service *vs) {
     }
 }
 
+int
+lb_is_vip6_exist(const uint8_t *vip6) {
+    struct lb_vs_table *t;
+
+    t = lb_vs_tbls[rte_socket_id()];
+    return rte_hash_lookup(t->vip6_htbl, vip6) >= 0;
+}
+
+static inline void
+virt_service_key6_init(struct virt_service_key6 *key, const uint8_t *vip6,
+                       uint16_t vport, uint8_t proto) {
+    rte_memcpy(key->vip6, vip6, 16);
+    key->vport = vport;
+    key->proto = proto;
+    key->pad = 0;
+}
+
+static struct lb_virt_service *
+vs6_tbl_find(struct lb_vs_table *t, const uint8_t *vip6, uint16_t vport,
+             uint8_t proto) {
+    struct lb_virt_service *vs = NULL;
+    struct virt_service_key6 key;
+
+    virt_service_key6_init(&key, vip6, vport, proto);
+    rte_hash_lookup_data(t->vs6_htbl, &key, (void **)&vs);
+
+    return vs;
+}
+
+static int
+vs6_tbl_add(struct lb_vs_table *t, struct lb_virt_service *vs) {
+    struct virt_service_key6 key;
+    int rc;
+    void *p;
+    uint32_t count = 0;
+
+    virt_service_key6_init(&key, vs->vip6, vs->vport, vs->proto);
+    rc = rte_hash_add_key_data(t->vs6_htbl, &key, vs);
+    if (rc < 0) {
+        return rc;
+    }
+
+    rc = rte_hash_lookup_data(t->vip6_htbl, vs->vip6, &p);
+    if (rc == 0) {
+        count = (uint32_t)(uintptr_t)p;
+    }
+    count += 1;
+
+    rc = rte_hash_add_key_data(t->vip6_htbl, vs->vip6,
+                               (void *)(uintptr_t)count);
+    if (unlikely(rc < 0)) {
+        rte_hash_del_key(t->vs6_htbl, &key);
+    }
+
+    return rc;
+}
+
+static void
+vs6_tbl_del(struct lb_vs_table *t, struct lb_virt_service *vs) {
+    struct virt_service_key6 key;
+    int rc;
+    void *p;
+    uint32_t count;
+
+    virt_service_key6_init(&key, vs->vip6, vs->vport, vs->proto);
+    rc = rte_hash_del_key(t->vs6_htbl, &key);
+    if (rc < 0) {
+        return;
+    }
+
+    rc = rte_hash_lookup_data(t->vip6_htbl, vs->vip6, &p);
+    if (unlikely(rc < 0)) {
+        return;
+    }
+
+    count = (uint32_t)(uintptr_t)p;
+    count -= 1;
+    if (count == 0) {
+        rte_hash_del_key(t->vip6_htbl, vs->vip6);
+    } else {
+        rte_hash_add_key_data(t->vip6_htbl, vs->vip6,
+                              (void *)(uintptr_t)count);
+    }
+}
+
 static struct lb_real_service *
 vs_find_rs(struct lb_virt_service *vs, uint32_t rip, uint16_t rport) {
     struct lb_real_service *rs;
@@ -201,6 +553,145 @@ vs_find_rs(struct lb_virt_service *vs, uint32_t rip, uint16_t rport) {
     return NULL;
 }
 
+static void
+service_metrics_vs_add(struct metrics_shm_vs *m, struct lb_virt_service *vs) {
+    struct lb_service_stats sum = {0};
+    uint32_t dir;
+
+    service_stats_sum(vs->stats_id, &sum);
+    m->conns += sum.conns;
+    for (dir = 0; dir < METRICS_SHM_DIRS; dir++) {
+        m->packets[dir] += sum.packets[dir];
+        m->bytes[dir] += sum.bytes[dir];
+        m->drops[dir] += sum.drops[dir];
+    }
+    m->active_conns += rte_atomic32_read(&vs->active_conns);
+}
+
+static void
+service_metrics_rs_add(struct metrics_shm_rs *m, struct lb_real_service *rs) {
+    struct lb_service_stats sum = {0};
+    uint32_t dir;
+
+    service_stats_sum(rs->stats_id, &sum);
+    m->conns += sum.conns;
+    for (dir = 0; dir < METRICS_SHM_DIRS; dir++) {
+        m->packets[dir] += sum.packets[dir];
+        m->bytes[dir] += sum.bytes[dir];
+    }
+    m->active_conns += rte_atomic32_read(&rs->active_conns);
+}
+
+/*
+ * Fill the service tables of the metrics region, the vs one at vs_off and
+ * the rs one packed after it, summing the replicas of each service like
+ * vs/stats. Runs on the master with the commands changing the services,
+ * both walks see the same services. The commands change all the replicas
+ * alike, their real service lists are in the same order and are walked
+ * side by side.
+ */
+void
+lb_service_metrics(struct metrics_shm_header *h) {
+    struct lb_virt_service *vs, *replica;
+    struct lb_virt_service *replicas[RTE_MAX_NUMA_NODES];
+    struct lb_real_service *rs, *rs_replica;
+    struct lb_real_service *rs_replicas[RTE_MAX_NUMA_NODES];
+    struct metrics_shm_vs *mvs;
+    struct metrics_shm_rs *mrs;
+    uint32_t socket_id, first, nb_vs = 0, nb_rs = 0;
+    const void *key;
+    uint32_t next = 0;
+
+    h->vs_truncated = 0;
+    h->rs_truncated = 0;
+    first = vs_tbl_get_next(-1);
+    if (first >= RTE_MAX_NUMA_NODES)
+        goto out;
+
+    while (rte_hash_iterate(lb_vs_tbls[first]->vs_htbl, &key, (void **)&vs,
+                            &next) >= 0) {
+        if (nb_vs == h->max_vs) {
+            h->vs_truncated++;
+            continue;
+        }
+        mvs = METRICS_SHM_ENTRY(h, vs, nb_vs);
+        memset(mvs, 0, sizeof(*mvs));
+        mvs->vip = vs->vip;
+        mvs->vport = vs->vport;
+        mvs->proto = vs->proto;
+        mvs->fwd_mode = vs->fwd_mode;
+        mvs->flags = vs->flags;
+        mvs->max_conns = vs->max_conns;
+        mvs->rs_first = nb_rs;
+        VS_TBL_FOREACH_SOCKET(socket_id) {
+            replica = vs_tbl_find(lb_vs_tbls[socket_id], vs->vip, vs->vport,
+                                  vs->proto);
+            if (replica != NULL)
+                service_metrics_vs_add(mvs, replica);
+        }
+        LIST_FOREACH(rs, &vs->real_services, next) {
+            if (nb_rs == h->max_rs) {
+                h->rs_truncated++;
+                continue;
+            }
+            mvs->nb_rs++;
+            nb_rs++;
+        }
+        nb_vs++;
+    }
+
+    h->rs_off = h->vs_off + (uint64_t)nb_vs * h->vs_size;
+    next = 0;
+    nb_vs = 0;
+    nb_rs = 0;
+    while (rte_hash_iterate(lb_vs_tbls[first]->vs_htbl, &key, (void **)&vs,
+                            &next) >= 0 &&
+           nb_vs < h->max_vs) {
+        VS_TBL_FOREACH_SOCKET(socket_id) {
+            replicas[socket_id] = vs_tbl_find(lb_vs_tbls[socket_id], vs->vip,
+                                              vs->vport, vs->proto);
+            rs_replicas[socket_id] =
+                replicas[socket_id] != NULL
+                    ? LIST_FIRST(&replicas[socket_id]->real_services)
+                    : NULL;
+        }
+        LIST_FOREACH(rs, &vs->real_services, next) {
+            if (nb_rs == h->max_rs)
+                break;
+            mrs = METRICS_SHM_ENTRY(h, rs, nb_rs);
+            memset(mrs, 0, sizeof(*mrs));
+            mrs->rip = rs->rip;
+            mrs->rport = rs->rport;
+            mrs->proto = rs->proto;
+            mrs->vs = nb_vs;
+            mrs->flags = rs->flags;
+            mrs->weight = rs->weight;
+            VS_TBL_FOREACH_SOCKET(socket_id) {
+                replica = replicas[socket_id];
+                if (replica == NULL)
+                    continue;
+                rs_replica = rs_replicas[socket_id];
+                /* Out of step, should not happen. */
+                if (rs_replica == NULL || rs_replica->rip != rs->rip ||
+                    rs_replica->rport != rs->rport)
+                    rs_replica = vs_find_rs(replica, rs->rip, rs->rport);
+                if (rs_replica == NULL)
+                    continue;
+                service_metrics_rs_add(mrs, rs_replica);
+                rs_replicas[socket_id] = LIST_NEXT(rs_replica, next);
+            }
+            nb_rs++;
+        }
+        nb_vs++;
+    }
+
+out:
+    h->nb_vs = nb_vs;
+    h->nb_rs = nb_rs;
+    if (nb_vs == 0)
+        h->rs_off = h->vs_off;
+}
+
 static void
 lb_rs_list_insert_by_weight(struct lb_virt_service *vs,
                             struct lb_real_service *rs) {
@@ -246,6 +737,21 @@ lb_vs_get(uint32_t vip, uint16_t vport, uint8_t proto) {
     return vs;
 }
 
+struct lb_virt_service *
+lb_vs_get6(const uint8_t *vip6, uint16_t vport, uint8_t proto) {
+    uint32_t socket_id = rte_socket_id();
+    struct lb_virt_service *vs;
+
+    LB_VS_TBL_RLOCK(lb_vs_tbls[socket_id]);
+    vs = vs6_tbl_find(lb_vs_tbls[socket_id], vip6, vport, proto);
+    if (vs != NULL) {
+        rte_atomic32_add(&vs->refcnt, 1);
+    }
+    LB_VS_TBL_RUNLOCK(lb_vs_tbls[socket_id]);
+
+    return vs;
+}
+
 void
 lb_vs_put(struct lb_virt_service *vs) {
     lb_vs_free(vs);
@@ -259,6 +765,7 @@ lb_vs_get_rs(struct lb_virt_service *vs, uint32_t cip, uint16_t cport) {
     rs = vs->sched->dispatch(vs, cip, cport);
     if (rs != NULL) {
         rte_atomic32_add(&rs->refcnt, 1);
+        LB_TRACE(sched_dispatch, vs, rs, cip, cport, rs->rip, rs->rport);
     }
     LB_VS_RUNLOCK(vs);
 
@@ -279,7 +786,13 @@ lb_vs_alloc(uint32_t vip, uint16_t vport, uint8_t proto,
     if (vs == NULL)
         return NULL;
 
+    if (service_stats_id_alloc(&vs->stats_id) < 0) {
+        rte_free(vs);
+        return NULL;
+    }
+
     if (sched->init && sched->init(vs) < 0) {
+        service_stats_id_free(vs->stats_id);
         rte_free(vs);
         return NULL;
     }
@@ -304,6 +817,7 @@ lb_vs_free(struct lb_virt_service *vs) {
         return;
     if (vs->sched->fini)
         vs->sched->fini(vs);
+    service_stats_id_free(vs->stats_id);
     rte_free(vs);
 }
 
@@ -317,6 +831,11 @@ lb_rs_alloc(uint32_t rip, uint32_t rport, int weight,
     if (rs == NULL)
         return NULL;
 
+    if (service_stats_id_alloc(&rs->stats_id) < 0) {
+        rte_free(rs);
+        return NULL;
+    }
+
     rs->rip = rip;
     rs->rport = rport;
     rs->proto = vs->proto;
@@ -335,6 +854,7 @@ lb_rs_free(struct lb_real_service *rs) {
     if (rte_atomic32_add_return(&rs->refcnt, -1) != 0)
         return;
     lb_vs_free(rs->virt_service);
+    service_stats_id_free(rs->stats_id);
     rte_free(rs);
 }
 
@@ -420,6 +940,7 @@ vs_add_cmd_cb(int fd, char *argv[], int argc) {
         }
     }
 
+    lb_flow_vip_get(vip);
     return;
 
 del_vss:
@@ -465,6 +986,7 @@ vs_del_cmd_cb(int fd, char *argv[], int argc) {
     int rc;
     uint32_t socket_id;
     struct lb_virt_service *vs;
+    int found = 0;
 
     rc = vs_del_arg_parse(argv, argc, &vip, &vport, &proto);
     if (rc != argc) {
@@ -481,11 +1003,17 @@ vs_del_cmd_cb(int fd, char *argv[], int argc) {
 
             LB_VS_TBL_WLOCK(lb_vs_tbls[socket_id]);
             vs_tbl_del(lb_vs_tbls[socket_id], vs);
+            if (vs->flags & LB_VS_F_NAT64)
+                vs6_tbl_del(lb_vs_tbls[socket_id], vs);
             LB_VS_TBL_WUNLOCK(lb_vs_tbls[socket_id]);
 
             lb_vs_free(vs);
+            found = 1;
         }
     }
+
+    if (found)
+        lb_flow_vip_put(vip);
 }
 
 UNIXCTL_CMD_REGISTER("vs/del", "VIP:VPORT tcp|udp.", "Delete virtual service.",
@@ -500,6 +1028,20 @@ l4proto_format(uint8_t l4proto) {
     return "oth";
 }
 
+static const char *const vs_fwd_mode_names[LB_VS_FWD_MAX] = {
+    [LB_VS_FWD_FNAT] = "fnat",
+    [LB_VS_FWD_DR] = "dr",
+    [LB_VS_FWD_IPIP] = "ipip",
+    [LB_VS_FWD_GUE] = "gue",
+};
+
+static inline const char *
+fwd_mode_format(uint8_t fwd_mode) {
+    if (fwd_mode < LB_VS_FWD_MAX)
+        return vs_fwd_mode_names[fwd_mode];
+    return "oth";
+}
+
 static int
 vs_list_arg_parse(char *argv[], int argc, int *json_fmt) {
     int i = 0;
@@ -527,6 +1069,7 @@ vs_list_cmd_cb(int fd, char *argv[], int argc) {
     uint32_t next = 0;
     struct lb_virt_service *vs;
     char buf[32];
+    char buf6[INET6_ADDRSTRLEN];
 
     rc = vs_list_arg_parse(argv, argc, &json_fmt);
     if (rc != argc) {
@@ -537,12 +1080,16 @@ vs_list_cmd_cb(int fd, char *argv[], int argc) {
     VS_TBL_FOREACH_SOCKET(socket_id) {
         static const char *vs_list_header =
             "IP               Port   Type   Sched       Max_conns   synproxy  "
-            "toa  est_timeout\n";
+            "toa  onepacket  est_timeout  fwd_mode  nat64\n";
         t = lb_vs_tbls[socket_id];
 
         unixctl_command_reply(fd, json_fmt ? "[" : vs_list_header);
         while (rte_hash_iterate(t->vs_htbl, &key, (void **)&vs, &next) >= 0) {
             ipv4_addr_tostring(vs->vip, buf, sizeof(buf));
+            if (vs->flags & LB_VS_F_NAT64)
+                inet_ntop(AF_INET6, vs->vip6, buf6, sizeof(buf6));
+            else
+                snprintf(buf6, sizeof(buf6), "none");
 
             if (json_fmt) {
                 unixctl_command_reply(fd, json_first_obj ? "{" : ",{");
@@ -560,15 +1107,24 @@ vs_list_cmd_cb(int fd, char *argv[], int argc) {
                                       !!(vs->flags & LB_VS_F_SYNPROXY));
                 unixctl_command_reply(fd, JSON_KV_32_FMT("toa", ","),
                                       !!(vs->flags & LB_VS_F_TOA));
-                unixctl_command_reply(fd, JSON_KV_32_FMT("est_timeout", "}"),
+                unixctl_command_reply(fd, JSON_KV_32_FMT("onepacket", ","),
+                                      !!(vs->flags & LB_VS_F_ONEPACKET));
+                unixctl_command_reply(fd, JSON_KV_32_FMT("est_timeout", ","),
                                       vs->est_timeout);
+                unixctl_command_reply(fd, JSON_KV_S_FMT("fwd_mode", ","),
+                                      fwd_mode_format(vs->fwd_mode));
+                unixctl_command_reply(fd, JSON_KV_S_FMT("nat64", "}"), buf6);
             } else {
                 unixctl_command_reply(
-                    fd, "%-15s  %-5u  %-5s  %-10s  %-10d  %-8u  %-3u  %-10u\n",
+                    fd,
+                    "%-15s  %-5u  %-5s  %-10s  %-10d  %-8u  %-3u  %-9u  %-11u  "
+                    "%-8s  %s\n",
                     buf, rte_be_to_cpu_16(vs->vport), l4proto_format(vs->proto),
                     vs->sched->name, vs->max_conns,
                     !!(vs->flags & LB_VS_F_SYNPROXY),
-                    !!(vs->flags & LB_VS_F_TOA), vs->est_timeout);
+                    !!(vs->flags & LB_VS_F_TOA),
+                    !!(vs->flags & LB_VS_F_ONEPACKET), vs->est_timeout,
+                    fwd_mode_format(vs->fwd_mode), buf6);
             }
         }
         if (json_fmt)
@@ -635,6 +1191,10 @@ vs_synproxy_cmd_cb(int fd, char *argv[], int argc) {
             unixctl_command_reply(fd, "%u\n", !!(vs->flags & LB_VS_F_SYNPROXY));
             return;
         }
+        if (op && vs->fwd_mode != LB_VS_FWD_FNAT) {
+            unixctl_command_reply_error(fd, "Synproxy only works in fnat.\n");
+            return;
+        }
 
         if (op) {
             vs->flags |= LB_VS_F_SYNPROXY;
@@ -718,6 +1278,289 @@ vs_toa_cmd_cb(int fd, char *argv[], int argc) {
 UNIXCTL_CMD_REGISTER("vs/toa", "VIP:VPORT tcp [0|1].", "Show or set toa.", 2, 3,
                      vs_toa_cmd_cb);
 
+static int
+vs_onepacket_arg_parse(char *argv[], int argc, uint32_t *vip, uint16_t *vport,
+                       uint8_t *proto, uint8_t *echo, uint8_t *op) {
+    int rc;
+    int i = 0;
+
+    /* ip:port */
+    rc = parse_ipv4_port(argv[i++], vip, vport);
+    if (rc < 0)
+        return i - 1;
+
+    /*  proto */
+    rc = parse_l4_proto(argv[i++], proto);
+    if (rc < 0 || *proto != IPPROTO_UDP)
+        return i - 1;
+
+    if (i < argc) {
+        *echo = 0;
+        rc = parser_read_uint8(op, argv[i++]);
+        if (rc < 0)
+            return i - 1;
+    } else {
+        *echo = 1;
+    }
+
+    return i;
+}
+
+static void
+vs_onepacket_cmd_cb(int fd, char *argv[], int argc) {
+    uint32_t vip;
+    uint16_t vport;
+    uint8_t proto;
+    uint8_t echo = 0;
+    uint8_t op;
+    int rc;
+    struct lb_virt_service *vs;
+    uint32_t socket_id;
+
+    rc = vs_onepacket_arg_parse(argv, argc, &vip, &vport, &proto, &echo, &op);
+    if (rc != argc) {
+        unixctl_command_reply_error(fd, "Invalid parameter: %s.\n", argv[rc]);
+        return;
+    }
+
+    VS_TBL_FOREACH_SOCKET(socket_id) {
+        vs = vs_tbl_find(lb_vs_tbls[socket_id], vip, vport, proto);
+        if (vs == NULL) {
+            unixctl_command_reply_error(fd, "Cannot find virt service.\n");
+            return;
+        }
+        if (echo) {
+            unixctl_command_reply(fd, "%u\n",
+                                  !!(vs->flags & LB_VS_F_ONEPACKET));
+            return;
+        }
+
+        if (op) {
+            vs->flags |= LB_VS_F_ONEPACKET;
+        } else {
+            vs->flags &= ~LB_VS_F_ONEPACKET;
+        }
+    }
+
+    return;
+}
+
+UNIXCTL_CMD_REGISTER("vs/onepacket", "VIP:VPORT udp [0|1].",
+                     "Show or set UDP one-packet scheduling.", 2, 3,
+                     vs_onepacket_cmd_cb);
+
+static int
+vs_fwd_mode_arg_parse(char *argv[], int argc, uint32_t *vip, uint16_t *vport,
+                      uint8_t *proto, uint8_t *echo, uint8_t *mode) {
+    int rc;
+    int i = 0;
+    uint8_t m;
+
+    /* ip:port */
+    rc = parse_ipv4_port(argv[i++], vip, vport);
+    if (rc < 0)
+        return i - 1;
+
+    /*  proto */
+    rc = parse_l4_proto(argv[i++], proto);
+    if (rc < 0)
+        return i - 1;
+
+    if (i < argc) {
+        *echo = 0;
+        for (m = 0; m < LB_VS_FWD_MAX; m++) {
+            if (strcmp(argv[i], vs_fwd_mode_names[m]) == 0)
+                break;
+        }
+        if (m == LB_VS_FWD_MAX)
+            return i;
+        *mode = m;
+        i++;
+    } else {
+        *echo = 1;
+    }
+
+    return i;
+}
+
+static void
+vs_fwd_mode_cmd_cb(int fd, char *argv[], int argc) {
+    uint32_t vip;
+    uint16_t vport;
+    uint8_t proto;
+    uint8_t echo = 0;
+    uint8_t mode = LB_VS_FWD_FNAT;
+    int rc;
+    struct lb_virt_service *vs;
+    struct lb_real_service *rs;
+    uint32_t socket_id;
+
+    rc = vs_fwd_mode_arg_parse(argv, argc, &vip, &vport, &proto, &echo, &mode);
+    if (rc != argc) {
+        unixctl_command_reply_error(fd, "Invalid parameter: %s.\n", argv[rc]);
+        return;
+    }
+
+    VS_TBL_FOREACH_SOCKET(socket_id) {
+        vs = vs_tbl_find(lb_vs_tbls[socket_id], vip, vport, proto);
+        if (vs == NULL) {
+            unixctl_command_reply_error(fd, "Cannot find virt service.\n");
+            return;
+        }
+        if (echo) {
+            unixctl_command_reply(fd, "%s\n", fwd_mode_format(vs->fwd_mode));
+            return;
+        }
+        if (mode == LB_VS_FWD_FNAT)
+            continue;
+        if (vs->flags & LB_VS_F_SYNPROXY) {
+            unixctl_command_reply_error(fd, "Synproxy only works in fnat.\n");
+            return;
+        }
+        if (vs->flags & LB_VS_F_NAT64) {
+            unixctl_command_reply_error(fd, "NAT64 only works in fnat.\n");
+            return;
+        }
+        LIST_FOREACH(rs, &vs->real_services, next) {
+            if (rs->rport != vs->vport) {
+                unixctl_command_reply_error(
+                    fd, "Real service port must be the same as VPORT in %s.\n",
+                    fwd_mode_format(mode));
+                return;
+            }
+        }
+    }
+
+    /* Existing connections keep the mode they were created with. */
+    VS_TBL_FOREACH_SOCKET(socket_id) {
+        vs = vs_tbl_find(lb_vs_tbls[socket_id], vip, vport, proto);
+        vs->fwd_mode = mode;
+    }
+}
+
+UNIXCTL_CMD_REGISTER("vs/fwd_mode", "VIP:VPORT tcp|udp [fnat|dr|ipip|gue].",
+                     "Show or set forwarding mode.", 2, 3, vs_fwd_mode_cmd_cb);
+
+static int
+vs_nat64_arg_parse(char *argv[], int argc, uint32_t *vip, uint16_t *vport,
+                   uint8_t *proto, uint8_t *echo, uint8_t *op,
+                   struct in6_addr *vip6) {
+    int rc;
+    int i = 0;
+
+    /* ip:port */
+    rc = parse_ipv4_port(argv[i++], vip, vport);
+    if (rc < 0)
+        return i - 1;
+
+    /*  proto */
+    rc = parse_l4_proto(argv[i++], proto);
+    if (rc < 0)
+        return i - 1;
+
+    if (i < argc) {
+        *echo = 0;
+        if (strcmp(argv[i], "none") == 0) {
+            *op = 0;
+        } else {
+            rc = parse_ipv6_addr(argv[i], vip6);
+            if (rc < 0)
+                return i;
+            *op = 1;
+        }
+        i++;
+    } else {
+        *echo = 1;
+    }
+
+    return i;
+}
+
+static void
+vs_nat64_cmd_cb(int fd, char *argv[], int argc) {
+    uint32_t vip;
+    uint16_t vport;
+    uint8_t proto;
+    uint8_t echo = 0;
+    uint8_t op = 0;
+    struct in6_addr vip6;
+    char buf[INET6_ADDRSTRLEN];
+    int rc;
+    struct lb_virt_service *vs, *vs6;
+    struct lb_proto *p;
+    uint32_t socket_id, lcore_id;
+
+    rc = vs_nat64_arg_parse(argv, argc, &vip, &vport, &proto, &echo, &op,
+                            &vip6);
+    if (rc != argc) {
+        unixctl_command_reply_error(fd, "Invalid parameter: %s.\n", argv[rc]);
+        return;
+    }
+
+    VS_TBL_FOREACH_SOCKET(socket_id) {
+        vs = vs_tbl_find(lb_vs_tbls[socket_id], vip, vport, proto);
+        if (vs == NULL) {
+            unixctl_command_reply_error(fd, "Cannot find virt service.\n");
+            return;
+        }
+        if (echo) {
+            if (vs->flags & LB_VS_F_NAT64)
+                unixctl_command_reply(
+                    fd, "%s\n",
+                    inet_ntop(AF_INET6, vs->vip6, buf, sizeof(buf)));
+            else
+                unixctl_command_reply(fd, "none\n");
+            return;
+        }
+        if (!op)
+            continue;
+        if (vs->fwd_mode != LB_VS_FWD_FNAT) {
+            unixctl_command_reply_error(fd, "NAT64 only works in fnat.\n");
+            return;
+        }
+        vs6 = vs6_tbl_find(lb_vs_tbls[socket_id], vip6.s6_addr, vport, proto);
+        if (vs6 != NULL && vs6 != vs) {
+            unixctl_command_reply_error(fd, "Virt service already exists.\n");
+            return;
+        }
+    }
+
+    if (op) {
+        p = lb_proto_get(proto);
+        RTE_LCORE_FOREACH_SLAVE(lcore_id) {
+            if (lb_conn_table_ipv6_enable(p->conn_table(lcore_id)) < 0) {
+                unixctl_command_reply_error(fd, "Not enough memory.\n");
+                return;
+            }
+        }
+    }
+
+    /* Existing connections keep the address they were created with. */
+    VS_TBL_FOREACH_SOCKET(socket_id) {
+        vs = vs_tbl_find(lb_vs_tbls[socket_id], vip, vport, proto);
+        LB_VS_TBL_WLOCK(lb_vs_tbls[socket_id]);
+        if (vs->flags & LB_VS_F_NAT64) {
+            vs6_tbl_del(lb_vs_tbls[socket_id], vs);
+            vs->flags &= ~LB_VS_F_NAT64;
+        }
+        if (op) {
+            rte_memcpy(vs->vip6, vip6.s6_addr, 16);
+            rc = vs6_tbl_add(lb_vs_tbls[socket_id], vs);
+            if (rc == 0)
+                vs->flags |= LB_VS_F_NAT64;
+        }
+        LB_VS_TBL_WUNLOCK(lb_vs_tbls[socket_id]);
+        if (op && rc < 0) {
+            unixctl_command_reply_error(fd, "No space in the table.\n");
+            return;
+        }
+    }
+}
+
+UNIXCTL_CMD_REGISTER("vs/nat64", "VIP:VPORT tcp|udp [IPV6|none].",
+                     "Show or set the IPv6 address served by NAT64.", 2, 3,
+                     vs_nat64_cmd_cb);
+
 static int
 vs_max_conn_arg_parse(char *argv[], int argc, uint32_t *vip, uint16_t *vport,
                       uint8_t *proto, uint8_t *echo, int *max) {
@@ -979,10 +1822,9 @@ vs_stats_cmd_cb(int fd, char *argv[], int argc) {
     int rc;
     struct lb_virt_service *vs;
     struct lb_real_service *rs;
-    uint32_t socket_id, lcore_id;
-    uint64_t rx_packets[2] = {0}, rx_bytes[2] = {0}, rx_drops[2] = {0};
-    uint64_t tx_packets[2] = {0}, tx_bytes[2] = {0};
-    uint64_t active_conns = 0, history_conns = 0, max_conns = 0;
+    uint32_t socket_id;
+    struct lb_service_stats vs_stats = {0}, rs_stats = {0};
+    uint64_t active_conns = 0, max_conns = 0;
 
     rc = vs_stats_arg_parse(argv, argc, &vip, &vport, &proto, &json_fmt);
     if (rc != argc) {
@@ -997,23 +1839,10 @@ vs_stats_cmd_cb(int fd, char *argv[], int argc) {
             return;
         }
 
-        RTE_LCORE_FOREACH_SLAVE(lcore_id) {
-            rx_packets[0] += vs->stats[lcore_id].packets[0];
-            rx_packets[1] += vs->stats[lcore_id].packets[1];
-            rx_bytes[0] += vs->stats[lcore_id].bytes[0];
-            rx_bytes[1] += vs->stats[lcore_id].bytes[1];
-            rx_drops[0] += vs->stats[lcore_id].drops[0];
-            rx_drops[1] += vs->stats[lcore_id].drops[1];
-            history_conns += vs->stats[lcore_id].conns;
-        }
+        service_stats_sum(vs->stats_id, &vs_stats);
         active_conns += (uint64_t)rte_atomic32_read(&vs->active_conns);
         LIST_FOREACH(rs, &vs->real_services, next) {
-            RTE_LCORE_FOREACH_SLAVE(lcore_id) {
-                tx_packets[0] += rs->stats[lcore_id].packets[0];
-                tx_packets[1] += rs->stats[lcore_id].packets[1];
-                tx_bytes[0] += rs->stats[lcore_id].bytes[0];
-                tx_bytes[1] += rs->stats[lcore_id].bytes[1];
-            }
+            service_stats_sum(rs->stats_id, &rs_stats);
         }
 
         max_conns = vs->max_conns;
@@ -1033,48 +1862,48 @@ vs_stats_cmd_cb(int fd, char *argv[], int argc) {
     unixctl_command_reply(fd,
                           json_fmt ? JSON_KV_64_FMT("history-conns", ",")
                                    : NORM_KV_64_FMT("history-conns", "\n"),
-                          history_conns);
+                          vs_stats.conns);
 
     unixctl_command_reply(fd,
                           json_fmt ? JSON_KV_64_FMT("[c2v]packets", ",")
                                    : NORM_KV_64_FMT("[c2v]packets", "\n"),
-                          rx_packets[0]);
+                          vs_stats.packets[0]);
     unixctl_command_reply(fd,
                           json_fmt ? JSON_KV_64_FMT("[c2v]bytes", ",")
                                    : NORM_KV_64_FMT("[c2v]bytes", "\n"),
-                          rx_bytes[0]);
+                          vs_stats.bytes[0]);
     unixctl_command_reply(fd,
                           json_fmt ? JSON_KV_64_FMT("[c2v]drops", ",")
                                    : NORM_KV_64_FMT("[c2v]drops", "\n"),
-                          rx_drops[0]);
+                          vs_stats.drops[0]);
     unixctl_command_reply(fd,
                           json_fmt ? JSON_KV_64_FMT("[r2v]packets", ",")
                                    : NORM_KV_64_FMT("[r2v]packets", "\n"),
-                          rx_packets[1]);
+                          vs_stats.packets[1]);
     unixctl_command_reply(fd,
                           json_fmt ? JSON_KV_64_FMT("[r2v]bytes", ",")
                                    : NORM_KV_64_FMT("[r2v]bytes", "\n"),
-                          rx_bytes[1]);
+                          vs_stats.bytes[1]);
     unixctl_command_reply(fd,
                           json_fmt ? JSON_KV_64_FMT("[r2v]drops", ",")
                                    : NORM_KV_64_FMT("[r2v]drops", "\n"),
-                          rx_drops[1]);
+                          vs_stats.drops[1]);
     unixctl_command_reply(fd,
                           json_fmt ? JSON_KV_64_FMT("[v2r]packets", ",")
                                    : NORM_KV_64_FMT("[v2r]packets", "\n"),
-                          tx_packets[0]);
+                          rs_stats.packets[0]);
     unixctl_command_reply(fd,
                           json_fmt ? JSON_KV_64_FMT("[v2r]bytes", ",")
                                    : NORM_KV_64_FMT("[v2r]bytes", "\n"),
-                          tx_bytes[0]);
+                          rs_stats.bytes[0]);
     unixctl_command_reply(fd,
                           json_fmt ? JSON_KV_64_FMT("[v2c]packets", ",")
                                    : NORM_KV_64_FMT("[v2c]packets", "\n"),
-                          tx_packets[1]);
+                          rs_stats.packets[1]);
     unixctl_command_reply(fd,
                           json_fmt ? JSON_KV_64_FMT("[v2c]bytes", "")
                                    : NORM_KV_64_FMT("[v2c]bytes", "\n"),
-                          tx_bytes[1]);
+                          rs_stats.bytes[1]);
 
     if (json_fmt)
         unixctl_command_reply(fd, "}\n");
@@ -1084,6 +1913,115 @@ UNIXCTL_CMD_REGISTER("vs/stats", "VIP:VPORT tcp|udp [--json].",
                      "Show packet statistics of virtual service.", 2, 3,
                      vs_stats_cmd_cb);
 
+static void
+service_rate_kv_reply(int fd, int json_fmt, int *json_first, const char *key,
+                      uint64_t val) {
+    if (json_fmt) {
+        unixctl_command_reply(fd, "%s\"%s\":%" PRIu64, *json_first ? "" : ",",
+                              key, val);
+        *json_first = 0;
+    } else {
+        unixctl_command_reply(fd, "  %s: %" PRIu64 "\n", key, val);
+    }
+}
+
+/*
+ * Rates of a window, the directions named after those of vs/stats. Only
+ * virtual services count drops, they come with the rates of their real
+ * services.
+ */
+static void
+service_rate_reply(int fd, int json_fmt, uint32_t window, const uint64_t *rates,
+                   const uint64_t *rs_rates, const char *dirs[]) {
+    char key[32];
+    int json_first = 1;
+    uint32_t dir;
+
+    if (json_fmt)
+        unixctl_command_reply(fd, "%s\"%s\":{", window != 0 ? "," : "",
+                              lb_rate_window_names[window]);
+    else
+        unixctl_command_reply(fd, "%s\n", lb_rate_window_names[window]);
+    service_rate_kv_reply(fd, json_fmt, &json_first, "cps",
+                          rates[SERVICE_RATE_CONNS]);
+    unixctl_command_reply(fd,
+                          json_fmt ? ",\"active-conns-delta\":%" PRId64
+                                   : "  active-conns-delta: %" PRId64 "\n",
+                          (int64_t)rates[SERVICE_RATE_ACTIVE_CONNS]);
+    for (dir = 0; dir < LB_DIR_MAX; dir++) {
+        snprintf(key, sizeof(key), "[%s]pps", dirs[dir]);
+        service_rate_kv_reply(fd, json_fmt, &json_first, key,
+                              rates[SERVICE_RATE_PACKETS + dir]);
+        snprintf(key, sizeof(key), "[%s]Bps", dirs[dir]);
+        service_rate_kv_reply(fd, json_fmt, &json_first, key,
+                              rates[SERVICE_RATE_BYTES + dir]);
+        if (rs_rates == NULL)
+            continue;
+        snprintf(key, sizeof(key), "[%s]drops-ps", dirs[dir]);
+        service_rate_kv_reply(fd, json_fmt, &json_first, key,
+                              rates[SERVICE_RATE_DROPS + dir]);
+    }
+    for (dir = 0; rs_rates != NULL && dir < LB_DIR_MAX; dir++) {
+        snprintf(key, sizeof(key), "[%s]pps", dirs[LB_DIR_MAX + dir]);
+        service_rate_kv_reply(fd, json_fmt, &json_first, key,
+                              rs_rates[SERVICE_RATE_PACKETS + dir]);
+        snprintf(key, sizeof(key), "[%s]Bps", dirs[LB_DIR_MAX + dir]);
+        service_rate_kv_reply(fd, json_fmt, &json_first, key,
+                              rs_rates[SERVICE_RATE_BYTES + dir]);
+    }
+    if (json_fmt)
+        unixctl_command_reply(fd, "}");
+}
+
+static void
+vs_rate_cmd_cb(int fd, char *argv[], int argc) {
+    static const char *dirs[] = {"c2v", "r2v", "v2r", "v2c"};
+    uint32_t vip;
+    uint16_t vport;
+    uint8_t proto;
+    int json_fmt = 0;
+    int rc;
+    struct lb_virt_service *vs;
+    struct lb_real_service *rs;
+    uint32_t socket_id, window;
+    uint64_t rates[LB_RATE_W_MAX][SERVICE_RATE_MAX] = {{0}};
+    uint64_t rs_rates[LB_RATE_W_MAX][SERVICE_RATE_MAX] = {{0}};
+
+    rc = vs_stats_arg_parse(argv, argc, &vip, &vport, &proto, &json_fmt);
+    if (rc != argc) {
+        unixctl_command_reply_error(fd, "Invalid parameter: %s.\n", argv[rc]);
+        return;
+    }
+
+    VS_TBL_FOREACH_SOCKET(socket_id) {
+        vs = vs_tbl_find(lb_vs_tbls[socket_id], vip, vport, proto);
+        if (vs == NULL) {
+            unixctl_command_reply_error(fd, "Cannot find virt service.\n");
+            return;
+        }
+        for (window = 0; window < LB_RATE_W_MAX; window++) {
+            service_rate_add(vs->stats_id, window, rates[window]);
+            LIST_FOREACH(rs, &vs->real_services, next) {
+                service_rate_add(rs->stats_id, window, rs_rates[window]);
+            }
+        }
+    }
+
+    if (json_fmt)
+        unixctl_command_reply(fd, "{");
+    for (window = 0; window < LB_RATE_W_MAX; window++) {
+        service_rate_reply(fd, json_fmt, window, rates[window],
+                           rs_rates[window], dirs);
+    }
+    if (json_fmt)
+        unixctl_command_reply(fd, "}\n");
+}
+
+UNIXCTL_CMD_REGISTER("vs/rate", "VIP:VPORT tcp|udp [--json].",
+                     "Show the rates of virtual service over the last 1, 10 "
+                     "and 60 seconds.",
+                     2, 3, vs_rate_cmd_cb);
+
 static int
 rs_add_arg_parse(char *argv[], __attribute((unused)) int argc, uint32_t *vip,
                  uint16_t *vport, uint8_t *proto, uint32_t *rip,
@@ -1152,6 +2090,12 @@ rs_add_cmd_cb(int fd, char *argv[], int argc) {
             unixctl_command_reply_error(fd, "Real service is exist.\n");
             return;
         }
+        if (vss[socket_id]->fwd_mode != LB_VS_FWD_FNAT && rport != vport) {
+            unixctl_command_reply_error(
+                fd, "Real service port must be the same as VPORT in %s.\n",
+                fwd_mode_format(vss[socket_id]->fwd_mode));
+            return;
+        }
     }
 
     VS_TBL_FOREACH_SOCKET(socket_id) {
@@ -1610,9 +2554,8 @@ rs_stats_cmd_cb(int fd, char *argv[], int argc) {
     uint32_t socket_id;
     struct lb_virt_service *vs;
     struct lb_real_service *rs;
-    uint32_t lcore_id;
-    uint64_t packets[2] = {0}, bytes[2] = {0};
-    uint64_t active_conns = 0, history_conns = 0;
+    struct lb_service_stats stats = {0};
+    uint64_t active_conns = 0;
 
     rc = rs_stats_arg_parse(argv, argc, &vip, &vport, &proto, &rip, &rport,
                             &json_fmt);
@@ -1634,14 +2577,8 @@ rs_stats_cmd_cb(int fd, char *argv[], int argc) {
             return;
         }
 
-        RTE_LCORE_FOREACH_SLAVE(lcore_id) {
-            packets[0] += rs->stats[lcore_id].packets[0];
-            packets[1] += rs->stats[lcore_id].packets[1];
-            bytes[0] += rs->stats[lcore_id].bytes[0];
-            bytes[1] += rs->stats[lcore_id].bytes[1];
-            history_conns += rs->stats[lcore_id].conns;
-            active_conns += (uint64_t)rte_atomic32_read(&rs->active_conns);
-        }
+        service_stats_sum(rs->stats_id, &stats);
+        active_conns += (uint64_t)rte_atomic32_read(&rs->active_conns);
     }
 
     if (json_fmt)
@@ -1653,23 +2590,23 @@ rs_stats_cmd_cb(int fd, char *argv[], int argc) {
     unixctl_command_reply(fd,
                           json_fmt ? JSON_KV_32_FMT("history-conns", ",")
                                    : NORM_KV_32_FMT("history-conns", "\n"),
-                          history_conns);
+                          stats.conns);
     unixctl_command_reply(fd,
                           json_fmt ? JSON_KV_32_FMT("[v2r]packets", ",")
                                    : NORM_KV_32_FMT("[v2r]packets", "\n"),
-                          packets[0]);
+                          stats.packets[0]);
     unixctl_command_reply(fd,
                           json_fmt ? JSON_KV_32_FMT("[v2r]bytes", ",")
                                    : NORM_KV_32_FMT("[v2r]bytes", "\n"),
-                          bytes[0]);
+                          stats.bytes[0]);
     unixctl_command_reply(fd,
                           json_fmt ? JSON_KV_32_FMT("[r2v]packets", ",")
                                    : NORM_KV_32_FMT("[r2v]packets", "\n"),
-                          packets[1]);
+                          stats.packets[1]);
     unixctl_command_reply(fd,
                           json_fmt ? JSON_KV_32_FMT("[r2v]bytes", "")
                                    : NORM_KV_32_FMT("[r2v]bytes", "\n"),
-                          bytes[1]);
+                          stats.bytes[1]);
     if (json_fmt)
         unixctl_command_reply(fd, "}\n");
 }
@@ -1677,3 +2614,56 @@ rs_stats_cmd_cb(int fd, char *argv[], int argc) {
 UNIXCTL_CMD_REGISTER("rs/stats", "VIP:VPORT tcp|udp RIP:RPORT.",
                      "Show the packet stats of real services.", 3, 4,
                      rs_stats_cmd_cb);
+
+static void
+rs_rate_cmd_cb(int fd, char *argv[], int argc) {
+    static const char *dirs[] = {"v2r", "r2v"};
+    uint32_t vip;
+    uint16_t vport;
+    uint8_t proto;
+    uint32_t rip;
+    uint16_t rport;
+    int json_fmt = 0;
+    int rc;
+    uint32_t socket_id, window;
+    struct lb_virt_service *vs;
+    struct lb_real_service *rs;
+    uint64_t rates[LB_RATE_W_MAX][SERVICE_RATE_MAX] = {{0}};
+
+    rc = rs_stats_arg_parse(argv, argc, &vip, &vport, &proto, &rip, &rport,
+                            &json_fmt);
+    if (rc != argc) {
+        unixctl_command_reply_error(fd, "Invalid parameter: %s.\n", argv[rc]);
+        return;
+    }
+
+    VS_TBL_FOREACH_SOCKET(socket_id) {
+        vs = vs_tbl_find(lb_vs_tbls[socket_id], vip, vport, proto);
+        if (vs == NULL) {
+            unixctl_command_reply_error(fd, "Cannot find virt service.\n");
+            return;
+        }
+
+        rs = vs_find_rs(vs, rip, rport);
+        if (rs == NULL) {
+            unixctl_command_reply_error(fd, "Cannot find real service.\n");
+            return;
+        }
+
+        for (window = 0; window < LB_RATE_W_MAX; window++)
+            service_rate_add(rs->stats_id, window, rates[window]);
+    }
+
+    if (json_fmt)
+        unixctl_command_reply(fd, "{");
+    for (window = 0; window < LB_RATE_W_MAX; window++) {
+        service_rate_reply(fd, json_fmt, window, rates[window], NULL, dirs);
+    }
+    if (json_fmt)
+        unixctl_command_reply(fd, "}\n");
+}
+
+UNIXCTL_CMD_REGISTER("rs/rate", "VIP:VPORT tcp|udp RIP:RPORT [--json].",
+                     "Show the rates of real services over the last 1, 10 "
+                     "and 60 seconds.",
+                     3, 4, rs_rate_cmd_cb);
@@ -16,6 +16,16 @@
 #define LB_VS_F_SYNPROXY (0x01)
 #define LB_VS_F_TOA (0x02)
 #define LB_VS_F_CQL (0x04)
+#define LB_VS_F_ONEPACKET (0x08)
+#define LB_VS_F_NAT64 (0x10)
+
+enum {
+    LB_VS_FWD_FNAT = 0, /* Full NAT. */
+    LB_VS_FWD_DR,       /* Direct server return. */
+    LB_VS_FWD_IPIP,     /* IPIP tunnel. */
+    LB_VS_FWD_GUE,      /* GUE tunnel. */
+    LB_VS_FWD_MAX,
+};
 
 #define LB_RS_F_AVAILABLE (0x1)
 
@@ -26,6 +36,19 @@ struct lb_service_stats {
     uint64_t conns;
 };
 
+/*
+ * The service statistics of a worker live in its own arena, chunks of
+ * entries indexed by the stats id of a service, so workers never share
+ * their cache lines. Chunks are allocated when their first id is.
+ */
+#define LB_SERVICE_STATS_CHUNK_SHIFT 10
+#define LB_SERVICE_STATS_CHUNK_SIZE (1 << LB_SERVICE_STATS_CHUNK_SHIFT)
+#define LB_SERVICE_STATS_MAX (1 << 20)
+#define LB_SERVICE_STATS_MAX_CHUNKS                                            \
+    (LB_SERVICE_STATS_MAX >> LB_SERVICE_STATS_CHUNK_SHIFT)
+
+extern struct lb_service_stats **lb_service_stats_arenas[RTE_MAX_LCORE];
+
 struct lb_real_service;
 
 struct lb_virt_service {
@@ -33,12 +56,16 @@ struct lb_virt_service {
     uint16_t vport;
     uint8_t proto;
 
+    /* IPv6 address served by NAT64, valid with LB_VS_F_NAT64. */
+    uint8_t vip6[16];
+
     uint32_t est_timeout;
     int max_conns;
     rte_atomic32_t active_conns;
     rte_atomic32_t refcnt;
 
     uint32_t flags;
+    uint8_t fwd_mode;
 
     uint32_t socket_id;
 
@@ -49,7 +76,7 @@ struct lb_virt_service {
 
     LIST_HEAD(, lb_real_service) real_services;
 
-    struct lb_service_stats stats[RTE_MAX_LCORE];
+    uint32_t stats_id;
 };
 
 struct lb_real_service {
@@ -68,11 +95,14 @@ struct lb_real_service {
     struct lb_virt_service *virt_service;
     void *sched_node;
 
-    struct lb_service_stats stats[RTE_MAX_LCORE];
+    uint32_t stats_id;
 };
 
 int lb_is_vip_exist(uint32_t vip);
 struct lb_virt_service *lb_vs_get(uint32_t vip, uint16_t vport, uint8_t proto);
+int lb_is_vip6_exist(const uint8_t *vip6);
+struct lb_virt_service *lb_vs_get6(const uint8_t *vip6, uint16_t vport,
+                                   uint8_t proto);
 void lb_vs_put(struct lb_virt_service *vs);
 struct lb_real_service *lb_vs_get_rs(struct lb_virt_service *vs, uint32_t cip,
                                      uint16_t cport);
@@ -81,6 +111,33 @@ void lb_vs_free(struct lb_virt_service *vs);
 void lb_rs_free(struct lb_real_service *rs);
 int lb_service_init(void);
 
+struct metrics_shm_header;
+void lb_service_metrics(struct metrics_shm_header *h);
+
+static inline struct lb_service_stats *
+lb_service_stats_get(uint32_t stats_id, uint32_t lcore_id) {
+    uint32_t chunk = stats_id >> LB_SERVICE_STATS_CHUNK_SHIFT;
+    uint32_t idx = stats_id & (LB_SERVICE_STATS_CHUNK_SIZE - 1);
+
+    return &lb_service_stats_arenas[lcore_id][chunk][idx];
+}
+
+static inline struct lb_service_stats *
+lb_vs_stats(struct lb_virt_service *vs, uint32_t lcore_id) {
+    return lb_service_stats_get(vs->stats_id, lcore_id);
+}
+
+static inline struct lb_service_stats *
+lb_rs_stats(struct lb_real_service *rs, uint32_t lcore_id) {
+    return lb_service_stats_get(rs->stats_id, lcore_id);
+}
+
+/* A packet of the service dropped by the current worker. */
+static inline void
+lb_vs_drop(struct lb_virt_service *vs, uint8_t dir) {
+    lb_vs_stats(vs, rte_lcore_id())->drops[dir] += 1;
+}
+
 static inline int
 lb_vs_check_max_conn(struct lb_virt_service *vs) {
     return rte_atomic32_read(&vs->active_conns) >= vs->max_conns;
@@ -0,0 +1,458 @@
+/* Copyright (c) 2018. TIG developer. */
+
+#include <rte_ether.h>
+#include <rte_hash_crc.h>
+#include <rte_icmp.h>
+#include <rte_ip.h>
+#include <rte_log.h>
+#include <rte_malloc.h>
+#include <rte_mbuf.h>
+#include <rte_ring.h>
+#include <rte_tcp.h>
+
+#include <unixctl_command.h>
+
+#include "lb_device.h"
+#include "lb_drop.h"
+#include "lb_format.h"
+#include "lb_ipfrag.h"
+#include "lb_steer.h"
+
+#define STEER_RING_SIZE (PKT_MAX_BURST * 16)
+#define STEER_NONE UINT16_MAX
+/* The address is shared by all queues, the local port picks the owner. */
+#define STEER_BY_PORT (UINT16_MAX - 1)
+#define STEER_FRAG_SLOTS 1024
+
+/*
+ * Software steering, used when the NIC cannot steer the local addresses to
+ * the RX queue of the lcore owning them. Every RX queue maps one-to-one to
+ * a worker lcore, packets to a local address of another queue are handed
+ * over through the SPSC ring of the (from, to) queue pair. With partitioned
+ * local ports every queue owns all the addresses and a range of their ports.
+ */
+struct steer_entry {
+    uint32_t ip;
+    uint16_t rxq_id;
+};
+
+/*
+ * Only the first fragment carries the ports. The NIC hashes fragments by
+ * their addresses, so all the fragments of a packet reach the same queue,
+ * which remembers where the first one went for the others to follow it.
+ */
+struct steer_frag {
+    uint32_t sip, dip;
+    uint16_t id;
+    uint16_t owner;
+    uint8_t proto;
+};
+
+struct lb_steer {
+    uint32_t mask;
+    struct steer_entry *entries;
+
+    uint16_t nb_rxq;
+    /* rings[from * nb_rxq + to] */
+    struct rte_ring **rings;
+    /* frags[rxq * STEER_FRAG_SLOTS], with partitioned ports only. */
+    struct steer_frag *frags;
+
+    struct {
+        uint64_t redirected;
+        uint64_t received;
+        uint64_t ring_full;
+        /* Queue to drain first. */
+        uint16_t next;
+    } __rte_cache_aligned lcores[RTE_MAX_LCORE];
+};
+
+static inline uint32_t
+steer_hash(uint32_t ip) {
+    return rte_hash_crc_4byte(ip, 0);
+}
+
+/* The table is read-only once built, lookups take no lock. */
+static inline uint16_t
+steer_lookup(struct lb_steer *s, uint32_t ip) {
+    uint32_t i;
+
+    for (i = steer_hash(ip) & s->mask; s->entries[i].ip != 0;
+         i = (i + 1) & s->mask) {
+        if (s->entries[i].ip == ip)
+            return s->entries[i].rxq_id;
+    }
+    return STEER_NONE;
+}
+
+static void
+steer_insert(struct lb_steer *s, uint32_t ip, uint16_t rxq_id) {
+    uint32_t i;
+
+    for (i = steer_hash(ip) & s->mask; s->entries[i].ip != 0;
+         i = (i + 1) & s->mask) {
+        if (s->entries[i].ip == ip)
+            break;
+    }
+    s->entries[i].ip = ip;
+    s->entries[i].rxq_id = rxq_id;
+}
+
+int
+lb_steer_init(struct lb_device *dev) {
+    struct lb_steer *s;
+    struct lb_laddr_list *list;
+    char name[RTE_RING_NAMESIZE];
+    uint32_t lcore_id, nb_lips = 0, size, i;
+    uint16_t from, to;
+
+    if (dev->steer != NULL || dev->nb_rxq <= 1)
+        return 0;
+
+    s = rte_zmalloc_socket("steer", sizeof(*s), RTE_CACHE_LINE_SIZE,
+                           dev->socket_id);
+    if (s == NULL) {
+        RTE_LOG(ERR, USER1, "%s(): Not enough memory.\n", __func__);
+        return -1;
+    }
+
+    RTE_LCORE_FOREACH_SLAVE(lcore_id) {
+        nb_lips += dev->laddr_list[lcore_id].nb;
+    }
+    /* At most a quarter full. */
+    size = rte_align32pow2(nb_lips * 4);
+    s->mask = size - 1;
+    s->entries = rte_zmalloc_socket("steer-entries", sizeof(*s->entries) * size,
+                                    RTE_CACHE_LINE_SIZE, dev->socket_id);
+    s->nb_rxq = dev->nb_rxq;
+    s->rings = rte_zmalloc_socket("steer-rings",
+                                  sizeof(*s->rings) * s->nb_rxq * s->nb_rxq,
+                                  RTE_CACHE_LINE_SIZE, dev->socket_id);
+    if (s->entries == NULL || s->rings == NULL) {
+        RTE_LOG(ERR, USER1, "%s(): Not enough memory.\n", __func__);
+        goto free_steer;
+    }
+    if (dev->lport_partition) {
+        s->frags = rte_zmalloc_socket(
+            "steer-frags", sizeof(*s->frags) * STEER_FRAG_SLOTS * s->nb_rxq,
+            RTE_CACHE_LINE_SIZE, dev->socket_id);
+        if (s->frags == NULL) {
+            RTE_LOG(ERR, USER1, "%s(): Not enough memory.\n", __func__);
+            goto free_steer;
+        }
+    }
+
+    RTE_LCORE_FOREACH_SLAVE(lcore_id) {
+        list = &dev->laddr_list[lcore_id];
+        for (i = 0; i < list->nb; i++)
+            steer_insert(s, list->entries[i].ipv4,
+                         dev->lport_partition ? STEER_BY_PORT
+                                              : list->entries[i].rxq_id);
+    }
+
+    for (from = 0; from < s->nb_rxq; from++) {
+        for (to = 0; to < s->nb_rxq; to++) {
+            if (from == to)
+                continue;
+            snprintf(name, sizeof(name), "steer%u_%u_%u", dev->port_id, from,
+                     to);
+            s->rings[from * s->nb_rxq + to] =
+                rte_ring_create(name, STEER_RING_SIZE, dev->socket_id,
+                                RING_F_SP_ENQ | RING_F_SC_DEQ);
+            if (s->rings[from * s->nb_rxq + to] == NULL) {
+                RTE_LOG(ERR, USER1, "%s(): Create ring %s failed.\n", __func__,
+                        name);
+                goto free_steer;
+            }
+        }
+    }
+
+    dev->steer = s;
+    RTE_LOG(INFO, USER1,
+            "%s(): Port%u steers %u local addresses by software.\n", __func__,
+            dev->port_id, nb_lips);
+
+    return 0;
+
+free_steer:
+    if (s->rings != NULL) {
+        for (i = 0; i < (uint32_t)s->nb_rxq * s->nb_rxq; i++)
+            rte_ring_free(s->rings[i]);
+        rte_free(s->rings);
+    }
+    rte_free(s->frags);
+    rte_free(s->entries);
+    rte_free(s);
+    return -1;
+}
+
+/* Owner of the local port the packet is sent to. */
+static inline uint16_t
+steer_owner_by_port(struct lb_device *dev, struct rte_mbuf *m,
+                    struct ipv4_hdr *iph) {
+    struct tcp_hdr *th;
+    struct icmp_hdr *icmph;
+    uint32_t iphlen, len;
+
+    iphlen = (iph->version_ihl & IPV4_HDR_IHL_MASK) << 2;
+    len = rte_pktmbuf_data_len(m) - sizeof(struct ether_hdr) - iphlen;
+    th = (struct tcp_hdr *)((char *)iph + iphlen);
+
+    switch (iph->next_proto_id) {
+    case IPPROTO_TCP:
+        if (len < 4)
+            return STEER_NONE;
+        return lb_lport_to_rxq(dev, LB_IPPROTO_TCP,
+                               rte_be_to_cpu_16(th->dst_port));
+    case IPPROTO_UDP:
+        if (len < 4)
+            return STEER_NONE;
+        return lb_lport_to_rxq(dev, LB_IPPROTO_UDP,
+                               rte_be_to_cpu_16(th->dst_port));
+    case IPPROTO_ICMP:
+        /* ICMP errors quote the packet sent from the local port. */
+        icmph = (struct icmp_hdr *)th;
+        iph = (struct ipv4_hdr *)(icmph + 1);
+        if (len < sizeof(*icmph) + sizeof(*iph) + 4)
+            return STEER_NONE;
+        iphlen = (iph->version_ihl & IPV4_HDR_IHL_MASK) << 2;
+        if (len < sizeof(*icmph) + iphlen + 4)
+            return STEER_NONE;
+        th = (struct tcp_hdr *)((char *)iph + iphlen);
+        if (iph->next_proto_id == IPPROTO_TCP)
+            return lb_lport_to_rxq(dev, LB_IPPROTO_TCP,
+                                   rte_be_to_cpu_16(th->src_port));
+        if (iph->next_proto_id == IPPROTO_UDP)
+            return lb_lport_to_rxq(dev, LB_IPPROTO_UDP,
+                                   rte_be_to_cpu_16(th->src_port));
+        return STEER_NONE;
+    default:
+        return STEER_NONE;
+    }
+}
+
+static inline struct steer_frag *
+steer_frag_slot(struct lb_steer *s, uint16_t self,
+                const struct ipv4_hdr *iph) {
+    uint32_t h;
+
+    h = rte_hash_crc_4byte(iph->src_addr, iph->dst_addr);
+    h = rte_hash_crc_4byte((uint32_t)iph->packet_id << 8 | iph->next_proto_id,
+                           h);
+    return &s->frags[self * STEER_FRAG_SLOTS + (h & (STEER_FRAG_SLOTS - 1))];
+}
+
+/*
+ * Remember the owner of a first fragment to a partitioned address. The
+ * slots are overwritten, never expired.
+ */
+static inline int
+steer_frag_learn(struct lb_device *dev, struct rte_mbuf *m, uint16_t self) {
+    struct ether_hdr *eth;
+    struct ipv4_hdr *iph;
+    struct steer_frag *f;
+
+    eth = rte_pktmbuf_mtod(m, struct ether_hdr *);
+    if (eth->ether_type != rte_cpu_to_be_16(ETHER_TYPE_IPv4))
+        return 0;
+    iph = (struct ipv4_hdr *)(eth + 1);
+    if (likely(!rte_ipv4_frag_pkt_is_fragmented(iph)) ||
+        !lb_ipfrag_is_first(iph) ||
+        steer_lookup(dev->steer, iph->dst_addr) != STEER_BY_PORT)
+        return 0;
+
+    f = steer_frag_slot(dev->steer, self, iph);
+    f->sip = iph->src_addr;
+    f->dip = iph->dst_addr;
+    f->id = iph->packet_id;
+    f->proto = iph->next_proto_id;
+    f->owner = steer_owner_by_port(dev, m, iph);
+    return 1;
+}
+
+static inline uint16_t
+steer_frag_owner(struct lb_steer *s, uint16_t self,
+                 const struct ipv4_hdr *iph) {
+    struct steer_frag *f = steer_frag_slot(s, self, iph);
+
+    if (f->sip == iph->src_addr && f->dip == iph->dst_addr &&
+        f->id == iph->packet_id && f->proto == iph->next_proto_id)
+        return f->owner;
+    return STEER_NONE;
+}
+
+static inline uint16_t
+steer_owner(struct lb_device *dev, struct rte_mbuf *m, uint16_t self) {
+    struct ether_hdr *eth;
+    struct ipv4_hdr *iph;
+    uint16_t owner;
+
+    eth = rte_pktmbuf_mtod(m, struct ether_hdr *);
+    if (eth->ether_type != rte_cpu_to_be_16(ETHER_TYPE_IPv4))
+        return STEER_NONE;
+    iph = (struct ipv4_hdr *)(eth + 1);
+    owner = steer_lookup(dev->steer, iph->dst_addr);
+    if (owner != STEER_BY_PORT)
+        return owner;
+    if (lb_ipfrag_is_first(iph))
+        return steer_owner_by_port(dev, m, iph);
+    /* Without the first fragment seen, left to the local ipfrag table. */
+    return steer_frag_owner(dev->steer, self, iph);
+}
+
+/*
+ * Hand the packets to a local address of another queue over to its lcore,
+ * the others are compacted at the head of pkts. Returns their number.
+ */
+uint16_t
+lb_steer_rx(struct lb_device *dev, struct rte_mbuf **pkts, uint16_t n) {
+    struct lb_steer *s = dev->steer;
+    uint32_t lcore_id = rte_lcore_id();
+    uint16_t self = dev->lcore_conf[lcore_id].rxq_id;
+    /* Room for the fragments held for the first ones handed over. */
+    struct rte_mbuf *out[PKT_MAX_BURST * 2], *burst[PKT_MAX_BURST * 2];
+    uint16_t owner[PKT_MAX_BURST * 2];
+    uint64_t first = 0;
+    uint16_t i, j, nb_local = 0, nb_out = 0, nb_burst, nb, to, sent;
+
+    RTE_BUILD_BUG_ON(PKT_MAX_BURST > 64);
+
+    /* The first fragments are learned before the others of the burst. */
+    if (s->frags != NULL) {
+        for (i = 0; i < n; i++) {
+            if (unlikely(steer_frag_learn(dev, pkts[i], self)))
+                first |= 1ULL << i;
+        }
+    }
+
+    for (i = 0; i < n; i++) {
+        to = steer_owner(dev, pkts[i], self);
+        if (to == STEER_NONE || to == self) {
+            pkts[nb_local++] = pkts[i];
+            continue;
+        }
+        owner[nb_out] = to;
+        out[nb_out++] = pkts[i];
+        if (likely(!(first & (1ULL << i))))
+            continue;
+        /*
+         * The fragments of the packet already handled here wait in the
+         * local ipfrag table, they follow the first one.
+         */
+        nb = lb_ipfrag_take_pending(
+            rte_pktmbuf_mtod_offset(pkts[i], struct ipv4_hdr *,
+                                    ETHER_HDR_LEN),
+            out + nb_out, RTE_DIM(out) - nb_out - (n - i - 1));
+        for (j = 0; j < nb; j++)
+            owner[nb_out++] = to;
+    }
+
+    /* One burst per destination queue. */
+    while (nb_out > 0) {
+        to = owner[0];
+        nb_burst = 0;
+        for (i = 0, j = 0; i < nb_out; i++) {
+            if (owner[i] == to) {
+                burst[nb_burst++] = out[i];
+            } else {
+                owner[j] = owner[i];
+                out[j++] = out[i];
+            }
+        }
+        nb_out = j;
+
+        sent = rte_ring_sp_enqueue_burst(s->rings[self * s->nb_rxq + to],
+                                         (void **)burst, nb_burst, NULL);
+        s->lcores[lcore_id].redirected += sent;
+        if (unlikely(sent < nb_burst)) {
+            s->lcores[lcore_id].ring_full += nb_burst - sent;
+            dev->lcore_stats[lcore_id].rx_dropped += nb_burst - sent;
+            for (i = sent; i < nb_burst; i++)
+                lb_drop(burst[i], LB_DROP_RING_FULL);
+        }
+    }
+
+    return nb_local;
+}
+
+/* Take up to n packets handed over by the other queues. */
+uint16_t
+lb_steer_drain(struct lb_device *dev, struct rte_mbuf **pkts, uint16_t n) {
+    struct lb_steer *s = dev->steer;
+    uint32_t lcore_id = rte_lcore_id();
+    uint16_t self = dev->lcore_conf[lcore_id].rxq_id;
+    uint16_t from, i, nb = 0;
+
+    /* Start from a different queue every time to share the budget. */
+    from = s->lcores[lcore_id].next;
+    for (i = 0; i < s->nb_rxq && nb < n; i++) {
+        if (++from >= s->nb_rxq)
+            from = 0;
+        if (from == self)
+            continue;
+        nb += rte_ring_sc_dequeue_burst(s->rings[from * s->nb_rxq + self],
+                                        (void **)pkts + nb, n - nb, NULL);
+    }
+    s->lcores[lcore_id].next = from;
+    s->lcores[lcore_id].received += nb;
+
+    return nb;
+}
+
+static void
+steer_stats_cmd_cb(int fd, char *argv[], int argc) {
+    uint16_t devid;
+    struct lb_device *dev;
+    struct lb_steer *s;
+    uint32_t lcore_id;
+    int json_fmt = 0, json_first_obj = 1;
+
+    if (argc > 0) {
+        if (strcmp(argv[0], "--json") != 0) {
+            unixctl_command_reply_error(fd, "Invalid parameter: %s.\n",
+                                        argv[0]);
+            return;
+        }
+        json_fmt = 1;
+    }
+
+    if (json_fmt)
+        unixctl_command_reply(fd, "[");
+    LB_DEVICE_FOREACH(devid, dev) {
+        s = dev->steer;
+        if (s == NULL)
+            continue;
+        RTE_LCORE_FOREACH_SLAVE(lcore_id) {
+            if (!dev->lcore_conf[lcore_id].rxq_enable)
+                continue;
+            if (json_fmt) {
+                unixctl_command_reply(fd, json_first_obj ? "{" : ",{");
+                json_first_obj = 0;
+                unixctl_command_reply(fd, JSON_KV_S_FMT("dev", ","),
+                                      dev->name);
+                unixctl_command_reply(fd, JSON_KV_32_FMT("lcore", ","),
+                                      lcore_id);
+                unixctl_command_reply(fd, JSON_KV_64_FMT("redirected", ","),
+                                      s->lcores[lcore_id].redirected);
+                unixctl_command_reply(fd, JSON_KV_64_FMT("received", ","),
+                                      s->lcores[lcore_id].received);
+                unixctl_command_reply(fd, JSON_KV_64_FMT("ring_full", "}"),
+                                      s->lcores[lcore_id].ring_full);
+            } else {
+                unixctl_command_reply(
+                    fd,
+                    "%s lcore%u: redirected %" PRIu64 ", received %" PRIu64
+                    ", ring_full %" PRIu64 "\n",
+                    dev->name, lcore_id, s->lcores[lcore_id].redirected,
+                    s->lcores[lcore_id].received,
+                    s->lcores[lcore_id].ring_full);
+            }
+        }
+    }
+    if (json_fmt)
+        unixctl_command_reply(fd, "]\n");
+}
+
+UNIXCTL_CMD_REGISTER("steer/stats", "[--json].",
+                     "Show software flow steering statistics.", 0, 1,
+                     steer_stats_cmd_cb);
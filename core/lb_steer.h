@@ -0,0 +1,16 @@
+/* Copyright (c) 2018. TIG developer. */
+
+#ifndef __LB_STEER_H__
+#define __LB_STEER_H__
+
+#include <rte_mbuf.h>
+
+struct lb_device;
+
+int lb_steer_init(struct lb_device *dev);
+uint16_t lb_steer_rx(struct lb_device *dev, struct rte_mbuf **pkts,
+                     uint16_t n);
+uint16_t lb_steer_drain(struct lb_device *dev, struct rte_mbuf **pkts,
+                        uint16_t n);
+
+#endif
@@ -4,12 +4,15 @@
 #include <rte_random.h>
 
 #include "lb_conn.h"
+#include "lb_drop.h"
+#include "lb_mbuf.h"
 #include "lb_md5.h"
 #include "lb_proto.h"
 #include "lb_service.h"
 #include "lb_synproxy.h"
 #include "lb_tcp_secret_seq.h"
 #include "lb_toa.h"
+#include "lb_trace.h"
 
 // #define SYNPROXY_DEBUG
 #ifdef SYNPROXY_DEBUG
@@ -119,6 +122,7 @@ synproxy_cookie_ipv4_init_sequence(struct ipv4_hdr *iph, struct tcp_hdr *th,
     int mssid;
     const uint16_t mss = opts->mss_clamp;
     uint32_t data = 0;
+    uint32_t cookie;
 
     for (mssid = RTE_DIM(msstab) - 1; mssid; mssid--)
         if (mss >= msstab[mssid])
@@ -129,9 +133,12 @@ synproxy_cookie_ipv4_init_sequence(struct ipv4_hdr *iph, struct tcp_hdr *th,
     data |= opts->tstamp_ok << LB_SYNPROXY_TSOK_BIT;
     data |= ((opts->snd_wscale & 0x0f) << LB_SYNPROXY_SND_WSCALE_BITS);
 
-    return secure_tcp_syn_cookie(iph->src_addr, iph->dst_addr, th->src_port,
-                                 th->dst_port, rte_be_to_cpu_32(th->sent_seq),
-                                 tcp_cookie_time(), data);
+    cookie = secure_tcp_syn_cookie(iph->src_addr, iph->dst_addr, th->src_port,
+                                   th->dst_port, rte_be_to_cpu_32(th->sent_seq),
+                                   tcp_cookie_time(), data);
+    LB_TRACE(synproxy_cookie, iph->src_addr, th->src_port, iph->dst_addr,
+             th->dst_port, cookie);
+    return cookie;
 }
 
 uint32_t
@@ -147,6 +154,8 @@ synproxy_cookie_ipv4_check(struct ipv4_hdr *iph, struct tcp_hdr *th,
     rc = check_tcp_syn_cookie(cookie, iph->src_addr, iph->dst_addr,
                               th->src_port, th->dst_port, sseq,
                               tcp_cookie_time(), COUNTER_TRIES);
+    LB_TRACE(synproxy_cookie_check, iph->src_addr, th->src_port,
+             iph->dst_addr, th->dst_port, cookie, rc != (uint32_t)-1);
     if (rc == (uint32_t)-1)
         return 0;
 
@@ -283,6 +292,7 @@ synproxy_sent_client_synack(struct rte_mbuf *m, struct ipv4_hdr *iph,
     synproxy_parse_set_options(th, &opts);
     isn = synproxy_cookie_ipv4_init_sequence(iph, th, &opts);
 
+    lb_pktmbuf_trim_segs(m);
     pkt_len = m->data_len;
     rte_pktmbuf_reset(m);
     m->pkt_len = m->data_len = pkt_len;
@@ -316,11 +326,13 @@ synproxy_recv_client_syn(struct rte_mbuf *m, struct ipv4_hdr *iph,
     if (SYN(th) && !ACK(th) && !RST(th) && !FIN(th) &&
         (vs = lb_vs_get(iph->dst_addr, th->dst_port, iph->next_proto_id)) &&
         (vs->flags & LB_VS_F_SYNPROXY)) {
-        if (lb_vs_check_max_conn(vs))
+        if (lb_vs_check_max_conn(vs)) {
             /* Reject connect. */
-            rte_pktmbuf_free(m);
-        else
+            lb_vs_drop(vs, LB_DIR_ORIGINAL);
+            lb_drop(m, LB_DROP_MAX_CONNS);
+        } else {
             synproxy_sent_client_synack(m, iph, th, dev);
+        }
         lb_vs_put(vs);
         return 0;
     } else {
@@ -367,6 +379,7 @@ synproxy_sent_backend_syn(struct rte_mbuf *m, struct ipv4_hdr *iph,
                         rte_be_to_cpu_32(th->sent_seq) - 1, &conn->tseq);
     win = th->rx_win;
     tcphdr_size = sizeof(struct tcp_hdr) + synproxy_options_size(opts);
+    lb_pktmbuf_trim_segs(m);
     rte_pktmbuf_reset(m);
     m->pkt_len = m->data_len =
         ETHER_HDR_LEN + sizeof(struct ipv4_hdr) + tcphdr_size;
@@ -411,16 +424,24 @@ synproxy_recv_client_ack(struct rte_mbuf *m, struct ipv4_hdr *iph,
     if (!SYN(th) && ACK(th) && !RST(th) && !FIN(th) &&
         (vs = lb_vs_get(iph->dst_addr, th->dst_port, iph->next_proto_id)) &&
         (vs->flags & LB_VS_F_SYNPROXY)) {
-        if (synproxy_cookie_ipv4_check(iph, th, &opts) &&
-            (rs = lb_vs_get_rs(vs, iph->src_addr, th->src_port)) &&
-            (conn = lb_conn_new(ct, iph->src_addr, th->src_port, rs, 1, dev))) {
+        if (!synproxy_cookie_ipv4_check(iph, th, &opts)) {
+            lb_vs_drop(vs, LB_DIR_ORIGINAL);
+            lb_drop(m, LB_DROP_SYNPROXY);
+        } else if ((rs = lb_vs_get_rs(vs, iph->src_addr, th->src_port)) ==
+                   NULL) {
+            lb_vs_drop(vs, LB_DIR_ORIGINAL);
+            lb_drop(m, LB_DROP_NO_RS);
+        } else if ((conn = lb_conn_new(ct, iph->src_addr, th->src_port, rs,
+                                       LB_CONN_F_SYNPROXY, dev)) == NULL) {
+            /* The reason is counted by lb_conn_new(). */
+            lb_vs_drop(vs, LB_DIR_ORIGINAL);
+            rte_pktmbuf_free(m);
+        } else {
             tcp_conn_set_state(conn, TCP_CONNTRACK_SYN_SENT);
 
             conn->proxy.isn = rte_be_to_cpu_32(th->recv_ack) - 1;
 
             synproxy_sent_backend_syn(m, iph, th, conn, &opts, dev);
-        } else {
-            rte_pktmbuf_free(m);
         }
 
         lb_vs_put(vs);
@@ -453,7 +474,7 @@ synproxy_sent_ack_to_backend(struct rte_mbuf *m, struct lb_conn *conn,
     iph->hdr_checksum = 0;
     iph->hdr_checksum = rte_ipv4_cksum(iph);
     th->cksum = 0;
-    th->cksum = rte_ipv4_udptcp_cksum(iph, th);
+    th->cksum = lb_ipv4_udptcp_cksum_mbuf(m, iph, th);
 
     lb_device_output(m, iph, dev);
 }
@@ -471,7 +492,7 @@ synproxy_fwd_synack_to_client(struct rte_mbuf *m, struct ipv4_hdr *iph,
     iph->hdr_checksum = 0;
     iph->hdr_checksum = rte_ipv4_cksum(iph);
     th->cksum = 0;
-    th->cksum = rte_ipv4_udptcp_cksum(iph, th);
+    th->cksum = lb_ipv4_udptcp_cksum_mbuf(m, iph, th);
 
     lb_device_output(m, iph, dev);
 }
@@ -490,7 +511,7 @@ synproxy_fwd_rst_to_client(struct rte_mbuf *m, struct ipv4_hdr *iph,
     iph->hdr_checksum = 0;
     iph->hdr_checksum = rte_ipv4_cksum(iph);
     th->cksum = 0;
-    th->cksum = rte_ipv4_udptcp_cksum(iph, th);
+    th->cksum = lb_ipv4_udptcp_cksum_mbuf(m, iph, th);
 
     lb_device_output(m, iph, dev);
 }
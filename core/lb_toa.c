@@ -1,5 +1,7 @@
 /* Copyright (c) 2018. TIG developer. */
 
+#include <string.h>
+
 #include <rte_ip.h>
 #include <rte_mbuf.h>
 #include <rte_tcp.h>
@@ -16,23 +18,31 @@ struct tcp_opt_toa {
     uint32_t addr;
 } __attribute__((__packed__));
 
+/*
+ * The option is inserted after the TCP header, the payload of the first
+ * segment is shifted into its tailroom. The following segments are left
+ * untouched, so the packet is sent without TOA when the first one is full.
+ */
 void
 tcp_opt_add_toa(struct rte_mbuf *m, struct ipv4_hdr *iph, struct tcp_hdr *th,
                 uint32_t sip, uint16_t sport) {
     struct tcp_opt_toa *toa;
-    uint8_t *p, *q;
+    uint8_t *p;
+    uint32_t off;
 
     /* tcp header max length */
     if ((60 - (th->data_off >> 2)) < (int)sizeof(struct tcp_opt_toa))
         return;
-    p = (uint8_t *)rte_pktmbuf_append(m, sizeof(struct tcp_opt_toa));
-    q = p + sizeof(struct tcp_opt_toa);
-    while (p >= ((uint8_t *)th + (th->data_off >> 2))) {
-        *q = *p;
-        q--;
-        p--;
-    }
-    toa = (struct tcp_opt_toa *)((uint8_t *)th + (th->data_off >> 2));
+    if (rte_pktmbuf_tailroom(m) < sizeof(struct tcp_opt_toa))
+        return;
+
+    p = (uint8_t *)th + (th->data_off >> 2);
+    off = p - rte_pktmbuf_mtod(m, uint8_t *);
+    memmove(p + sizeof(struct tcp_opt_toa), p, m->data_len - off);
+    m->data_len += sizeof(struct tcp_opt_toa);
+    m->pkt_len += sizeof(struct tcp_opt_toa);
+
+    toa = (struct tcp_opt_toa *)p;
     toa->optcode = TCPOPT_ADDR;
     toa->optsize = TCPOLEN_ADDR;
     toa->port = sport;
@@ -41,4 +51,3 @@ tcp_opt_add_toa(struct rte_mbuf *m, struct ipv4_hdr *iph, struct tcp_hdr *th,
     iph->total_length = rte_cpu_to_be_16(rte_be_to_cpu_16(iph->total_length) +
                                          sizeof(struct tcp_opt_toa));
 }
-
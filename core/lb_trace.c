@@ -0,0 +1,17 @@
+/* Copyright (c) 2018. TIG developer. */
+
+#include "lb_trace.h"
+
+#ifdef LB_USDT
+
+/*
+ * The semaphores are found through the notes of the probes, in the
+ * section the tracers expect, and raised while they are attached.
+ */
+#define LB_TRACE_SEMAPHORE_DEFINE(name)                                        \
+    volatile unsigned short LB_TRACE_SEMAPHORE(name)                           \
+        __attribute__((section(".probes")));
+
+LB_TRACE_PROBES(LB_TRACE_SEMAPHORE_DEFINE)
+
+#endif
@@ -0,0 +1,68 @@
+/* Copyright (c) 2018. TIG developer. */
+
+#ifndef __LB_TRACE_H__
+#define __LB_TRACE_H__
+
+/*
+ * Static probes of the provider "jupiter", built in when sys/sdt.h is
+ * found. A probe is a nop until a tracer such as bpftrace or perf
+ * attaches to it, its arguments are only computed while the tracer holds
+ * its semaphore. Addresses and ports are in network order.
+ *
+ *   conn_new(conn, proto, cip, cport, vip, vport, lip, lport, rip, rport)
+ *   conn_new6(conn, proto, cip6, cport, vip6, vport, lip, lport, rip,
+ *             rport), NAT64, cip6 and vip6 point to 16 bytes
+ *   conn_expire(conn, proto, cip, cport, vip, vport, lifetime_ms), cip and
+ *   vip are 0 for NAT64
+ *   sched_dispatch(vs, rs, cip, cport, rip, rport)
+ *   synproxy_cookie(saddr, sport, daddr, dport, cookie)
+ *   synproxy_cookie_check(saddr, sport, daddr, dport, cookie, ok)
+ *   arp_miss(ip, port_id)
+ *   tcp_state(conn, cip, cport, old_state, new_state)
+ *   drop(reason, data, data_len), data is NULL for a packet not freed
+ *   here
+ */
+#define LB_TRACE_PROBES(X)                                                     \
+    X(conn_new)                                                                \
+    X(conn_new6)                                                               \
+    X(conn_expire)                                                             \
+    X(sched_dispatch)                                                          \
+    X(synproxy_cookie)                                                         \
+    X(synproxy_cookie_check)                                                   \
+    X(arp_miss)                                                                \
+    X(tcp_state)                                                               \
+    X(drop)
+
+#ifdef LB_USDT
+
+#include <rte_branch_prediction.h>
+
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+/* Counts the tracers attached to the probe, defined in lb_trace.c. */
+#define LB_TRACE_SEMAPHORE(name) jupiter_##name##_semaphore
+#define LB_TRACE_SEMAPHORE_DECLARE(name)                                       \
+    extern volatile unsigned short LB_TRACE_SEMAPHORE(name);
+
+LB_TRACE_PROBES(LB_TRACE_SEMAPHORE_DECLARE)
+
+#define LB_TRACE_ENABLED(name) unlikely(LB_TRACE_SEMAPHORE(name) != 0)
+
+#define LB_TRACE(name, ...)                                                    \
+    do {                                                                       \
+        if (LB_TRACE_ENABLED(name))                                            \
+            STAP_PROBEV(jupiter, name, ##__VA_ARGS__);                         \
+    } while (0)
+
+#else
+
+#define LB_TRACE_ENABLED(name) 0
+
+#define LB_TRACE(name, ...)                                                    \
+    do {                                                                       \
+    } while (0)
+
+#endif
+
+#endif
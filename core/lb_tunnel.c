@@ -0,0 +1,217 @@
+/* Copyright (c) 2018. TIG developer. */
+
+#include <rte_ether.h>
+#include <rte_hash_crc.h>
+#include <rte_ip.h>
+#include <rte_ip_frag.h>
+#include <rte_mbuf.h>
+#include <rte_tcp.h>
+#include <rte_udp.h>
+
+#include <unixctl_command.h>
+
+#include "lb_device.h"
+#include "lb_drop.h"
+#include "lb_format.h"
+#include "lb_mbuf.h"
+#include "lb_proto.h"
+#include "lb_proto_icmp.h"
+#include "lb_tunnel.h"
+
+/* GUE variant 0 header without optional fields. */
+struct gue_hdr {
+    uint8_t hlen_c_ver; /* |ver(2)|C(1)|hlen(5)| */
+    uint8_t proto;
+    uint16_t flags;
+} __attribute__((__packed__));
+
+#define TUNNEL_IPIP_HLEN (sizeof(struct ipv4_hdr))
+#define TUNNEL_GUE_HLEN                                                        \
+    (sizeof(struct ipv4_hdr) + sizeof(struct udp_hdr) + sizeof(struct gue_hdr))
+
+static struct {
+    uint64_t encaps;
+    uint64_t frag_needed;
+    uint64_t too_big;
+    uint64_t no_headroom;
+} __rte_cache_aligned tunnel_stats[RTE_MAX_LCORE];
+
+static void
+tunnel_tcp_mss_clamp(struct rte_mbuf *m, struct ipv4_hdr *iph,
+                     uint16_t mss) {
+    struct tcp_hdr *th;
+    uint8_t *ptr;
+    int len;
+
+    th = TCP_HDR(iph);
+    if (!SYN(th))
+        return;
+
+    ptr = (uint8_t *)(th + 1);
+    len = (th->data_off >> 2) - sizeof(struct tcp_hdr);
+    while (len > 0) {
+        int opcode = *ptr++;
+        int opsize;
+
+        switch (opcode) {
+        case TCPOPT_EOL:
+            return;
+        case TCPOPT_NOP:
+            len--;
+            continue;
+        default:
+            opsize = *ptr++;
+            if (opsize < 2)
+                return;
+            if (opsize > len)
+                return;
+            if ((opcode == TCPOPT_MSS) && (opsize == TCPOLEN_MSS)) {
+                if (((ptr[0] << 8) | ptr[1]) > mss) {
+                    ptr[0] = mss >> 8;
+                    ptr[1] = mss & 0xff;
+                    th->cksum = 0;
+                    th->cksum = lb_ipv4_udptcp_cksum_mbuf(m, iph, th);
+                }
+                return;
+            }
+            ptr += opsize - 2;
+            len -= opsize;
+        }
+    }
+}
+
+/* Spread the flows over the receive queues of the real service. */
+static uint16_t
+tunnel_gue_src_port(struct ipv4_hdr *iph) {
+    uint32_t hash;
+
+    hash = rte_hash_crc_4byte(iph->src_addr, iph->dst_addr);
+    if (!rte_ipv4_frag_pkt_is_fragmented(iph) &&
+        (iph->next_proto_id == IPPROTO_TCP ||
+         iph->next_proto_id == IPPROTO_UDP)) {
+        hash = rte_hash_crc_4byte(
+            *(uint32_t *)((char *)iph + IPv4_HLEN(iph)), hash);
+    }
+    return rte_cpu_to_be_16((hash & 0x3fff) | 0xc000);
+}
+
+int
+lb_tunnel_xmit(struct rte_mbuf *m, struct ipv4_hdr *iph, uint32_t rip,
+               uint8_t type, struct lb_device *dev) {
+    uint32_t cid = rte_lcore_id();
+    struct ipv4_hdr *oiph;
+    struct udp_hdr *uh;
+    struct gue_hdr *gueh;
+    uint16_t hlen, len;
+
+    hlen = type == LB_TUNNEL_GUE ? TUNNEL_GUE_HLEN : TUNNEL_IPIP_HLEN;
+    len = rte_be_to_cpu_16(iph->total_length);
+
+    if (iph->next_proto_id == IPPROTO_TCP &&
+        !rte_ipv4_frag_pkt_is_fragmented(iph)) {
+        tunnel_tcp_mss_clamp(m, iph,
+                             dev->mtu - hlen - sizeof(struct ipv4_hdr) -
+                                 sizeof(struct tcp_hdr));
+    }
+
+    if (len + hlen > dev->mtu) {
+        if (iph->fragment_offset & rte_cpu_to_be_16(IPV4_HDR_DF_FLAG)) {
+            lb_icmp_send_frag_needed(iph, dev->mtu - hlen, dev);
+            tunnel_stats[cid].frag_needed++;
+        } else {
+            tunnel_stats[cid].too_big++;
+        }
+        lb_drop(m, LB_DROP_TOO_BIG);
+        return -1;
+    }
+
+    if (rte_pktmbuf_prepend(m, hlen) == NULL) {
+        tunnel_stats[cid].no_headroom++;
+        lb_drop(m, LB_DROP_NO_HEADROOM);
+        return -1;
+    }
+
+    oiph = rte_pktmbuf_mtod_offset(m, struct ipv4_hdr *, ETHER_HDR_LEN);
+    oiph->version_ihl = 0x45;
+    oiph->type_of_service = iph->type_of_service;
+    oiph->total_length = rte_cpu_to_be_16(len + hlen);
+    oiph->packet_id = iph->packet_id;
+    oiph->fragment_offset =
+        iph->fragment_offset & rte_cpu_to_be_16(IPV4_HDR_DF_FLAG);
+    oiph->time_to_live = 64;
+    oiph->src_addr = dev->ipv4;
+    oiph->dst_addr = rip;
+
+    if (type == LB_TUNNEL_GUE) {
+        oiph->next_proto_id = IPPROTO_UDP;
+        uh = (struct udp_hdr *)(oiph + 1);
+        uh->src_port = tunnel_gue_src_port(iph);
+        uh->dst_port = dev->gue_port;
+        uh->dgram_len = rte_cpu_to_be_16(len + hlen - sizeof(struct ipv4_hdr));
+        uh->dgram_cksum = 0;
+        gueh = (struct gue_hdr *)(uh + 1);
+        gueh->hlen_c_ver = 0;
+        gueh->proto = IPPROTO_IPIP;
+        gueh->flags = 0;
+    } else {
+        oiph->next_proto_id = IPPROTO_IPIP;
+    }
+
+    oiph->hdr_checksum = 0;
+    if (dev->tx_offload & DEV_TX_OFFLOAD_IPV4_CKSUM) {
+        m->l2_len = ETHER_HDR_LEN;
+        m->l3_len = sizeof(struct ipv4_hdr);
+        m->ol_flags |= PKT_TX_IPV4 | PKT_TX_IP_CKSUM;
+    } else {
+        oiph->hdr_checksum = rte_ipv4_cksum(oiph);
+    }
+
+    tunnel_stats[cid].encaps++;
+
+    return lb_device_output(m, oiph, dev);
+}
+
+static void
+tunnel_stats_cmd_cb(int fd, char *argv[], int argc) {
+    uint64_t encaps = 0, frag_needed = 0, too_big = 0, no_headroom = 0;
+    uint32_t lcore_id;
+    int json_fmt = 0;
+
+    if (argc > 0) {
+        if (strcmp(argv[0], "--json") != 0) {
+            unixctl_command_reply_error(fd, "Invalid parameter: %s.\n",
+                                        argv[0]);
+            return;
+        }
+        json_fmt = 1;
+    }
+
+    RTE_LCORE_FOREACH_SLAVE(lcore_id) {
+        encaps += tunnel_stats[lcore_id].encaps;
+        frag_needed += tunnel_stats[lcore_id].frag_needed;
+        too_big += tunnel_stats[lcore_id].too_big;
+        no_headroom += tunnel_stats[lcore_id].no_headroom;
+    }
+
+    if (json_fmt) {
+        unixctl_command_reply(fd, "{");
+        unixctl_command_reply(fd, JSON_KV_64_FMT("encaps", ","), encaps);
+        unixctl_command_reply(fd, JSON_KV_64_FMT("frag_needed", ","),
+                              frag_needed);
+        unixctl_command_reply(fd, JSON_KV_64_FMT("too_big", ","), too_big);
+        unixctl_command_reply(fd, JSON_KV_64_FMT("no_headroom", ""),
+                              no_headroom);
+        unixctl_command_reply(fd, "}\n");
+    } else {
+        unixctl_command_reply(fd, NORM_KV_64_FMT("encaps", "\n"), encaps);
+        unixctl_command_reply(fd, NORM_KV_64_FMT("frag_needed", "\n"),
+                              frag_needed);
+        unixctl_command_reply(fd, NORM_KV_64_FMT("too_big", "\n"), too_big);
+        unixctl_command_reply(fd, NORM_KV_64_FMT("no_headroom", "\n"),
+                              no_headroom);
+    }
+}
+
+UNIXCTL_CMD_REGISTER("tunnel/stats", "[--json].",
+                     "Show IPIP/GUE encapsulation statistics.", 0, 1,
+                     tunnel_stats_cmd_cb);
@@ -0,0 +1,21 @@
+/* Copyright (c) 2018. TIG developer. */
+
+#ifndef __LB_TUNNEL_H__
+#define __LB_TUNNEL_H__
+
+#include <rte_ip.h>
+#include <rte_mbuf.h>
+
+#define LB_GUE_DEFAULT_PORT (6080)
+
+enum {
+    LB_TUNNEL_IPIP,
+    LB_TUNNEL_GUE,
+};
+
+struct lb_device;
+
+int lb_tunnel_xmit(struct rte_mbuf *m, struct ipv4_hdr *iph, uint32_t rip,
+                   uint8_t type, struct lb_device *dev);
+
+#endif
@@ -0,0 +1,272 @@
+/* Copyright (c) 2018. TIG developer. */
+
+#include <execinfo.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <rte_common.h>
+#include <rte_cycles.h>
+#include <rte_lcore.h>
+#include <rte_log.h>
+#include <rte_timer.h>
+
+#include <unixctl_command.h>
+
+#include "lb_clock.h"
+#include "lb_config.h"
+#include "lb_format.h"
+#include "lb_watchdog.h"
+
+/*
+ * The master checks the heartbeat of each worker WATCHDOG_CHECKS times
+ * per stall_ms. A worker whose heartbeat has not moved for stall_ms is
+ * reported once with the step of the loop it is in, then again when it
+ * turns again. With backtrace set, the stalled worker is signalled to
+ * write its own stack to stderr.
+ */
+#define WATCHDOG_DEFAULT_STALL_MS 200
+#define WATCHDOG_CHECKS 4
+#define WATCHDOG_SIGNAL SIGUSR2
+#define WATCHDOG_BACKTRACE_SIZE 64
+
+static uint32_t watchdog_stall_ms = WATCHDOG_DEFAULT_STALL_MS;
+static uint64_t watchdog_stall_cycles;
+static uint32_t watchdog_backtrace;
+static struct rte_timer watchdog_timer;
+
+struct lb_watchdog_lcore lb_watchdog_lcores[RTE_MAX_LCORE];
+
+static const char *watchdog_where_names[] = {
+    [LB_WD_W_FLUSH] = "tx_flush",
+    [LB_WD_W_RX] = "rx",
+    [LB_WD_W_HANDLE] = "handle",
+    [LB_WD_W_DRAIN] = "steer_drain",
+    [LB_WD_W_IDLE] = "idle",
+    [LB_WD_W_TIMERS] = "timers",
+};
+
+/*
+ * Only async-signal-safe calls, the worker may be stopped anywhere, even
+ * in the logging or malloc locks. backtrace() is primed at init.
+ */
+static void
+watchdog_signal_handler(__attribute__((unused)) int signum) {
+    static const char head[] = "watchdog: stack of stalled lcore";
+    void *frames[WATCHDOG_BACKTRACE_SIZE];
+    char id[16];
+    uint32_t lcore_id = rte_lcore_id();
+    int i = sizeof(id), n;
+
+    id[--i] = '\n';
+    id[--i] = ':';
+    do {
+        id[--i] = '0' + lcore_id % 10;
+        lcore_id /= 10;
+    } while (lcore_id != 0);
+    if (write(STDERR_FILENO, head, sizeof(head) - 1) < 0 ||
+        write(STDERR_FILENO, id + i, sizeof(id) - i) < 0)
+        return;
+
+    n = backtrace(frames, RTE_DIM(frames));
+    backtrace_symbols_fd(frames, n, STDERR_FILENO);
+}
+
+static void
+watchdog_stall_report(uint32_t lcore_id, struct lb_watchdog_lcore *wl,
+                      uint64_t now) {
+    uint64_t hz = rte_get_timer_hz();
+
+    RTE_LOG(WARNING, USER1,
+            "%s(): lcore%u stalled for %" PRIu64 "ms in %s, round started "
+            "%" PRIu64 "ms ago, heartbeat %" PRIu64 ".\n",
+            __func__, lcore_id, (now - wl->wd.heartbeat_tsc) * MS_PER_S / hz,
+            watchdog_where_names[wl->where],
+            (now - wl->round_tsc) * MS_PER_S / hz, wl->wd.heartbeat);
+    if (watchdog_backtrace)
+        pthread_kill(lcore_config[lcore_id].thread_id, WATCHDOG_SIGNAL);
+}
+
+static void
+watchdog_check(struct lb_watchdog_lcore *wl, uint32_t lcore_id, uint64_t now) {
+    uint64_t heartbeat = wl->heartbeat;
+    uint64_t busy = wl->busy_cycles;
+    uint64_t idle = wl->idle_cycles;
+    uint64_t delta;
+
+    delta = (busy - wl->wd.busy_cycles) + (idle - wl->wd.idle_cycles);
+    if (delta != 0)
+        wl->wd.util = (busy - wl->wd.busy_cycles) * 100 / delta;
+    wl->wd.busy_cycles = busy;
+    wl->wd.idle_cycles = idle;
+
+    if (heartbeat != wl->wd.heartbeat) {
+        if (wl->wd.stalled) {
+            RTE_LOG(WARNING, USER1,
+                    "%s(): lcore%u recovered after %" PRIu64 "ms.\n",
+                    __func__, lcore_id,
+                    (now - wl->wd.heartbeat_tsc) * MS_PER_S /
+                        rte_get_timer_hz());
+            wl->wd.stalled = 0;
+        }
+        wl->wd.heartbeat = heartbeat;
+        wl->wd.heartbeat_tsc = now;
+        return;
+    }
+
+    delta = now - wl->wd.heartbeat_tsc;
+    if (delta < watchdog_stall_cycles)
+        return;
+    if (delta > wl->wd.stall_max)
+        wl->wd.stall_max = delta;
+    if (!wl->wd.stalled) {
+        wl->wd.stalled = 1;
+        wl->wd.stalls++;
+        watchdog_stall_report(lcore_id, wl, now);
+    }
+}
+
+static void
+watchdog_timer_cb(__attribute__((unused)) struct rte_timer *t,
+                  __attribute__((unused)) void *arg) {
+    uint64_t now = rte_rdtsc();
+    uint32_t lcore_id;
+
+    RTE_LCORE_FOREACH_SLAVE(lcore_id) {
+        if (lb_watchdog_lcores[lcore_id].enabled)
+            watchdog_check(&lb_watchdog_lcores[lcore_id], lcore_id, now);
+    }
+}
+
+/* Called by the worker itself, the signal is sent to its thread. */
+void
+lb_watchdog_lcore_init(uint32_t lcore_id) {
+    struct lb_watchdog_lcore *wl = &lb_watchdog_lcores[lcore_id];
+
+    wl->round_tsc = rte_rdtsc();
+    wl->enabled = 1;
+}
+
+int
+lb_watchdog_init(void) {
+    struct lb_watchdog_conf *conf = &lb_cfg->watchdog;
+    struct sigaction sa;
+    uint32_t period_ms;
+
+    if (conf->stall_ms != 0)
+        watchdog_stall_ms = conf->stall_ms;
+    watchdog_backtrace = conf->backtrace;
+    watchdog_stall_cycles = MS_TO_CYCLES(watchdog_stall_ms);
+
+    if (watchdog_backtrace) {
+        void *frame;
+
+        /* The first call may load libgcc, not in the handler. */
+        backtrace(&frame, 1);
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = watchdog_signal_handler;
+        sigemptyset(&sa.sa_mask);
+        if (sigaction(WATCHDOG_SIGNAL, &sa, NULL) < 0) {
+            RTE_LOG(ERR, USER1, "%s(): sigaction failed.\n", __func__);
+            return -1;
+        }
+    }
+
+    /* A zero period would run the check on every master loop. */
+    period_ms = RTE_MAX(watchdog_stall_ms / WATCHDOG_CHECKS, 1u);
+    rte_timer_init(&watchdog_timer);
+    return rte_timer_reset(&watchdog_timer, MS_TO_CYCLES(period_ms),
+                           PERIODICAL, rte_get_master_lcore(),
+                           watchdog_timer_cb, NULL);
+}
+
+static void
+lcore_stats_cmd_cb(int fd, char *argv[], int argc) {
+    struct lb_watchdog_lcore *wl;
+    uint64_t hz = rte_get_timer_hz();
+    uint64_t total;
+    uint32_t lcore_id, busy;
+    int json_fmt = 0, json_first_obj = 1;
+
+    if (argc > 0) {
+        if (strcmp(argv[0], "--json") != 0) {
+            unixctl_command_reply_error(fd, "Invalid parameter: %s.\n",
+                                        argv[0]);
+            return;
+        }
+        json_fmt = 1;
+    }
+
+    if (json_fmt)
+        unixctl_command_reply(fd, "[");
+    RTE_LCORE_FOREACH_SLAVE(lcore_id) {
+        wl = &lb_watchdog_lcores[lcore_id];
+        if (!wl->enabled)
+            continue;
+        total = wl->busy_cycles + wl->idle_cycles;
+        busy = total != 0 ? wl->busy_cycles * 100 / total : 0;
+        if (json_fmt) {
+            unixctl_command_reply(fd, json_first_obj ? "{" : ",{");
+            json_first_obj = 0;
+            unixctl_command_reply(fd, JSON_KV_32_FMT("lcore", ","), lcore_id);
+            unixctl_command_reply(fd, JSON_KV_64_FMT("busy_rounds", ","),
+                                  wl->busy_rounds);
+            unixctl_command_reply(fd, JSON_KV_64_FMT("idle_rounds", ","),
+                                  wl->idle_rounds);
+            unixctl_command_reply(fd, JSON_KV_64_FMT("busy_cycles", ","),
+                                  wl->busy_cycles);
+            unixctl_command_reply(fd, JSON_KV_64_FMT("idle_cycles", ","),
+                                  wl->idle_cycles);
+            unixctl_command_reply(fd, JSON_KV_32_FMT("busy", ","), busy);
+            unixctl_command_reply(fd, JSON_KV_32_FMT("util", ","),
+                                  wl->wd.util);
+            unixctl_command_reply(fd, JSON_KV_64_FMT("round_max_us", ","),
+                                  wl->round_max * US_PER_S / hz);
+            unixctl_command_reply(fd, JSON_KV_64_FMT("heartbeat", ","),
+                                  wl->heartbeat);
+            unixctl_command_reply(fd, JSON_KV_32_FMT("stalled", ","),
+                                  wl->wd.stalled);
+            unixctl_command_reply(fd, JSON_KV_64_FMT("stalls", ","),
+                                  wl->wd.stalls);
+            unixctl_command_reply(fd, JSON_KV_64_FMT("stall_max_ms", ","),
+                                  wl->wd.stall_max * MS_PER_S / hz);
+            unixctl_command_reply(fd, JSON_KV_S_FMT("where", "}"),
+                                  watchdog_where_names[wl->where]);
+        } else {
+            unixctl_command_reply(fd, "lcore%u\n", lcore_id);
+            unixctl_command_reply(fd, NORM_KV_64_FMT("  busy_rounds", "\n"),
+                                  wl->busy_rounds);
+            unixctl_command_reply(fd, NORM_KV_64_FMT("  idle_rounds", "\n"),
+                                  wl->idle_rounds);
+            unixctl_command_reply(fd, NORM_KV_64_FMT("  busy_cycles", "\n"),
+                                  wl->busy_cycles);
+            unixctl_command_reply(fd, NORM_KV_64_FMT("  idle_cycles", "\n"),
+                                  wl->idle_cycles);
+            unixctl_command_reply(fd, NORM_KV_32_FMT("  busy(%%)", "\n"), busy);
+            unixctl_command_reply(fd, NORM_KV_32_FMT("  util(%%)", "\n"),
+                                  wl->wd.util);
+            unixctl_command_reply(fd, NORM_KV_64_FMT("  round_max_us", "\n"),
+                                  wl->round_max * US_PER_S / hz);
+            unixctl_command_reply(fd, NORM_KV_64_FMT("  heartbeat", "\n"),
+                                  wl->heartbeat);
+            unixctl_command_reply(fd, NORM_KV_S_FMT("  stalled", "\n"),
+                                  wl->wd.stalled ? "yes" : "no");
+            unixctl_command_reply(fd, NORM_KV_64_FMT("  stalls", "\n"),
+                                  wl->wd.stalls);
+            unixctl_command_reply(fd, NORM_KV_64_FMT("  stall_max_ms", "\n"),
+                                  wl->wd.stall_max * MS_PER_S / hz);
+            unixctl_command_reply(fd, NORM_KV_S_FMT("  where", "\n"),
+                                  watchdog_where_names[wl->where]);
+        }
+    }
+    if (json_fmt)
+        unixctl_command_reply(fd, "]\n");
+}
+
+UNIXCTL_CMD_REGISTER("lcore/stats", "[--json].",
+                     "Show the busy and idle cycles of the workers and the "
+                     "stalls seen by the watchdog.",
+                     0, 1, lcore_stats_cmd_cb);
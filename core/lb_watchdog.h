@@ -0,0 +1,86 @@
+/* Copyright (c) 2018. TIG developer. */
+
+#ifndef __LB_WATCHDOG_H__
+#define __LB_WATCHDOG_H__
+
+#include <rte_cycles.h>
+#include <rte_lcore.h>
+
+/* Where a worker is in its loop, reported when it stalls. */
+enum {
+    LB_WD_W_FLUSH,
+    LB_WD_W_RX,
+    LB_WD_W_HANDLE,
+    LB_WD_W_DRAIN,
+    LB_WD_W_IDLE,
+    LB_WD_W_TIMERS,
+    LB_WD_W_MAX,
+};
+
+struct lb_watchdog_lcore {
+    /* Written by the worker, rounds and cycles of its loop. */
+    uint32_t enabled;
+    uint64_t heartbeat;
+    uint64_t round_tsc;
+    uint32_t where;
+    uint64_t busy_rounds;
+    uint64_t idle_rounds;
+    uint64_t busy_cycles;
+    uint64_t idle_cycles;
+    /* Longest round with packets. */
+    uint64_t round_max;
+
+    /* Written by the watchdog on the master. */
+    struct {
+        uint64_t heartbeat;
+        uint64_t heartbeat_tsc;
+        uint64_t busy_cycles;
+        uint64_t idle_cycles;
+        /* Percent of busy cycles since the last check. */
+        uint32_t util;
+        uint32_t stalled;
+        uint64_t stalls;
+        uint64_t stall_max;
+    } __rte_cache_aligned wd;
+} __rte_cache_aligned;
+
+extern struct lb_watchdog_lcore lb_watchdog_lcores[RTE_MAX_LCORE];
+
+static inline void
+lb_watchdog_where(uint32_t lcore_id, uint32_t where) {
+    lb_watchdog_lcores[lcore_id].where = where;
+}
+
+static inline void
+lb_watchdog_round_begin(uint32_t lcore_id) {
+    struct lb_watchdog_lcore *wl = &lb_watchdog_lcores[lcore_id];
+
+    wl->round_tsc = rte_rdtsc();
+    wl->heartbeat++;
+}
+
+/*
+ * Called at the end of a round, after the timers and the idle back off,
+ * so a round without packets is idle with its sleeps and timers.
+ */
+static inline void
+lb_watchdog_round_end(uint32_t lcore_id, uint32_t nb_rx) {
+    struct lb_watchdog_lcore *wl = &lb_watchdog_lcores[lcore_id];
+    uint64_t cycles = rte_rdtsc() - wl->round_tsc;
+
+    if (nb_rx != 0) {
+        wl->busy_rounds++;
+        wl->busy_cycles += cycles;
+        if (cycles > wl->round_max)
+            wl->round_max = cycles;
+    } else {
+        wl->idle_rounds++;
+        wl->idle_cycles += cycles;
+    }
+    wl->where = LB_WD_W_FLUSH;
+}
+
+int lb_watchdog_init(void);
+void lb_watchdog_lcore_init(uint32_t lcore_id);
+
+#endif
@@ -15,13 +15,28 @@
 #include <unixctl_command.h>
 
 #include "lb_arp.h"
+#include "lb_capture.h"
 #include "lb_clock.h"
 #include "lb_config.h"
+#include "lb_connlog.h"
 #include "lb_device.h"
+#include "lb_drop.h"
+#include "lb_exporter.h"
 #include "lb_format.h"
+#include "lb_ipfix.h"
+#include "lb_ipfrag.h"
+#include "lb_ipv6.h"
+#include "lb_kni.h"
+#include "lb_metrics.h"
+#include "lb_overload.h"
 #include "lb_parser.h"
+#include "lb_perf.h"
+#include "lb_poll.h"
 #include "lb_proto.h"
+#include "lb_proto_icmp.h"
 #include "lb_service.h"
+#include "lb_steer.h"
+#include "lb_watchdog.h"
 
 #define VERSION "0.1"
 
@@ -106,103 +121,100 @@ handle_packets(struct rte_mbuf **pkts, uint16_t n, struct lb_device *dev) {
     struct ether_hdr *eth;
     struct ipv4_hdr *iph;
     struct lb_proto *p;
+    uint64_t burst_tsc;
 
+    burst_tsc = lb_perf_begin();
     for (i = 0; i < n; i++) {
         m = pkts[i];
+        lb_perf_packet_begin();
+        lb_capture(m, LB_CAPTURE_P_RX);
 
         eth = rte_pktmbuf_mtod_offset(m, struct ether_hdr *, 0);
         switch (rte_be_to_cpu_16(eth->ether_type)) {
         case ETHER_TYPE_ARP:
-            if (rte_ring_enqueue(dev->ring, m) < 0) {
-                rte_pktmbuf_free(m);
-            }
+            lb_kni_enqueue(m, 0, dev);
             break;
         case ETHER_TYPE_IPv4:
             iph = rte_pktmbuf_mtod_offset(m, struct ipv4_hdr *, ETHER_HDR_LEN);
             if ((iph->dst_addr == dev->ipv4) ||
                 (iph->next_proto_id == IPPROTO_OSPFIGP)) {
-                if (rte_ring_enqueue(dev->ring, m) < 0) {
-                    rte_pktmbuf_free(m);
-                }
+                lb_kni_enqueue(m, iph->src_addr ^ iph->dst_addr, dev);
             } else {
                 p = lb_proto_get(iph->next_proto_id);
                 if (p != NULL) {
+                    lb_perf_mark(LB_PERF_CLASSIFY);
                     p->fullnat_handle(m, iph, dev);
                 } else {
-                    rte_pktmbuf_free(m);
+                    lb_drop(m, LB_DROP_UNSUPPORTED);
                 }
             }
             break;
+        case ETHER_TYPE_IPv6:
+            lb_ipv6_input(m, dev);
+            break;
         default:
-            rte_pktmbuf_free(m);
+            lb_drop(m, LB_DROP_UNSUPPORTED);
         }
+        lb_perf_packet_end();
     }
+    if (n != 0)
+        lb_perf_end(LB_PERF_BURST, burst_tsc);
 }
 
 static int
 master_loop(__attribute__((unused)) void *arg) {
     uint32_t lcore_id;
-    uint16_t i, j;
-    uint16_t nb_ctx;
-    struct {
-        uint16_t port_id;
-        uint16_t txq_id;
-        struct rte_eth_dev_tx_buffer *tx_buffer;
-        struct rte_kni *kni;
-        struct rte_ring *ring;
-        struct lb_device *dev;
-    } ctx[RTE_MAX_ETHPORTS];
+    uint16_t i, nb_ctx;
+    struct lb_device *devs[RTE_MAX_ETHPORTS];
     uint16_t devid;
     struct lb_device *dev;
-    struct rte_mbuf *pkts[PKT_MAX_BURST];
-    uint32_t n, nb_tx;
-    struct ether_hdr *ethh;
+
+    if (lb_device_count == 0) {
+        RTE_LOG(INFO, USER1, "%s(): master thread exit early.\n", __func__);
+        return 0;
+    }
 
     lcore_id = rte_lcore_id();
     nb_ctx = 0;
     LB_DEVICE_FOREACH(devid, dev) {
-        ctx[nb_ctx].port_id = dev->port_id;
-        ctx[nb_ctx].txq_id = dev->lcore_conf[lcore_id].txq_id;
-        ctx[nb_ctx].tx_buffer = dev->tx_buffer[lcore_id];
-        ctx[nb_ctx].kni = dev->kni;
-        ctx[nb_ctx].ring = dev->ring;
-        ctx[nb_ctx].dev = dev;
-        nb_ctx++;
-    }
-
-    if (nb_ctx == 0) {
-        RTE_LOG(INFO, USER1, "%s(): master thread exit early.\n", __func__);
-        return 0;
+        if (dev->lcore_conf[lcore_id].kni_enable)
+            devs[nb_ctx++] = dev;
     }
 
     RTE_LOG(INFO, USER1, "%s(): master thread started.\n", __func__);
 
+    /* The kni rounds are bounded, the timers and commands still run. */
     while (lb_loop) {
         for (i = 0; i < nb_ctx; i++) {
-            rte_kni_handle_request(ctx[i].kni);
+            lb_kni_poll(devs[i], lcore_id);
+        }
+
+        RUN_ONCE_N_MS(rte_timer_manage, 1);
+    }
 
-            n = rte_kni_rx_burst(ctx[i].kni, pkts, PKT_MAX_BURST);
+    return 0;
+}
 
-            for (j = 0; j < n; j++) {
-                rte_eth_tx_buffer(ctx[i].port_id, ctx[i].txq_id,
-                                  ctx[i].tx_buffer, pkts[j]);
-            }
+static int
+kni_loop(__attribute__((unused)) void *arg) {
+    uint32_t lcore_id;
+    uint16_t i, nb_ctx;
+    struct lb_device *devs[RTE_MAX_ETHPORTS];
+    uint16_t devid;
+    struct lb_device *dev;
+
+    lcore_id = rte_lcore_id();
+    nb_ctx = 0;
+    LB_DEVICE_FOREACH(devid, dev) {
+        if (dev->lcore_conf[lcore_id].kni_enable)
+            devs[nb_ctx++] = dev;
+    }
 
-            rte_eth_tx_buffer_flush(ctx[i].port_id, ctx[i].txq_id,
-                                    ctx[i].tx_buffer);
+    RTE_LOG(INFO, USER1, "%s(): kni thread%u started.\n", __func__, lcore_id);
 
-            n = rte_ring_dequeue_burst(ctx[i].ring, (void **)pkts,
-                                       PKT_MAX_BURST, NULL);
-            for (j = 0; j < n; j++) {
-                ethh = rte_pktmbuf_mtod_offset(pkts[j], struct ether_hdr *, 0);
-                if (ethh->ether_type == rte_be_to_cpu_16(ETHER_TYPE_ARP)) {
-                    lb_arp_input(pkts[j], ctx[i].dev);
-                }
-            }
-            nb_tx = rte_kni_tx_burst(ctx[i].kni, pkts, n);
-            for (j = nb_tx; j < n; j++) {
-                rte_pktmbuf_free(pkts[j]);
-            }
+    while (lb_loop) {
+        for (i = 0; i < nb_ctx; i++) {
+            lb_kni_poll(devs[i], lcore_id);
         }
 
         RUN_ONCE_N_MS(rte_timer_manage, 1);
@@ -214,30 +226,38 @@ master_loop(__attribute__((unused)) void *arg) {
 static int
 worker_loop(__attribute__((unused)) void *arg) {
     uint32_t lcore_id;
-    uint16_t i;
+    uint16_t i, k;
     uint16_t nb_ctx;
+    /* One context per polled queue, the first of each device drains. */
     struct {
         uint16_t port_id;
         uint16_t rxq_id, txq_id;
+        uint16_t first;
         struct lb_device *dev;
         struct rte_eth_dev_tx_buffer *tx_buffer;
         struct rte_mbuf *rx_pkts[PKT_MAX_BURST];
         uint32_t n;
-    } ctx[RTE_MAX_ETHPORTS];
+    } ctx[RTE_MAX_ETHPORTS * LB_MAX_RXQ_PER_LCORE];
     uint16_t devid;
     struct lb_device *dev;
+    uint32_t nb_rx, nb_tx;
+    uint64_t perf_tsc;
 
     lcore_id = rte_lcore_id();
     nb_ctx = 0;
     LB_DEVICE_FOREACH(devid, dev) {
         if (!dev->lcore_conf[lcore_id].rxq_enable)
             continue;
-        ctx[nb_ctx].port_id = dev->port_id;
-        ctx[nb_ctx].rxq_id = dev->lcore_conf[lcore_id].rxq_id;
-        ctx[nb_ctx].txq_id = dev->lcore_conf[lcore_id].txq_id;
-        ctx[nb_ctx].tx_buffer = dev->tx_buffer[lcore_id];
-        ctx[nb_ctx].dev = dev;
-        nb_ctx++;
+        for (k = 0; k < dev->rxq_per_lcore; k++) {
+            ctx[nb_ctx].port_id = dev->port_id;
+            ctx[nb_ctx].rxq_id =
+                dev->lcore_conf[lcore_id].rxq_id + k * dev->nb_rxq;
+            ctx[nb_ctx].txq_id = dev->lcore_conf[lcore_id].txq_id;
+            ctx[nb_ctx].first = k == 0;
+            ctx[nb_ctx].tx_buffer = dev->tx_buffer[lcore_id];
+            ctx[nb_ctx].dev = dev;
+            nb_ctx++;
+        }
     }
 
     if (nb_ctx == 0) {
@@ -246,25 +266,67 @@ worker_loop(__attribute__((unused)) void *arg) {
         return 0;
     }
 
+    lb_poll_lcore_init(lcore_id);
+    lb_overload_lcore_init(lcore_id);
+    lb_watchdog_lcore_init(lcore_id);
+
     RTE_LOG(INFO, USER1, "%s(): worker%u thread started.\n", __func__,
             lcore_id);
 
     while (lb_loop) {
+        lb_watchdog_round_begin(lcore_id);
+        lb_overload_round_begin(lcore_id);
+        nb_rx = 0;
+        nb_tx = 0;
+        perf_tsc = lb_perf_begin();
         for (i = 0; i < nb_ctx; i++) {
-            rte_eth_tx_buffer_flush(ctx[i].port_id, ctx[i].txq_id,
-                                    ctx[i].tx_buffer);
+            if (!ctx[i].first)
+                continue;
+            nb_tx += rte_eth_tx_buffer_flush(ctx[i].port_id, ctx[i].txq_id,
+                                             ctx[i].tx_buffer);
         }
+        if (nb_tx != 0)
+            lb_perf_end(LB_PERF_TX_FLUSH, perf_tsc);
 
+        lb_watchdog_where(lcore_id, LB_WD_W_RX);
         for (i = 0; i < nb_ctx; i++) {
+            perf_tsc = lb_perf_begin();
             ctx[i].n = rte_eth_rx_burst(ctx[i].port_id, ctx[i].rxq_id,
                                         ctx[i].rx_pkts, PKT_MAX_BURST);
+            if (ctx[i].n == 0)
+                continue;
+            nb_rx += ctx[i].n;
+            if (ctx[i].dev->steer != NULL)
+                ctx[i].n = lb_steer_rx(ctx[i].dev, ctx[i].rx_pkts, ctx[i].n);
+            lb_perf_end(LB_PERF_RX, perf_tsc);
+        }
+
+        lb_watchdog_where(lcore_id, LB_WD_W_HANDLE);
+        for (i = 0; i < nb_ctx; i++) {
+            handle_packets(ctx[i].rx_pkts, ctx[i].n, ctx[i].dev);
         }
 
+        lb_watchdog_where(lcore_id, LB_WD_W_DRAIN);
         for (i = 0; i < nb_ctx; i++) {
+            if (ctx[i].dev->steer == NULL || !ctx[i].first)
+                continue;
+            ctx[i].n =
+                lb_steer_drain(ctx[i].dev, ctx[i].rx_pkts, PKT_MAX_BURST);
+            nb_rx += ctx[i].n;
             handle_packets(ctx[i].rx_pkts, ctx[i].n, ctx[i].dev);
         }
+        for (i = 0; i < nb_ctx; i++) {
+            if (ctx[i].first)
+                nb_rx += lb_icmp_relay_drain(ctx[i].dev);
+        }
+
+        lb_overload_round_end(lcore_id);
+        lb_watchdog_where(lcore_id, LB_WD_W_IDLE);
+        lb_poll_idle(lcore_id, nb_rx);
 
+        lb_watchdog_where(lcore_id, LB_WD_W_TIMERS);
         RUN_ONCE_N_MS(rte_timer_manage, 1);
+        lb_watchdog_round_end(lcore_id, nb_rx);
     }
 
     return 0;
@@ -274,6 +336,8 @@ static int
 main_loop(void *arg) {
     if (rte_get_master_lcore() == rte_lcore_id()) {
         return master_loop(arg);
+    } else if (lb_kni_lcore_is_enabled(rte_lcore_id())) {
+        return kni_loop(arg);
     } else {
         return worker_loop(arg);
     }
@@ -371,6 +435,18 @@ main(int argc, char **argv) {
     rte_timer_subsystem_init();
     rte_pdump_init(NULL);
 
+    rc = lb_overload_init();
+    if (rc < 0) {
+        RTE_LOG(ERR, USER1, "%s(): lb_overload_init failed.\n", __func__);
+        return rc;
+    }
+
+    rc = lb_poll_init();
+    if (rc < 0) {
+        RTE_LOG(ERR, USER1, "%s(): lb_poll_init failed.\n", __func__);
+        return rc;
+    }
+
     rc = lb_device_init(lb_cfg->devices, lb_cfg->nb_decices);
     if (rc < 0) {
         RTE_LOG(ERR, USER1, "%s(): lb_device_init failed.\n", __func__);
@@ -389,6 +465,12 @@ main(int argc, char **argv) {
         return rc;
     }
 
+    rc = lb_watchdog_init();
+    if (rc < 0) {
+        RTE_LOG(ERR, USER1, "%s(): lb_watchdog_init failed.\n", __func__);
+        return rc;
+    }
+
     rc = unixctl_server_init(SOCK_FILEPATH);
     if (rc < 0) {
         RTE_LOG(ERR, USER1, "%s(): unixctl_server_init failed.\n", __func__);
@@ -407,6 +489,36 @@ main(int argc, char **argv) {
         return rc;
     }
 
+    rc = lb_ipfrag_init();
+    if (rc < 0) {
+        RTE_LOG(ERR, USER1, "%s(): lb_ipfrag_init failed.\n", __func__);
+        return rc;
+    }
+
+    rc = lb_metrics_init();
+    if (rc < 0) {
+        RTE_LOG(ERR, USER1, "%s(): lb_metrics_init failed.\n", __func__);
+        return rc;
+    }
+
+    rc = lb_exporter_init();
+    if (rc < 0) {
+        RTE_LOG(ERR, USER1, "%s(): lb_exporter_init failed.\n", __func__);
+        return rc;
+    }
+
+    rc = lb_ipfix_init();
+    if (rc < 0) {
+        RTE_LOG(ERR, USER1, "%s(): lb_ipfix_init failed.\n", __func__);
+        return rc;
+    }
+
+    rc = lb_connlog_init();
+    if (rc < 0) {
+        RTE_LOG(ERR, USER1, "%s(): lb_connlog_init failed.\n", __func__);
+        return rc;
+    }
+
     rc = rte_eal_mp_remote_launch(main_loop, NULL, CALL_MASTER);
     if (rc < 0) {
         RTE_LOG(ERR, USER1, "%s(): Launch remote thread failed.\n", __func__);
@@ -0,0 +1,68 @@
+/* Copyright (c) 2018. TIG developer. */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "connlog.h"
+
+int
+connlog_open(struct connlog_file *f, const char *path) {
+    struct connlog_header *h;
+    struct stat st;
+
+    f->fd = open(path, O_RDONLY);
+    if (f->fd < 0)
+        return -1;
+    if (fstat(f->fd, &st) < 0 || (size_t)st.st_size < sizeof(*h)) {
+        close(f->fd);
+        errno = EINVAL;
+        return -1;
+    }
+    f->size = st.st_size;
+    f->base = mmap(NULL, f->size, PROT_READ, MAP_SHARED, f->fd, 0);
+    if (f->base == MAP_FAILED) {
+        close(f->fd);
+        return -1;
+    }
+    h = f->base;
+    if (h->magic != CONNLOG_MAGIC || h->version == 0 ||
+        h->version > CONNLOG_VERSION || h->size > f->size ||
+        h->record_size < (h->version == 1 ? CONNLOG_RECORD_V1_SIZE
+                                          : sizeof(struct connlog_record))) {
+        connlog_close(f);
+        errno = EPROTO;
+        return -1;
+    }
+    return 0;
+}
+
+void
+connlog_close(struct connlog_file *f) {
+    munmap(f->base, f->size);
+    close(f->fd);
+}
+
+void
+connlog_record_get(const struct connlog_file *f, uint64_t i,
+                   struct connlog_record *r) {
+    const struct connlog_header *h = f->base;
+    size_t len = h->record_size < sizeof(*r) ? h->record_size : sizeof(*r);
+
+    memcpy(r, (const char *)f->base + sizeof(*h) + i * h->record_size, len);
+    memset((char *)r + len, 0, sizeof(*r) - len);
+}
+
+uint64_t
+connlog_count(const struct connlog_file *f) {
+    const struct connlog_header *h = f->base;
+    uint64_t used;
+
+    used = __atomic_load_n(&h->used, __ATOMIC_ACQUIRE);
+    if (used < sizeof(*h) || used > f->size)
+        return 0;
+    return (used - sizeof(*h)) / h->record_size;
+}
@@ -0,0 +1,83 @@
+/* Copyright (c) 2018. TIG developer. */
+
+#ifndef __CONNLOG_H__
+#define __CONNLOG_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Connection log of jupiter-service: a set of files PATH.0 to PATH.N-1
+ * of a fixed size, written in turn. Each one is a header followed by
+ * records appended in the order the writer drained them, roughly in
+ * time order across lcores. used is stored after the records it covers,
+ * readers load it with acquire semantics and may follow a live file.
+ * A file is reused in place, used falls back to the header size and seq
+ * changes. Version 2 adds the IPv6 client side of the NAT64 connections.
+ */
+#define CONNLOG_MAGIC 0x4c43504a /* "JPCL" */
+#define CONNLOG_VERSION 2
+#define CONNLOG_DEFAULT_PATH "/var/log/jupiter/conn.log"
+/* Files a reader looks for, at most. */
+#define CONNLOG_MAX_FILES 1024
+
+enum {
+    CONNLOG_EV_NEW = 1,
+    CONNLOG_EV_END = 2,
+};
+
+/* The client side is IPv6, in cip6 and vip6, cip and vip are 0. */
+#define CONNLOG_F_IPV6 0x1
+
+struct connlog_header {
+    uint32_t magic;
+    uint32_t version;
+    /* Bytes of the file, and of the header and records written. */
+    uint64_t size;
+    uint64_t used;
+    /* Rank of the file in the log, kept across restarts. */
+    uint64_t seq;
+    /* Wall clock of the first and the last record, 0 if none. */
+    uint64_t first_ns;
+    uint64_t last_ns;
+    uint32_t record_size;
+    uint32_t pid;
+};
+
+/* Addresses and ports in network order. */
+struct connlog_record {
+    uint64_t ts_ns;
+    uint32_t cip, vip, lip, rip;
+    uint16_t cport, vport, lport, rport;
+    uint8_t event;
+    uint8_t proto;
+    uint16_t lcore_id;
+    /* Milliseconds from the new event, for the end events. */
+    uint32_t duration_ms;
+    /* Version 2. */
+    uint8_t flags;
+    uint8_t pad[7];
+    uint8_t cip6[16], vip6[16];
+};
+
+/* Size of the records of version 1. */
+#define CONNLOG_RECORD_V1_SIZE offsetof(struct connlog_record, flags)
+
+struct connlog_file {
+    int fd;
+    void *base;
+    size_t size;
+};
+
+int connlog_open(struct connlog_file *f, const char *path);
+void connlog_close(struct connlog_file *f);
+/*
+ * Copy record i, the stride is record_size. The fields a version lacks
+ * are 0.
+ */
+void connlog_record_get(const struct connlog_file *f, uint64_t i,
+                        struct connlog_record *r);
+/* Records written so far. */
+uint64_t connlog_count(const struct connlog_file *f);
+
+#endif
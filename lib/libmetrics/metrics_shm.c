@@ -0,0 +1,85 @@
+/* Copyright (c) 2018. TIG developer. */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "metrics_shm.h"
+
+/* Copies overlapping a write before the reader gives up. */
+#define METRICS_SHM_RETRIES 1000
+
+int
+metrics_shm_open(struct metrics_shm *m, const char *path) {
+    struct metrics_shm_header *h;
+    struct stat st;
+
+    m->fd = open(path, O_RDONLY);
+    if (m->fd < 0)
+        return -1;
+    if (fstat(m->fd, &st) < 0 || (size_t)st.st_size < sizeof(*h)) {
+        close(m->fd);
+        errno = EINVAL;
+        return -1;
+    }
+    m->size = st.st_size;
+    m->base = mmap(NULL, m->size, PROT_READ, MAP_SHARED, m->fd, 0);
+    if (m->base == MAP_FAILED) {
+        close(m->fd);
+        return -1;
+    }
+    h = m->base;
+    if (h->magic != METRICS_SHM_MAGIC || h->version != METRICS_SHM_VERSION ||
+        h->size > m->size) {
+        metrics_shm_close(m);
+        errno = EPROTO;
+        return -1;
+    }
+    return 0;
+}
+
+void
+metrics_shm_close(struct metrics_shm *m) {
+    munmap(m->base, m->size);
+    close(m->fd);
+}
+
+/*
+ * Copy a consistent snapshot of the used part of the region into buf, a
+ * buffer of the region size always fits. Returns the bytes copied, or -1
+ * with errno ENOBUFS if buf is smaller, EAGAIN if the service kept
+ * writing.
+ */
+int
+metrics_shm_snapshot(struct metrics_shm *m, void *buf, size_t size) {
+    struct metrics_shm_header *h = m->base;
+    uint64_t seq, used;
+    uint32_t i;
+
+    for (i = 0; i < METRICS_SHM_RETRIES; i++) {
+        seq = __atomic_load_n(&h->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            sched_yield();
+            continue;
+        }
+        used = h->used;
+        if (used < sizeof(*h) || used > m->size) {
+            /* Torn by a write, the sequence tells. */
+            used = sizeof(*h);
+        }
+        if (used > size) {
+            errno = ENOBUFS;
+            return -1;
+        }
+        memcpy(buf, m->base, used);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&h->seq, __ATOMIC_RELAXED) == seq)
+            return (int)used;
+    }
+    errno = EAGAIN;
+    return -1;
+}
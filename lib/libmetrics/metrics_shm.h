@@ -0,0 +1,123 @@
+/* Copyright (c) 2018. TIG developer. */
+
+#ifndef __METRICS_SHM_H__
+#define __METRICS_SHM_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Metrics region of jupiter-service, a file it maps and rewrites every
+ * interval. Readers map it read only and copy it under the sequence
+ * number: odd while the service writes, changed if it wrote during the
+ * copy. The tables are packed after the header at the offsets it gives,
+ * only the used bytes need a copy. Fields can be appended to the entries
+ * within a version, a reader takes the entry sizes from the header.
+ */
+#define METRICS_SHM_MAGIC 0x4d50554a /* "JUPM" */
+#define METRICS_SHM_VERSION 1
+#define METRICS_SHM_DEFAULT_PATH "/dev/shm/jupiter.metrics"
+
+#define METRICS_SHM_NAMESIZE 32
+
+/* Stats directions, the original one from the client. */
+#define METRICS_SHM_DIRS 2
+
+struct metrics_shm_header {
+    uint32_t magic;
+    uint32_t version;
+    /* Bytes of the whole region, and of the last update. */
+    uint64_t size;
+    uint64_t used;
+    uint64_t seq;
+    /* Wall clock of the last update, and the TSC rate of the cycles. */
+    uint64_t update_ns;
+    uint64_t tsc_hz;
+    uint32_t pid;
+    uint32_t interval_ms;
+
+    uint32_t nb_lcores, lcore_size;
+    uint64_t lcore_off;
+    uint32_t nb_ports, port_size;
+    uint64_t port_off;
+    uint32_t nb_vs, vs_size;
+    uint64_t vs_off;
+    uint32_t nb_rs, rs_size;
+    uint64_t rs_off;
+    /* Entries that did not fit, the region is sized at start. */
+    uint32_t max_vs, max_rs;
+    uint32_t vs_truncated, rs_truncated;
+};
+
+struct metrics_shm_lcore {
+    uint32_t lcore_id;
+    uint32_t socket_id;
+    uint32_t worker;
+    uint32_t stalled;
+    uint64_t busy_rounds, idle_rounds;
+    uint64_t busy_cycles, idle_cycles;
+    uint64_t drops;
+    /* Occupancy of the connection tables of the lcore. */
+    uint32_t tcp_conns, tcp_conns_max;
+    uint32_t udp_conns, udp_conns_max;
+};
+
+struct metrics_shm_port {
+    char name[METRICS_SHM_NAMESIZE];
+    uint32_t port_id;
+    uint32_t socket_id;
+    uint64_t ipackets, opackets;
+    uint64_t ibytes, obytes;
+    uint64_t imissed, ierrors, oerrors, rx_nombuf;
+    uint64_t rx_dropped, tx_dropped;
+    uint32_t mbuf_in_use, mbuf_avail;
+};
+
+/* Summed over the replicas of a service on each socket. */
+struct metrics_shm_vs {
+    uint32_t vip;
+    uint16_t vport;
+    uint8_t proto;
+    uint8_t fwd_mode;
+    uint32_t flags;
+    int32_t max_conns;
+    int32_t active_conns;
+    /* The first real service of the vs in the rs table, and their count. */
+    uint32_t rs_first, nb_rs;
+    uint32_t pad;
+    uint64_t conns;
+    uint64_t packets[METRICS_SHM_DIRS];
+    uint64_t bytes[METRICS_SHM_DIRS];
+    uint64_t drops[METRICS_SHM_DIRS];
+};
+
+struct metrics_shm_rs {
+    uint32_t rip;
+    uint16_t rport;
+    uint8_t proto;
+    uint8_t pad;
+    uint32_t vs;
+    uint32_t flags;
+    int32_t weight;
+    int32_t active_conns;
+    uint64_t conns;
+    uint64_t packets[METRICS_SHM_DIRS];
+    uint64_t bytes[METRICS_SHM_DIRS];
+};
+
+/* Entry i of a table of a snapshot. */
+#define METRICS_SHM_ENTRY(h, table, i)                                         \
+    ((void *)((char *)(h) + (h)->table##_off +                                 \
+              (uint64_t)(i) * (h)->table##_size))
+
+struct metrics_shm {
+    int fd;
+    void *base;
+    size_t size;
+};
+
+int metrics_shm_open(struct metrics_shm *m, const char *path);
+void metrics_shm_close(struct metrics_shm *m);
+int metrics_shm_snapshot(struct metrics_shm *m, void *buf, size_t size);
+
+#endif
@@ -9,6 +9,8 @@ URL: none
 Source: jupiter-%{_version}.tar.xz
 
 BuildRequires: kernel-devel, kernel-headers, libpcap-devel
+# sys/sdt.h, for the static probes.
+BuildRequires: systemtap-sdt-devel
 
 # Requires:
 
@@ -20,7 +22,7 @@ machine=%{_machine}.
 %setup -q
 
 %build
-make machine=%{_machine}
+make machine=%{_machine} USDT=y
 
 %install
 rm -rf %{buildroot}